@@ -26,6 +26,7 @@ namespace psys
 			~Camera() {};
 			void move(float forward, float strafe, float up);
 			void reset();
+			void frame(glm::vec3 target, float distance);
 			glm::vec3 getPosition();
 			glm::vec3 getCenter();
 			glm::vec2 getAngles();
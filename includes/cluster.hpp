@@ -0,0 +1,67 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   cluster.hpp                                        :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: tmoragli <tmoragli@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 18:40:12 by tmoragli          #+#    #+#             */
+/*   Updated: 2026/10/19 18:40:12 by tmoragli         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace psys
+{
+	// Kind of a cluster message, checked on receipt, the payload layout depends on it
+	enum cluster_message : uint32_t {
+		CLUSTER_STEP = 1,	// rank 0 to a worker: cluster_step then the sim_params of the tick
+		CLUSTER_MIGRATE,	// worker to worker: the particles now inside the receiver's slab
+		CLUSTER_VIEW		// worker to rank 0: cluster_summary then the decimated particles
+	};
+
+	/*
+		Full mesh of TCP connections between the --ranks processes, one socket per peer.
+		Rank r listens on basePort + r, connects to every lower rank and accepts the higher ones.
+		Messages are a type and a byte count followed by the payload, in host byte order:
+		every rank is expected to run the same build on the same architecture
+	*/
+	class Cluster
+	{
+		public:
+			Cluster();
+			~Cluster();
+			bool connect(unsigned int rank, unsigned int ranks, const std::vector<std::string> &hosts, unsigned int basePort);
+			bool active() const;
+			unsigned int rank() const;
+			unsigned int ranks() const;
+
+			// Blocking, a false receive without an error printed means the peer closed its end
+			bool send(unsigned int peer, uint32_t type, const void *data, size_t bytes);
+			bool receive(unsigned int peer, uint32_t type, std::vector<unsigned char> &payload);
+
+			// One message to and from every rank in peers at once, indexed by rank.
+			// Sends and receives are interleaved so two large messages crossing never block each other
+			bool exchange(const std::vector<unsigned int> &peers, uint32_t type,
+				const std::vector<std::vector<unsigned char>> &outgoing, std::vector<std::vector<unsigned char>> &incoming);
+
+		private:
+			bool connectTo(unsigned int peer, const std::string &host, unsigned int port);
+			bool acceptFrom(int listener, unsigned int expected);
+
+			unsigned int self;
+			unsigned int count;
+			std::vector<int> sockets;
+	};
+
+	// Whole buffer transfers on a blocking socket. A failed read leaves errno at 0 when the peer
+	// closed before the first byte
+	bool writeAll(int fd, const void *data, size_t bytes);
+	bool readAll(int fd, void *data, size_t bytes);
+};
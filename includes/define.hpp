@@ -14,6 +14,111 @@
 # define TRAIL_SAMPLES 16
 # define TRAIL_INTERVAL 0.07f // ~1 second of history
 
+// Motion blur config
+# define MOTION_BLUR_TIME 0.05f		// seconds of motion covered by a streak
+# define MOTION_BLUR_MAX_LENGTH 3.0f	// longest streak in world units, respawn jumps stay short
+
+// Simulation thread config
+# define SIM_TICK_RATE 60			// fixed simulation steps per second, overridden by --tick-rate
+# define SIM_CHANNEL_CAPACITY 64	// parameter snapshots queued between input and simulation
+
+// Quality governor config
+# define GOVERNOR_TARGET_FPS 60		// frame rate the governor keeps, overridden by --target-fps
+# define GOVERNOR_INTERVAL 0.5f		// seconds of measurements behind each decision
+# define GOVERNOR_DOWNGRADE 1.0f		// step down above this fraction of the budget
+# define GOVERNOR_UPGRADE 0.7f		// step up below this fraction of the budget...
+# define GOVERNOR_UPGRADE_WINDOWS 4	// ...held for this many windows in a row
+# define GOVERNOR_TIMER_QUERIES 4	// GPU timer queries in flight
+# define REDUCED_PARTICLE_COUNT 100000	// cap in trailing and spaghetti modes
+
+// Statistics config
+# define STATS_GROUP_SIZE 256		// work-group size of the reduction, same as in reduce_stats.cl
+# define FRAME_MARGIN 1.2f			// auto-framing keeps the bounding sphere this much inside the view
+
+// Spatial query config
+# define QUERY_CELL_OCCUPANCY 8		// particles per cell aimed for when sizing the grid
+# define QUERY_MAX_RESOLUTION 128	// cells per side at most
+# define QUERY_MAX_RESULTS (1 << 22)	// indices returned by one radius or box query
+# define QUERY_SCAN_GROUP_SIZE 256	// work-group size of the cell scan, same as in spatial_query.cl
+# define QUERY_PICK_PIXELS 6.0f		// radius of the pick cone around the cursor, in pixels
+# define QUERY_SELECT_RADIUS 5.0f	// half size of the middle click selection
+
+// Point splatting config (F2, --splat)
+# define SPLAT_TILE_SIZE 16			// pixels per side of a screen tile, same as in splat_points.cl
+# define SPLAT_SCAN_GROUP_SIZE 256	// work-group size of the tile scan, same as in splat_points.cl
+
+// Distributed run config (--ranks, --rank)
+# define CLUSTER_BASE_PORT 47100			// rank r listens on this port + r, overridden by --port
+# define CLUSTER_MAX_RANKS 64				// processes in one run at most
+# define CLUSTER_CONNECT_TIMEOUT 30			// seconds given to every rank to come up
+# define CLUSTER_MIGRATE_MAX (1 << 18)		// emigrant list to start with, grown when more particles leave a slab in one tick
+# define CLUSTER_VIEW_PARTICLES (1 << 18)	// particles displayed by rank 0, split between the workers
+
+// Remote viewer config (--serve, --connect)
+# define STREAM_EXTENT 64.0f				// side of the cube centred on the origin quantized to 16 bits per axis
+# define STREAM_START_PARTICLES (1 << 20)	// particles per frame a new viewer starts with
+# define STREAM_MIN_PARTICLES 16384			// a viewer never gets fewer, however slow its link
+# define STREAM_MAX_IN_FLIGHT 2				// frames sent but not acknowledged before a viewer skips the next ones
+# define STREAM_SKIP_TOLERANCE 0.1f			// fraction of skipped frames in a second that shrinks the budget
+# define STREAM_BACKOFF 0.7f				// budget factor after such a second
+# define STREAM_GROWTH 1.25f				// budget factor after STREAM_CALM_WINDOWS seconds without a skip
+# define STREAM_CALM_WINDOWS 3
+# define STREAM_WAIT_MS 100					// longest wait of the viewer thread for a frame
+
+// HUD config
+# define HUD_FONT_PATH "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf"	// overridden by --font
+# define HUD_FONT_SIZE 16.0f			// glyph height in pixels
+# define HUD_ATLAS_SIZE 512			// texels per side of the baked glyph atlas
+# define HUD_GRAPH_SAMPLES 180		// frames shown by the timing graphs
+# define HUD_PANEL_WIDTH 440.0f		// width of the overlay panel in pixels
+
+// Validation config (--validate)
+# define VALIDATE_PARTICLES 65536		// scenario size unless a count is given
+# define VALIDATE_SEED 42				// seed of the scenario, the same run every time
+# define VALIDATE_MASS_INTENSITY 10.0f	// pull of the mass during the run
+# define VALIDATE_TOLERANCE 1e-3		// largest error allowed, relative to max(1, |reference|)
+
+// OpenCL build profiles (--cl-profile), every program is built with the options of the selected one
+# define CL_OPTIONS_STRICT ""												// correctly rounded builtins, the default
+# define CL_OPTIONS_FAST "-cl-fast-relaxed-math -cl-mad-enable"
+# define CL_OPTIONS_NATIVE "-cl-fast-relaxed-math -cl-mad-enable -DNATIVE_MATH"	// plus native_* and 16 float particle loads
+
+// Point cloud config (--load)
+# define LOAD_STAGING_BYTES (64 << 20)	// file bytes uploaded per batch
+# define LOAD_PLY_HEADER_MAX 65536		// a PLY header must end within this many bytes
+
+// Particle storage config
+# define MEMORY_RESERVE_FRACTION 0.1	// share of the usable memory left to the driver and other applications
+# define CHUNK_MAX_PARTICLES (1 << 21) // a chunk also stays under CL_DEVICE_MAX_MEM_ALLOC_SIZE
+
+// Density volume LOD config
+# define LOD_GRID_RESOLUTION 128	// cells per side, overridden by --lod-res
+# define LOD_COARSE_FACTOR 8		// fine cells per empty-space skipping cell
+# define LOD_GRID_EXTENT 200.0f		// world size of the grid cube around the camera
+# define LOD_DISTANCE 60.0f			// particles further than this are splatted
+# define LOD_DENSITY_SCALE 0.02f	// opacity contributed by each splatted particle
+
+// Vector field config
+# define FIELD_RESOLUTION 64			// texels per side of a generated field frame
+# define FIELD_EXTENT 60.0f			// world size covered by one tile of the field
+# define FIELD_STRENGTH 6.0f			// acceleration applied at unit field value
+# define FIELD_FRAME_PERIOD 5.0f		// seconds to blend from one field frame to the next
+# define FIELD_SCROLL_SPEED 2.0f		// world units per second the field drifts by
+
+// Collision config
+# define SDF_RESOLUTION 128			// cells per side of the baked signed distance grid
+# define SDF_GRID_MIN -60.0f			// corner of the grid cube on every axis
+# define SDF_GRID_SIZE 120.0f		// world size of the grid cube
+# define SDF_RESTITUTION 0.4f		// fraction of the normal velocity kept on bounce
+# define SDF_FRICTION 0.1f			// fraction of the tangential velocity lost on contact
+# define SDF_MARGIN 0.1f				// particles are kept this far outside the surfaces
+
+// Gizmo config
+# define GIZMO_SPHERE_SEGMENTS 48	// slices and stacks of the cached sphere mesh
+# define GIZMO_MAX_INSTANCES 64		// gizmos drawn by the single instanced call
+
+# define USAGE "Usage: ./particle_system [nb] [--lod-res n] [--field file] [--colliders file] [--tick-rate n] [--target-fps n] [--no-governor] [--bench seconds] [--font file.ttf] [--validate steps] [--cl-profile strict|fast|native] [--species heavy%,tracer%] [--load file.ply|file.xyz] [--splat] [--headless n|first-last [--output frames/####.png|'|command']] [--ranks n --rank r [--hosts h0,h1,...] [--port p]] [--serve port | --connect host:port]"
+
 # define COMMANDS_LIST														\
 	"Controls:\n"															\
 	"'H': Display commands\n"												\
@@ -24,12 +129,24 @@
 	"'Left Ctrl': Move faster\n"											\
 	"Arrow keys or mouse (when captured): Rotate camera\n"					\
 	"'C': Toggle mouse capture (hides the cursor when active)\n"			\
+	"'Home': Frame every particle in view\n"								\
+	"'Left click': Pick the particle under the cursor (screen center when captured)\n"	\
+	"'Right click': Move the mass onto the particle under the cursor\n"		\
+	"'Middle click': Select the particles around it (sphere, box with Shift)\n"	\
 	"\n"																	\
 	"Simulation controls:\n"												\
 	"'Keypad 0': Reset simulation to the cube\n"							\
 	"'Keypad 1': Reset simulation to the sphere\n"							\
+	"'Keypad 2': Reset simulation to the loaded point cloud (--load)\n"		\
 	"'R': Toggle trailing mode (~1 second particle paths)\n"				\
 	"'G': Toggle spaghetti mode (line strip rendering)\n"					\
+	"'X': Toggle motion blur (velocity streaks, full particle count)\n"		\
+	"'V': Toggle density volume LOD for far particles\n"					\
+	"'[' / ']': Decrease/Increase the LOD distance threshold\n"			\
+	"'Page Up' / 'Page Down': Increase/Decrease the particle count\n"		\
+	"'N': Toggle the curl-noise force field\n"								\
+	"'Z': Toggle collisions with the SDF collision geometry\n"				\
+	"'Q': Toggle the adaptive quality governor\n"							\
 	"\n"																	\
 	"Mass commands:\n"														\
 	"'M' or ';': Toggle mass activity\n"									\
@@ -48,5 +165,7 @@
 	"'E': Toggle emitter on/off\n"											\
 	"\n"																	\
 	"System:\n"															\
+	"'F2': Toggle the OpenCL point splatting renderer (points only)\n"		\
+	"'F3': Toggle the performance HUD\n"									\
 	"'F11': Toggle fullscreen\n"											\
 	"'Esc': Quit\n"
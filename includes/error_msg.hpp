@@ -22,9 +22,21 @@
 #define PROGRAM_BUILD_ERR "Couldn't build program: "
 #define KERNEL_CREATE_ERR "Couldn't create kernel: "
 #define BUFFER_CREATE_ERR "Couldn't create interoperable buffer"
+#define DENSITY_BUFFER_CREATE_ERR "Couldn't create density volume buffers"
+#define FIELD_CREATE_ERR "Couldn't create vector field images"
+#define FIELD_LOAD_ERR "Couldn't load vector field file"
+#define SDF_CREATE_ERR "Couldn't bake the collision distance field"
+#define COLLIDER_LOAD_ERR "Couldn't load collision scene"
+#define STATS_CREATE_ERR "Couldn't create statistics buffers"
+#define QUERY_CREATE_ERR "Couldn't create spatial query buffers"
+#define SPLAT_CREATE_ERR "Couldn't create point splatting buffers"
+#define CLUSTER_CREATE_ERR "Couldn't create particle migration buffers"
+#define STREAM_CREATE_ERR "Couldn't create the stream quantization buffer"
+#define CLOUD_LOAD_ERR "Couldn't upload the point cloud"
 #define KERNEL_ARGS_SET_ERR "Couldn't set args for kernel"
 #define ENQUEUE_NDRANGE_KERNEL_ERR "Couldn't run kernel"
 #define ENQUEUE_BUFFER_CL_GL_ERR "Failed to acquire OpenGL buffer for OpenCL"
 #define RELEASE_BUFFER_CL_GL_ERR "Failed to release OpenGL buffer for OpenCL"
 #define FETCH_CL_FILE_ERR "Failed to open .cl file"
 #define NO_PARTICLES_ERR "0 particles detected, at least 1 required"
+#define NOT_ENOUGH_MEMORY_ERR "Not enough memory for the requested particle count"
@@ -0,0 +1,75 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   hud.hpp                                            :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: tmoragli <tmoragli@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 14:03:12 by tmoragli          #+#    #+#             */
+/*   Updated: 2026/10/19 14:03:12 by tmoragli         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include <array>
+#include <cstddef>
+
+namespace psys
+{
+	// Screen space vertex, pixels from the top left corner
+	struct hud_vertex {
+		float x, y;
+		float u, v;
+		float r, g, b, a;
+	};
+
+	// Baked glyph: atlas rectangle in texels and placement from the pen position
+	struct hud_glyph {
+		float x0, y0, x1, y1;
+		float xoff, yoff;
+		float xadvance;
+	};
+
+	/*
+		Overlay batcher: text from a glyph atlas baked once and flat quads
+		(a white texel of the atlas) are collected between begin() and draw(),
+		then drawn with a single call
+	*/
+	class Hud
+	{
+		public:
+			Hud();
+			~Hud();
+			bool init(const std::string &fontPath, GLuint program);
+			bool ready() const;
+			float lineHeight() const;
+
+			void begin(int width, int height);
+			float text(float x, float y, const std::string &str, const glm::vec4 &color);
+			void rect(float x, float y, float w, float h, const glm::vec4 &color);
+			void graph(float x, float y, float w, float h, const float *samples, size_t count, size_t first,
+				float maxValue, const glm::vec4 &color);
+			void draw();
+
+		private:
+			void quad(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1, const glm::vec4 &color);
+
+			GLuint program;
+			GLuint atlasTex;
+			GLuint vao;
+			GLuint vbo;
+			size_t vboCapacity;
+			std::vector<hud_vertex> vertices;
+			std::array<hud_glyph, 96> glyphs;
+			float whiteU;
+			float whiteV;
+			int screenWidth;
+			int screenHeight;
+			bool loaded;
+	};
+};
@@ -0,0 +1,56 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   offscreen.hpp                                      :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: tmoragli <tmoragli@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 17:12:05 by tmoragli          #+#    #+#             */
+/*   Updated: 2026/10/19 17:12:05 by tmoragli         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#pragma once
+
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <string>
+#include <vector>
+#include <cstdio>
+
+namespace psys
+{
+	/*
+		Window replacement of --headless: a surfaceless EGL context (no display server, Mesa's
+		software rasterizer works) rendering into a framebuffer object of a fixed size.
+		The context is created before GLEW is loaded, the framebuffer after
+	*/
+	class Offscreen
+	{
+		public:
+			Offscreen();
+			~Offscreen();
+			bool createContext();
+			bool createFramebuffer(int width, int height);
+			bool ready() const;
+
+			// Last rendered frame, rows top first
+			bool readFrame();
+			bool writePng(const std::string &path) const;
+			bool writeRaw(FILE *stream) const;
+
+		private:
+			EGLDisplay display;
+			EGLContext context;
+			GLuint fbo;
+			GLuint colorRb;
+			GLuint depthRb;
+			int width;
+			int height;
+			std::vector<unsigned char> pixels;
+	};
+
+	// Pattern with its run of '#' replaced by the zero padded number, "frame_###.png" -> "frame_007.png"
+	std::string numberedPath(const std::string &pattern, unsigned int number);
+};
@@ -31,6 +31,10 @@
 #include <chrono>
 #include <algorithm>
 #include <random>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
 #include <GL/glx.h>
 #include <CL/cl.h>
 #include <CL/cl_gl.h>
@@ -42,14 +46,17 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <GLFW/glfw3.h>
+#include <unistd.h>
 #include "camera.hpp"
 #include "define.hpp"
+#include "spsc_channel.hpp"
+#include "hud.hpp"
+#include "offscreen.hpp"
+#include "cluster.hpp"
+#include "stream.hpp"
+#include "sim_types.hpp"
 
 namespace psys {
-	struct float3 {
-		float x, y, z;
-	};
-
 	struct Color {
 		//red, green, blue, opacity
 		float r;
@@ -91,44 +98,203 @@ namespace psys {
 		{0.5f, 0.5f, 0.5f}
 	};
 
+	// Steps of the quality governor, lowest first, the last one is full quality
+	struct quality_level {
+		float particle_scale;	// fraction of the requested particle count kept active
+		int trail_samples;		// trail samples drawn out of TRAIL_SAMPLES
+		float point_size;		// width of the particle dots
+		float lod_scale;		// factor on the LOD distance threshold
+	};
+	const std::vector<quality_level> quality_levels = {
+		{0.10f, 4, 1.0f, 0.35f},
+		{0.20f, 6, 1.0f, 0.45f},
+		{0.35f, 8, 1.0f, 0.55f},
+		{0.50f, 10, 1.0f, 0.7f},
+		{0.70f, 12, 1.0f, 0.85f},
+		{0.85f, 14, 1.5f, 1.0f},
+		{1.00f, 16, 1.5f, 1.0f},
+	};
+
 	const float movespeed = 0.1f;
-	const unsigned int cubeSize = 15;
-	const float sphereRadius = 1.0f;
 
-	struct particle {
-		float3 pos;
-		float3 velocity;
-		float3 color;
-		float3 pos_prev;
-		float3 trail[TRAIL_SAMPLES];
-		float trail_timer;
-		float trail_head;
-		float life;
-		float max_life;
-		unsigned int seed;
+	// One shared GL/CL buffer holding the particles [offset, offset + capacity) and one holding their
+	// trail history, TRAIL_SAMPLES slices of capacity packed positions.
+	// The lock is held by the simulation while it writes the chunk and by the renderer while it draws it
+	struct particle_chunk {
+		GLuint bufferGL;
+		GLuint trailGL;
+		GLuint vao;
+		cl_mem bufferCL;
+		cl_mem trailCL;
+		size_t offset;
+		size_t capacity;
+		std::unique_ptr<std::mutex> lock;
+		std::chrono::steady_clock::time_point tick;
+		cl_uint trailClock;		// history slices written to this chunk
+		cl_uint trailValidFrom;	// first slice written for every active particle
+		size_t trailActive;		// active count of the last tick
+		GLsync glDone;			// last GL use of the buffers, waited for by the next OpenCL acquire
 	};
 
-	struct mass {
+	// clCreateEventFromGLsyncKHR, queried at runtime as cl_khr_gl_event is optional
+	typedef cl_event (CL_API_CALL *gl_sync_event_fn)(cl_context context, cl_GLsync sync, cl_int *errcode_ret);
+
+	// Per instance data of the sphere gizmos, unit mesh scaled by radius
+	struct gizmo_instance {
 		float3 pos;
-		float3 rotationTangent;
-		float intensity;
 		float radius;
+		Color color;
 	};
 
-	struct emitter {
-		float3 pos;
-		float spawn_radius;
-		float push_intensity;
-		float push_radius;
-		float spawn_speed;
-		float life_min;
-		float life_max;
-		unsigned int enabled;
+	struct lod_params {
+		float3 eye;
+		float3 grid_min;
+		float cell_size;
+		float distance;
+		float density_scale;
+		unsigned int resolution;
+	};
+
+	enum colliderShape {
+		COLLIDER_PLANE,
+		COLLIDER_SPHERE,
+		COLLIDER_BOX
+	};
+
+	// Analytic collision primitive baked into the SDF, see bake_sdf.cl for the field meanings
+	struct collider {
+		float3 center;
+		float3 extent;
+		unsigned int type;
+	};
+
+	// Last reduction read back from the device, one tick behind the simulation
+	struct sim_stats {
+		float3 bbox_min;
+		float3 bbox_max;
+		float3 centroid;
+		float kinetic_energy;
+		float max_speed;
+		size_t inside_mass;
+		size_t live_emitter;
+		size_t count;
+		bool valid;
+	};
+
+	// Uniform grid of the spatial queries, cubic cells over the particle bounding box
+	struct query_grid {
+		float3 grid_min;
+		float cell_size;
+		unsigned int resolution;
+		unsigned int count;
+	};
+
+	// Camera and frame of the OpenCL point splatter, mirrors splat_params in splat_points.cl
+	struct splat_params {
+		float view_proj[16];
+		cl_uint width;
+		cl_uint height;
+		cl_uint tiles_x;
+		float alpha;
+	};
+
+	// Byte layout of one point record, mirrors cloud_layout in init_particles_cloud.cl
+	struct cloud_layout {
+		cl_uint stride;
+		cl_uint x;
+		cl_uint y;
+		cl_uint z;
+	};
+
+	// Memory mapped --load file, the upload reads the records in place
+	struct point_cloud {
+		void *mapping;
+		size_t mappingSize;
+		const unsigned char *data;	// first point record, after any header
+		size_t count;
+		cloud_layout layout;
+	};
+
+	// One fixed size device resource of the memory plan
+	struct memory_item {
+		const char *name;
+		size_t bytes;
+	};
+
+	struct memory_plan {
+		std::vector<memory_item> fixed;
+		size_t perParticle;
+	};
+
+	// Particle species in buffer order, each a contiguous range updated by its own kernel of update_particles.cl
+	enum particle_species {
+		SPECIES_HEAVY,
+		SPECIES_TRACER,
+		SPECIES_PASSIVE,
+		SPECIES_EMITTER,
+		SPECIES_COUNT
+	};
+	const char *const speciesKernels[SPECIES_COUNT] = {"updateHeavy", "updateTracer", "updatePassive", "updateEmitter"};
+
+	// Everything the simulation thread reads from the input side, sent whole every frame
+	struct sim_params {
+		mass m;
+		emitter e;
+		size_t tracer_start;		// heavy particles come first, from 0
+		size_t passive_start;
+		size_t emitter_start;
+		bool field;
+		bool collisions;
+	};
+
+	// Head of a CLUSTER_VIEW message from a worker, sampleCount particles follow
+	struct cluster_summary {
+		uint64_t count;			// particles in the worker's slab after the tick
+		uint64_t migrated;		// particles it sent to the other slabs
+		uint64_t sampleCount;
+		float stepMs;			// update kernel of the tick
+		float exchangeMs;		// finding, sending and receiving the migrants
+	};
+
+	// OpenCL build profiles, from the most exact to the fastest
+	enum build_profile {
+		PROFILE_STRICT,
+		PROFILE_FAST,
+		PROFILE_NATIVE,
+		PROFILE_COUNT
+	};
+	const char *const profileNames[PROFILE_COUNT] = {"strict", "fast", "native"};
+	const char *const profileOptions[PROFILE_COUNT] = {CL_OPTIONS_STRICT, CL_OPTIONS_FAST, CL_OPTIONS_NATIVE};
+
+	struct launch_options {
+		size_t nb_particles;
+		unsigned int lod_resolution;
+		std::string field_path;
+		std::string collider_path;
+		std::string font_path;
+		std::string load_path;
+		unsigned int tick_rate;
+		unsigned int target_fps;
+		unsigned int bench_seconds;
+		unsigned int validate_steps;
+		build_profile profile;		// --cl-profile, build options of every program
+		unsigned int heavy_percent;	// --species, shares of the particles that are heavy and tracers
+		unsigned int tracer_percent;
+		bool governor;
+		bool splat;
+		Offscreen *offscreen;		// --headless target created by main, nullptr with a window
+		unsigned int headless_first;	// first frame written and timed
+		unsigned int headless_last;
+		std::string output_path;	// numbered PNGs ('#' run) or '|command' fed raw RGBA frames
+		Cluster *cluster;			// --ranks mesh connected by main, nullptr for a single process
+		StreamServer *stream_server;	// --serve listener opened by main, nullptr otherwise
+		StreamClient *stream_client;	// --connect link to the server, nullptr otherwise
 	};
 
 	enum particleShape {
 		SPHERE,
-		CUBE
+		CUBE,
+		CLOUD
 	};
 
 	class Camera;
@@ -136,50 +302,144 @@ namespace psys {
 	class particle_system
 	{
 		public:
-			particle_system(const size_t &nbParticles);
+			particle_system(const launch_options &options);
 			~particle_system();
 
 			//Init functions
 			bool initCLdata();
-			void run();
+			bool startCLdata();
+			bool finishCLdata();
+			bool run();
 		private:
+			bool runHeadless();
+			bool runWorker();
+			bool runServer();
+			struct cl_program_source {
+				cl_program *program;
+				const char *path;
+				const char *name;
+			};
+
 			bool initContext();
 			void initSimData();
 			bool initQueue();
 			bool initPrograms();
 			bool initKernels();
 			bool initSharedBufferData();
+			bool initDensityVolumeData();
+			bool initGizmoData();
+			bool initDensityVolumeCL();
+			bool initVectorFieldCL();
+			bool loadVectorField();
+			bool generateFieldFrame(cl_mem image, unsigned int seed);
+			bool advanceVectorField(bool enabled);
+			bool initCollisionCL();
+			bool loadColliders();
+			bool loadColliderMesh(const std::string &path);
+			bool bakeCollisionField();
+			bool initStatsCL();
+			bool initQueryCL();
+			bool initClusterCL();
+			bool mapPointCloud(const std::string &path);
+			bool parsePlyHeader(const char *begin, size_t size);
+			void unmapPointCloud();
 			void initShaders();
-			const char *get_CL_program(const std::string &path);
+			void bindParticleAttributes(particle_chunk &chunk);
+			void fenceChunk(particle_chunk &chunk);
+			cl_int acquireChunk(cl_command_queue target, particle_chunk &chunk, cl_uint count, const cl_mem *objects);
+			bool get_CL_program(const std::string &path, std::string &content);
+			std::vector<cl_program_source> programSources();
+			static void CL_CALLBACK programBuilt(cl_program program, void *user_data);
+			bool programsReady();
+			void waitForPrograms();
+			bool checkPrograms();
+			bool pollShaders();
+			void reportFirstFrame(bool withParticles);
 			bool selectDevice();
+			void queryDeviceLimits();
+			memory_plan memoryFootprint() const;
+			void planMemoryBudget();
 
 			void toggleFullscreen();
 			//Runtime functions
-			cl_event enqueueUpdateParticles();
-			bool enqueueInitCubeParticles();
-			bool enqueueInitSphereParticles();
+			bool enqueueUpdateParticles(const sim_params &params);
+			cl_int setUpdateArg(cl_uint index, size_t size, const void *value);
+			bool reserveStatsPartials(size_t groups);
+			bool enqueueReduceStats(particle_chunk &chunk, size_t count, const sim_params &params, cl_uint groupOffset);
+			bool enqueueCombineStats(cl_uint groupCount);
+			void collectStats();
+			sim_stats latestStats() const;
+			void frameParticles();
+			bool reserveQueryBuffers(size_t cells, size_t particles);
+			bool buildQueryGrid();
+			bool runCellQuery(cl_kernel kernel, const glm::vec3 &low, const glm::vec3 &high, std::vector<cl_uint> &indices);
+			bool queryRadius(const glm::vec3 &center, float radius, std::vector<cl_uint> &indices);
+			bool queryBox(const glm::vec3 &low, const glm::vec3 &high, std::vector<cl_uint> &indices);
+			bool queryRayNearest(const glm::vec3 &origin, const glm::vec3 &direction, float slope, cl_uint &index, glm::vec3 &pos);
+			bool pickParticle(cl_uint &index, glm::vec3 &pos);
+			bool reserveSplatBuffers(size_t tiles, size_t points);
+			bool resizeSplatFrame(int width, int height);
+			bool enqueueSplatPoints(const glm::mat4 &viewProj);
+			unsigned int slabOwner(float x) const;
+			bool migrateParticles(uint64_t &migrated);
+			bool listEmigrants(std::vector<cl_uint> &indices, std::vector<particle> &emigrants);
+			bool reserveMigrateBuffers(size_t particles);
+			bool sendViewSample(cluster_summary &summary);
+			void viewerLoop();
+			void uploadViewFrame();
+			bool reserveStreamBuffer(size_t particles);
+			bool quantizeParticles();
+			void streamLoop();
+			void updateBenchmark(bool ready);
+			void simLoop();
+			void startSimThread();
+			void stopSimThread();
+			sim_params currentSimParams() const;
+			size_t desiredParticleCount() const;
+			void beginFrameTimer();
+			void resetGovernorWindow();
+			void governQuality(float cpuMs);
+			void applyQualityLevel(size_t level);
+			const quality_level &currentQuality() const;
+			bool enqueueInitParticles(size_t offset, size_t count);
+			bool enqueueInitCubeParticles(size_t offset, size_t count);
+			bool enqueueInitSphereParticles(size_t offset, size_t count);
+			bool enqueueInitCloudParticles(size_t offset, size_t count);
+			bool enqueueInitKernel(cl_kernel kernel, size_t offset, size_t count);
+			bool growParticleBuffer(size_t minCount);
+			bool createParticleChunk(size_t offset, size_t capacity);
+			bool resizeParticleChunk(particle_chunk &chunk, size_t capacity);
+			bool registerParticleChunk(particle_chunk &chunk);
+			bool registerChunkBuffers(GLuint bufferGL, GLuint trailGL, cl_mem &bufferCL, cl_mem &trailCL);
+			void dropLastChunk();
+			size_t chunkActiveCount(const particle_chunk &chunk) const;
+			std::vector<cl_mem> sharedChunkBuffers() const;
+			bool enqueueSplatDensity();
 			void resetSimulation();
 			void update_mass_tangent(float x, float y, float z);
 			void update_mass_position(glm::mat4 projectionMatrix, glm::mat4 viewMatrix);
 			void update_emitter_position(glm::mat4 projectionMatrix, glm::mat4 viewMatrix);
 			void update_window_size(int height, int width);
+			void update_lod_grid(const glm::mat4 &viewMatrix);
 			void setParticleCount(size_t newCount);
-			void updateEmitterRange();
+			void updateSpeciesRanges();
 
 			//Exit functions
-			bool freeCLdata(bool err, const std::string &err_msg = "");
+			bool freeCLdata(bool err, const std::string &err_msg = "", bool keepBaked = false);
 
 			int initGLFW();
 
 			// Event hook actions
 			void keyAction(int key, int scancode, int action, int mods);
 			void mouseAction(double x, double y);
+			void mouseButtonAction(int button, int action, int mods);
 			void reshapeAction(int width, int height);
 
 			// Event hook callbacks
 			static void reshape(GLFWwindow* window, int width, int height); 
 			static void keyPress(GLFWwindow* window, int key, int scancode, int action, int mods);
 			static void mouseCallback(GLFWwindow* window, double x, double y);
+			static void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
 			void update();
 			void updateParticles();
 			void updateMovement();
@@ -187,6 +447,11 @@ namespace psys {
 			void tickRandomMassRotation();
 			void display();
 			void renderParticles(glm::mat4 &viewMatrix);
+			void renderDensityVolume(const glm::mat4 &viewProj);
+			void renderSplatPoints(glm::mat4 &viewMatrix);
+			void renderGizmos(const glm::mat4 &viewProj);
+			void renderHud();
+			size_t deviceMemoryUsed() const;
 			void calculateFps();
 
 			void initData();
@@ -200,20 +465,45 @@ namespace psys {
 			cl_program update_program;
 			cl_program init_cube_program;
 			cl_program init_sphere_program;
-			cl_kernel calculate_position;
+			cl_kernel update_species[SPECIES_COUNT];
 			cl_kernel init_particles_cube;
 			cl_kernel init_particles_sphere;
+			cl_program init_cloud_program;
+			cl_kernel init_particles_cloud;
+			cl_program lod_program;
+			cl_kernel splat_density;
+			cl_kernel resolve_density;
 			cl_platform_id selected_platform;
 			cl_device_id selected_device;
+			gl_sync_event_fn createEventFromGLsync;	// nullptr without cl_khr_gl_event, GL is finished instead
 			cl_uint num_platforms;
 			cl_uint num_devices;
-			cl_mem particleBufferCL;
+			cl_mem densityAccumCL;
+			cl_mem densityVolumeCL;
+			cl_mem densityCoarseCL;
+
+			// Particle storage, split under the device allocation limit
+			std::vector<particle_chunk> chunks;
+			size_t chunkCapacity;
+			size_t maxParticles;
 
 			// OpenGL
-			GLuint particleBufferGL;
-			GLuint vao;
 			GLuint shaderProgram;
 			GLuint spaghettiShaderProgram;
+			GLuint volumeShaderProgram;
+			GLuint gizmoShaderProgram;
+			GLuint hudShaderProgram;
+			GLuint splatShaderProgram;
+			GLuint gizmoVao;
+			GLuint gizmoMeshVBO;
+			GLuint gizmoMeshIBO;
+			GLuint gizmoInstanceVBO;
+			GLsizei gizmoIndexCount;
+			GLuint volumeVao;
+			GLuint densityVolumeGL;
+			GLuint densityCoarseGL;
+			GLuint densityVolumeTex;
+			GLuint densityCoarseTex;
 
 			// Window		
 			int windowHeight;
@@ -232,15 +522,105 @@ namespace psys {
 			bool massDisplay;
 			bool trailingMode;
 			bool spaghettiMode;
+			bool motionBlurMode;
 			bool randomMassRotation;
+			bool lodMode;
+			lod_params lod;
+
+			// Curl-noise force field
+			cl_program field_program;
+			cl_kernel generate_field;
+			cl_mem fieldStagingCL;
+			cl_mem fieldImagesCL[2];
+			field_params field;
+			std::string fieldPath;
+			unsigned int fieldResolution;
+			unsigned int fieldSeed;
+			float fieldTime;
+			bool fieldMode;
+
+			// SDF collision geometry
+			cl_program sdf_program;
+			cl_kernel bake_distance;
+			cl_kernel bake_normals;
+			cl_mem sdfImageCL;
+			collision_params collision;
+			std::string colliderPath;
+			std::vector<collider> colliders;
+			std::vector<float> colliderTriangles;
+			bool collidersLoaded;
+			bool collisionMode;
+
+			// Device statistics, reduced after every tick and read back one tick late
+			cl_program stats_program;
+			cl_kernel reduce_stats;
+			cl_kernel combine_stats;
+			cl_mem statsPartialsCL;
+			cl_mem statsResultCL;
+			size_t statsPartialCapacity;
+			cl_event statsEvent;
+			stats_record statsReadback;
+			mutable std::mutex statsMutex;
+			sim_stats stats;
+
+			// Spatial queries, the grid is built on demand and reused within a tick
+			cl_program query_program;
+			cl_kernel count_cells;
+			cl_kernel scan_cells;
+			cl_kernel scatter_particles;
+			cl_kernel query_radius;
+			cl_kernel query_box;
+			cl_kernel query_ray;
+			cl_mem queryCellCountsCL;
+			cl_mem queryCellStartsCL;
+			cl_mem queryCellCursorCL;
+			cl_mem queryParticleCellsCL;
+			cl_mem queryParticlePosCL;
+			cl_mem querySortedIndexCL;
+			cl_mem querySortedPosCL;
+			cl_mem queryResultsCL;
+			size_t queryCellCapacity;
+			size_t queryParticleCapacity;
+			query_grid queryGrid;
+			unsigned long queryGridTick;
+			bool queryGridValid;
+			std::vector<cl_uint> selection;
+
+			// OpenCL point splatting (F2), binned into screen tiles and written to a texture GL presents
+			cl_program splat_program;
+			cl_kernel bin_points;
+			cl_kernel scan_tiles;
+			cl_kernel scatter_points;
+			cl_kernel raster_tiles;
+			cl_mem splatTileCountsCL;
+			cl_mem splatTileStartsCL;
+			cl_mem splatTileCursorCL;
+			cl_mem splatPointTilesCL;
+			cl_mem splatPointFragmentsCL;
+			cl_mem splatTileFragmentsCL;
+			cl_mem splatFrameCL;
+			size_t splatTileCapacity;
+			size_t splatPointCapacity;
+			GLuint splatFrameTex;
+			int splatWidth;
+			int splatHeight;
+			bool splatMode;
+
+			// Point cloud start (--load), mapped for the whole run so resets reload it
+			point_cloud cloud;
+
 			particleShape reset_shape;
 			size_t nb_particles;
 			size_t default_nb_particles;
 			size_t particleBufferSize;
 			mass m;
 			emitter e;
+			size_t tracer_start;
+			size_t passive_start;
 			size_t emitter_start;
 			size_t emitter_count;
+			float heavyShare;
+			float tracerShare;
 			bool emitterEnabled;
 			bool emitterDisplay;
 			float randomRotationTimer;
@@ -248,6 +628,7 @@ namespace psys {
 
 			// Camera and view
 			glm::mat4 projectionMatrix;
+			glm::mat4 lastViewMatrix;
 			Camera camera;
 
 			// Keys states and runtime booleans
@@ -268,13 +649,117 @@ namespace psys {
 			double currentFrameTime;
 			int fps;
 
+			// Asynchronous startup
+			std::mutex buildMutex;
+			std::condition_variable buildDone;
+			std::chrono::steady_clock::time_point launchTime;
+			std::chrono::steady_clock::time_point buildStart;
+			bool simReady;
+			bool shadersReady;
+			bool firstFrameShown;
+			bool firstParticlesShown;
+
 			// Simulation time
 			std::chrono::steady_clock::time_point start;
 			std::chrono::steady_clock::time_point end;
 			float delta;
+
+			// Fixed rate simulation thread
+			std::thread simThread;
+			std::mutex simMutex;
+			std::condition_variable simWake;
+			spsc_channel<sim_params, SIM_CHANNEL_CAPACITY> simChannel;
+			sim_params simParams;
+			cl_command_queue simQueue;
+			float simDelta;
+			bool simRunning;
+			std::atomic<bool> simFailed;		// a step failed and stopped the simulation thread, the main loop exits
+			std::atomic<unsigned int> simTicks;
+			std::atomic<unsigned long> simTickTotal;
+			std::atomic<float> simStepMs;
+			std::atomic<cl_uint> trailClock;
+			float trailTimer;
+
+			// Adaptive quality governor
+			bool governorMode;
+			float governorBudgetMs;
+			size_t qualityLevel;
+			GLuint frameTimers[GOVERNOR_TIMER_QUERIES];
+			std::array<bool, GOVERNOR_TIMER_QUERIES> frameTimerUsed;
+			size_t frameTimerIndex;
+			std::chrono::steady_clock::time_point governorWindowStart;
+			float gpuMsSum;
+			float cpuMsSum;
+			int gpuSamples;
+			int cpuSamples;
+			int underBudgetWindows;
+			float lodBaseDistance;
+
+			// Performance overlay
+			Hud hud;
+			bool hudMode;
+			std::array<float, HUD_GRAPH_SAMPLES> frameHistory;
+			std::array<float, HUD_GRAPH_SAMPLES> simHistory;
+			size_t historyIndex;
+			std::chrono::steady_clock::time_point lastFrameStamp;
+			float lastGpuMs;
+			float interopMs;
+			cl_ulong deviceGlobalMem;
+
+			// Offscreen run (--headless), the framebuffer object replaces the window
+			Offscreen *offscreen;
+			unsigned int headlessFirst;
+			unsigned int headlessLast;
+			std::string outputPath;
+
+			// Distributed run (--ranks): rank 0 steps the workers and displays what they send back,
+			// each worker simulates the particles inside its slab of x
+			Cluster *cluster;
+			cl_program migrate_program;
+			cl_kernel find_emigrants;
+			cl_kernel fill_holes;
+			cl_kernel sample_particles;
+			cl_mem emigrantCountCL;
+			cl_mem emigrantIndexCL;
+			cl_mem emigrantsCL;
+			cl_mem migrateMovesCL;
+			size_t migrateCapacity;		// emigrants the three buffers above hold
+			cl_mem viewSamplesCL;
+			size_t clusterFirst;		// index of the worker's first particle in the initial shape
+			size_t clusterTotal;		// particles over every worker, 0 for a single process
+			float slabLow;
+			float slabHigh;
+			std::mutex viewMutex;
+			std::vector<particle> viewFrame;
+			bool viewPending;
+
+			// Remote viewing: --serve sends the quantized particles to its viewers, a --connect viewer
+			// simulates nothing and displays the server's frames through viewFrame
+			StreamServer *streamServer;
+			StreamClient *streamClient;
+			cl_program quantize_program;
+			cl_kernel quantize_particles;
+			cl_mem streamQuantizedCL;
+			size_t streamCapacity;
+			std::vector<uint16_t> streamQuantized;
+			std::vector<uint16_t> streamValues;		// viewer's last decoded frame, kept across resets
+
+			// Benchmark run (--bench), per second lines then a summary
+			unsigned int benchSeconds;
+			build_profile buildProfile;
+			bool benchStarted;
+			std::chrono::steady_clock::time_point benchStart;
+			std::chrono::steady_clock::time_point benchLast;
+			unsigned long benchFrames;
+			unsigned long benchLastFrames;
+			unsigned long benchStartTicks;
+			unsigned long benchLastTicks;
+			float benchMinFps;
 			std::mt19937 rng;
 	};
 };
 
 GLuint compileShader(const char* filePath, GLenum shaderType);
 GLuint createShaderProgram(const char* vertexShaderPath, const char* fragmentShaderPath, const char* geometryShaderPath);
+void enableParallelShaderCompile();
+bool shaderProgramReady(GLuint program);
@@ -0,0 +1,132 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   psys.h                                             :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: tmoragli <tmoragli@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 21:02:47 by tmoragli          #+#    #+#             */
+/*   Updated: 2026/10/19 21:02:47 by tmoragli         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef PSYS_H
+# define PSYS_H
+
+/*
+	libpsys: the simulation core without a window. One system is a plain OpenCL buffer of particles
+	stepped by update_particles.cl, no GL context, no GLFW and no per step synchronisation.
+	Only psys_reset(), psys_finish(), psys_read(), psys_write(), psys_map(), psys_member_stats() and
+	psys_destroy() wait for the steps already queued. psys_step() and psys_unmap() only queue work, the
+	psys_set_*() calls change what the next psys_step() uploads and the getters read host state.
+	An ensemble packs many independent systems of the same size in that buffer, each with its own
+	mass and emitter, and steps them all in one launch: a system from psys_create() is an ensemble of one.
+	Errors are returned as a status and described on stderr
+*/
+
+# include <stddef.h>
+# include <stdint.h>
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+# define PSYS_API_VERSION 1
+
+typedef struct psys_system psys_system;
+
+typedef enum psys_status {
+	PSYS_OK = 0,
+	PSYS_ERROR_ARGUMENT,	// null handle or pointer, range past the particle count
+	PSYS_ERROR_DEVICE,		// no OpenCL device, context or queue
+	PSYS_ERROR_PROGRAM,		// kernel source missing or failing to build
+	PSYS_ERROR_MEMORY,		// the particles don't fit in one device allocation
+	PSYS_ERROR_RUNTIME		// a kernel, read or map failed
+} psys_status;
+
+typedef enum psys_shape {
+	PSYS_SHAPE_CUBE = 0,
+	PSYS_SHAPE_SPHERE
+} psys_shape;
+
+// Gravity well pulling every particle, swirling them inside its radius
+typedef struct psys_mass {
+	float pos[3];
+	float rotation_tangent[3];
+	float intensity;
+	float radius;
+} psys_mass;
+
+// Respawns the last count particles around pos when their life runs out and pushes the others away
+typedef struct psys_emitter {
+	float pos[3];
+	float spawn_radius;
+	float push_intensity;
+	float push_radius;
+	float spawn_speed;
+	float life_min;
+	float life_max;
+	uint64_t count;		// 0 turns the emitter off
+} psys_emitter;
+
+// One particle as the device stores it, 64 bytes
+typedef struct psys_particle {
+	float pos[3];
+	float velocity[3];
+	float color[3];
+	float pos_prev[3];
+	float life;
+	float max_life;
+	uint32_t seed;
+	uint32_t trail_birth;
+} psys_particle;
+
+// Reduction of one ensemble member on the device, unit mass particles
+typedef struct psys_stats {
+	float bbox_min[3];
+	float bbox_max[3];
+	float centroid[3];
+	float kinetic_energy;
+	float max_speed;
+	uint64_t inside_mass;	// particles within the mass radius
+	uint64_t live_emitter;	// emitter particles still alive
+	uint64_t count;
+} psys_stats;
+
+// kernel_dir holds the .cl sources, "kernel_srcs" when NULL. The particles start as a cube
+psys_status psys_create(uint64_t count, const char *kernel_dir, psys_system **out);
+// members systems of member_count particles each, member i holds particles [i * member_count, (i + 1) * member_count)
+psys_status psys_create_ensemble(uint64_t members, uint64_t member_count, const char *kernel_dir, psys_system **out);
+void psys_destroy(psys_system *sys);
+
+// Every member restarts from the same particles
+psys_status psys_reset(psys_system *sys, psys_shape shape);
+// Applied to every member
+psys_status psys_set_mass(psys_system *sys, const psys_mass *mass);
+psys_status psys_set_emitter(psys_system *sys, const psys_emitter *emitter);
+// One member, a NULL mass or emitter is left as it is. The emitter count is within the member
+psys_status psys_set_member(psys_system *sys, uint64_t member, const psys_mass *mass, const psys_emitter *emitter);
+psys_status psys_set_time_step(psys_system *sys, float seconds);
+
+// Queues steps updates and returns, the device runs them back to back
+psys_status psys_step(psys_system *sys, uint64_t steps);
+psys_status psys_finish(psys_system *sys);
+uint64_t psys_count(const psys_system *sys);
+uint64_t psys_members(const psys_system *sys);
+// Steps run since the creation or the last reset
+uint64_t psys_steps(const psys_system *sys);
+
+psys_status psys_read(psys_system *sys, uint64_t first, uint64_t count, psys_particle *out);
+psys_status psys_write(psys_system *sys, uint64_t first, uint64_t count, const psys_particle *in);
+// Every particle in host memory until psys_unmap(), no step may run in between
+psys_status psys_map(psys_system *sys, psys_particle **particles);
+psys_status psys_unmap(psys_system *sys);
+
+// Statistics of members [first, first + count), reduced on the device, one record per member in out
+psys_status psys_member_stats(psys_system *sys, uint64_t first, uint64_t count, psys_stats *out);
+
+# ifdef __cplusplus
+}
+# endif
+
+#endif
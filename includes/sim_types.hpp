@@ -0,0 +1,106 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   sim_types.hpp                                      :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: tmoragli <tmoragli@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 21:02:47 by tmoragli          #+#    #+#             */
+/*   Updated: 2026/10/19 21:02:47 by tmoragli         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#pragma once
+
+#ifndef CL_TARGET_OPENCL_VERSION
+# define CL_TARGET_OPENCL_VERSION 300
+#endif
+
+#include <CL/cl.h>
+
+/*
+	Layouts the update, init and statistics kernels read, shared by the application and libpsys.
+	Nothing here may pull in GL or GLFW, the library is built without them
+*/
+namespace psys
+{
+	struct float3 {
+		float x, y, z;
+	};
+
+	const unsigned int cubeSize = 15;
+	const float sphereRadius = 1.0f;
+
+	struct particle {
+		float3 pos;
+		float3 velocity;
+		float3 color;
+		float3 pos_prev;
+		float life;
+		float max_life;
+		unsigned int seed;
+		unsigned int trail_birth;
+	};
+
+	struct mass {
+		float3 pos;
+		float3 rotationTangent;
+		float intensity;
+		float radius;
+	};
+
+	struct emitter {
+		float3 pos;
+		float spawn_radius;
+		float push_intensity;
+		float push_radius;
+		float spawn_speed;
+		float life_min;
+		float life_max;
+		unsigned int enabled;
+	};
+
+	// Parameter block of one ensemble member, mirrors member_params in update_particles.cl
+	struct member_params {
+		mass m;
+		emitter e;
+		cl_uint emitter_start;
+	};
+
+	// One reduction record, mirrors stats_record in reduce_stats.cl (float4 members as arrays)
+	struct stats_record {
+		float min[4];
+		float max[4];
+		float sum[4];		// xyz: position sum, w: kinetic energy
+		float max_speed;
+		unsigned int inside;
+		unsigned int live;
+		unsigned int count;
+	};
+
+	// Trail slice written by a tick, mirrors trail_params in update_particles.cl
+	struct trail_params {
+		cl_uint slot;
+		cl_uint stride;
+		cl_uint clock;
+		cl_uint write;
+	};
+
+	// Force field sampling, origin scrolls and blend moves between the two frames
+	struct field_params {
+		float3 origin;
+		float inv_extent;
+		float blend;
+		float strength;
+		unsigned int enabled;
+	};
+
+	struct collision_params {
+		float3 grid_min;
+		float size;
+		float restitution;
+		float friction;
+		float margin;
+		unsigned int enabled;
+	};
+};
@@ -0,0 +1,58 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   spsc_channel.hpp                                   :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: tmoragli <tmoragli@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 10:12:41 by tmoragli          #+#    #+#             */
+/*   Updated: 2026/10/19 10:12:41 by tmoragli         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace psys
+{
+	/*
+		Lock-free ring buffer between exactly one producer thread and one consumer thread,
+		push() fails when the ring is full instead of blocking
+	*/
+	template <typename T, size_t Capacity>
+	class spsc_channel
+	{
+		public:
+			spsc_channel(): head(0), tail(0) {}
+
+			bool push(const T &value)
+			{
+				size_t t = tail.load(std::memory_order_relaxed);
+				size_t next = (t + 1) % Capacity;
+				if (next == head.load(std::memory_order_acquire))
+					return false;
+				slots[t] = value;
+				tail.store(next, std::memory_order_release);
+				return true;
+			}
+
+			bool pop(T &value)
+			{
+				size_t h = head.load(std::memory_order_relaxed);
+				if (h == tail.load(std::memory_order_acquire))
+					return false;
+				value = slots[h];
+				head.store((h + 1) % Capacity, std::memory_order_release);
+				return true;
+			}
+
+		private:
+			std::array<T, Capacity> slots;
+			// Separate cache lines so both ends don't fight over the same one
+			alignas(64) std::atomic<size_t> head;
+			alignas(64) std::atomic<size_t> tail;
+	};
+}
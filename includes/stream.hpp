@@ -0,0 +1,117 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   stream.hpp                                         :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: tmoragli <tmoragli@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 20:05:31 by tmoragli          #+#    #+#             */
+/*   Updated: 2026/10/19 20:05:31 by tmoragli         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace psys
+{
+	// Sent before every compressed frame, server to viewer
+	struct stream_frame_header {
+		uint32_t sequence;	// frames sent to this viewer so far, this one included
+		uint32_t tick;		// simulation tick the particles come from
+		uint32_t keyframe;	// 1 when the values are absolute, 0 when they add to the viewer's last frame
+		uint32_t count;		// particles in the frame
+		uint32_t total;		// particles simulated by the server
+		uint32_t stride;	// the frame holds every stride-th of them
+		uint32_t bytes;		// compressed payload following the header
+	};
+
+	// Viewer to server after each frame it decoded, its sim_params follow so the input drives the simulation
+	struct stream_ack {
+		uint32_t sequence;	// of the frame decoded
+		uint32_t bytes;
+	};
+
+	// Server side state of one viewer
+	struct stream_viewer {
+		int fd;
+		std::string name;					// address:port, for the reports
+		std::vector<unsigned char> out;		// frame being sent
+		size_t sent;
+		std::vector<unsigned char> in;		// acknowledgements not parsed yet
+		uint32_t sentFrames;				// sequence of the last frame sent
+		uint32_t ackedFrames;				// sequence of the last frame acknowledged
+		size_t budget;						// particles per frame the link is believed to carry
+		uint32_t stride;
+		uint32_t total;
+		std::vector<uint16_t> previous;		// last frame sent, the base of the next delta
+		unsigned int offered;				// frames of the current second, sent or skipped
+		unsigned int skipped;
+		unsigned int calmWindows;
+		uint64_t windowBytes;
+		uint64_t windowParticles;
+	};
+
+	/*
+		--serve side: accepts any number of viewers and sends each one the particles quantized by the
+		device, 4 uint16 each. Every viewer gets its own decimation (a stride over the particles) sized by
+		an adaptive budget: a viewer still receiving the last frame, or STREAM_MAX_IN_FLIGHT frames behind
+		on its acknowledgements, skips the new one, and the skips of each second steer its budget
+	*/
+	class StreamServer
+	{
+		public:
+			StreamServer();
+			~StreamServer();
+			bool listen(unsigned int port);
+			size_t viewers() const;
+
+			// Accepts the new viewers and reads their acknowledgements, params gets the latest sim_params sent.
+			// A viewer whose input is not paramBytes long or acknowledging a frame never sent is dropped
+			bool service(std::vector<unsigned char> &params, size_t paramBytes);
+			// At least one viewer can take a frame now
+			bool wantsFrame() const;
+			void publish(const uint16_t *quantized, size_t total, uint32_t tick);
+			// Sends what the sockets accept without blocking
+			void flush();
+			// Once a second: per viewer rate line, then the budgets follow the skips
+			void report(double seconds);
+
+		private:
+			void drop(size_t index, const char *reason);
+
+			int listener;
+			std::vector<stream_viewer> clients;
+	};
+
+	/*
+		--connect side: a blocking socket, frames come in whole, each one acknowledged with the viewer's input
+	*/
+	class StreamClient
+	{
+		public:
+			StreamClient();
+			~StreamClient();
+			bool connect(const std::string &host, unsigned int port);
+			// Waits up to timeoutMs for a frame, ready stays false when none came.
+			// A header past maxCount particles or past what encodeFrame() makes of them is an error
+			bool receive(stream_frame_header &header, std::vector<unsigned char> &payload, int timeoutMs, size_t maxCount,
+				bool &ready);
+			bool acknowledge(uint32_t sequence, const void *params, size_t bytes);
+
+		private:
+			int fd;
+	};
+
+	// Zigzag deltas against previous (absolute values when nullptr) split into 8 byte planes, each one run
+	// length encoded behind its uint32 size. Particles barely moving leave the high planes almost all zeros
+	void encodeFrame(const uint16_t *values, const uint16_t *previous, size_t count, std::vector<unsigned char> &out);
+	// Largest payload encodeFrame() can make of count particles
+	size_t encodedFrameBound(size_t count);
+	// Adds the decoded deltas to values (overwritten by a keyframe), false on a malformed payload
+	bool decodeFrame(const unsigned char *data, size_t bytes, size_t count, uint16_t *values, bool keyframe);
+};
@@ -0,0 +1,38 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   validate.hpp                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: tmoragli <tmoragli@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 15:21:40 by tmoragli          #+#    #+#             */
+/*   Updated: 2026/10/19 15:21:40 by tmoragli         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#pragma once
+
+#include "particle_system.hpp"
+
+namespace psys
+{
+	// Largest and root mean square error of one compared field, over every float of it
+	struct field_error {
+		const char *name;
+		double max;
+		double sum2;
+		size_t samples;
+	};
+
+	/*
+		Golden reference check of update_particles.cl (--validate): a seeded scenario is stepped
+		by the kernel on a plain OpenCL buffer and by the scalar C++ copy of its math below,
+		then both are compared field by field. Every build profile is run and timed against the same
+		reference. Returns false when the selected profile is past VALIDATE_TOLERANCE
+	*/
+	bool runValidation(unsigned int steps, size_t count, build_profile selected);
+
+	// Scalar copy of update_particles.cl for one particle of a species, the field sampled as fieldForce, collisions off
+	void referenceUpdate(particle &p, unsigned int id, particle_species species, const mass &m, const emitter &e, float deltaTime,
+		const field_params &f, const float3 &fieldForce, float3 *trails, const trail_params &t);
+};
@@ -0,0 +1,143 @@
+#define COLLIDER_PLANE 0
+#define COLLIDER_SPHERE 1
+#define COLLIDER_BOX 2
+
+typedef struct {
+	float x, y, z;
+} vec3;
+
+typedef struct {
+	vec3 center;
+	vec3 extent;
+	uint type;
+} collider;
+
+typedef struct {
+	vec3 grid_min;
+	float size;
+	float restitution;
+	float friction;
+	float margin;
+	uint enabled;
+} collision_params;
+
+float3 toFloat3(vec3 v)
+{
+	return (float3)(v.x, v.y, v.z);
+}
+
+/*
+	Signed distance to one analytic collider: plane normal is stored in center
+	and its height in extent.x, sphere radius in extent.x, box half sizes in extent
+*/
+float colliderDistance(float3 p, collider c)
+{
+	float3 center = toFloat3(c.center);
+	float3 extent = toFloat3(c.extent);
+
+	if (c.type == COLLIDER_PLANE)
+		return dot(p, center) - extent.x;
+	if (c.type == COLLIDER_SPHERE)
+		return length(p - center) - extent.x;
+	float3 q = fabs(p - center) - extent;
+	return length(fmax(q, (float3)(0.0f))) + fmin(fmax(q.x, fmax(q.y, q.z)), 0.0f);
+}
+
+/*
+	Closest point on triangle abc (Ericson, Real-Time Collision Detection 5.1.5)
+*/
+float3 closestOnTriangle(float3 p, float3 a, float3 b, float3 c)
+{
+	float3 ab = b - a, ac = c - a, ap = p - a;
+	float d1 = dot(ab, ap), d2 = dot(ac, ap);
+	if (d1 <= 0.0f && d2 <= 0.0f)
+		return a;
+
+	float3 bp = p - b;
+	float d3 = dot(ab, bp), d4 = dot(ac, bp);
+	if (d3 >= 0.0f && d4 <= d3)
+		return b;
+
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+		return a + ab * (d1 / (d1 - d3));
+
+	float3 cp = p - c;
+	float d5 = dot(ab, cp), d6 = dot(ac, cp);
+	if (d6 >= 0.0f && d5 <= d6)
+		return c;
+
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+		return a + ac * (d2 / (d2 - d6));
+
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+		return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+	float denom = 1.0f / (va + vb + vc);
+	return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+/*
+	Writes the scene signed distance of every grid cell center,
+	the union of the analytic colliders and the triangle mesh.
+	The mesh sign comes from the face normal of the closest triangle,
+	so meshes are expected to be closed and consistently wound
+*/
+__kernel void bakeDistance(__global float *dist, uint resolution, collision_params grid,
+	__global const collider *colliders, uint colliderCount, __global const float *triangles, uint triangleCount) {
+	uint id = get_global_id(0);
+	uint x = id % resolution;
+	uint y = (id / resolution) % resolution;
+	uint z = id / (resolution * resolution);
+
+	float cell = grid.size / (float)resolution;
+	float3 p = toFloat3(grid.grid_min) + ((float3)(x, y, z) + 0.5f) * cell;
+
+	float d = MAXFLOAT;
+	for (uint i = 0; i < colliderCount; ++i)
+		d = fmin(d, colliderDistance(p, colliders[i]));
+
+	float best = MAXFLOAT;
+	float sign = 1.0f;
+	for (uint i = 0; i < triangleCount; ++i) {
+		__global const float *t = triangles + i * 9;
+		float3 a = (float3)(t[0], t[1], t[2]);
+		float3 b = (float3)(t[3], t[4], t[5]);
+		float3 c = (float3)(t[6], t[7], t[8]);
+		float3 delta = p - closestOnTriangle(p, a, b, c);
+		float d2 = dot(delta, delta);
+		if (d2 < best) {
+			best = d2;
+			sign = dot(delta, cross(b - a, c - a)) < 0.0f ? -1.0f : 1.0f;
+		}
+	}
+	if (triangleCount > 0u)
+		d = fmin(d, sign * sqrt(best));
+
+	dist[id] = d;
+}
+
+/*
+	Packs the outward normal (central differences of the distance grid)
+	with the distance into half4 texels: one fetch answers a collision test
+*/
+__kernel void bakeNormals(__global const float *dist, __global half *sdf, uint resolution) {
+	uint id = get_global_id(0);
+	int res = (int)resolution;
+	int x = id % resolution;
+	int y = (id / resolution) % resolution;
+	int z = id / (resolution * resolution);
+
+	#define DIST(i, j, k) dist[((uint)clamp(k, 0, res - 1) * resolution + (uint)clamp(j, 0, res - 1)) * resolution + (uint)clamp(i, 0, res - 1)]
+	float3 gradient = (float3)(
+		DIST(x + 1, y, z) - DIST(x - 1, y, z),
+		DIST(x, y + 1, z) - DIST(x, y - 1, z),
+		DIST(x, y, z + 1) - DIST(x, y, z - 1));
+	#undef DIST
+
+	float len = length(gradient);
+	float3 normal = len > 1e-6f ? gradient / len : (float3)(0.0f, 1.0f, 0.0f);
+	vstore_half4((float4)(normal, dist[id]), id, sdf);
+}
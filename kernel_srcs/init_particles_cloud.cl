@@ -0,0 +1,70 @@
+typedef struct {
+	float x, y, z;
+} vec3;
+
+typedef struct {
+	float r, g, b;
+} color;
+
+typedef struct {
+	vec3 pos;
+	vec3 velocity;
+	color color;
+	vec3 pos_prev;
+	float life;
+	float max_life;
+	uint seed;
+	uint trail_birth;
+} particle;
+
+// Byte layout of one point record of the file, x, y and z are little endian float32
+typedef struct {
+	uint stride;
+	uint x;
+	uint y;
+	uint z;
+} cloud_layout;
+
+/*
+	Records are not always 4 byte aligned (a PLY vertex with uchar colors is 15 bytes),
+	the floats are assembled from their bytes
+*/
+float readFloat(__global const uchar *record)
+{
+	return as_float((uchar4)(record[0], record[1], record[2], record[3]));
+}
+
+/*
+	Particle id takes point id * pointCount / totalCount: every point once when the counts match,
+	evenly spaced points when there are fewer particles, repeated points when there are more.
+	points holds the uploaded records from firstPoint on
+*/
+__kernel void init_particles_cloud(__global particle* particles, __global const uchar *points, uint chunkOffset, uint totalCount,
+	cloud_layout layout, ulong pointCount, ulong firstPoint, uint trailClock) {
+	// Index in the chunk for the writes, index in the whole system for the resampling
+	int slot = get_global_id(0);
+	int id = chunkOffset + slot;
+
+	ulong point = (ulong)id * pointCount / totalCount;
+	__global const uchar *record = points + (point - firstPoint) * layout.stride;
+
+	particles[slot].pos.x = readFloat(record + layout.x);
+	particles[slot].pos.y = readFloat(record + layout.y);
+	particles[slot].pos.z = readFloat(record + layout.z);
+	particles[slot].pos_prev = particles[slot].pos;
+
+	// Initialize velocity to zero
+	particles[slot].velocity.x = 0.0f;
+	particles[slot].velocity.y = 0.0f;
+	particles[slot].velocity.z = 0.0f;
+
+	// Initialize particle color (white by default)
+	particles[slot].color.r = 1.0f;
+	particles[slot].color.g = 1.0f;
+	particles[slot].color.b = 1.0f;
+
+	particles[slot].trail_birth = trailClock;
+	particles[slot].life = 0.0f;
+	particles[slot].max_life = 0.0f;
+	particles[slot].seed = (uint)(id * 747796405u + 2891336453u);
+}
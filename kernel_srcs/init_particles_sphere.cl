@@ -1,5 +1,3 @@
-#define TRAIL_SAMPLES 16
-
 typedef struct {
 	float x, y, z;
 } vec3;
@@ -13,12 +11,10 @@ typedef struct {
 	vec3 velocity;
 	color color;
 	vec3 pos_prev;
-	vec3 trail[TRAIL_SAMPLES];
-	float trail_timer;
-	float trail_head;
 	float life;
 	float max_life;
 	uint seed;
+	uint trail_birth;
 } particle;
 
 float fract(float value) {
@@ -29,8 +25,10 @@ float get_random(int seed) {
 	return fract(sin(seed * 12345.6789f) * 98765.4321f);
 }
 
-__kernel void init_particles_sphere(__global particle* particles, float radius) {
-	int id = get_global_id(0);
+__kernel void init_particles_sphere(__global particle* particles, float radius, uint chunkOffset, uint totalCount, uint trailClock) {
+	// Index in the chunk for the writes, index in the whole system for the randoms
+	int slot = get_global_id(0);
+	int id = chunkOffset + slot;
 
 	// Get random spherical coordinates
 	float theta = acos(2.0f * get_random(id) - 1.0f);  // Latitude (0 to pi)
@@ -38,27 +36,23 @@ __kernel void init_particles_sphere(__global particle* particles, float radius)
 	float r = (float)cbrt(get_random(id + 2)) * radius;  // Radial distance (0 to radius)
 
 	// Convert spherical coordinates to Cartesian coordinates
-	particles[id].pos.x = r * sin(theta) * cos(phi);
-	particles[id].pos.y = r * cos(theta);
-	particles[id].pos.z = r * sin(theta) * sin(phi);
-	particles[id].pos_prev = particles[id].pos;
+	particles[slot].pos.x = r * sin(theta) * cos(phi);
+	particles[slot].pos.y = r * cos(theta);
+	particles[slot].pos.z = r * sin(theta) * sin(phi);
+	particles[slot].pos_prev = particles[slot].pos;
 
 	// Initialize velocity to zero
-	particles[id].velocity.x = 0.0f;
-	particles[id].velocity.y = 0.0f;
-	particles[id].velocity.z = 0.0f;
+	particles[slot].velocity.x = 0.0f;
+	particles[slot].velocity.y = 0.0f;
+	particles[slot].velocity.z = 0.0f;
 
 	// Initialize particle color (white by default)
-	particles[id].color.r = 1.0f;
-	particles[id].color.g = 1.0f;
-	particles[id].color.b = 1.0f;
-
-	for (int i = 0; i < TRAIL_SAMPLES; ++i) {
-		particles[id].trail[i] = particles[id].pos;
-	}
-	particles[id].trail_timer = 0.0f;
-	particles[id].trail_head = 0.0f;
-	particles[id].life = 0.0f;
-	particles[id].max_life = 0.0f;
-	particles[id].seed = (uint)(id * 747796405u + 2891336453u);
+	particles[slot].color.r = 1.0f;
+	particles[slot].color.g = 1.0f;
+	particles[slot].color.b = 1.0f;
+
+	particles[slot].trail_birth = trailClock;
+	particles[slot].life = 0.0f;
+	particles[slot].max_life = 0.0f;
+	particles[slot].seed = (uint)(id * 747796405u + 2891336453u);
 }
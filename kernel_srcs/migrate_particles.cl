@@ -0,0 +1,58 @@
+typedef struct {
+	float x, y, z;
+} vec3;
+
+typedef struct {
+	float r, g, b;
+} color;
+
+typedef struct {
+	vec3 pos;
+	vec3 velocity;
+	color color;
+	vec3 pos_prev;
+	float life;
+	float max_life;
+	uint seed;
+	uint trail_birth;
+} particle;
+
+/*
+	Per chunk: every particle outside the worker's slab [slabLow, slabHigh) on x is appended
+	to the emigrant list, its index in the whole system and a copy of its state.
+	The count goes past capacity when the list is full, the host grows the list and runs it again
+*/
+__kernel void findEmigrants(__global const particle *particles, uint chunkOffset, float slabLow, float slabHigh,
+	__global uint *emigrantCount, __global uint *emigrantIndex, __global particle *emigrants, uint capacity) {
+	uint id = get_global_id(0);
+	float x = particles[id].pos.x;
+	if (x >= slabLow && x < slabHigh)
+		return;
+	uint slot = atomic_inc(emigrantCount);
+	if (slot >= capacity)
+		return;
+	emigrantIndex[slot] = chunkOffset + id;
+	emigrants[slot] = particles[id];
+}
+
+/*
+	Per chunk: fills the holes the emigrants left below the new end of the range with the particles
+	staying in its tail, staged in order in the emigrant buffer.
+	A move is the hole's index in the system and the staging slot it is filled from
+*/
+__kernel void fillHoles(__global particle *particles, uint chunkOffset, __global const uint2 *moves, uint firstMove,
+	__global const particle *staging) {
+	uint2 move = moves[firstMove + get_global_id(0)];
+	particles[move.x - chunkOffset] = staging[move.y];
+}
+
+/*
+	Per chunk: copies every count / sampleCount-th particle into the view sample sent to rank 0,
+	the host gives the first sample landing in this chunk
+*/
+__kernel void sampleParticles(__global const particle *particles, uint chunkOffset, uint count, uint sampleCount,
+	uint firstSample, __global particle *samples) {
+	uint sample = firstSample + get_global_id(0);
+	uint source = (uint)(((ulong)sample * count) / sampleCount);
+	samples[sample] = particles[source - chunkOffset];
+}
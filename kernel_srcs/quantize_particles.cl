@@ -0,0 +1,33 @@
+typedef struct {
+	float x, y, z;
+} vec3;
+
+typedef struct {
+	float r, g, b;
+} color;
+
+typedef struct {
+	vec3 pos;
+	vec3 velocity;
+	color color;
+	vec3 pos_prev;
+	float life;
+	float max_life;
+	uint seed;
+	uint trail_birth;
+} particle;
+
+/*
+	Per chunk: the 8 bytes a remote viewer gets of a particle, its position on 16 bits per axis
+	over the cube of side extent centred on the origin (outside it clamps to the faces)
+	and its color as RGB565
+*/
+__kernel void quantizeParticles(__global const particle *particles, uint chunkOffset, float extent,
+	__global ushort4 *quantized) {
+	uint id = get_global_id(0);
+	particle p = particles[id];
+	float3 pos = ((float3)(p.pos.x, p.pos.y, p.pos.z) / extent + 0.5f) * 65535.0f;
+	float3 c = clamp((float3)(p.color.r, p.color.g, p.color.b), 0.0f, 1.0f) * (float3)(31.0f, 63.0f, 31.0f);
+	uint3 rgb = convert_uint3_rte(c);
+	quantized[chunkOffset + id] = (ushort4)(convert_ushort3_sat_rte(pos), (ushort)((rgb.x << 11) | (rgb.y << 5) | rgb.z));
+}
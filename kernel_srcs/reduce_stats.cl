@@ -0,0 +1,185 @@
+#define STATS_GROUP_SIZE 256
+
+typedef struct {
+	float x, y, z;
+} vec3;
+
+typedef struct {
+	float r, g, b;
+} color;
+
+typedef struct {
+	vec3 pos;
+	vec3 velocity;
+	color color;
+	vec3 pos_prev;
+	float life;
+	float max_life;
+	uint seed;
+	uint trail_birth;
+} particle;
+
+typedef struct {
+	vec3 position;
+	vec3 rotationTangent;
+	float intensity;
+	float radius;
+} mass;
+
+typedef struct {
+	vec3 position;
+	float spawn_radius;
+	float push_intensity;
+	float push_radius;
+	float spawn_speed;
+	float life_min;
+	float life_max;
+	uint enabled;
+} emitter;
+
+typedef struct {
+	mass m;
+	emitter e;
+	uint emitter_start;
+} member_params;
+
+// Sum xyz of the positions in sum.xyz and the kinetic energy in sum.w
+typedef struct {
+	float4 min;
+	float4 max;
+	float4 sum;
+	float max_speed;
+	uint inside;
+	uint live;
+	uint count;
+} stats_record;
+
+/*
+	Tree reduction of the work-group slots into slot 0
+*/
+void reduceGroup(__local stats_record *scratch, uint lid)
+{
+	for (uint stride = STATS_GROUP_SIZE / 2; stride > 0; stride >>= 1) {
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid < stride) {
+			__local stats_record *a = &scratch[lid];
+			__local stats_record *b = &scratch[lid + stride];
+			a->min = fmin(a->min, b->min);
+			a->max = fmax(a->max, b->max);
+			a->sum += b->sum;
+			a->max_speed = fmax(a->max_speed, b->max_speed);
+			a->inside += b->inside;
+			a->live += b->live;
+			a->count += b->count;
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+stats_record emptyRecord()
+{
+	stats_record r;
+	r.min = (float4)(MAXFLOAT);
+	r.max = (float4)(-MAXFLOAT);
+	r.sum = (float4)(0.0f);
+	r.max_speed = 0.0f;
+	r.inside = 0u;
+	r.live = 0u;
+	r.count = 0u;
+	return r;
+}
+
+/*
+	Record of a single particle, emitted when it belongs to the emitter (live while its life lasts)
+*/
+stats_record particleRecord(__global const particle *p, mass m, int emitted)
+{
+	float3 pos = (float3)(p->pos.x, p->pos.y, p->pos.z);
+	float3 v = (float3)(p->velocity.x, p->velocity.y, p->velocity.z);
+	float speed2 = dot(v, v);
+	float3 toMass = pos - (float3)(m.position.x, m.position.y, m.position.z);
+
+	stats_record r;
+	r.min = (float4)(pos, 0.0f);
+	r.max = (float4)(pos, 0.0f);
+	r.sum = (float4)(pos, 0.5f * speed2);
+	r.max_speed = sqrt(speed2);
+	r.inside = dot(toMass, toMass) <= m.radius * m.radius ? 1u : 0u;
+	r.live = (emitted && p->life > 0.0f) ? 1u : 0u;
+	r.count = 1u;
+	return r;
+}
+
+void mergeRecord(stats_record *a, stats_record b)
+{
+	a->min = fmin(a->min, b.min);
+	a->max = fmax(a->max, b.max);
+	a->sum += b.sum;
+	a->max_speed = fmax(a->max_speed, b.max_speed);
+	a->inside += b.inside;
+	a->live += b.live;
+	a->count += b.count;
+}
+
+/*
+	First pass, one record per work-group of the chunk written at partials[groupOffset + group].
+	Particles from emitterStart on belong to the emitter and are live while their life lasts
+*/
+__kernel __attribute__((reqd_work_group_size(STATS_GROUP_SIZE, 1, 1)))
+void reduceStats(__global const particle *particles, uint count, mass m, uint emitterStart,
+	__global stats_record *partials, uint groupOffset) {
+	__local stats_record scratch[STATS_GROUP_SIZE];
+	uint id = get_global_id(0);
+	uint lid = get_local_id(0);
+
+	stats_record r = emptyRecord();
+	if (id < count)
+		r = particleRecord(&particles[id], m, id >= emitterStart);
+	scratch[lid] = r;
+	reduceGroup(scratch, lid);
+
+	if (lid == 0)
+		partials[groupOffset + get_group_id(0)] = scratch[0];
+}
+
+/*
+	Second pass in a single work-group, folds every partial record into result[0]
+*/
+__kernel __attribute__((reqd_work_group_size(STATS_GROUP_SIZE, 1, 1)))
+void combineStats(__global const stats_record *partials, uint partialCount, __global stats_record *result) {
+	__local stats_record scratch[STATS_GROUP_SIZE];
+	uint lid = get_local_id(0);
+
+	stats_record r = emptyRecord();
+	for (uint i = lid; i < partialCount; i += STATS_GROUP_SIZE)
+		mergeRecord(&r, partials[i]);
+	scratch[lid] = r;
+	reduceGroup(scratch, lid);
+
+	if (lid == 0)
+		result[0] = scratch[0];
+}
+
+/*
+	Ensemble statistics in one pass, work-group g folds every particle of member firstMember + g
+	into result[g]. The mass and emitter come from the same blocks as the update
+*/
+__kernel __attribute__((reqd_work_group_size(STATS_GROUP_SIZE, 1, 1)))
+void reduceMembers(__global const particle *particles, uint memberSize, __global const member_params *members,
+	uint firstMember, __global stats_record *result) {
+	__local stats_record scratch[STATS_GROUP_SIZE];
+	uint lid = get_local_id(0);
+	uint member = firstMember + get_group_id(0);
+	member_params p = members[member];
+	__global const particle *base = particles + (size_t)member * memberSize;
+	uint emitterStart = p.e.enabled != 0u ? p.emitter_start : memberSize;
+
+	stats_record r = emptyRecord();
+	for (uint i = lid; i < memberSize; i += STATS_GROUP_SIZE)
+		mergeRecord(&r, particleRecord(&base[i], p.m, i >= emitterStart));
+	scratch[lid] = r;
+	reduceGroup(scratch, lid);
+
+	if (lid == 0)
+		result[get_group_id(0)] = scratch[0];
+}
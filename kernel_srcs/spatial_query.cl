@@ -0,0 +1,198 @@
+#define QUERY_SCAN_GROUP_SIZE 256
+
+typedef struct {
+	float x, y, z;
+} vec3;
+
+typedef struct {
+	float r, g, b;
+} color;
+
+typedef struct {
+	vec3 pos;
+	vec3 velocity;
+	color color;
+	vec3 pos_prev;
+	float life;
+	float max_life;
+	uint seed;
+	uint trail_birth;
+} particle;
+
+// Uniform grid over the particle bounding box, cubic cells
+typedef struct {
+	vec3 grid_min;
+	float cell_size;
+	uint resolution;
+	uint count;
+} query_grid;
+
+/*
+	Cell of a position, clamped: particles outside the grid land in the border cells
+*/
+int3 cellCoords(float3 p, query_grid grid)
+{
+	float3 rel = (p - (float3)(grid.grid_min.x, grid.grid_min.y, grid.grid_min.z)) / grid.cell_size;
+	int res = (int)grid.resolution;
+	// Clamped as floats first, far outliers would overflow the conversion
+	rel = clamp(rel, (float3)(-1.0f), (float3)((float)res));
+	return clamp(convert_int3_rtn(rel), (int3)(0), (int3)(res - 1));
+}
+
+uint cellIndex(int3 c, uint resolution)
+{
+	return ((uint)c.z * resolution + (uint)c.y) * resolution + (uint)c.x;
+}
+
+/*
+	Build step 1, per chunk: counts the particles of every cell, remembers each particle's cell
+	and copies its position, the rest of the build no longer reads the shared chunks
+*/
+__kernel void countCells(__global const particle *particles, uint chunkOffset, query_grid grid,
+	__global uint *cellCounts, __global uint *particleCells, __global float4 *particlePos) {
+	uint id = get_global_id(0);
+	float3 p = (float3)(particles[id].pos.x, particles[id].pos.y, particles[id].pos.z);
+	uint cell = cellIndex(cellCoords(p, grid), grid.resolution);
+
+	particleCells[chunkOffset + id] = cell;
+	particlePos[chunkOffset + id] = (float4)(p, 0.0f);
+	atomic_inc(&cellCounts[cell]);
+}
+
+/*
+	Build step 2, one work-group: exclusive prefix sum of the counts into cellStarts
+	(cellCount + 1 entries) and a copy in cellCursor for the scatter.
+	Every work-item scans a contiguous run of cells, the run totals are scanned in local memory
+*/
+__kernel __attribute__((reqd_work_group_size(QUERY_SCAN_GROUP_SIZE, 1, 1)))
+void scanCells(__global const uint *cellCounts, __global uint *cellStarts, __global uint *cellCursor, uint cellCount) {
+	__local uint totals[QUERY_SCAN_GROUP_SIZE];
+	uint lid = get_local_id(0);
+	uint run = (cellCount + QUERY_SCAN_GROUP_SIZE - 1) / QUERY_SCAN_GROUP_SIZE;
+	uint begin = min(lid * run, cellCount);
+	uint end = min(begin + run, cellCount);
+
+	uint sum = 0;
+	for (uint i = begin; i < end; ++i)
+		sum += cellCounts[i];
+	totals[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// 256 values, a serial scan is cheaper than the barriers of a tree
+	if (lid == 0) {
+		uint acc = 0;
+		for (uint i = 0; i < QUERY_SCAN_GROUP_SIZE; ++i) {
+			uint t = totals[i];
+			totals[i] = acc;
+			acc += t;
+		}
+		cellStarts[cellCount] = acc;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	uint acc = totals[lid];
+	for (uint i = begin; i < end; ++i) {
+		cellStarts[i] = acc;
+		cellCursor[i] = acc;
+		acc += cellCounts[i];
+	}
+}
+
+/*
+	Build step 3, every particle at once: writes its index and position in its cell's slice.
+	The order inside a cell is whatever the atomics give
+*/
+__kernel void scatterParticles(__global const uint *particleCells, __global const float4 *particlePos,
+	__global uint *cellCursor, __global uint *sortedIndex, __global float4 *sortedPos) {
+	uint id = get_global_id(0);
+	uint slot = atomic_inc(&cellCursor[particleCells[id]]);
+
+	sortedIndex[slot] = id;
+	sortedPos[slot] = particlePos[id];
+}
+
+/*
+	Appends a match to the compact result list: results[0] is the match count,
+	the indices follow. Matches past maxResults are counted but not written
+*/
+void appendResult(__global uint *results, uint maxResults, uint index)
+{
+	uint slot = atomic_inc(&results[0]);
+	if (slot < maxResults)
+		results[1 + slot] = index;
+}
+
+/*
+	One work-item per cell of the box [cellMin, cellMin + global size) around the sphere center.xyz, radius center.w
+*/
+__kernel void queryRadius(__global const uint *cellStarts, __global const uint *sortedIndex, __global const float4 *sortedPos,
+	query_grid grid, int4 cellMin, __global uint *results, uint maxResults, float4 center) {
+	int3 c = cellMin.xyz + (int3)(get_global_id(0), get_global_id(1), get_global_id(2));
+	uint cell = cellIndex(c, grid.resolution);
+	float r2 = center.w * center.w;
+
+	for (uint i = cellStarts[cell]; i < cellStarts[cell + 1]; ++i) {
+		float3 d = sortedPos[i].xyz - center.xyz;
+		if (dot(d, d) <= r2)
+			appendResult(results, maxResults, sortedIndex[i]);
+	}
+}
+
+/*
+	Same cell walk for an axis aligned box
+*/
+__kernel void queryBox(__global const uint *cellStarts, __global const uint *sortedIndex, __global const float4 *sortedPos,
+	query_grid grid, int4 cellMin, __global uint *results, uint maxResults, float4 boxMin, float4 boxMax) {
+	int3 c = cellMin.xyz + (int3)(get_global_id(0), get_global_id(1), get_global_id(2));
+	uint cell = cellIndex(c, grid.resolution);
+
+	for (uint i = cellStarts[cell]; i < cellStarts[cell + 1]; ++i) {
+		float3 p = sortedPos[i].xyz;
+		if (all(p >= boxMin.xyz) && all(p <= boxMax.xyz))
+			appendResult(results, maxResults, sortedIndex[i]);
+	}
+}
+
+/*
+	Nearest particle along a pick cone: a particle hits when its distance to the ray
+	is under direction.w times its depth along it. One work-item per grid cell,
+	cells whose bounding sphere misses the cone are skipped (not the border ones, they are unbounded).
+	Pass 0 keeps the smallest depth in best[0] (positive floats order like their bits),
+	pass 1 keeps the smallest sorted slot at that depth in best[1]
+*/
+__kernel void queryRay(__global const uint *cellStarts, __global const float4 *sortedPos, query_grid grid,
+	float4 origin, float4 direction, uint pass, __global uint *best) {
+	uint cell = get_global_id(0);
+	uint res = grid.resolution;
+	uint begin = cellStarts[cell];
+	uint end = cellStarts[cell + 1];
+	if (begin == end)
+		return;
+
+	uint3 c = (uint3)(cell % res, (cell / res) % res, cell / (res * res));
+	bool border = any(c == (uint3)(0)) || any(c == (uint3)(res - 1));
+	float slope = direction.w;
+	if (!border) {
+		float3 cellCenter = (float3)(grid.grid_min.x, grid.grid_min.y, grid.grid_min.z) + (convert_float3(c) + 0.5f) * grid.cell_size;
+		float halfDiagonal = 0.8660254f * grid.cell_size;
+		float3 v = cellCenter - origin.xyz;
+		float t = dot(v, direction.xyz);
+		float away = sqrt(max(dot(v, v) - t * t, 0.0f));
+		if (t + halfDiagonal < 0.0f || away - halfDiagonal > slope * (t + halfDiagonal))
+			return;
+	}
+
+	for (uint i = begin; i < end; ++i) {
+		float3 v = sortedPos[i].xyz - origin.xyz;
+		float t = dot(v, direction.xyz);
+		if (t <= 0.0f)
+			continue;
+		float allowed = slope * t;
+		if (dot(v, v) - t * t > allowed * allowed)
+			continue;
+		if (pass == 0u)
+			atomic_min(&best[0], as_uint(t));
+		else if (as_uint(t) == best[0])
+			atomic_min(&best[1], i);
+	}
+}
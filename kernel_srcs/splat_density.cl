@@ -0,0 +1,94 @@
+#define LOD_COARSE_FACTOR 8
+
+typedef struct {
+	float x, y, z;
+} vec3;
+
+typedef struct {
+	float r, g, b;
+} color;
+
+typedef struct {
+	vec3 pos;
+	vec3 velocity;
+	color color;
+	vec3 pos_prev;
+	float life;
+	float max_life;
+	uint seed;
+	uint trail_birth;
+} particle;
+
+typedef struct {
+	vec3 eye;
+	vec3 grid_min;
+	float cell_size;
+	float distance;
+	float density_scale;
+	uint resolution;
+} lod_params;
+
+/*
+	Accumulates every particle further than lod.distance from the eye
+	into its grid cell: particle count followed by the summed 8 bits colors
+*/
+__kernel void splatDensity(__global const particle *particles, __global uint *accum, lod_params lod) {
+	int id = get_global_id(0);
+	vec3 p = particles[id].pos;
+
+	float dx = p.x - lod.eye.x;
+	float dy = p.y - lod.eye.y;
+	float dz = p.z - lod.eye.z;
+	if (dx * dx + dy * dy + dz * dz <= lod.distance * lod.distance)
+		return;
+
+	float invCell = 1.0f / lod.cell_size;
+	int cx = (int)floor((p.x - lod.grid_min.x) * invCell);
+	int cy = (int)floor((p.y - lod.grid_min.y) * invCell);
+	int cz = (int)floor((p.z - lod.grid_min.z) * invCell);
+	int res = (int)lod.resolution;
+	if (cx < 0 || cy < 0 || cz < 0 || cx >= res || cy >= res || cz >= res)
+		return;
+
+	__global uint *cell = accum + (((uint)cz * lod.resolution + (uint)cy) * lod.resolution + (uint)cx) * 4;
+	atomic_inc(&cell[0]);
+	atomic_add(&cell[1], (uint)(clamp(particles[id].color.r, 0.0f, 1.0f) * 255.0f));
+	atomic_add(&cell[2], (uint)(clamp(particles[id].color.g, 0.0f, 1.0f) * 255.0f));
+	atomic_add(&cell[3], (uint)(clamp(particles[id].color.b, 0.0f, 1.0f) * 255.0f));
+}
+
+/*
+	Turns the accumulated cells into averaged color + opacity texels,
+	flags non empty coarse cells for empty space skipping
+	and clears the accumulators for the next frame
+*/
+__kernel void resolveDensity(__global uint *accum, __global half *volume, __global uchar *coarse, lod_params lod) {
+	uint cell = get_global_id(0);
+	uint count = accum[cell * 4];
+
+	if (count == 0u) {
+		vstore_half4((float4)(0.0f), cell, volume);
+		return;
+	}
+
+	float inv = 1.0f / ((float)count * 255.0f);
+	float4 texel = (float4)(
+		accum[cell * 4 + 1] * inv,
+		accum[cell * 4 + 2] * inv,
+		accum[cell * 4 + 3] * inv,
+		1.0f - exp(-(float)count * lod.density_scale));
+	vstore_half4(texel, cell, volume);
+
+	accum[cell * 4] = 0u;
+	accum[cell * 4 + 1] = 0u;
+	accum[cell * 4 + 2] = 0u;
+	accum[cell * 4 + 3] = 0u;
+
+	uint res = lod.resolution;
+	uint coarseRes = res / LOD_COARSE_FACTOR;
+	uint x = (cell % res) / LOD_COARSE_FACTOR;
+	uint y = ((cell / res) % res) / LOD_COARSE_FACTOR;
+	uint z = (cell / (res * res)) / LOD_COARSE_FACTOR;
+	// Every writer stores the same value so the race is harmless
+	coarse[(z * coarseRes + y) * coarseRes + x] = 1;
+}
@@ -0,0 +1,168 @@
+#define SPLAT_TILE_SIZE 16
+#define SPLAT_TILE_PIXELS (SPLAT_TILE_SIZE * SPLAT_TILE_SIZE)
+#define SPLAT_SCAN_GROUP_SIZE 256
+#define SPLAT_CULLED 0xffffffffu
+
+typedef struct {
+	float x, y, z;
+} vec3;
+
+typedef struct {
+	float r, g, b;
+} color;
+
+typedef struct {
+	vec3 pos;
+	vec3 velocity;
+	color color;
+	vec3 pos_prev;
+	float life;
+	float max_life;
+	uint seed;
+	uint trail_birth;
+} particle;
+
+// Camera and frame of one splat, the matrix is column major as glm stores it
+typedef struct {
+	float view_proj[16];
+	uint width;
+	uint height;
+	uint tiles_x;
+	float alpha;
+} splat_params;
+
+/*
+	Step 1, per chunk: projects every particle at the interpolated position like particle.vert,
+	counts it in its screen tile and keeps its tile and fragment for the scatter.
+	A fragment is the pixel in the tile (low 8 bits) under the 24 bits depth, then the RGBA8 color
+*/
+__kernel void binPoints(__global const particle *particles, uint chunkOffset, splat_params s,
+	__global uint *tileCounts, __global uint *pointTiles, __global uint2 *pointFragments) {
+	uint id = get_global_id(0);
+	uint slot = chunkOffset + id;
+
+	vec3 prev = particles[id].pos_prev;
+	vec3 curr = particles[id].pos;
+	float3 p = mix((float3)(prev.x, prev.y, prev.z), (float3)(curr.x, curr.y, curr.z), s.alpha);
+	const float *m = s.view_proj;
+	float4 clip = (float4)(
+		m[0] * p.x + m[4] * p.y + m[8] * p.z + m[12],
+		m[1] * p.x + m[5] * p.y + m[9] * p.z + m[13],
+		m[2] * p.x + m[6] * p.y + m[10] * p.z + m[14],
+		m[3] * p.x + m[7] * p.y + m[11] * p.z + m[15]);
+
+	// Behind the camera or outside the frustum
+	if (clip.w <= 0.0f || fabs(clip.x) > clip.w || fabs(clip.y) > clip.w || fabs(clip.z) > clip.w) {
+		pointTiles[slot] = SPLAT_CULLED;
+		return;
+	}
+
+	// Row 0 at the bottom, as the GL texture is sampled
+	float3 ndc = clip.xyz / clip.w;
+	uint x = min((uint)((ndc.x * 0.5f + 0.5f) * s.width), s.width - 1);
+	uint y = min((uint)((ndc.y * 0.5f + 0.5f) * s.height), s.height - 1);
+	uint depth = (uint)((ndc.z * 0.5f + 0.5f) * 16777215.0f);
+	uint tile = (y / SPLAT_TILE_SIZE) * s.tiles_x + x / SPLAT_TILE_SIZE;
+	uint pixel = (y % SPLAT_TILE_SIZE) * SPLAT_TILE_SIZE + x % SPLAT_TILE_SIZE;
+
+	color c = particles[id].color;
+	uint rgba = (uint)(clamp(c.r, 0.0f, 1.0f) * 255.0f)
+		| (uint)(clamp(c.g, 0.0f, 1.0f) * 255.0f) << 8
+		| (uint)(clamp(c.b, 0.0f, 1.0f) * 255.0f) << 16
+		| 0xff000000u;
+
+	pointTiles[slot] = tile;
+	pointFragments[slot] = (uint2)((depth << 8) | pixel, rgba);
+	atomic_inc(&tileCounts[tile]);
+}
+
+/*
+	Step 2, one work-group: exclusive prefix sum of the tile counts into tileStarts
+	(tileCount + 1 entries) and a copy in tileCursor for the scatter, same scheme as scanCells
+*/
+__kernel __attribute__((reqd_work_group_size(SPLAT_SCAN_GROUP_SIZE, 1, 1)))
+void scanTiles(__global const uint *tileCounts, __global uint *tileStarts, __global uint *tileCursor, uint tileCount) {
+	__local uint totals[SPLAT_SCAN_GROUP_SIZE];
+	uint lid = get_local_id(0);
+	uint run = (tileCount + SPLAT_SCAN_GROUP_SIZE - 1) / SPLAT_SCAN_GROUP_SIZE;
+	uint begin = min(lid * run, tileCount);
+	uint end = min(begin + run, tileCount);
+
+	uint sum = 0;
+	for (uint i = begin; i < end; ++i)
+		sum += tileCounts[i];
+	totals[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (lid == 0) {
+		uint acc = 0;
+		for (uint i = 0; i < SPLAT_SCAN_GROUP_SIZE; ++i) {
+			uint t = totals[i];
+			totals[i] = acc;
+			acc += t;
+		}
+		tileStarts[tileCount] = acc;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	uint acc = totals[lid];
+	for (uint i = begin; i < end; ++i) {
+		tileStarts[i] = acc;
+		tileCursor[i] = acc;
+		acc += tileCounts[i];
+	}
+}
+
+/*
+	Step 3, every particle at once: moves the visible fragments into their tile's slice
+*/
+__kernel void scatterPoints(__global const uint *pointTiles, __global const uint2 *pointFragments,
+	__global uint *tileCursor, __global uint2 *tileFragments) {
+	uint id = get_global_id(0);
+	uint tile = pointTiles[id];
+	if (tile == SPLAT_CULLED)
+		return;
+	tileFragments[atomic_inc(&tileCursor[tile])] = pointFragments[id];
+}
+
+/*
+	Step 4, one work-group per tile, one work-item per pixel: the nearest depth of every pixel
+	is found with local atomics, then a fragment holding it writes its color.
+	Every pixel of the frame is written, empty ones with alpha 0, so no clear is needed
+*/
+__kernel __attribute__((reqd_work_group_size(SPLAT_TILE_PIXELS, 1, 1)))
+void rasterTiles(__global const uint *tileStarts, __global const uint2 *tileFragments, splat_params s,
+	__write_only image2d_t frame) {
+	__local uint depth[SPLAT_TILE_PIXELS];
+	__local uint rgba[SPLAT_TILE_PIXELS];
+	uint tile = get_group_id(0);
+	uint lid = get_local_id(0);
+	uint begin = tileStarts[tile];
+	uint end = tileStarts[tile + 1];
+
+	depth[lid] = 0xffffffffu;
+	rgba[lid] = 0u;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint i = begin + lid; i < end; i += SPLAT_TILE_PIXELS) {
+		uint key = tileFragments[i].x;
+		atomic_min(&depth[key & 0xffu], key >> 8);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// Fragments tied at the nearest depth race, any of them is a valid result
+	for (uint i = begin + lid; i < end; i += SPLAT_TILE_PIXELS) {
+		uint2 fragment = tileFragments[i];
+		if (depth[fragment.x & 0xffu] == fragment.x >> 8)
+			rgba[fragment.x & 0xffu] = fragment.y;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	uint x = (tile % s.tiles_x) * SPLAT_TILE_SIZE + lid % SPLAT_TILE_SIZE;
+	uint y = (tile / s.tiles_x) * SPLAT_TILE_SIZE + lid / SPLAT_TILE_SIZE;
+	if (x >= s.width || y >= s.height)
+		return;
+	uint c = rgba[lid];
+	float4 texel = (float4)(c & 0xffu, (c >> 8) & 0xffu, (c >> 16) & 0xffu, c >> 24) / 255.0f;
+	write_imagef(frame, (int2)((int)x, (int)y), texel);
+}
@@ -1,6 +1,3 @@
-#define TRAIL_SAMPLES 16
-#define TRAIL_INTERVAL 0.07f
-
 typedef struct {
 	float x, y, z;
 } vec3;
@@ -14,12 +11,10 @@ typedef struct {
 	vec3 velocity;
 	color color;
 	vec3 pos_prev;
-	vec3 trail[TRAIL_SAMPLES];
-	float trail_timer;
-	float trail_head;
 	float life;
 	float max_life;
 	uint seed;
+	uint trail_birth;	// trail clock at spawn, older history slices are not this particle's
 } particle;
 
 typedef struct {
@@ -40,6 +35,63 @@ typedef struct {
 	uint enabled;
 } emitter;
 
+typedef struct {
+	vec3 origin;
+	float inv_extent;
+	float blend;
+	float strength;
+	uint enabled;
+} field_params;
+
+typedef struct {
+	vec3 grid_min;
+	float size;
+	float restitution;
+	float friction;
+	float margin;
+	uint enabled;
+} collision_params;
+
+// Global trail clock: slice slot of the [samples][stride] history is written this tick when write is set,
+// clock counts the slices written before it
+typedef struct {
+	uint slot;
+	uint stride;
+	uint clock;
+	uint write;
+} trail_params;
+
+// Layout of a particle for the 16 float vector loads of the native profile
+typedef union {
+	particle p;
+	float16 v;
+} particle_bits;
+
+// Build profiles: strict and fast call the builtins (fast relaxes them through its build options),
+// native (-DNATIVE_MATH) maps them to the hardware approximations
+#ifdef NATIVE_MATH
+# define SQRT(x) native_sqrt(x)
+# define EXP(x) native_exp(x)
+# define POW(x, y) native_powr(x, y)
+# define COS(x) native_cos(x)
+# define SIN(x) native_sin(x)
+# define RECIP(x) native_recip(x)
+# define DIVIDE(a, b) native_divide(a, b)
+#else
+# define SQRT(x) sqrt(x)
+# define EXP(x) exp(x)
+# define POW(x, y) pow(x, y)
+# define COS(x) cos(x)
+# define SIN(x) sin(x)
+# define RECIP(x) (1.0f / (x))
+# define DIVIDE(a, b) ((a) / (b))
+#endif
+
+// Hardware trilinear filtering, the field tiles the whole space
+__constant sampler_t fieldSampler = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_REPEAT | CLK_FILTER_LINEAR;
+// The SDF only covers its grid, lookups outside are skipped
+__constant sampler_t sdfSampler = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_LINEAR;
+
 uint lcg(uint *state)
 {
 	*state = (*state * 1664525u) + 1013904223u;
@@ -51,58 +103,86 @@ float rand01(uint *state)
 	return (float)(lcg(state) & 0x00FFFFFFu) / 16777216.0f;
 }
 
-__kernel void updateParticles(__global particle *particles, mass m, emitter e, float deltaTime, uint emitterStart) {
-	int id = get_global_id(0);
+// Species, each a contiguous range of the buffer updated by its own kernel (same order as particle_species)
+#define SPECIES_HEAVY 0
+#define SPECIES_TRACER 1
+#define SPECIES_PASSIVE 2
+#define SPECIES_EMITTER 3
+
+// Heavy particles: the emitter push and the field move them HEAVY_MASS times less, the drag is HEAVY_DRAG of the usual
+#define HEAVY_MASS 4.0f
+#define HEAVY_DRAG 0.25f
+// Tracers follow the field TRACER_FIELD_GAIN times harder and go through the emitter push and the colliders
+#define TRACER_FIELD_GAIN 3.0f
+
+// One ensemble member's settings, its emitter owns the member's particles from emitter_start on
+typedef struct {
+	mass m;
+	emitter e;
+	uint emitter_start;
+} member_params;
+
+/*
+	One tick of particle id under the mass m and the emitter e. Every kernel passes species as a constant,
+	the branches of the other species are compiled out of it
+*/
+void updateParticle(__global particle *particles, int id, const int species, mass m, emitter e, float deltaTime,
+	__read_only image3d_t fieldA, __read_only image3d_t fieldB, field_params f,
+	__read_only image3d_t sdf, collision_params c, __global float *trails, trail_params t) {
 	// Exponential damping scaled by real deltaTime so it remains frame-rate independent.
 	// decayRate is chosen so that exp(-decayRate * (1/60)) ~= 0.995f (old per-frame factor at 60 FPS).
 	const float decayRate = 0.30075f;
 	const float eps = 0.0001f;
 
+#ifdef NATIVE_MATH
+	// The 64 byte record as four aligned float4 loads instead of sixteen scalar ones
+	particle_bits bits;
+	bits.v = vload16(id, (__global const float *)particles);
+	particle p = bits.p;
+#else
+	particle p = particles[id];
+#endif
+
 	// Save the current position as the previous one for trailing
-	particles[id].pos_prev = particles[id].pos;
+	p.pos_prev = p.pos;
 
-	const int isEmitter = (e.enabled != 0u) && id >= (int)emitterStart;
-	if (isEmitter) {
-		particles[id].life -= deltaTime;
-		if (particles[id].life <= 0.0f) {
-			uint seed = particles[id].seed ^ (uint)(id * 747796405u + 2891336453u);
+	if (species == SPECIES_EMITTER) {
+		p.life -= deltaTime;
+		if (p.life <= 0.0f) {
+			uint seed = p.seed ^ (uint)(id * 747796405u + 2891336453u);
 			float u = rand01(&seed);
 			float v = rand01(&seed);
 			float theta = 6.2831853f * u;
 			float z = 1.0f - 2.0f * v;
-			float xy = sqrt(fmax(0.0f, 1.0f - z * z));
-			vec3 dir = {xy * cos(theta), xy * sin(theta), z};
-			float spawnScale = pow(rand01(&seed), 0.3333333f) * e.spawn_radius;
-			particles[id].pos.x = e.position.x + dir.x * spawnScale;
-			particles[id].pos.y = e.position.y + dir.y * spawnScale;
-			particles[id].pos.z = e.position.z + dir.z * spawnScale;
-			particles[id].pos_prev = particles[id].pos;
-
-			particles[id].velocity.x = dir.x * e.spawn_speed;
-			particles[id].velocity.y = dir.y * e.spawn_speed;
-			particles[id].velocity.z = dir.z * e.spawn_speed;
-
-			particles[id].max_life = e.life_min + (e.life_max - e.life_min) * rand01(&seed);
-			particles[id].life = particles[id].max_life;
-
-			for (int i = 0; i < TRAIL_SAMPLES; ++i) {
-				particles[id].trail[i] = particles[id].pos;
-			}
-			particles[id].trail_timer = 0.0f;
-			particles[id].trail_head = 0.0f;
+			float xy = SQRT(fmax(0.0f, 1.0f - z * z));
+			vec3 dir = {xy * COS(theta), xy * SIN(theta), z};
+			float spawnScale = POW(rand01(&seed), 0.3333333f) * e.spawn_radius;
+			p.pos.x = e.position.x + dir.x * spawnScale;
+			p.pos.y = e.position.y + dir.y * spawnScale;
+			p.pos.z = e.position.z + dir.z * spawnScale;
+			p.pos_prev = p.pos;
+
+			p.velocity.x = dir.x * e.spawn_speed;
+			p.velocity.y = dir.y * e.spawn_speed;
+			p.velocity.z = dir.z * e.spawn_speed;
+
+			p.max_life = e.life_min + (e.life_max - e.life_min) * rand01(&seed);
+			p.life = p.max_life;
+
+			p.trail_birth = t.clock;
 
-			particles[id].seed = seed;
+			p.seed = seed;
 		}
 	}
 
 	vec3 direction;
-	direction.x = m.position.x - particles[id].pos.x;
-	direction.y = m.position.y - particles[id].pos.y;
-	direction.z = m.position.z - particles[id].pos.z;
+	direction.x = m.position.x - p.pos.x;
+	direction.y = m.position.y - p.pos.y;
+	direction.z = m.position.z - p.pos.z;
 
 	// Compute distance from the particle to the center of mass
-	float distance = sqrt(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
-	float invDist = 1.0f / fmax(distance, eps);
+	float distance = SQRT(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+	float invDist = RECIP(fmax(distance, eps));
 
 	// Normalize the direction vector
 	vec3 directionNorm;
@@ -113,12 +193,12 @@ __kernel void updateParticles(__global particle *particles, mass m, emitter e, f
 	// If the particle is outside the massRadius, apply gravitational attraction
 	if (distance > m.radius) {
 		// Gravitational force (simplified inverse square law)
-		float gravitationalForce = m.intensity / (distance * distance) * 20.0f;
+		float gravitationalForce = DIVIDE(m.intensity, distance * distance) * 20.0f;
 
 		// Update velocity towards mass center (radial component)
-		particles[id].velocity.x += directionNorm.x * gravitationalForce * deltaTime;
-		particles[id].velocity.y += directionNorm.y * gravitationalForce * deltaTime;
-		particles[id].velocity.z += directionNorm.z * gravitationalForce * deltaTime;
+		p.velocity.x += directionNorm.x * gravitationalForce * deltaTime;
+		p.velocity.y += directionNorm.y * gravitationalForce * deltaTime;
+		p.velocity.z += directionNorm.z * gravitationalForce * deltaTime;
 	}
 	else
 	{
@@ -129,71 +209,181 @@ __kernel void updateParticles(__global particle *particles, mass m, emitter e, f
 		tangentialVelocity.z = directionNorm.x * m.rotationTangent.y - directionNorm.y * m.rotationTangent.x;
 
 		// Scale the tangential velocity by some factor
-		float tangentialForce = m.intensity / fmax(distance, eps);
+		float tangentialForce = DIVIDE(m.intensity, fmax(distance, eps));
 		tangentialVelocity.x *= tangentialForce * deltaTime;
 		tangentialVelocity.y *= tangentialForce * deltaTime;
 		tangentialVelocity.z *= tangentialForce * deltaTime;
 
 		// Apply the tangential velocity
-		particles[id].velocity.x += tangentialVelocity.x * 2.0f;
-		particles[id].velocity.y += tangentialVelocity.y * 2.0f;
-		particles[id].velocity.z += tangentialVelocity.z * 2.0f;
+		p.velocity.x += tangentialVelocity.x * 2.0f;
+		p.velocity.y += tangentialVelocity.y * 2.0f;
+		p.velocity.z += tangentialVelocity.z * 2.0f;
 	}
 
 	// Emitter repulsion (push)
-	if (e.enabled != 0u) {
+	if (e.enabled != 0u && species != SPECIES_TRACER) {
 		vec3 eDir;
-		eDir.x = particles[id].pos.x - e.position.x;
-		eDir.y = particles[id].pos.y - e.position.y;
-		eDir.z = particles[id].pos.z - e.position.z;
-		float eDist = sqrt(eDir.x * eDir.x + eDir.y * eDir.y + eDir.z * eDir.z);
+		eDir.x = p.pos.x - e.position.x;
+		eDir.y = p.pos.y - e.position.y;
+		eDir.z = p.pos.z - e.position.z;
+		float eDist = SQRT(eDir.x * eDir.x + eDir.y * eDir.y + eDir.z * eDir.z);
 		if (eDist > eps && eDist < e.push_radius) {
-			float invEDist = 1.0f / eDist;
-			float repulse = e.push_intensity / (eDist * eDist + 1.0f);
-			particles[id].velocity.x += (eDir.x * invEDist) * repulse * deltaTime;
-			particles[id].velocity.y += (eDir.y * invEDist) * repulse * deltaTime;
-			particles[id].velocity.z += (eDir.z * invEDist) * repulse * deltaTime;
+			float invEDist = RECIP(eDist);
+			float repulse = DIVIDE(e.push_intensity, eDist * eDist + 1.0f);
+			if (species == SPECIES_HEAVY)
+				repulse *= 1.0f / HEAVY_MASS;
+			p.velocity.x += (eDir.x * invEDist) * repulse * deltaTime;
+			p.velocity.y += (eDir.y * invEDist) * repulse * deltaTime;
+			p.velocity.z += (eDir.z * invEDist) * repulse * deltaTime;
 		}
 	}
 
+	// Turbulence from the precomputed force field instead of per particle noise math
+	if (f.enabled != 0u) {
+		float4 coord = (float4)(
+			(p.pos.x - f.origin.x) * f.inv_extent,
+			(p.pos.y - f.origin.y) * f.inv_extent,
+			(p.pos.z - f.origin.z) * f.inv_extent,
+			0.0f);
+		float4 force = read_imagef(fieldA, fieldSampler, coord);
+		// The second fetch only happens while two generated frames are blended
+		if (f.blend > 0.0f)
+			force = mix(force, read_imagef(fieldB, fieldSampler, coord), f.blend);
+		if (species == SPECIES_HEAVY)
+			force *= 1.0f / HEAVY_MASS;
+		else if (species == SPECIES_TRACER)
+			force *= TRACER_FIELD_GAIN;
+		p.velocity.x += force.x * f.strength * deltaTime;
+		p.velocity.y += force.y * f.strength * deltaTime;
+		p.velocity.z += force.z * f.strength * deltaTime;
+	}
+
 	// Slowing down particles so they don't go too far away
-	const float damping = exp(-decayRate * deltaTime);
-	particles[id].velocity.x *= damping;
-	particles[id].velocity.y *= damping;
-	particles[id].velocity.z *= damping;
+	const float drag = species == SPECIES_HEAVY ? decayRate * HEAVY_DRAG : decayRate;
+	const float damping = EXP(-drag * deltaTime);
+	p.velocity.x *= damping;
+	p.velocity.y *= damping;
+	p.velocity.z *= damping;
 
 	// Update the position based on the updated velocity
-	particles[id].pos.x += particles[id].velocity.x * deltaTime;
-	particles[id].pos.y += particles[id].velocity.y * deltaTime;
-	particles[id].pos.z += particles[id].velocity.z * deltaTime;
+	p.pos.x += p.velocity.x * deltaTime;
+	p.pos.y += p.velocity.y * deltaTime;
+	p.pos.z += p.velocity.z * deltaTime;
+
+	// Static collision geometry: a single fetch gives the distance and the outward normal
+	if (c.enabled != 0u && species != SPECIES_TRACER) {
+		float4 uvw = (float4)(
+			(p.pos.x - c.grid_min.x) / c.size,
+			(p.pos.y - c.grid_min.y) / c.size,
+			(p.pos.z - c.grid_min.z) / c.size,
+			0.0f);
+		if (all(uvw.xyz >= 0.0f) && all(uvw.xyz <= 1.0f)) {
+			float4 s = read_imagef(sdf, sdfSampler, uvw);
+			float penetration = c.margin - s.w;
+			if (penetration > 0.0f) {
+				float3 n = normalize(s.xyz);
+				p.pos.x += n.x * penetration;
+				p.pos.y += n.y * penetration;
+				p.pos.z += n.z * penetration;
+
+				// Reflect the normal part with restitution, slow the tangential part with friction
+				float3 v = (float3)(p.velocity.x, p.velocity.y, p.velocity.z);
+				float vn = dot(v, n);
+				if (vn < 0.0f) {
+					float3 vt = (v - vn * n) * (1.0f - c.friction);
+					v = vt - vn * c.restitution * n;
+					p.velocity.x = v.x;
+					p.velocity.y = v.y;
+					p.velocity.z = v.z;
+				}
+			}
+		}
+	}
 
 	// Normalize distance and avoid division with 0
 	float normalizedDist = (distance / m.radius) / 2.0f;
-	float totalVelocity = particles[id].velocity.x + particles[id].velocity.y + particles[id].velocity.z;
+	float totalVelocity = p.velocity.x + p.velocity.y + p.velocity.z;
 	float normalizedVelocity = totalVelocity / 2.0f;
 
 	// Update colors based on distance to the mass point
-	particles[id].color.r = clamp(normalizedVelocity - normalizedDist, 0.0f, 1.0f);
-	particles[id].color.g = clamp((normalizedDist + normalizedVelocity) * 0.3f, 0.0f, 1.0f);
-	particles[id].color.b = clamp(0.5f * normalizedDist, 0.0f, 1.0f);
+	p.color.r = clamp(normalizedVelocity - normalizedDist, 0.0f, 1.0f);
+	p.color.g = clamp((normalizedDist + normalizedVelocity) * 0.3f, 0.0f, 1.0f);
+	p.color.b = clamp(0.5f * normalizedDist, 0.0f, 1.0f);
 
-	if (isEmitter) {
-		float lifeRatio = (particles[id].max_life > 0.0f) ? (particles[id].life / particles[id].max_life) : 0.0f;
+	if (species == SPECIES_EMITTER) {
+		float lifeRatio = (p.max_life > 0.0f) ? (p.life / p.max_life) : 0.0f;
 		lifeRatio = clamp(lifeRatio, 0.0f, 1.0f);
-		particles[id].color.r = 1.0f;
-		particles[id].color.g = lifeRatio;
-		particles[id].color.b = lifeRatio;
+		p.color.r = 1.0f;
+		p.color.g = lifeRatio;
+		p.color.b = lifeRatio;
+	}
+	else if (species == SPECIES_HEAVY) {
+		float shade = clamp(0.35f + fabs(normalizedVelocity) * 0.5f, 0.0f, 1.0f);
+		p.color.r = shade * 0.8f;
+		p.color.g = shade * 0.8f;
+		p.color.b = shade;
+	}
+	else if (species == SPECIES_TRACER) {
+		p.color.r = 0.2f;
+		p.color.g = clamp(0.4f + fabs(normalizedVelocity), 0.0f, 1.0f);
+		p.color.b = 0.5f;
 	}
 
-	// Trail bookkeeping: sample the path roughly every TRAIL_INTERVAL seconds
-	float accumulator = particles[id].trail_timer + deltaTime;
-	int head = (int)(particles[id].trail_head + 0.5f);
+#ifdef NATIVE_MATH
+	bits.p = p;
+	vstore16(bits.v, id, (__global float *)particles);
+#else
+	particles[id] = p;
+#endif
 
-	while (accumulator >= TRAIL_INTERVAL) {
-		particles[id].trail[head] = particles[id].pos;
-		head = (head + 1) % TRAIL_SAMPLES;
-		accumulator -= TRAIL_INTERVAL;
-	}
-	particles[id].trail_timer = accumulator;
-	particles[id].trail_head = (float)head;
+	// Every particle writes the same slice, neighbours store to neighbouring addresses
+	if (t.write != 0u)
+		vstore3((float3)(p.pos.x, p.pos.y, p.pos.z), (size_t)t.slot * t.stride + id, trails);
+}
+
+/*
+	One kernel per species, dispatched over the species range with a global offset so that
+	every wavefront runs the same code. Ids stay relative to the buffer
+*/
+__kernel void updateHeavy(__global particle *particles, mass m, emitter e, float deltaTime,
+	__read_only image3d_t fieldA, __read_only image3d_t fieldB, field_params f,
+	__read_only image3d_t sdf, collision_params c, __global float *trails, trail_params t) {
+	updateParticle(particles, (int)get_global_id(0), SPECIES_HEAVY, m, e, deltaTime, fieldA, fieldB, f, sdf, c, trails, t);
+}
+
+__kernel void updateTracer(__global particle *particles, mass m, emitter e, float deltaTime,
+	__read_only image3d_t fieldA, __read_only image3d_t fieldB, field_params f,
+	__read_only image3d_t sdf, collision_params c, __global float *trails, trail_params t) {
+	updateParticle(particles, (int)get_global_id(0), SPECIES_TRACER, m, e, deltaTime, fieldA, fieldB, f, sdf, c, trails, t);
+}
+
+__kernel void updatePassive(__global particle *particles, mass m, emitter e, float deltaTime,
+	__read_only image3d_t fieldA, __read_only image3d_t fieldB, field_params f,
+	__read_only image3d_t sdf, collision_params c, __global float *trails, trail_params t) {
+	updateParticle(particles, (int)get_global_id(0), SPECIES_PASSIVE, m, e, deltaTime, fieldA, fieldB, f, sdf, c, trails, t);
+}
+
+// Only dispatched while the emitter is on, its range is passive otherwise
+__kernel void updateEmitter(__global particle *particles, mass m, emitter e, float deltaTime,
+	__read_only image3d_t fieldA, __read_only image3d_t fieldB, field_params f,
+	__read_only image3d_t sdf, collision_params c, __global float *trails, trail_params t) {
+	updateParticle(particles, (int)get_global_id(0), SPECIES_EMITTER, m, e, deltaTime, fieldA, fieldB, f, sdf, c, trails, t);
+}
+
+/*
+	Many independent systems of memberSize particles each packed back to back, member i owns
+	[i * memberSize, (i + 1) * memberSize) and reads its mass and emitter from members[i].
+	A work-group spans one or two members, its parameter loads hit the same cache lines
+*/
+__kernel void updateEnsemble(__global particle *particles, __global const member_params *members, uint memberSize,
+	float deltaTime, __read_only image3d_t fieldA, __read_only image3d_t fieldB, field_params f,
+	__read_only image3d_t sdf, collision_params c, __global float *trails, trail_params t) {
+	int id = get_global_id(0);
+	uint member = (uint)id / memberSize;
+	member_params p = members[member];
+	// Members are too short to split by species, the emitter test stays a branch here
+	if ((p.e.enabled != 0u) && (uint)id - member * memberSize >= p.emitter_start)
+		updateParticle(particles, id, SPECIES_EMITTER, p.m, p.e, deltaTime, fieldA, fieldB, f, sdf, c, trails, t);
+	else
+		updateParticle(particles, id, SPECIES_PASSIVE, p.m, p.e, deltaTime, fieldA, fieldB, f, sdf, c, trails, t);
 }
@@ -0,0 +1,90 @@
+#define FIELD_NOISE_PERIOD 4
+
+/*
+	Integer hash of a lattice corner, wrapped so the field tiles
+	and can be sampled with repeat addressing while it scrolls
+*/
+uint hashCorner(int x, int y, int z, uint seed)
+{
+	uint h = (uint)(x & (FIELD_NOISE_PERIOD - 1)) * 73856093u
+		^ (uint)(y & (FIELD_NOISE_PERIOD - 1)) * 19349663u
+		^ (uint)(z & (FIELD_NOISE_PERIOD - 1)) * 83492791u
+		^ seed * 2654435761u;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return h;
+}
+
+float3 cornerGradient(int x, int y, int z, uint seed)
+{
+	uint h = hashCorner(x, y, z, seed);
+	float3 g = (float3)((h & 0x3FFu), ((h >> 10) & 0x3FFu), ((h >> 20) & 0x3FFu));
+	return normalize(g / 511.5f - 1.0f + 1e-4f);
+}
+
+float fade(float t)
+{
+	return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+/*
+	Periodic gradient noise, p in lattice units
+*/
+float gradientNoise(float3 p, uint seed)
+{
+	float3 cell = floor(p);
+	float3 f = p - cell;
+	int x = (int)cell.x, y = (int)cell.y, z = (int)cell.z;
+	float3 u = (float3)(fade(f.x), fade(f.y), fade(f.z));
+
+	float n000 = dot(cornerGradient(x, y, z, seed), f);
+	float n100 = dot(cornerGradient(x + 1, y, z, seed), f - (float3)(1, 0, 0));
+	float n010 = dot(cornerGradient(x, y + 1, z, seed), f - (float3)(0, 1, 0));
+	float n110 = dot(cornerGradient(x + 1, y + 1, z, seed), f - (float3)(1, 1, 0));
+	float n001 = dot(cornerGradient(x, y, z + 1, seed), f - (float3)(0, 0, 1));
+	float n101 = dot(cornerGradient(x + 1, y, z + 1, seed), f - (float3)(1, 0, 1));
+	float n011 = dot(cornerGradient(x, y + 1, z + 1, seed), f - (float3)(0, 1, 1));
+	float n111 = dot(cornerGradient(x + 1, y + 1, z + 1, seed), f - (float3)(1, 1, 1));
+
+	float nx00 = mix(n000, n100, u.x);
+	float nx10 = mix(n010, n110, u.x);
+	float nx01 = mix(n001, n101, u.x);
+	float nx11 = mix(n011, n111, u.x);
+	return mix(mix(nx00, nx10, u.y), mix(nx01, nx11, u.y), u.z);
+}
+
+/*
+	Vector potential made of three decorrelated noise channels
+*/
+float3 potential(float3 p, uint seed)
+{
+	return (float3)(
+		gradientNoise(p, seed * 3u),
+		gradientNoise(p, seed * 3u + 1u),
+		gradientNoise(p, seed * 3u + 2u));
+}
+
+/*
+	Fills one frame of the force field with the curl of the noise potential,
+	divergence free so particles swirl instead of bunching up.
+	The RGBA float texels are copied into the sampled 3D image afterwards
+*/
+__kernel void generateCurlField(__global float4 *field, uint resolution, uint seed) {
+	uint id = get_global_id(0);
+	uint x = id % resolution;
+	uint y = (id / resolution) % resolution;
+	uint z = id / (resolution * resolution);
+
+	const float h = 0.01f;
+	float3 p = (float3)(x, y, z) * ((float)FIELD_NOISE_PERIOD / (float)resolution);
+
+	float3 dx = (potential(p + (float3)(h, 0, 0), seed) - potential(p - (float3)(h, 0, 0), seed)) / (2.0f * h);
+	float3 dy = (potential(p + (float3)(0, h, 0), seed) - potential(p - (float3)(0, h, 0), seed)) / (2.0f * h);
+	float3 dz = (potential(p + (float3)(0, 0, h), seed) - potential(p - (float3)(0, 0, h), seed)) / (2.0f * h);
+
+	float3 curl = (float3)(dy.z - dz.y, dz.x - dx.z, dx.y - dy.x);
+	field[id] = (float4)(curl, 0.0f);
+}
@@ -0,0 +1,16 @@
+#version 430 core
+
+layout(location = 0) in vec3 in_pos;
+layout(location = 1) in vec4 in_center_radius;
+layout(location = 2) in vec4 in_color;
+
+uniform mat4 u_viewProj;
+
+out vec4 v_color;
+
+void main()
+{
+	// Unit sphere scaled and moved per instance
+	gl_Position = u_viewProj * vec4(in_center_radius.xyz + in_pos * in_center_radius.w, 1.0);
+	v_color = in_color;
+}
@@ -0,0 +1,14 @@
+#version 430 core
+
+in vec2 v_uv;
+in vec4 v_color;
+
+uniform sampler2D u_atlas;
+
+out vec4 out_color;
+
+void main()
+{
+	// Glyph coverage, the flat quads sample the white texel
+	out_color = vec4(v_color.rgb, v_color.a * texture(u_atlas, v_uv).r);
+}
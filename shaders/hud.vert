@@ -0,0 +1,18 @@
+#version 430 core
+
+layout(location = 0) in vec4 in_pos_uv;
+layout(location = 1) in vec4 in_color;
+
+uniform vec2 u_screen;
+
+out vec2 v_uv;
+out vec4 v_color;
+
+void main()
+{
+	// Pixels from the top left corner to clip space
+	vec2 ndc = vec2(in_pos_uv.x / u_screen.x * 2.0 - 1.0, 1.0 - in_pos_uv.y / u_screen.y * 2.0);
+	gl_Position = vec4(ndc, 0.0, 1.0);
+	v_uv = in_pos_uv.zw;
+	v_color = in_color;
+}
@@ -7,24 +7,41 @@ layout(std430, binding = 0) readonly buffer ParticleBuffer {
 	float particles[];
 };
 
+// [u_trailCapacity][u_trailStride] packed positions, one slice per trail clock tick
+layout(std430, binding = 1) readonly buffer TrailBuffer {
+	float trails[];
+};
+
 in VS_OUT {
 	vec3 pos_curr;
 	vec3 color;
 	vec3 pos_prev;
+	vec3 motion;
 } vs_out[];
 
 out vec4 fragColor;
 
 uniform mat4 u_viewProj;
 uniform bool u_trailMode;
-uniform int  u_trailSamples;
+uniform int  u_trailSamples;  // newest samples drawn
+uniform int  u_trailCapacity; // slices of the history
+uniform int  u_trailStride;   // particles per slice
+uniform uint u_trailClock;    // slices written so far, the newest is in (clock - 1) % capacity
+uniform uint u_trailValidFrom;// first slice written for every particle of the chunk
 uniform int  u_particleStride; // in floats
-uniform int  u_trailOffset;    // in floats
-uniform int  u_trailHeadOffset;// in floats
-
-vec3 loadVec3(int base)
+uniform int  u_trailBirthOffset;// in floats
+uniform bool  u_motionBlur;
+uniform float u_blurScale;     // streak length in ticks of motion
+uniform float u_blurMaxLength; // in world units
+uniform bool  u_lodMode;
+uniform float u_lodDistance;
+uniform vec3  u_eye;
+uniform vec3  u_gridMin;
+uniform float u_gridSize;
+
+vec3 loadTrail(int base)
 {
-	return vec3(particles[base], particles[base + 1], particles[base + 2]);
+	return vec3(trails[base], trails[base + 1], trails[base + 2]);
 }
 
 void main()
@@ -33,8 +50,46 @@ void main()
 	vec3	posPrev = vs_out[0].pos_prev;
 	vec3	col = vs_out[0].color;
 
-	// Fast path: regular point rendering
-	if (!u_trailMode)
+	// Far particles inside the density grid are drawn by the volume pass
+	if (u_lodMode && distance(posCurr, u_eye) > u_lodDistance)
+	{
+		vec3 gridPos = posCurr - u_gridMin;
+		if (all(greaterThanEqual(gridPos, vec3(0.0))) && all(lessThan(gridPos, vec3(u_gridSize))))
+			return;
+	}
+
+	// Slices from before the particle spawned, or skipped while it was inactive, are not drawn
+	int capacity = clamp(u_trailCapacity, 1, 63); // leave room for the final vertex
+	int samples = 0;
+	if (u_trailMode)
+	{
+		uint birth = floatBitsToUint(particles[gl_PrimitiveIDIn * max(u_particleStride, 1) + u_trailBirthOffset]);
+		uint first = max(birth, u_trailValidFrom);
+		uint available = u_trailClock > first ? u_trailClock - first : 0u;
+		samples = int(min(available, uint(clamp(u_trailSamples, 1, capacity))));
+	}
+
+	// Motion blur: one segment back along the last motion, fading out towards the tail
+	vec3 streak = u_motionBlur ? vs_out[0].motion * u_blurScale : vec3(0.0);
+	float streakLength = length(streak);
+	if (samples == 0 && streakLength > 0.006)
+	{
+		streak *= min(1.0, u_blurMaxLength / streakLength);
+
+		gl_Position = u_viewProj * vec4(posCurr - streak, 1.0);
+		fragColor = vec4(col, 0.0);
+		EmitVertex();
+
+		gl_Position = u_viewProj * vec4(posCurr, 1.0);
+		fragColor = vec4(col, 1.0);
+		EmitVertex();
+
+		EndPrimitive();
+		return;
+	}
+
+	// Fast path: regular point rendering, also for particles too slow to streak
+	if (samples == 0)
 	{
 		// Emit a tiny degenerate line around the current position to rasterize as a point-like dot
 		vec3 offset = vec3(0.0, 0.003, 0.0);
@@ -51,19 +106,11 @@ void main()
 		return;
 	}
 
-	// Trailing mode: fetch packed particle data to draw a fading line strip
-	int stride = max(u_particleStride, 1);
-	int base = gl_PrimitiveIDIn * stride;
-	int samples = clamp(u_trailSamples, 1, 63); // leave room for the final vertex
-
-	// Head points to the next slot to be written, so it also marks the oldest sample
-	int head = clamp(int(particles[base + u_trailHeadOffset] + 0.5), 0, samples - 1);
-
+	// Trailing mode: the newest slices of the global history, oldest first, then a fading line strip
 	for (int i = 0; i < samples; ++i)
 	{
-		int idx = (head + i) % samples;
-		int offset = base + u_trailOffset + (idx * 3);
-		vec3 trailPos = loadVec3(offset);
+		uint slice = (u_trailClock - uint(samples - i)) % uint(capacity);
+		vec3 trailPos = loadTrail((int(slice) * u_trailStride + gl_PrimitiveIDIn) * 3);
 		float alpha = float(i) / float(samples);
 
 		gl_Position = u_viewProj * vec4(trailPos, 1.0);
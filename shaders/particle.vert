@@ -4,17 +4,24 @@ layout(location = 0) in vec3 in_pos;
 layout(location = 1) in vec3 in_color;
 layout(location = 2) in vec3 in_pos_prev;
 
+// Progress from the previous simulation tick to the latest one
+uniform float u_alpha;
+
 out VS_OUT {
 	vec3 pos_curr;
 	vec3 color;
 	vec3 pos_prev;
+	vec3 motion;
 } vs_out;
 
 void main()
 {
-	vs_out.pos_curr = in_pos;
+	vec3 pos = mix(in_pos_prev, in_pos, u_alpha);
+	vs_out.pos_curr = pos;
 	vs_out.color = in_color;
 	vs_out.pos_prev = in_pos_prev;
+	// Full displacement of the last tick, the interpolated one shrinks to zero after each step
+	vs_out.motion = in_pos - in_pos_prev;
 	// Pass-through position for completeness; geometry shader handles transform
-	gl_Position = vec4(in_pos, 1.0);
+	gl_Position = vec4(pos, 1.0);
 }
@@ -5,11 +5,13 @@ layout(location = 1) in vec3 in_color;
 layout(location = 2) in vec3 in_pos_prev;
 
 uniform mat4 u_viewProj;
+// Progress from the previous simulation tick to the latest one
+uniform float u_alpha;
 
 out vec3 v_color;
 
 void main()
 {
-	gl_Position = u_viewProj * vec4(in_pos, 1.0);
+	gl_Position = u_viewProj * vec4(mix(in_pos_prev, in_pos, u_alpha), 1.0);
 	v_color = in_color;
 }
@@ -0,0 +1,15 @@
+#version 430 core
+
+// Written by the OpenCL rasterizer at the framebuffer size, one texel per pixel
+uniform sampler2D u_frame;
+
+out vec4 out_color;
+
+void main()
+{
+	vec4 texel = texelFetch(u_frame, ivec2(gl_FragCoord.xy), 0);
+	// No particle landed on this pixel
+	if (texel.a == 0.0)
+		discard;
+	out_color = texel;
+}
@@ -0,0 +1,66 @@
+#version 430 core
+
+in vec2 v_ndc;
+out vec4 out_color;
+
+uniform mat4		u_invViewProj;
+uniform vec3		u_eye;
+uniform vec3		u_gridMin;
+uniform float		u_gridSize;		// world size of the grid cube
+uniform int			u_resolution;	// fine cells per side
+uniform int			u_coarseFactor;	// fine cells per coarse cell
+uniform float		u_lodDistance;	// closer particles are drawn as points
+uniform sampler3D	u_volume;		// rgb: averaged color, a: opacity
+uniform sampler3D	u_coarse;		// non zero when the coarse cell holds particles
+
+void main()
+{
+	vec4 farPoint = u_invViewProj * vec4(v_ndc, 1.0, 1.0);
+	vec3 dir = normalize(farPoint.xyz / farPoint.w - u_eye);
+	vec3 invDir = 1.0 / dir;
+
+	// Clip the ray against the grid box, starting at the LOD distance
+	vec3 t0 = (u_gridMin - u_eye) * invDir;
+	vec3 t1 = (u_gridMin + vec3(u_gridSize) - u_eye) * invDir;
+	vec3 tMin = min(t0, t1);
+	vec3 tMax = max(t0, t1);
+	float tNear = max(max(tMin.x, tMin.y), max(tMin.z, u_lodDistance));
+	float tFar = min(min(tMax.x, tMax.y), tMax.z);
+	if (tNear >= tFar)
+		discard;
+
+	float cellSize = u_gridSize / float(u_resolution);
+	float stepSize = cellSize * 0.5;
+	float coarseSize = cellSize * float(u_coarseFactor);
+	int coarseRes = u_resolution / u_coarseFactor;
+	vec3 exitSide = step(vec3(0.0), dir) * coarseSize;
+
+	vec4 acc = vec4(0.0);
+	float t = tNear;
+	for (int i = 0; i < u_resolution * 4 && t < tFar && acc.a < 0.99; ++i)
+	{
+		vec3 pos = u_eye + dir * t;
+		vec3 uvw = (pos - u_gridMin) / u_gridSize;
+		ivec3 coarseCell = clamp(ivec3(uvw * float(coarseRes)), ivec3(0), ivec3(coarseRes - 1));
+
+		// Empty space skipping: jump straight to the exit of an empty coarse cell
+		if (texelFetch(u_coarse, coarseCell, 0).r == 0.0)
+		{
+			vec3 cellMin = u_gridMin + vec3(coarseCell) * coarseSize;
+			vec3 exits = (cellMin + exitSide - u_eye) * invDir;
+			t = max(min(min(exits.x, exits.y), exits.z), t) + stepSize * 0.5;
+			continue;
+		}
+
+		vec4 texel = texture(u_volume, uvw);
+		// Opacity is stored per cell, correct it for the step length
+		float alpha = 1.0 - pow(1.0 - texel.a, stepSize / cellSize);
+		acc.rgb += (1.0 - acc.a) * alpha * texel.rgb;
+		acc.a += (1.0 - acc.a) * alpha;
+		t += stepSize;
+	}
+	if (acc.a <= 0.0)
+		discard;
+	// Premultiplied alpha output
+	out_color = acc;
+}
@@ -0,0 +1,11 @@
+#version 430 core
+
+out vec2 v_ndc;
+
+void main()
+{
+	// Fullscreen triangle generated from the vertex id, no vertex buffer needed
+	vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+	v_ndc = pos;
+	gl_Position = vec4(pos, 0.0, 1.0);
+}
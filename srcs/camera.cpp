@@ -70,6 +70,21 @@ namespace psys
 		movementspeed = 0.1;
 	}
 
+	/*
+		Places the camera distance away from target, looking at it
+		along the current view direction
+	*/
+	void Camera::frame(glm::vec3 target, float distance)
+	{
+		glm::mat4 rotation = glm::rotate(glm::mat4(1.0f), glm::radians(angle.y), glm::vec3(-1.0f, 0.0f, 0.0f));
+		rotation = glm::rotate(rotation, glm::radians(angle.x), glm::vec3(0.0f, -1.0f, 0.0f));
+		glm::vec3 forward = glm::vec3(glm::transpose(rotation) * glm::vec4(0.0f, 0.0f, -1.0f, 0.0f));
+
+		// The view matrix translates by position, the eye itself sits at -position
+		position = -(target - forward * distance);
+		center = glm::vec3(position.x, position.y, position.z - 10.0f);
+	}
+
 	glm::vec3 Camera::getPosition()
 	{
 		return position;
@@ -0,0 +1,350 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   cluster.cpp                                        :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: tmoragli <tmoragli@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 18:40:12 by tmoragli          #+#    #+#             */
+/*   Updated: 2026/10/19 18:40:12 by tmoragli         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "cluster.hpp"
+#include "define.hpp"
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+namespace psys
+{
+	// Sent before every payload
+	struct message_header {
+		uint32_t type;
+		uint32_t rank;
+		uint64_t bytes;
+	};
+
+	bool writeAll(int fd, const void *data, size_t bytes)
+	{
+		const unsigned char *p = static_cast<const unsigned char *>(data);
+		while (bytes > 0)
+		{
+			ssize_t n = ::send(fd, p, bytes, MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+			p += n;
+			bytes -= static_cast<size_t>(n);
+		}
+		return true;
+	}
+
+	bool readAll(int fd, void *data, size_t bytes)
+	{
+		unsigned char *p = static_cast<unsigned char *>(data);
+		const size_t total = bytes;
+		while (bytes > 0)
+		{
+			ssize_t n = ::recv(fd, p, bytes, 0);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n == 0)
+				errno = bytes == total ? 0 : ECONNRESET;
+			if (n <= 0)
+				return false;
+			p += n;
+			bytes -= static_cast<size_t>(n);
+		}
+		return true;
+	}
+
+	Cluster::Cluster()
+		: self(0), count(1)
+	{
+	}
+
+	Cluster::~Cluster()
+	{
+		for (int fd : sockets)
+		{
+			if (fd >= 0)
+				close(fd);
+		}
+	}
+
+	bool Cluster::connect(unsigned int rank, unsigned int ranks, const std::vector<std::string> &hosts, unsigned int basePort)
+	{
+		self = rank;
+		count = ranks;
+		sockets.assign(ranks, -1);
+
+		int listener = socket(AF_INET, SOCK_STREAM, 0);
+		int yes = 1;
+		sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_ANY);
+		address.sin_port = htons(static_cast<uint16_t>(basePort + rank));
+		if (listener < 0 || setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) != 0
+			|| bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, ranks) != 0)
+		{
+			std::cerr << "Failed to listen on port " << basePort + rank << ": " << strerror(errno) << std::endl;
+			if (listener >= 0)
+				close(listener);
+			return false;
+		}
+
+		// A connect completes in the peer's backlog, so the lower ranks don't have to be accepting yet
+		bool connected = true;
+		for (unsigned int peer = 0; peer < rank && connected; ++peer)
+			connected = connectTo(peer, hosts[peer], basePort + peer);
+		for (unsigned int peer = rank + 1; peer < ranks && connected; ++peer)
+			connected = acceptFrom(listener, ranks - peer);
+		close(listener);
+		if (!connected)
+			return false;
+
+		std::cout << "Rank " << rank << " of " << ranks << " connected to every peer" << std::endl;
+		return true;
+	}
+
+	/*
+		Retries until the peer listens, up to CLUSTER_CONNECT_TIMEOUT seconds, then says who we are
+	*/
+	bool Cluster::connectTo(unsigned int peer, const std::string &host, unsigned int port)
+	{
+		addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo *found = nullptr;
+		int status = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found);
+		if (status != 0)
+		{
+			std::cerr << "Failed to resolve rank " << peer << " host " << host << ": " << gai_strerror(status) << std::endl;
+			return false;
+		}
+
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(CLUSTER_CONNECT_TIMEOUT);
+		int fd = -1;
+		while (fd < 0 && std::chrono::steady_clock::now() < deadline)
+		{
+			fd = socket(AF_INET, SOCK_STREAM, 0);
+			if (fd >= 0 && ::connect(fd, found->ai_addr, found->ai_addrlen) != 0)
+			{
+				close(fd);
+				fd = -1;
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			}
+		}
+		freeaddrinfo(found);
+		if (fd < 0)
+		{
+			std::cerr << "Failed to connect to rank " << peer << " at " << host << ":" << port << std::endl;
+			return false;
+		}
+
+		int yes = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+		message_header hello = {0, self, 0};
+		if (!writeAll(fd, &hello, sizeof(hello)))
+		{
+			std::cerr << "Failed to greet rank " << peer << ": " << strerror(errno) << std::endl;
+			close(fd);
+			return false;
+		}
+		sockets[peer] = fd;
+		return true;
+	}
+
+	/*
+		Takes the next incoming connection, its first header tells which rank it is
+	*/
+	bool Cluster::acceptFrom(int listener, unsigned int expected)
+	{
+		pollfd waiting = {listener, POLLIN, 0};
+		if (poll(&waiting, 1, CLUSTER_CONNECT_TIMEOUT * 1000) <= 0)
+		{
+			std::cerr << "Failed to accept the higher ranks, " << expected << " still missing" << std::endl;
+			return false;
+		}
+		int fd = accept(listener, nullptr, nullptr);
+		message_header hello;
+		if (fd < 0 || !readAll(fd, &hello, sizeof(hello)) || hello.rank <= self || hello.rank >= count
+			|| sockets[hello.rank] >= 0)
+		{
+			std::cerr << "Failed to accept a peer: unexpected greeting" << std::endl;
+			if (fd >= 0)
+				close(fd);
+			return false;
+		}
+		int yes = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+		sockets[hello.rank] = fd;
+		return true;
+	}
+
+	bool Cluster::active() const
+	{
+		return count > 1;
+	}
+
+	unsigned int Cluster::rank() const
+	{
+		return self;
+	}
+
+	unsigned int Cluster::ranks() const
+	{
+		return count;
+	}
+
+	bool Cluster::send(unsigned int peer, uint32_t type, const void *data, size_t bytes)
+	{
+		message_header header = {type, self, bytes};
+		if (!writeAll(sockets[peer], &header, sizeof(header)) || (bytes > 0 && !writeAll(sockets[peer], data, bytes)))
+		{
+			std::cerr << "Failed to send to rank " << peer << ": " << strerror(errno) << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	bool Cluster::receive(unsigned int peer, uint32_t type, std::vector<unsigned char> &payload)
+	{
+		message_header header;
+		if (!readAll(sockets[peer], &header, sizeof(header)))
+		{
+			if (errno != 0)
+				std::cerr << "Failed to receive from rank " << peer << ": " << strerror(errno) << std::endl;
+			return false;
+		}
+		if (header.type != type)
+		{
+			std::cerr << "Failed to receive from rank " << peer << ": message " << header.type
+				<< " instead of " << type << std::endl;
+			return false;
+		}
+		payload.resize(header.bytes);
+		if (header.bytes > 0 && !readAll(sockets[peer], payload.data(), payload.size()))
+		{
+			std::cerr << "Failed to receive from rank " << peer << ": " << strerror(errno) << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	/*
+		Non blocking rounds driven by poll(): every peer has an outgoing message (header then payload)
+		and an incoming one (header, then the payload once its size is known)
+	*/
+	bool Cluster::exchange(const std::vector<unsigned int> &peers, uint32_t type,
+		const std::vector<std::vector<unsigned char>> &outgoing, std::vector<std::vector<unsigned char>> &incoming)
+	{
+		struct transfer {
+			message_header sendHeader;
+			message_header recvHeader;
+			size_t sent;
+			size_t received;
+		};
+		std::vector<transfer> transfers(peers.size());
+		incoming.assign(count, {});
+		for (size_t i = 0; i < peers.size(); ++i)
+			transfers[i] = {{type, self, outgoing[peers[i]].size()}, {0, 0, 0}, 0, 0};
+
+		const size_t headerBytes = sizeof(message_header);
+		size_t pending = peers.size() * 2;
+		std::vector<pollfd> fds(peers.size());
+		while (pending > 0)
+		{
+			for (size_t i = 0; i < peers.size(); ++i)
+			{
+				const transfer &t = transfers[i];
+				fds[i] = {sockets[peers[i]], 0, 0};
+				if (t.sent < headerBytes + t.sendHeader.bytes)
+					fds[i].events |= POLLOUT;
+				if (t.received < headerBytes || t.received < headerBytes + t.recvHeader.bytes)
+					fds[i].events |= POLLIN;
+			}
+			if (poll(fds.data(), fds.size(), -1) < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				std::cerr << "Failed to poll the cluster sockets: " << strerror(errno) << std::endl;
+				return false;
+			}
+
+			for (size_t i = 0; i < peers.size(); ++i)
+			{
+				transfer &t = transfers[i];
+				const unsigned int peer = peers[i];
+				const int fd = sockets[peer];
+				if (fds[i].revents & (POLLERR | POLLNVAL))
+				{
+					std::cerr << "Failed to exchange with rank " << peer << ": socket error" << std::endl;
+					return false;
+				}
+				if ((fds[i].revents & POLLOUT) && (fds[i].events & POLLOUT))
+				{
+					const unsigned char *from = t.sent < headerBytes
+						? reinterpret_cast<const unsigned char *>(&t.sendHeader) + t.sent
+						: outgoing[peer].data() + (t.sent - headerBytes);
+					size_t left = t.sent < headerBytes ? headerBytes - t.sent : headerBytes + t.sendHeader.bytes - t.sent;
+					ssize_t n = ::send(fd, from, left, MSG_DONTWAIT | MSG_NOSIGNAL);
+					if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+					{
+						std::cerr << "Failed to send to rank " << peer << ": " << strerror(errno) << std::endl;
+						return false;
+					}
+					if (n > 0)
+					{
+						t.sent += static_cast<size_t>(n);
+						if (t.sent == headerBytes + t.sendHeader.bytes)
+							pending--;
+					}
+				}
+				if ((fds[i].revents & (POLLIN | POLLHUP)) && (fds[i].events & POLLIN))
+				{
+					unsigned char *to = t.received < headerBytes
+						? reinterpret_cast<unsigned char *>(&t.recvHeader) + t.received
+						: incoming[peer].data() + (t.received - headerBytes);
+					size_t left = t.received < headerBytes ? headerBytes - t.received : headerBytes + t.recvHeader.bytes - t.received;
+					ssize_t n = ::recv(fd, to, left, MSG_DONTWAIT);
+					if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+					{
+						std::cerr << "Failed to receive from rank " << peer << ": "
+							<< (n == 0 ? "connection closed" : strerror(errno)) << std::endl;
+						return false;
+					}
+					if (n > 0)
+					{
+						t.received += static_cast<size_t>(n);
+						if (t.received == headerBytes)
+						{
+							if (t.recvHeader.type != type)
+							{
+								std::cerr << "Failed to receive from rank " << peer << ": message " << t.recvHeader.type
+									<< " instead of " << type << std::endl;
+								return false;
+							}
+							incoming[peer].resize(t.recvHeader.bytes);
+						}
+						if (t.received == headerBytes + t.recvHeader.bytes)
+							pending--;
+					}
+				}
+			}
+		}
+		return true;
+	}
+};
@@ -0,0 +1,212 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   hud.cpp                                            :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: tmoragli <tmoragli@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 14:03:12 by tmoragli          #+#    #+#             */
+/*   Updated: 2026/10/19 14:03:12 by tmoragli         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "hud.hpp"
+#include "define.hpp"
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <cmath>
+#include <algorithm>
+
+// Third-party code, not held to the project warnings
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wsign-compare"
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+#pragma GCC diagnostic ignored "-Wtype-limits"
+#pragma GCC diagnostic ignored "-Wimplicit-fallthrough"
+#define STB_TRUETYPE_IMPLEMENTATION
+#include "stb_truetype.hpp"
+#pragma GCC diagnostic pop
+
+namespace psys
+{
+	Hud::Hud()
+		: program(0), atlasTex(0), vao(0), vbo(0), vboCapacity(0), whiteU(0.0f), whiteV(0.0f),
+		screenWidth(1), screenHeight(1), loaded(false)
+	{
+	}
+
+	Hud::~Hud()
+	{
+		if (vbo)
+			glDeleteBuffers(1, &vbo);
+		if (vao)
+			glDeleteVertexArrays(1, &vao);
+		if (atlasTex)
+			glDeleteTextures(1, &atlasTex);
+	}
+
+	/*
+		Bakes the printable ASCII range of the font into a single channel atlas once,
+		the last texel is set to white for the flat quads
+	*/
+	bool Hud::init(const std::string &fontPath, GLuint shaderProgram)
+	{
+		std::ifstream file(fontPath, std::ios::binary);
+		if (!file.is_open())
+		{
+			std::cerr << "Failed to open HUD font: " << fontPath << std::endl;
+			return false;
+		}
+		std::vector<unsigned char> font((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+		std::vector<unsigned char> bitmap(HUD_ATLAS_SIZE * HUD_ATLAS_SIZE, 0);
+		stbtt_bakedchar baked[96];
+		if (stbtt_BakeFontBitmap(font.data(), 0, HUD_FONT_SIZE, bitmap.data(), HUD_ATLAS_SIZE, HUD_ATLAS_SIZE, 32, 96, baked) <= 0)
+		{
+			std::cerr << "Failed to bake HUD font: " << fontPath << std::endl;
+			return false;
+		}
+		for (size_t i = 0; i < glyphs.size(); ++i)
+		{
+			const stbtt_bakedchar &b = baked[i];
+			glyphs[i] = {static_cast<float>(b.x0), static_cast<float>(b.y0), static_cast<float>(b.x1), static_cast<float>(b.y1),
+				b.xoff, b.yoff, b.xadvance};
+		}
+		bitmap.back() = 255;
+		whiteU = (HUD_ATLAS_SIZE - 0.5f) / HUD_ATLAS_SIZE;
+		whiteV = (HUD_ATLAS_SIZE - 0.5f) / HUD_ATLAS_SIZE;
+
+		glGenTextures(1, &atlasTex);
+		glBindTexture(GL_TEXTURE_2D, atlasTex);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, HUD_ATLAS_SIZE, HUD_ATLAS_SIZE, 0, GL_RED, GL_UNSIGNED_BYTE, bitmap.data());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+		glGenBuffers(1, &vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(hud_vertex), (void*)offsetof(hud_vertex, x));
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(hud_vertex), (void*)offsetof(hud_vertex, r));
+		glEnableVertexAttribArray(1);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		program = shaderProgram;
+		loaded = glGetError() == GL_NO_ERROR;
+		if (!loaded)
+			std::cerr << "OpenGL error during HUD initialization" << std::endl;
+		return loaded;
+	}
+
+	bool Hud::ready() const
+	{
+		return loaded;
+	}
+
+	float Hud::lineHeight() const
+	{
+		return std::ceil(HUD_FONT_SIZE * 1.25f);
+	}
+
+	/*
+		Starts a new batch for a framebuffer of the given size
+	*/
+	void Hud::begin(int width, int height)
+	{
+		vertices.clear();
+		screenWidth = std::max(width, 1);
+		screenHeight = std::max(height, 1);
+	}
+
+	void Hud::quad(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1, const glm::vec4 &color)
+	{
+		hud_vertex a = {x0, y0, u0, v0, color.x, color.y, color.z, color.w};
+		hud_vertex b = {x1, y0, u1, v0, color.x, color.y, color.z, color.w};
+		hud_vertex c = {x1, y1, u1, v1, color.x, color.y, color.z, color.w};
+		hud_vertex d = {x0, y1, u0, v1, color.x, color.y, color.z, color.w};
+		vertices.insert(vertices.end(), {a, b, c, a, c, d});
+	}
+
+	/*
+		Queues a line of text, y is the top of the line. Returns the pen position after it
+	*/
+	float Hud::text(float x, float y, const std::string &str, const glm::vec4 &color)
+	{
+		const float scale = 1.0f / HUD_ATLAS_SIZE;
+		float baseline = y + HUD_FONT_SIZE;
+		for (unsigned char c : str)
+		{
+			if (c < 32 || c >= 128)
+				c = '?';
+			const hud_glyph &g = glyphs[c - 32];
+			float x0 = std::round(x + g.xoff);
+			float y0 = std::round(baseline + g.yoff);
+			quad(x0, y0, x0 + (g.x1 - g.x0), y0 + (g.y1 - g.y0), g.x0 * scale, g.y0 * scale, g.x1 * scale, g.y1 * scale, color);
+			x += g.xadvance;
+		}
+		return x;
+	}
+
+	void Hud::rect(float x, float y, float w, float h, const glm::vec4 &color)
+	{
+		quad(x, y, x + w, y + h, whiteU, whiteV, whiteU, whiteV, color);
+	}
+
+	/*
+		Bar graph of a ring of samples starting at first, clamped to maxValue
+	*/
+	void Hud::graph(float x, float y, float w, float h, const float *samples, size_t count, size_t first,
+		float maxValue, const glm::vec4 &color)
+	{
+		rect(x, y, w, h, glm::vec4(0.0f, 0.0f, 0.0f, 0.5f));
+		if (count == 0 || maxValue <= 0.0f)
+			return;
+		float barWidth = w / count;
+		for (size_t i = 0; i < count; ++i)
+		{
+			float value = std::min(samples[(first + i) % count] / maxValue, 1.0f);
+			float barHeight = value * h;
+			rect(x + i * barWidth, y + h - barHeight, barWidth, barHeight, color);
+		}
+	}
+
+	/*
+		Uploads the batch and draws everything queued since begin() in one call
+	*/
+	void Hud::draw()
+	{
+		if (!loaded || vertices.empty())
+			return;
+
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		if (vertices.size() > vboCapacity)
+		{
+			vboCapacity = vertices.size() * 2;
+			glBufferData(GL_ARRAY_BUFFER, vboCapacity * sizeof(hud_vertex), nullptr, GL_STREAM_DRAW);
+		}
+		glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(hud_vertex), vertices.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		glDisable(GL_DEPTH_TEST);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glUseProgram(program);
+		glUniform2f(glGetUniformLocation(program, "u_screen"), static_cast<float>(screenWidth), static_cast<float>(screenHeight));
+		glUniform1i(glGetUniformLocation(program, "u_atlas"), 0);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, atlasTex);
+		glBindVertexArray(vao);
+		glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(vertices.size()));
+		glBindVertexArray(0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glUseProgram(0);
+	}
+};
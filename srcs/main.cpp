@@ -11,6 +11,7 @@
 /* ************************************************************************** */
 
 #include "particle_system.hpp"
+#include "validate.hpp"
 
 #include <cctype>
 #include <cstdlib>
@@ -19,7 +20,6 @@ using namespace psys;
 
 // Constants
 const size_t particle_number = 1000000;
-const size_t max_particles = 5000000;
 const float mouse_sensitivity = 0.05f;
 
 static bool is_digits_only(const char *str)
@@ -34,41 +34,373 @@ static bool is_digits_only(const char *str)
 	return true;
 }
 
-int main(int argc, char **argv)
+static bool parse_count(const char *str, unsigned long long &out)
+{
+	if (!is_digits_only(str))
+		return false;
+	out = std::strtoull(str, nullptr, 10);
+	return true;
+}
+
+// "n" for frames 0 to n - 1, "first-last" for an inclusive range
+static bool parse_frame_range(const char *str, unsigned long long &first, unsigned long long &last)
 {
-	size_t particle_count = particle_number;
-	if (argc > 2)
+	std::string range(str);
+	size_t dash = range.find('-');
+	if (dash == std::string::npos)
 	{
-		std::cerr << "Usage: ./particle_system [nb]" << std::endl;
-		return 1;
+		first = 0;
+		if (!parse_count(str, last) || last == 0)
+			return false;
+		last--;
+		return true;
 	}
-	if (argc == 2)
+	return parse_count(range.substr(0, dash).c_str(), first) && parse_count(range.substr(dash + 1).c_str(), last)
+		&& first <= last;
+}
+
+// "heavy,tracer" percentages of the particles, the emitter keeps its 5% at the end of the buffer
+static bool parse_species(const char *str, unsigned int &heavy, unsigned int &tracer)
+{
+	std::string shares(str);
+	size_t comma = shares.find(',');
+	unsigned long long h = 0;
+	unsigned long long t = 0;
+	if (comma == std::string::npos || !parse_count(shares.substr(0, comma).c_str(), h)
+		|| !parse_count(shares.substr(comma + 1).c_str(), t) || h + t > 95)
+		return false;
+	heavy = static_cast<unsigned int>(h);
+	tracer = static_cast<unsigned int>(t);
+	return true;
+}
+
+// Comma separated host names, one for every rank or a single one they all share
+static bool parse_hosts(const char *str, std::vector<std::string> &hosts)
+{
+	std::string list(str);
+	size_t start = 0;
+	while (start <= list.size())
+	{
+		size_t comma = list.find(',', start);
+		if (comma == std::string::npos)
+			comma = list.size();
+		if (comma == start)
+			return false;
+		hosts.push_back(list.substr(start, comma - start));
+		start = comma + 1;
+	}
+	return true;
+}
+
+// "host:port", the port above 1023
+static bool parse_address(const char *str, std::string &host, unsigned int &port)
+{
+	std::string address(str);
+	size_t colon = address.rfind(':');
+	unsigned long long parsed = 0;
+	if (colon == std::string::npos || colon == 0 || !parse_count(address.c_str() + colon + 1, parsed)
+		|| parsed < 1024 || parsed > 65535)
+		return false;
+	host = address.substr(0, colon);
+	port = static_cast<unsigned int>(parsed);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	launch_options options;
+	options.nb_particles = particle_number;
+	options.lod_resolution = LOD_GRID_RESOLUTION;
+	options.tick_rate = SIM_TICK_RATE;
+	options.target_fps = GOVERNOR_TARGET_FPS;
+	options.bench_seconds = 0;
+	options.validate_steps = 0;
+	options.profile = PROFILE_STRICT;
+	options.heavy_percent = 0;
+	options.tracer_percent = 0;
+	options.governor = true;
+	options.splat = false;
+	options.offscreen = nullptr;
+	options.headless_first = 0;
+	options.headless_last = 0;
+	options.cluster = nullptr;
+	options.stream_server = nullptr;
+	options.stream_client = nullptr;
+
+	bool headless = false;
+	bool countParsed = false;
+	unsigned int ranks = 1;
+	unsigned int rank = 0;
+	bool rankParsed = false;
+	unsigned int port = CLUSTER_BASE_PORT;
+	std::vector<std::string> hosts;
+	unsigned int servePort = 0;
+	std::string serverHost;
+	unsigned int serverPort = 0;
+	for (int i = 1; i < argc; ++i)
 	{
-		if (!is_digits_only(argv[1]))
+		std::string arg(argv[i]);
+		unsigned long long parsed = 0;
+		if (arg == "--lod-res" && i + 1 < argc)
 		{
-			std::cerr << "Error: particle count must be numeric" << std::endl;
-			return 1;
+			if (!parse_count(argv[++i], parsed) || parsed < LOD_COARSE_FACTOR * 4 || parsed > 512
+				|| parsed % LOD_COARSE_FACTOR != 0)
+			{
+				std::cerr << "Error: --lod-res must be a multiple of " << LOD_COARSE_FACTOR
+					<< " between " << LOD_COARSE_FACTOR * 4 << " and 512" << std::endl;
+				return 1;
+			}
+			options.lod_resolution = static_cast<unsigned int>(parsed);
+		}
+		else if (arg == "--tick-rate" && i + 1 < argc)
+		{
+			if (!parse_count(argv[++i], parsed) || parsed < 1 || parsed > 1000)
+			{
+				std::cerr << "Error: --tick-rate must be between 1 and 1000" << std::endl;
+				return 1;
+			}
+			options.tick_rate = static_cast<unsigned int>(parsed);
+		}
+		else if (arg == "--target-fps" && i + 1 < argc)
+		{
+			if (!parse_count(argv[++i], parsed) || parsed < 1 || parsed > 1000)
+			{
+				std::cerr << "Error: --target-fps must be between 1 and 1000" << std::endl;
+				return 1;
+			}
+			options.target_fps = static_cast<unsigned int>(parsed);
 		}
-		unsigned long long parsed = std::strtoull(argv[1], nullptr, 10);
-		if (parsed == 0 || parsed > max_particles)
+		else if (arg == "--bench" && i + 1 < argc)
 		{
-			std::cerr << "Error: particle count must be > 0 and < 5000000" << std::endl;
+			if (!parse_count(argv[++i], parsed) || parsed < 1 || parsed > 3600)
+			{
+				std::cerr << "Error: --bench must be between 1 and 3600 seconds" << std::endl;
+				return 1;
+			}
+			options.bench_seconds = static_cast<unsigned int>(parsed);
+		}
+		else if (arg == "--validate" && i + 1 < argc)
+		{
+			if (!parse_count(argv[++i], parsed) || parsed < 1 || parsed > 100000)
+			{
+				std::cerr << "Error: --validate must be between 1 and 100000 steps" << std::endl;
+				return 1;
+			}
+			options.validate_steps = static_cast<unsigned int>(parsed);
+		}
+		else if (arg == "--cl-profile" && i + 1 < argc)
+		{
+			std::string name(argv[++i]);
+			int profile = 0;
+			while (profile < PROFILE_COUNT && name != profileNames[profile])
+				++profile;
+			if (profile == PROFILE_COUNT)
+			{
+				std::cerr << "Error: --cl-profile must be strict, fast or native" << std::endl;
+				return 1;
+			}
+			options.profile = static_cast<build_profile>(profile);
+		}
+		else if (arg == "--species" && i + 1 < argc)
+		{
+			if (!parse_species(argv[++i], options.heavy_percent, options.tracer_percent))
+			{
+				std::cerr << "Error: --species takes heavy,tracer percentages adding up to 95 at most" << std::endl;
+				return 1;
+			}
+		}
+		else if (arg == "--no-governor")
+			options.governor = false;
+		else if (arg == "--splat")
+			options.splat = true;
+		else if (arg == "--headless" && i + 1 < argc)
+		{
+			unsigned long long first = 0;
+			if (!parse_frame_range(argv[++i], first, parsed) || parsed > 1000000)
+			{
+				std::cerr << "Error: --headless takes a frame count or a range first-last, up to frame 1000000" << std::endl;
+				return 1;
+			}
+			options.headless_first = static_cast<unsigned int>(first);
+			options.headless_last = static_cast<unsigned int>(parsed);
+			headless = true;
+		}
+		else if (arg == "--output" && i + 1 < argc)
+		{
+			options.output_path = argv[++i];
+			if (options.output_path[0] != '|' && options.output_path.find('#') == std::string::npos)
+			{
+				std::cerr << "Error: --output needs a '#' run for the frame number (frames/####.png) or '|command'" << std::endl;
+				return 1;
+			}
+		}
+		else if (arg == "--ranks" && i + 1 < argc)
+		{
+			if (!parse_count(argv[++i], parsed) || parsed < 2 || parsed > CLUSTER_MAX_RANKS)
+			{
+				std::cerr << "Error: --ranks must be between 2 and " << CLUSTER_MAX_RANKS << std::endl;
+				return 1;
+			}
+			ranks = static_cast<unsigned int>(parsed);
+		}
+		else if (arg == "--rank" && i + 1 < argc)
+		{
+			if (!parse_count(argv[++i], parsed) || parsed >= CLUSTER_MAX_RANKS)
+			{
+				std::cerr << "Error: --rank must be between 0 and " << CLUSTER_MAX_RANKS - 1 << std::endl;
+				return 1;
+			}
+			rank = static_cast<unsigned int>(parsed);
+			rankParsed = true;
+		}
+		else if (arg == "--port" && i + 1 < argc)
+		{
+			if (!parse_count(argv[++i], parsed) || parsed < 1024 || parsed + CLUSTER_MAX_RANKS > 65535)
+			{
+				std::cerr << "Error: --port must be between 1024 and " << 65535 - CLUSTER_MAX_RANKS << std::endl;
+				return 1;
+			}
+			port = static_cast<unsigned int>(parsed);
+		}
+		else if (arg == "--hosts" && i + 1 < argc)
+		{
+			if (!parse_hosts(argv[++i], hosts))
+			{
+				std::cerr << "Error: --hosts takes comma separated host names" << std::endl;
+				return 1;
+			}
+		}
+		else if (arg == "--serve" && i + 1 < argc)
+		{
+			if (!parse_count(argv[++i], parsed) || parsed < 1024 || parsed > 65535)
+			{
+				std::cerr << "Error: --serve takes a port between 1024 and 65535" << std::endl;
+				return 1;
+			}
+			servePort = static_cast<unsigned int>(parsed);
+		}
+		else if (arg == "--connect" && i + 1 < argc)
+		{
+			if (!parse_address(argv[++i], serverHost, serverPort))
+			{
+				std::cerr << "Error: --connect takes host:port, the port between 1024 and 65535" << std::endl;
+				return 1;
+			}
+		}
+		else if (arg == "--field" && i + 1 < argc)
+			options.field_path = argv[++i];
+		else if (arg == "--colliders" && i + 1 < argc)
+			options.collider_path = argv[++i];
+		else if (arg == "--font" && i + 1 < argc)
+			options.font_path = argv[++i];
+		else if (arg == "--load" && i + 1 < argc)
+			options.load_path = argv[++i];
+		else if (!countParsed && arg.rfind("--", 0) != 0)
+		{
+			if (!parse_count(argv[i], parsed))
+			{
+				std::cerr << "Error: particle count must be numeric" << std::endl;
+				return 1;
+			}
+			// The upper bound depends on the device memory, checked once it is known
+			if (parsed == 0)
+			{
+				std::cerr << "Error: particle count must be > 0" << std::endl;
+				return 1;
+			}
+			options.nb_particles = static_cast<size_t>(parsed);
+			countParsed = true;
+		}
+		else
+		{
+			std::cerr << USAGE << std::endl;
 			return 1;
 		}
-		particle_count = static_cast<size_t>(parsed);
 	}
-	if (!glfwInit())
+	// Headless check of the update kernel against the scalar reference, no window is opened
+	if (options.validate_steps > 0)
+		return runValidation(options.validate_steps, countParsed ? options.nb_particles : VALIDATE_PARTICLES, options.profile) ? 0 : 1;
+	if (!options.output_path.empty() && !headless)
+	{
+		std::cerr << "Error: --output is only used with --headless" << std::endl;
+		return 1;
+	}
+	if (rankParsed != (ranks > 1) || rank >= ranks)
+	{
+		std::cerr << "Error: --ranks n and --rank r (below n) go together" << std::endl;
+		return 1;
+	}
+	if (hosts.size() > 1 && hosts.size() != ranks)
+	{
+		std::cerr << "Error: --hosts needs one host per rank, or a single one" << std::endl;
+		return 1;
+	}
+	if (rank > 0 && headless)
+	{
+		std::cerr << "Error: only rank 0 renders, --headless is for rank 0" << std::endl;
+		return 1;
+	}
+	if ((servePort != 0) + (serverPort != 0) + (ranks > 1) > 1)
+	{
+		std::cerr << "Error: --serve, --connect and --ranks don't go together" << std::endl;
+		return 1;
+	}
+	if (servePort && headless)
+	{
+		std::cerr << "Error: a server draws nothing, --headless is for its viewers" << std::endl;
+		return 1;
+	}
+	// Like the workers, a server only needs a GL context for the shared particle buffers.
+	// A viewer is connected before its window opens so a wrong address fails right away
+	StreamServer server;
+	StreamClient client;
+	if (servePort)
+	{
+		if (!server.listen(servePort))
+			return 1;
+		options.stream_server = &server;
+		headless = true;
+	}
+	else if (serverPort)
+	{
+		if (!client.connect(serverHost, serverPort))
+			return 1;
+		options.stream_client = &client;
+	}
+	// Every rank is connected before anything is allocated, the workers draw nothing and only
+	// need a GL context for the shared particle buffers
+	Cluster cluster;
+	if (ranks > 1)
+	{
+		if (hosts.empty())
+			hosts.push_back("127.0.0.1");
+		if (hosts.size() == 1)
+			hosts.resize(ranks, hosts[0]);
+		if (!cluster.connect(rank, ranks, hosts, port))
+			return 1;
+		options.cluster = &cluster;
+		headless = headless || rank > 0;
+	}
+	// Offscreen EGL context in place of the window, outlives the particle system
+	Offscreen offscreen;
+	if (headless)
+	{
+		if (!offscreen.createContext())
+			return 1;
+		options.offscreen = &offscreen;
+	}
+	else if (!glfwInit())
 	{
 		std::cerr << "Failed to initialize GLFW" << std::endl;
 		return -1;
 	}
-	particle_system particle_sys(particle_count);
-	if (!particle_sys.initCLdata())
+	particle_system particle_sys(options);
+	// Kernels keep building while the window starts drawing
+	if (!particle_sys.startCLdata())
 		return 1;
 	std::cout << std::endl;
 	std::cout << "Welcome to particle_system" << std::endl;
 	std::cout << "Press 'H' key to see the list of available commands" << std::endl;
 	std::cout << "Press 'M' to start attracting particles to the mass" << std::endl;
-	particle_sys.run();
-	return 0;
+	return particle_sys.run() ? 0 : 1;
 }
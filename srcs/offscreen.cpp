@@ -0,0 +1,197 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   offscreen.cpp                                      :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: tmoragli <tmoragli@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 17:12:05 by tmoragli          #+#    #+#             */
+/*   Updated: 2026/10/19 17:12:05 by tmoragli         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "offscreen.hpp"
+#include <iostream>
+#include <algorithm>
+
+// Third-party code, not held to the project warnings
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wsign-compare"
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+#pragma GCC diagnostic ignored "-Wtype-limits"
+#pragma GCC diagnostic ignored "-Wimplicit-fallthrough"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#pragma GCC diagnostic pop
+
+namespace psys
+{
+	Offscreen::Offscreen()
+		: display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT), fbo(0), colorRb(0), depthRb(0), width(0), height(0)
+	{
+	}
+
+	Offscreen::~Offscreen()
+	{
+		if (context != EGL_NO_CONTEXT)
+		{
+			if (fbo)
+				glDeleteFramebuffers(1, &fbo);
+			if (colorRb)
+				glDeleteRenderbuffers(1, &colorRb);
+			if (depthRb)
+				glDeleteRenderbuffers(1, &depthRb);
+			eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			eglDestroyContext(display, context);
+		}
+		if (display != EGL_NO_DISPLAY)
+			eglTerminate(display);
+	}
+
+	/*
+		Compatibility profile like the GLFW window, the renderer still sets the fixed function matrices.
+		Mesa's surfaceless platform is tried first, the default display otherwise
+	*/
+	bool Offscreen::createContext()
+	{
+		auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+		if (getPlatformDisplay)
+			display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		if (display == EGL_NO_DISPLAY)
+			display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		EGLint major = 0;
+		EGLint minor = 0;
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+		{
+			std::cerr << "Failed to initialize EGL: " << std::hex << eglGetError() << std::dec << std::endl;
+			display = EGL_NO_DISPLAY;
+			return false;
+		}
+		if (!eglBindAPI(EGL_OPENGL_API))
+		{
+			std::cerr << "Failed to bind the OpenGL API to EGL" << std::endl;
+			return false;
+		}
+
+		// Nothing is drawn to an EGL surface, any OpenGL config will do (or none with EGL_KHR_no_config_context)
+		const EGLint configAttribs[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+		EGLConfig config = EGL_NO_CONFIG_KHR;
+		EGLint configCount = 0;
+		if (!eglChooseConfig(display, configAttribs, &config, 1, &configCount) || configCount == 0)
+			config = EGL_NO_CONFIG_KHR;
+
+		const EGLint contextAttribs[] = {
+			EGL_CONTEXT_MAJOR_VERSION, 4,
+			EGL_CONTEXT_MINOR_VERSION, 3,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+			EGL_NONE
+		};
+		context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+		if (context == EGL_NO_CONTEXT)
+		{
+			std::cerr << "Failed to create an OpenGL 4.3 EGL context: " << std::hex << eglGetError() << std::dec << std::endl;
+			return false;
+		}
+		if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+		{
+			std::cerr << "Failed to make the surfaceless EGL context current: " << std::hex << eglGetError() << std::dec << std::endl;
+			return false;
+		}
+		std::cout << "Headless EGL " << major << "." << minor << " context on " << eglQueryString(display, EGL_VENDOR) << std::endl;
+		return true;
+	}
+
+	/*
+		Color and depth renderbuffers standing in for the window, left bound for the whole run
+	*/
+	bool Offscreen::createFramebuffer(int w, int h)
+	{
+		width = w;
+		height = h;
+		glGenRenderbuffers(1, &colorRb);
+		glBindRenderbuffer(GL_RENDERBUFFER, colorRb);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glGenRenderbuffers(1, &depthRb);
+		glBindRenderbuffer(GL_RENDERBUFFER, depthRb);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRb);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRb);
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		if (status != GL_FRAMEBUFFER_COMPLETE)
+		{
+			std::cerr << "Offscreen framebuffer incomplete: " << std::hex << status << std::dec << std::endl;
+			return false;
+		}
+		pixels.resize(static_cast<size_t>(width) * height * 4);
+		return true;
+	}
+
+	bool Offscreen::ready() const
+	{
+		return fbo != 0;
+	}
+
+	/*
+		Blocking read of the color attachment, GL rows are bottom first and get flipped
+	*/
+	bool Offscreen::readFrame()
+	{
+		if (!ready())
+			return false;
+		const size_t row = static_cast<size_t>(width) * 4;
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		for (int y = 0; y < height / 2; ++y)
+			std::swap_ranges(pixels.begin() + y * row, pixels.begin() + (y + 1) * row, pixels.begin() + (height - 1 - y) * row);
+		GLenum glErr = glGetError();
+		if (glErr != GL_NO_ERROR)
+		{
+			std::cerr << "Failed to read back the offscreen frame: " << glErr << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	bool Offscreen::writePng(const std::string &path) const
+	{
+		if (!stbi_write_png(path.c_str(), width, height, 4, pixels.data(), width * 4))
+		{
+			std::cerr << "Failed to write frame: " << path << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	/*
+		Tightly packed RGBA rows, what an encoder reading rawvideo rgba expects
+	*/
+	bool Offscreen::writeRaw(FILE *stream) const
+	{
+		if (fwrite(pixels.data(), 1, pixels.size(), stream) != pixels.size())
+		{
+			std::cerr << "Failed to pipe the frame to the encoder" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	std::string numberedPath(const std::string &pattern, unsigned int number)
+	{
+		size_t first = pattern.find('#');
+		if (first == std::string::npos)
+			return pattern;
+		size_t last = pattern.find_first_not_of('#', first);
+		size_t digits = (last == std::string::npos ? pattern.size() : last) - first;
+		std::string value = std::to_string(number);
+		if (value.size() < digits)
+			value.insert(0, digits - value.size(), '0');
+		return pattern.substr(0, first) + value + (last == std::string::npos ? "" : pattern.substr(last));
+	}
+};
@@ -12,33 +12,146 @@
 
 #include "particle_system.hpp"
 #include "cl_ext_loader.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <iomanip>
+#include <csignal>
 
 namespace psys
 {
-	particle_system::particle_system(const size_t &nbParticles)
+	particle_system::particle_system(const launch_options &options)
 		: windowHeight(W_HEIGHT), windowWidth(W_WIDTH), windowPosX(0), windowPosY(0),
 		windowedWidth(W_WIDTH), windowedHeight(W_HEIGHT), fullscreen(false), _window(nullptr),
-		nb_particles(nbParticles), default_nb_particles(nbParticles), rng(std::random_device{}())
+		nb_particles(options.nb_particles), default_nb_particles(options.nb_particles),
+		particleBufferSize(options.nb_particles), rng(std::random_device{}())
 	{
+		launchTime = std::chrono::steady_clock::now();
+		// The count is the whole system: each worker starts with its share of the shape and owns the
+		// slab of x it was given, rank 0 only holds the decimated view
+		cluster = options.cluster;
+		clusterFirst = 0;
+		clusterTotal = 0;
+		slabLow = -INFINITY;
+		slabHigh = INFINITY;
+		viewPending = false;
+		if (cluster && cluster->rank() == 0)
+			nb_particles = std::min<size_t>(nb_particles, CLUSTER_VIEW_PARTICLES);
+		else if (cluster)
+		{
+			const unsigned int workers = cluster->ranks() - 1;
+			const unsigned int slab = cluster->rank() - 1;
+			const float width = static_cast<float>(cubeSize) / workers;
+			clusterTotal = nb_particles;
+			clusterFirst = slab * (clusterTotal / workers);
+			nb_particles = slab + 1 == workers ? clusterTotal - clusterFirst : clusterTotal / workers;
+			if (slab > 0)
+				slabLow = -(cubeSize / 2.0f) + slab * width;
+			if (slab + 1 < workers)
+				slabHigh = -(cubeSize / 2.0f) + (slab + 1) * width;
+		}
+		// A viewer's buffers only hold the placeholder until the first frame, they grow to fit the frames
+		streamServer = options.stream_server;
+		streamClient = options.stream_client;
+		if (streamClient)
+			nb_particles = std::min<size_t>(nb_particles, STREAM_START_PARTICLES);
+		default_nb_particles = nb_particles;
+		particleBufferSize = nb_particles;
 		std::cout << "Starting particle system with: " << nb_particles << " particles" << std::endl;
 
+		lod.resolution = options.lod_resolution;
+		fieldPath = options.field_path;
+		colliderPath = options.collider_path;
+		collidersLoaded = false;
+		simDelta = 1.0f / options.tick_rate;
+		simRunning = false;
+		simFailed = false;
+		simTicks = 0;
+		simTickTotal = 0;
+		simStepMs = 0.0f;
+		// Never reset, resets and respawns move the particle birth forward instead
+		trailClock = 0;
+		trailTimer = 0.0f;
+		benchSeconds = options.bench_seconds;
+		buildProfile = options.profile;
+		heavyShare = options.heavy_percent / 100.0f;
+		tracerShare = options.tracer_percent / 100.0f;
+		benchStarted = false;
+		offscreen = options.offscreen;
+		headlessFirst = options.headless_first;
+		headlessLast = options.headless_last;
+		outputPath = options.output_path;
+		frameHistory.fill(0.0f);
+		simHistory.fill(0.0f);
+		historyIndex = 0;
+		lastFrameStamp = launchTime;
+		lastGpuMs = 0.0f;
+		interopMs = 0.0f;
+		deviceGlobalMem = 0;
+		// Kept across resets, the frame texture is created on the first splat
+		splatMode = options.splat;
+		splatFrameTex = 0;
+		splatWidth = 0;
+		splatHeight = 0;
+
+		// Adaptive quality, starts at full quality and steps down if the budget is missed.
+		// Rank 0 of a cluster and a remote viewer show whatever they receive, there is no count to govern
+		governorMode = options.governor && !cluster && !streamClient;
+		governorBudgetMs = 1000.0f / options.target_fps;
+		qualityLevel = quality_levels.size() - 1;
+		frameTimerIndex = 0;
+		resetGovernorWindow();
+		underBudgetWindows = 0;
+		selected_device = nullptr;
+		// Kept by resets, only the final teardown releases them
+		context = nullptr;
+		createEventFromGLsync = nullptr;
+		sdfImageCL = nullptr;
 		initSimData();
 		reset_shape = particleShape::CUBE;
-		initGLFW();
+		// Starts from the file when it maps, the cube otherwise
+		cloud = {nullptr, 0, nullptr, 0, {0, 0, 0, 0}};
+		if (!options.load_path.empty() && mapPointCloud(options.load_path))
+			reset_shape = particleShape::CLOUD;
+		// Headless, main has made the EGL context current and the framebuffer object stands in for the window
+		if (!offscreen)
+			initGLFW();
 		initGlew();
+		if (offscreen)
+			offscreen->createFramebuffer(windowWidth, windowHeight);
 		reshapeAction(windowWidth, windowHeight);
+
+		// The chunk size depends on the device allocation limit
+		selectDevice();
+		queryDeviceLimits();
+		planMemoryBudget();
+		// A partial allocation lowers the counts to what it got, none at all stops finishCLdata()
 		initSharedBufferData();
+		initDensityVolumeData();
+		initGizmoData();
+		glGenQueries(GOVERNOR_TIMER_QUERIES, frameTimers);
+		frameTimerUsed.fill(false);
+		enableParallelShaderCompile();
 		initShaders();
+		// The atlas is baked once, the overlay simply stays off without a font
+		hudMode = hud.init(options.font_path.empty() ? HUD_FONT_PATH : options.font_path, hudShaderProgram);
+		shadersReady = false;
+		firstFrameShown = false;
+		firstParticlesShown = false;
 	}
 
 	particle_system::~particle_system()
 	{
 		freeCLdata(false);
+		unmapPointCloud();
 	}
 
 	bool particle_system::initGlew()
 	{
 		GLenum err = glewInit();
+		// GLEW looks for a GLX display after loading the entry points, there is none under EGL
+		if (offscreen && err == GLEW_ERROR_NO_GLX_DISPLAY)
+			err = GLEW_OK;
 		if (err != GLEW_OK)
 		{
 			std::cerr << "Error initializing GLEW" << glewGetErrorString(err) << std::endl;
@@ -95,15 +208,225 @@ namespace psys
 		nextRandomRotationDelay = 1.0f;
 	}
 
-	void particle_system::run()
+	bool particle_system::run()
 	{
+		if (cluster && cluster->rank() > 0)
+			return runWorker();
+		if (streamServer)
+			return runServer();
+		if (offscreen)
+			return runHeadless();
+
 		// Main loop
-		while (!glfwWindowShouldClose(_window))
+		while (!glfwWindowShouldClose(_window) && !simFailed)
 		{
+			// Pieces still building in the background join as soon as they are ready
+			if (!shadersReady)
+				shadersReady = pollShaders();
+			if (!simReady && programsReady() && !finishCLdata())
+				return false;
 			glClear(GL_COLOR_BUFFER_BIT);
 			update();
 			glfwPollEvents();
 		}
+		return !simFailed;
+	}
+
+	/*
+		Offscreen main loop: waits for the build, then renders one frame per simulation tick so the
+		sequence plays back at the tick rate. Frames before headlessFirst only warm up, the others are
+		timed (render through glFinish, then readback and output) and written out when asked
+	*/
+	bool particle_system::runHeadless()
+	{
+		if (!offscreen->ready())
+			return false;
+		waitForPrograms();
+		if (!simReady && !finishCLdata())
+			return false;
+		while (!(shadersReady = pollShaders()))
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+		FILE *encoder = nullptr;
+		if (!outputPath.empty() && outputPath[0] == '|')
+		{
+			encoder = popen(outputPath.c_str() + 1, "w");
+			if (!encoder)
+			{
+				std::cerr << "Failed to start the frame encoder: " << outputPath.c_str() + 1 << std::endl;
+				return false;
+			}
+			std::cout << "Piping " << windowWidth << "x" << windowHeight << " RGBA frames to: " << outputPath.c_str() + 1 << std::endl;
+		}
+
+		std::vector<float> renderTimes;
+		unsigned long lastTick = simTickTotal;
+		bool written = true;
+		for (unsigned int frame = 0; frame <= headlessLast && written; ++frame)
+		{
+			while (simTickTotal == lastTick && !simFailed)
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			if (simFailed)
+			{
+				written = false;
+				break;
+			}
+			lastTick = simTickTotal;
+
+			auto frameStart = std::chrono::steady_clock::now();
+			glClear(GL_COLOR_BUFFER_BIT);
+			update();
+			glFinish();
+			auto outputStart = std::chrono::steady_clock::now();
+			float renderMs = std::chrono::duration<float, std::milli>(outputStart - frameStart).count();
+			if (frame < headlessFirst)
+				continue;
+			renderTimes.push_back(renderMs);
+
+			std::cout << "Frame " << frame << ": " << renderMs << " ms render";
+			if (!outputPath.empty())
+			{
+				written = offscreen->readFrame()
+					&& (encoder ? offscreen->writeRaw(encoder) : offscreen->writePng(numberedPath(outputPath, frame)));
+				std::cout << ", " << std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - outputStart).count()
+					<< " ms output";
+			}
+			std::cout << std::endl;
+		}
+		if (encoder && pclose(encoder) != 0)
+		{
+			std::cerr << "Frame encoder exited with an error" << std::endl;
+			written = false;
+		}
+
+		if (!renderTimes.empty())
+		{
+			std::vector<float> sorted = renderTimes;
+			std::sort(sorted.begin(), sorted.end());
+			float sum = 0.0f;
+			for (float ms : sorted)
+				sum += ms;
+			std::cout << "Headless: " << sorted.size() << " frames at " << windowWidth << "x" << windowHeight << " with "
+				<< nb_particles << " particles, render " << sum / sorted.size() << " ms average, "
+				<< sorted[sorted.size() / 2] << " ms median, " << sorted.front() << " - " << sorted.back() << " ms" << std::endl;
+		}
+		return written;
+	}
+
+	/*
+		Worker main loop, nothing is drawn: every CLUSTER_STEP from rank 0 is one tick of the local
+		particles, then the ones that left the slab change worker and a decimated copy goes back
+		for display. Ends when rank 0 closes its connection
+	*/
+	bool particle_system::runWorker()
+	{
+		waitForPrograms();
+		if (!simReady && !finishCLdata())
+			return false;
+		std::cout << "Worker " << cluster->rank() << ": slab [" << slabLow << ", " << slabHigh << ") on x, "
+			<< nb_particles << " particles to start" << std::endl;
+
+		std::vector<unsigned char> payload;
+		while (cluster->receive(0, CLUSTER_STEP, payload))
+		{
+			if (payload.size() != sizeof(sim_params))
+			{
+				std::cerr << "Failed to read the step sent by rank 0: " << payload.size() << " bytes" << std::endl;
+				return false;
+			}
+			sim_params params;
+			memcpy(&params, payload.data(), sizeof(params));
+			// The species are index ranges, migration reshuffles them every tick: every particle is passive here
+			params.e.enabled = 0u;
+			params.tracer_start = 0;
+			params.passive_start = 0;
+
+			cluster_summary summary = {0, 0, 0, 0.0f, 0.0f};
+			auto stepStart = std::chrono::steady_clock::now();
+			if (!enqueueUpdateParticles(params))
+				return false;
+			auto exchangeStart = std::chrono::steady_clock::now();
+			if (!migrateParticles(summary.migrated))
+				return false;
+			summary.stepMs = std::chrono::duration<float, std::milli>(exchangeStart - stepStart).count();
+			summary.exchangeMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - exchangeStart).count();
+			summary.count = nb_particles;
+			simTickTotal++;
+			if (!sendViewSample(summary))
+				return false;
+		}
+		std::cout << "Worker " << cluster->rank() << ": stopped by rank 0 after " << simTickTotal << " ticks, "
+			<< nb_particles << " particles in the slab" << std::endl;
+		return true;
+	}
+
+	// Set by SIGINT/SIGTERM while serving
+	static volatile std::sig_atomic_t serveStopped = 0;
+
+	static void stopServing(int)
+	{
+		serveStopped = 1;
+	}
+
+	/*
+		--serve main loop, nothing is drawn: the simulation thread ticks as usual and each new tick a
+		viewer can take is quantized on the device, read back once and compressed for every viewer.
+		The viewers' input drives the simulation, the most recent acknowledgement wins
+	*/
+	bool particle_system::runServer()
+	{
+		waitForPrograms();
+		if (!simReady && !finishCLdata())
+			return false;
+
+		// Ctrl+C or a kill leave the loop, the destructor then releases the GL/CL data as usual
+		serveStopped = 0;
+		std::signal(SIGINT, stopServing);
+		std::signal(SIGTERM, stopServing);
+
+		std::vector<unsigned char> input;
+		unsigned long lastTick = simTickTotal;
+		auto reportStart = std::chrono::steady_clock::now();
+		while (!serveStopped && !simFailed)
+		{
+			if (!streamServer->service(input, sizeof(sim_params)))
+				return false;
+			if (input.size() == sizeof(sim_params))
+			{
+				sim_params params;
+				memcpy(&params, input.data(), sizeof(params));
+				// The viewer's species ranges index its own particles
+				params.tracer_start = tracer_start;
+				params.passive_start = passive_start;
+				params.emitter_start = emitter_start;
+				simChannel.push(params);
+			}
+			input.clear();
+
+			unsigned long tick = simTickTotal;
+			if (tick != lastTick && streamServer->wantsFrame())
+			{
+				lastTick = tick;
+				if (!quantizeParticles())
+					return false;
+				streamServer->publish(streamQuantized.data(), nb_particles, static_cast<uint32_t>(tick));
+			}
+			streamServer->flush();
+
+			auto now = std::chrono::steady_clock::now();
+			std::chrono::duration<double> reportTime = now - reportStart;
+			if (reportTime.count() >= 1.0)
+			{
+				streamServer->report(reportTime.count());
+				reportStart = now;
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+		std::signal(SIGINT, SIG_DFL);
+		std::signal(SIGTERM, SIG_DFL);
+		std::cout << "Server stopped after " << simTickTotal << " ticks, " << streamServer->viewers()
+			<< " viewers still connected" << std::endl;
+		return !simFailed;
 	}
 
 	void particle_system::findMoveRotationSpeed()
@@ -148,13 +471,62 @@ namespace psys
 			resetSimulation();
 			camera.reset();
 		}
-		else
-			enqueueUpdateParticles();
+		else if (simReady)
+		{
+			// A full snapshot each frame, a push dropped on a full channel is replaced by the next one
+			simChannel.push(currentSimParams());
+			if (cluster || streamClient)
+				uploadViewFrame();
+		}
 		return ;
 	}
 
+	/*
+		Rank 0 of a distributed run and a remote viewer simulate nothing: the last particles received
+		replace the local ones, written straight into the GL buffers
+	*/
+	void particle_system::uploadViewFrame()
+	{
+		std::vector<particle> frame;
+		{
+			std::lock_guard<std::mutex> lock(viewMutex);
+			if (!viewPending)
+				return;
+			frame.swap(viewFrame);
+			viewPending = false;
+		}
+		if (frame.size() > particleBufferSize && !growParticleBuffer(frame.size()))
+			frame.resize(particleBufferSize);
+
+		const auto now = std::chrono::steady_clock::now();
+		size_t uploaded = 0;
+		for (particle_chunk &chunk : chunks)
+		{
+			if (uploaded >= frame.size())
+				break;
+			size_t count = std::min(chunk.capacity, frame.size() - uploaded);
+			std::lock_guard<std::mutex> lock(*chunk.lock);
+			glBindBuffer(GL_ARRAY_BUFFER, chunk.bufferGL);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(particle), frame.data() + uploaded);
+			// pos_prev came along so the renderer still interpolates, the local trail history matches nothing
+			chunk.tick = now;
+			chunk.trailValidFrom = chunk.trailClock;
+			uploaded += count;
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		nb_particles = frame.size();
+		updateSpeciesRanges();
+	}
+
 	void particle_system::renderParticles(glm::mat4& viewMatrix)
 	{
+		glm::mat4 viewProj = projectionMatrix * viewMatrix;
+		const bool volumePass = lodMode && !spaghettiMode;
+
+		// Far particles first, the near points are drawn over the volume
+		if (volumePass)
+			renderDensityVolume(viewProj);
+
 		// Activate shader
 		glEnable(GL_DEPTH_TEST);
 		glEnable(GL_BLEND);
@@ -164,7 +536,6 @@ namespace psys
 		glUseProgram(activeShader);
 
 		// Set the view-projection matrix uniform
-		glm::mat4 viewProj = projectionMatrix * viewMatrix;
 		GLint vpLoc = glGetUniformLocation(activeShader, "u_viewProj");
 		glUniformMatrix4fv(vpLoc, 1, GL_FALSE, glm::value_ptr(viewProj));
 
@@ -172,65 +543,311 @@ namespace psys
 		if (!spaghettiMode)
 		{
 			const GLint strideFloats = sizeof(particle) / sizeof(float);
-			const GLint trailOffset = static_cast<GLint>(offsetof(particle, trail) / sizeof(float));
-			const GLint trailHeadOffset = static_cast<GLint>(offsetof(particle, trail_head) / sizeof(float));
-
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particleBufferGL);
+			const GLint trailBirthOffset = static_cast<GLint>(offsetof(particle, trail_birth) / sizeof(float));
 
 			if (GLint loc = glGetUniformLocation(activeShader, "u_trailMode"); loc != -1)
 				glUniform1i(loc, trailingMode ? 1 : 0);
 			if (GLint loc = glGetUniformLocation(activeShader, "u_trailSamples"); loc != -1)
+				glUniform1i(loc, currentQuality().trail_samples);
+			if (GLint loc = glGetUniformLocation(activeShader, "u_trailCapacity"); loc != -1)
 				glUniform1i(loc, TRAIL_SAMPLES);
 			if (GLint loc = glGetUniformLocation(activeShader, "u_particleStride"); loc != -1)
 				glUniform1i(loc, strideFloats);
-			if (GLint loc = glGetUniformLocation(activeShader, "u_trailOffset"); loc != -1)
-				glUniform1i(loc, trailOffset);
-			if (GLint loc = glGetUniformLocation(activeShader, "u_trailHeadOffset"); loc != -1)
-				glUniform1i(loc, trailHeadOffset);
+			if (GLint loc = glGetUniformLocation(activeShader, "u_trailBirthOffset"); loc != -1)
+				glUniform1i(loc, trailBirthOffset);
+
+			// Motion blur streaks, sized in ticks so they cover the same time at any tick rate
+			if (GLint loc = glGetUniformLocation(activeShader, "u_motionBlur"); loc != -1)
+				glUniform1i(loc, motionBlurMode ? 1 : 0);
+			if (GLint loc = glGetUniformLocation(activeShader, "u_blurScale"); loc != -1)
+				glUniform1f(loc, MOTION_BLUR_TIME / simDelta);
+			if (GLint loc = glGetUniformLocation(activeShader, "u_blurMaxLength"); loc != -1)
+				glUniform1f(loc, MOTION_BLUR_MAX_LENGTH);
+
+			// Density volume LOD culling
+			if (GLint loc = glGetUniformLocation(activeShader, "u_lodMode"); loc != -1)
+				glUniform1i(loc, volumePass ? 1 : 0);
+			if (GLint loc = glGetUniformLocation(activeShader, "u_lodDistance"); loc != -1)
+				glUniform1f(loc, lod.distance);
+			if (GLint loc = glGetUniformLocation(activeShader, "u_eye"); loc != -1)
+				glUniform3f(loc, lod.eye.x, lod.eye.y, lod.eye.z);
+			if (GLint loc = glGetUniformLocation(activeShader, "u_gridMin"); loc != -1)
+				glUniform3f(loc, lod.grid_min.x, lod.grid_min.y, lod.grid_min.z);
+			if (GLint loc = glGetUniformLocation(activeShader, "u_gridSize"); loc != -1)
+				glUniform1f(loc, lod.cell_size * lod.resolution);
 		}
 
-		// Bind the VAO
-		glBindVertexArray(vao);
+		// The particle dots are short lines, their width is the point size
+		glLineWidth(currentQuality().point_size);
 
-		if (spaghettiMode && nb_particles >= 1024)
-		{
-			glDrawArrays(GL_LINE_STRIP, 0, nb_particles);
-		}
-		else
+		// One draw per chunk, the particle and trail SSBOs follow the chunk being drawn
+		GLint alphaLoc = glGetUniformLocation(activeShader, "u_alpha");
+		GLint trailStrideLoc = glGetUniformLocation(activeShader, "u_trailStride");
+		GLint trailClockLoc = glGetUniformLocation(activeShader, "u_trailClock");
+		GLint trailValidFromLoc = glGetUniformLocation(activeShader, "u_trailValidFrom");
+		for (particle_chunk &chunk : chunks)
 		{
-			// Draw each particle as a point
-			glDrawArrays(GL_POINTS, 0, nb_particles);
+			GLsizei count = static_cast<GLsizei>(chunkActiveCount(chunk));
+			if (count == 0)
+				break;
+
+			// Waits only while the simulation thread is stepping this chunk
+			auto waitStart = std::chrono::steady_clock::now();
+			std::lock_guard<std::mutex> lock(*chunk.lock);
+			interopMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
+			float sinceTick = std::chrono::duration<float>(std::chrono::steady_clock::now() - chunk.tick).count();
+			glUniform1f(alphaLoc, std::clamp(sinceTick / simDelta, 0.0f, 1.0f));
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, chunk.bufferGL);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, chunk.trailGL);
+			// The clock is read under the chunk lock, it matches the history being drawn
+			glUniform1i(trailStrideLoc, static_cast<GLint>(chunk.capacity));
+			glUniform1ui(trailClockLoc, chunk.trailClock);
+			glUniform1ui(trailValidFromLoc, chunk.trailValidFrom);
+			glBindVertexArray(chunk.vao);
+
+			if (spaghettiMode && nb_particles >= 1024)
+			{
+				glDrawArrays(GL_LINE_STRIP, 0, count);
+			}
+			else
+			{
+				// Draw each particle as a point
+				glDrawArrays(GL_POINTS, 0, count);
+			}
+			fenceChunk(chunk);
 		}
 		
 		// Clean up
 		glBindVertexArray(0);
 		glUseProgram(0);
 
-		// Render the mass point
+		// Mass and emitter spheres
+		renderGizmos(viewProj);
+	}
+
+	/*
+		Draws every visible gizmo sphere with one instanced call,
+		only the small instance buffer is updated per frame
+	*/
+	void particle_system::renderGizmos(const glm::mat4 &viewProj)
+	{
+		std::vector<gizmo_instance> instances;
 		if (massDisplay)
+			instances.push_back({m.pos, m.radius * 0.3f, Color(0.0f, 0.0f, 0.0f)});
+		if (emitterDisplay)
+			instances.push_back({e.pos, e.spawn_radius, Color(1.0f, 1.0f, 1.0f)});
+		if (instances.empty())
+			return;
+		if (instances.size() > GIZMO_MAX_INSTANCES)
+			instances.resize(GIZMO_MAX_INSTANCES);
+
+		glBindBuffer(GL_ARRAY_BUFFER, gizmoInstanceVBO);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(gizmo_instance), instances.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		glEnable(GL_DEPTH_TEST);
+		glUseProgram(gizmoShaderProgram);
+		glUniformMatrix4fv(glGetUniformLocation(gizmoShaderProgram, "u_viewProj"), 1, GL_FALSE, glm::value_ptr(viewProj));
+		glBindVertexArray(gizmoVao);
+		glDrawElementsInstanced(GL_TRIANGLES, gizmoIndexCount, GL_UNSIGNED_INT, nullptr, static_cast<GLsizei>(instances.size()));
+		glBindVertexArray(0);
+		glUseProgram(0);
+	}
+
+	/*
+		Performance overlay: frame and tick time graphs, per stage timings, counts and device memory.
+		Everything is queued in the HUD batch, the whole panel is one draw call
+	*/
+	void particle_system::renderHud()
+	{
+		const glm::vec4 text(1.0f, 1.0f, 1.0f, 1.0f);
+		const glm::vec4 dim(0.7f, 0.7f, 0.7f, 1.0f);
+		const glm::vec4 frameColor(0.3f, 0.9f, 0.4f, 0.9f);
+		const glm::vec4 simColor(1.0f, 0.6f, 0.2f, 0.9f);
+		const float margin = 10.0f;
+		const float line = hud.lineHeight();
+		const float graphHeight = 40.0f;
+		const float graphWidth = HUD_PANEL_WIDTH - 2.0f * margin;
+		const float tickMs = simDelta * 1000.0f;
+		sim_stats s = latestStats();
+
+		float frameSum = 0.0f;
+		size_t frameSamples = 0;
+		for (float ms : frameHistory)
 		{
-			glPushMatrix();
-			glTranslatef(m.pos.x, m.pos.y, m.pos.z);
-			glColor3f(0.0f, 0.0f, 0.0f);
-			GLUquadric* quad = gluNewQuadric();
-			gluSphere(quad, m.radius*0.3, 80, 80);
-			gluDeleteQuadric(quad);
-			glPopMatrix();
+			if (ms > 0.0f)
+			{
+				frameSum += ms;
+				frameSamples++;
+			}
+		}
+		float frameAvg = frameSamples ? frameSum / frameSamples : 0.0f;
+		float frameLast = frameHistory[(historyIndex + HUD_GRAPH_SAMPLES - 1) % HUD_GRAPH_SAMPLES];
+
+		std::vector<std::pair<std::string, glm::vec4>> lines;
+		std::ostringstream out;
+		out.setf(std::ios::fixed);
+		out.precision(2);
+		auto push = [&](const glm::vec4 &color) {
+			lines.push_back({out.str(), color});
+			out.str("");
+		};
+		out << "FPS " << (frameAvg > 0.0f ? 1000.0f / frameAvg : 0.0f) << "  frame " << frameLast << " ms (avg " << frameAvg << ")";
+		push(text);
+		out << "sim " << static_cast<float>(simStepMs) << " ms/tick at " << 1.0f / simDelta << " Hz";
+		push(simColor);
+		out << "interop " << interopMs << " ms  render " << lastGpuMs << " ms GPU";
+		push(text);
+		out << "particles " << nb_particles << "  live emitter " << s.live_emitter << "  in mass " << s.inside_mass;
+		push(text);
+		out << "kinetic energy " << s.kinetic_energy << "  max speed " << s.max_speed;
+		push(dim);
+		out << "device memory " << deviceMemoryUsed() / double(1 << 20) << " / " << deviceGlobalMem / double(1 << 20) << " MB";
+		push(dim);
+		out << "quality " << qualityLevel << "/" << quality_levels.size() - 1 << (governorMode ? ", governor on" : ", governor off");
+		push(dim);
+
+		float panelHeight = margin * 2.0f + lines.size() * line + 2.0f * (graphHeight + line);
+		hud.begin(windowWidth, windowHeight);
+		hud.rect(0.0f, 0.0f, HUD_PANEL_WIDTH, panelHeight, glm::vec4(0.0f, 0.0f, 0.0f, 0.45f));
+		float y = margin;
+		for (const auto &entry : lines)
+		{
+			hud.text(margin, y, entry.first, entry.second);
+			y += line;
 		}
 
-		// Render the emitter
-		if (emitterDisplay)
+		// Graphs scaled to twice the budget, the line marks the budget itself
+		out << "frame time, 0 - " << 2.0f * governorBudgetMs << " ms";
+		hud.text(margin, y, out.str(), dim);
+		out.str("");
+		y += line;
+		hud.graph(margin, y, graphWidth, graphHeight, frameHistory.data(), HUD_GRAPH_SAMPLES, historyIndex, 2.0f * governorBudgetMs, frameColor);
+		hud.rect(margin, y + graphHeight * 0.5f, graphWidth, 1.0f, text);
+		y += graphHeight;
+
+		out << "sim step, 0 - " << 2.0f * tickMs << " ms";
+		hud.text(margin, y, out.str(), dim);
+		out.str("");
+		y += line;
+		hud.graph(margin, y, graphWidth, graphHeight, simHistory.data(), HUD_GRAPH_SAMPLES, historyIndex, 2.0f * tickMs, simColor);
+		hud.rect(margin, y + graphHeight * 0.5f, graphWidth, 1.0f, text);
+		hud.draw();
+	}
+
+	/*
+		Sum of the sizes of every OpenCL buffer and image the system holds
+	*/
+	size_t particle_system::deviceMemoryUsed() const
+	{
+		std::vector<cl_mem> buffers = {densityAccumCL, densityVolumeCL, densityCoarseCL, fieldStagingCL, fieldImagesCL[0],
+			fieldImagesCL[1], sdfImageCL, statsPartialsCL, statsResultCL, queryCellCountsCL, queryCellStartsCL,
+			queryCellCursorCL, queryParticleCellsCL, queryParticlePosCL, querySortedIndexCL, querySortedPosCL, queryResultsCL,
+			splatTileCountsCL, splatTileStartsCL, splatTileCursorCL, splatPointTilesCL, splatPointFragmentsCL,
+			splatTileFragmentsCL, splatFrameCL, emigrantCountCL, emigrantIndexCL, emigrantsCL, migrateMovesCL, viewSamplesCL,
+			streamQuantizedCL};
+		for (const particle_chunk &chunk : chunks)
+		{
+			buffers.push_back(chunk.bufferCL);
+			buffers.push_back(chunk.trailCL);
+		}
+
+		size_t total = 0;
+		for (cl_mem buffer : buffers)
+		{
+			size_t size = 0;
+			if (buffer && clGetMemObjectInfo(buffer, CL_MEM_SIZE, sizeof(size), &size, nullptr) == CL_SUCCESS)
+				total += size;
+		}
+		return total;
+	}
+
+	/*
+		Ray marches the density grid splatted by the far particles,
+		the resolved grid is copied to the 3D textures on the GPU through the shared buffers
+	*/
+	void particle_system::renderDensityVolume(const glm::mat4 &viewProj)
+	{
+		const GLsizei res = static_cast<GLsizei>(lod.resolution);
+		const GLsizei coarseRes = res / LOD_COARSE_FACTOR;
+
+		// Buffer to texture uploads, no round trip through the host
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, densityVolumeGL);
+		glBindTexture(GL_TEXTURE_3D, densityVolumeTex);
+		glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, res, res, res, GL_RGBA, GL_HALF_FLOAT, nullptr);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, densityCoarseGL);
+		glBindTexture(GL_TEXTURE_3D, densityCoarseTex);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, coarseRes, coarseRes, coarseRes, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		// Premultiplied colors from the ray marcher
+		glDisable(GL_DEPTH_TEST);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+		glUseProgram(volumeShaderProgram);
+
+		glm::mat4 invViewProj = glm::inverse(viewProj);
+		glUniformMatrix4fv(glGetUniformLocation(volumeShaderProgram, "u_invViewProj"), 1, GL_FALSE, glm::value_ptr(invViewProj));
+		glUniform3f(glGetUniformLocation(volumeShaderProgram, "u_eye"), lod.eye.x, lod.eye.y, lod.eye.z);
+		glUniform3f(glGetUniformLocation(volumeShaderProgram, "u_gridMin"), lod.grid_min.x, lod.grid_min.y, lod.grid_min.z);
+		glUniform1f(glGetUniformLocation(volumeShaderProgram, "u_gridSize"), lod.cell_size * lod.resolution);
+		glUniform1i(glGetUniformLocation(volumeShaderProgram, "u_resolution"), res);
+		glUniform1i(glGetUniformLocation(volumeShaderProgram, "u_coarseFactor"), LOD_COARSE_FACTOR);
+		glUniform1f(glGetUniformLocation(volumeShaderProgram, "u_lodDistance"), lod.distance);
+		glUniform1i(glGetUniformLocation(volumeShaderProgram, "u_volume"), 0);
+		glUniform1i(glGetUniformLocation(volumeShaderProgram, "u_coarse"), 1);
+
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_3D, densityCoarseTex);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_3D, densityVolumeTex);
+
+		glBindVertexArray(volumeVao);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glBindVertexArray(0);
+		glBindTexture(GL_TEXTURE_3D, 0);
+		glUseProgram(0);
+	}
+
+	/*
+		Point renderer without the GL vertex, geometry and raster stages: OpenCL splats the particles
+		into the frame texture, which is then drawn with the fullscreen triangle of the volume pass.
+		Falls back to renderParticles() for good when the splat fails
+	*/
+	void particle_system::renderSplatPoints(glm::mat4 &viewMatrix)
+	{
+		glm::mat4 viewProj = projectionMatrix * viewMatrix;
+
+		auto splatStart = std::chrono::steady_clock::now();
+		bool splatted = enqueueSplatPoints(viewProj);
+		interopMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - splatStart).count();
+		if (!splatted)
 		{
-			glPushMatrix();
-			glTranslatef(e.pos.x, e.pos.y, e.pos.z);
-			glColor3f(1.0f, 1.0f, 1.0f);
-			GLUquadric* quad = gluNewQuadric();
-			gluSphere(quad, e.spawn_radius, 60, 60);
-			gluDeleteQuadric(quad);
-			glPopMatrix();
+			std::cerr << "Point splatting disabled, back to the GL point renderer" << std::endl;
+			splatMode = false;
+			renderParticles(viewMatrix);
+			return;
 		}
+
+		// Opaque texels, the empty ones are discarded
+		glDisable(GL_DEPTH_TEST);
+		glDisable(GL_BLEND);
+		glUseProgram(splatShaderProgram);
+		glUniform1i(glGetUniformLocation(splatShaderProgram, "u_frame"), 0);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, splatFrameTex);
+		glBindVertexArray(volumeVao);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glBindVertexArray(0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glUseProgram(0);
+
+		// No depth is written by the splat, the gizmos are drawn over the particles
+		renderGizmos(viewProj);
 	}
-	
+
 
 	void particle_system::calculateFps()
 	{
@@ -247,7 +864,7 @@ namespace psys
 			frameCount = 0;
 
 			std::stringstream title;
-			title << "particle_system | FPS: " << fps;
+			title << "particle_system | FPS: " << fps << " | Sim: " << simTicks.exchange(0) / timeInterval << " Hz";
 			glfwSetWindowTitle(_window, title.str().c_str());
 		}
 	}
@@ -272,6 +889,7 @@ namespace psys
 		viewMatrix = glm::rotate(viewMatrix, radX, glm::vec3(0.0f, -1.0f, 0.0f));
 		viewMatrix = glm::translate(viewMatrix, glm::vec3(camera.getPosition()));
 		glLoadMatrixf(glm::value_ptr(viewMatrix));
+		lastViewMatrix = viewMatrix;
 
 		// Update the size
 		update_window_size(windowWidth, windowHeight);
@@ -282,104 +900,631 @@ namespace psys
 		if (emitterFollow)
 			update_emitter_position(projectionMatrix, viewMatrix);
 
-		// Call update kernel
-		updateParticles();
-		
-		// Draw particles
-		renderParticles(viewMatrix);
-		calculateFps();
-		glfwSwapBuffers(_window);
-	}
+		// Until the kernels and shaders are built the scene stays empty
+		bool ready = simReady && shadersReady;
+		auto frameStart = std::chrono::steady_clock::now();
+		frameHistory[historyIndex] = std::chrono::duration<float, std::milli>(frameStart - lastFrameStamp).count();
+		simHistory[historyIndex] = simStepMs;
+		historyIndex = (historyIndex + 1) % HUD_GRAPH_SAMPLES;
+		lastFrameStamp = frameStart;
+		interopMs = 0.0f;
+		if (ready)
+		{
+			beginFrameTimer();
+			// Call update kernel
+			updateParticles();
 
-	void particle_system::update()
-	{
-		// Check for delta and apply to move and rotation speeds
-		findMoveRotationSpeed();
+			// Splat the far particles into the density grid
+			if (lodMode && !spaghettiMode && !splatMode)
+			{
+				auto splatStart = std::chrono::steady_clock::now();
+				update_lod_grid(viewMatrix);
+				enqueueSplatDensity();
+				interopMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - splatStart).count();
+			}
 
-		// Update player position and orientation
-		updateMovement();
+			// Draw particles
+			if (splatMode)
+				renderSplatPoints(viewMatrix);
+			else
+				renderParticles(viewMatrix);
+			glEndQuery(GL_TIME_ELAPSED);
 
-		// Mass control
-		// Increase tangent vector rotation in x, y z respectively
-		if (keyStates[GLFW_KEY_U])
-			update_mass_tangent(0.1f, 0.0f, 0.0f);
-		if (keyStates[GLFW_KEY_I])
-			update_mass_tangent(0.0f, 0.1f, 0.0f);
-		if (keyStates[GLFW_KEY_O])
-			update_mass_tangent(0.0f, 0.0f, 0.1f);
-		// Decrease tangent vector rotation in x, y z respectively
-		if (keyStates[GLFW_KEY_J])
-			update_mass_tangent(-0.1f, 0.0f, 0.0f);
-		if (keyStates[GLFW_KEY_K])
-			update_mass_tangent(0.0f, -0.1f, 0.0f);
-		if (keyStates[GLFW_KEY_L])
-			update_mass_tangent(0.0f, 0.0f, -0.1f);
-		if (keyStates[GLFW_KEY_KP_ADD]) m.intensity += 0.1f;
-		if (keyStates[GLFW_KEY_KP_SUBTRACT]) m.intensity -= 0.1f;
+			// Outside the timer, the overlay is not part of the measured frame
+			if (hudMode)
+				renderHud();
+		}
+		float cpuMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+		calculateFps();
+		updateBenchmark(ready);
+		// Offscreen frames stay in the framebuffer object for the readback
+		if (_window)
+			glfwSwapBuffers(_window);
+		reportFirstFrame(ready);
+		if (ready)
+			governQuality(cpuMs);
+	}
 
-		// Optional slow random drift of the mass tangent
-		tickRandomMassRotation();
+	/*
+		Starts the GPU timer of this frame, the query written GOVERNOR_TIMER_QUERIES frames ago
+		is read first when the result is ready so the pipeline never stalls on it
+	*/
+	void particle_system::beginFrameTimer()
+	{
+		GLuint query = frameTimers[frameTimerIndex];
+		if (frameTimerUsed[frameTimerIndex])
+		{
+			GLint available = 0;
+			glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available)
+			{
+				GLuint64 elapsed = 0;
+				glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+				lastGpuMs = elapsed / 1.0e6f;
+				gpuMsSum += lastGpuMs;
+				gpuSamples++;
+			}
+		}
+		glBeginQuery(GL_TIME_ELAPSED, query);
+		frameTimerUsed[frameTimerIndex] = true;
+		frameTimerIndex = (frameTimerIndex + 1) % GOVERNOR_TIMER_QUERIES;
+	}
 
-		display();
+	void particle_system::resetGovernorWindow()
+	{
+		governorWindowStart = std::chrono::steady_clock::now();
+		gpuMsSum = 0.0f;
+		cpuMsSum = 0.0f;
+		gpuSamples = 0;
+		cpuSamples = 0;
 	}
 
 	/*
-		Randomly selects rotation of particles around mass while toggle is active
-		Will also determine the next point in time that it will change
+		Every GOVERNOR_INTERVAL seconds compares the measured frame cost with the budget:
+		one level down as soon as it is over, one level up only after several windows well under it.
+		The simulation shares the GPU, its share is the step time times the ticks per frame
 	*/
-	void particle_system::tickRandomMassRotation()
+	void particle_system::governQuality(float cpuMs)
 	{
-		if (!randomMassRotation)
+		cpuMsSum += cpuMs;
+		cpuSamples++;
+		float windowTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - governorWindowStart).count();
+		if (!governorMode || windowTime < GOVERNOR_INTERVAL)
 			return;
 
-		randomRotationTimer += delta;
-		if (randomRotationTimer < nextRandomRotationDelay)
+		float gpuMs = gpuSamples ? gpuMsSum / gpuSamples : 0.0f;
+		float cpuAvg = cpuSamples ? cpuMsSum / cpuSamples : 0.0f;
+		float simMs = simStepMs;
+		float simShare = simMs * governorBudgetMs / (simDelta * 1000.0f);
+		float frameMs = std::max(gpuMs, cpuAvg) + simShare;
+		resetGovernorWindow();
+
+		size_t level = qualityLevel;
+		std::string reason;
+		if (frameMs > governorBudgetMs * GOVERNOR_DOWNGRADE && level > 0)
+		{
+			underBudgetWindows = 0;
+			level--;
+			reason = "over";
+		}
+		else if (frameMs < governorBudgetMs * GOVERNOR_UPGRADE && level + 1 < quality_levels.size())
+		{
+			if (++underBudgetWindows >= GOVERNOR_UPGRADE_WINDOWS)
+			{
+				underBudgetWindows = 0;
+				level++;
+				reason = "under";
+			}
+		}
+		else
+			underBudgetWindows = 0;
+		if (level == qualityLevel)
 			return;
 
-		// Pick next delay to keep motion slow and slightly unpredictable
-		std::uniform_real_distribution<float> delayDist(0.5f, 3.0f);
-		nextRandomRotationDelay = delayDist(rng);
-		randomRotationTimer = 0.0f;
+		std::cout << "Governor: " << frameMs << " ms/frame (render " << gpuMs << ", cpu " << cpuAvg
+			<< ", sim " << simMs << " ms/tick) " << reason << " the " << governorBudgetMs << " ms budget, quality "
+			<< qualityLevel << " -> " << level << std::endl;
+		applyQualityLevel(level);
+	}
 
-		std::uniform_int_distribution<int> axisDist(0, 2);
-		std::uniform_int_distribution<int> signDist(0, 1);
+	/*
+		Applies every knob of a quality level and logs the result
+	*/
+	void particle_system::applyQualityLevel(size_t level)
+	{
+		qualityLevel = level;
+		const quality_level &q = currentQuality();
+		setParticleCount(desiredParticleCount());
+		lod.distance = lodBaseDistance * q.lod_scale;
+		std::cout << "Quality " << level << ": " << nb_particles << " particles, " << q.trail_samples
+			<< " trail samples, point size " << q.point_size << ", LOD distance " << lod.distance << std::endl;
+	}
 
-		float step = signDist(rng) == 0 ? -0.5f : 0.5f;
-		float dx = 0.0f, dy = 0.0f, dz = 0.0f;
-		switch (axisDist(rng))
-		{
-			case 0: dx = step; break;
-			case 1: dy = step; break;
-			default: dz = step; break;
-		}
-		update_mass_tangent(dx, dy, dz);
+	const quality_level &particle_system::currentQuality() const
+	{
+		return quality_levels[qualityLevel];
 	}
 
-	int particle_system::initGLFW()
+	/*
+		Moves the camera back along its view direction until the bounding sphere
+		of the last statistics fits in the narrower of the two fields of view
+	*/
+	void particle_system::frameParticles()
 	{
-		GLFWmonitor *monitor = glfwGetPrimaryMonitor();
-		if (monitor)
+		sim_stats s = latestStats();
+		if (!s.valid)
 		{
-			const GLFWvidmode *mode = glfwGetVideoMode(monitor);
-			if (mode)
-			{
-				windowWidth = mode->width;
-				windowHeight = mode->height;
-				windowedWidth = windowWidth;
-				windowedHeight = windowHeight;
-			}
+			std::cout << "No particle statistics to frame yet" << std::endl;
+			return;
 		}
-		_window = glfwCreateWindow(windowWidth, windowHeight, "particle_system | FPS: 0", NULL, NULL);
-		if (!_window)
+		glm::vec3 low(s.bbox_min.x, s.bbox_min.y, s.bbox_min.z);
+		glm::vec3 high(s.bbox_max.x, s.bbox_max.y, s.bbox_max.z);
+		glm::vec3 target = (low + high) * 0.5f;
+		float radius = std::max(glm::length(high - low) * 0.5f, 1.0f);
+
+		float halfFov = glm::radians(45.0f) * 0.5f;
+		float aspect = static_cast<float>(windowWidth) / std::max(windowHeight, 1);
+		float halfFovX = std::atan(std::tan(halfFov) * aspect);
+		float distance = radius * FRAME_MARGIN / std::sin(std::min(halfFov, halfFovX));
+		camera.frame(target, distance);
+		std::cout << "Framed " << s.count << " particles around (" << target.x << ", " << target.y << ", "
+			<< target.z << "), radius " << radius << ", distance " << distance << std::endl;
+	}
+
+	/*
+		--bench: starts on the first frame with particles, prints the frame rate, the tick rate
+		and the device statistics every second, then a summary before closing the window
+	*/
+	void particle_system::updateBenchmark(bool ready)
+	{
+		if (!benchSeconds || !ready)
+			return;
+		auto now = std::chrono::steady_clock::now();
+		unsigned long ticks = simTickTotal;
+		if (!benchStarted)
 		{
-			std::cerr << "Failed to create GLFW window" << std::endl;
-			glfwTerminate();
-			return 0;
+			benchStarted = true;
+			benchStart = now;
+			benchLast = now;
+			benchFrames = 0;
+			benchLastFrames = 0;
+			benchStartTicks = ticks;
+			benchLastTicks = ticks;
+			benchMinFps = std::numeric_limits<float>::max();
+			std::cout << "Benchmark: " << benchSeconds << " s with " << nb_particles << " particles, "
+				<< (splatMode ? "OpenCL splatting" : "GL point") << " renderer, " << profileNames[buildProfile]
+				<< " build profile" << std::endl;
+			return;
+		}
+		benchFrames++;
+		float sinceLast = std::chrono::duration<float>(now - benchLast).count();
+		if (sinceLast < 1.0f)
+			return;
+
+		float fps = (benchFrames - benchLastFrames) / sinceLast;
+		float simHz = (ticks - benchLastTicks) / sinceLast;
+		float elapsed = std::chrono::duration<float>(now - benchStart).count();
+		benchMinFps = std::min(benchMinFps, fps);
+		benchLast = now;
+		benchLastFrames = benchFrames;
+		benchLastTicks = ticks;
+
+		sim_stats s = latestStats();
+		std::cout << "Bench " << elapsed << " s: " << fps << " fps, " << simHz << " Hz sim, " << nb_particles
+			<< " particles | kinetic energy " << s.kinetic_energy << ", max speed " << s.max_speed
+			<< ", inside mass " << s.inside_mass << ", live emitter " << s.live_emitter
+			<< ", bbox (" << s.bbox_min.x << ", " << s.bbox_min.y << ", " << s.bbox_min.z << ") - ("
+			<< s.bbox_max.x << ", " << s.bbox_max.y << ", " << s.bbox_max.z << ")" << std::endl;
+
+		if (elapsed < benchSeconds)
+			return;
+		std::cout << "Benchmark done: " << benchFrames << " frames in " << elapsed << " s, "
+			<< benchFrames / elapsed << " fps average, " << benchMinFps << " fps minimum, "
+			<< (ticks - benchStartTicks) / elapsed << " Hz sim average" << std::endl;
+		glfwSetWindowShouldClose(_window, GL_TRUE);
+	}
+
+	/*
+		Grows the grid buffers, the cell ones and the per particle ones separately
+	*/
+	bool particle_system::reserveQueryBuffers(size_t cells, size_t particles) {
+		cl_int err = CL_SUCCESS;
+		if (cells > queryCellCapacity)
+		{
+			queryCellCapacity = 0;
+			for (cl_mem *buffer : {&queryCellCountsCL, &queryCellStartsCL, &queryCellCursorCL})
+			{
+				if (*buffer)
+					clReleaseMemObject(*buffer);
+				// One more start than cells, the end of the last cell
+				*buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, (cells + 1) * sizeof(cl_uint), nullptr, &err);
+				if (err != CL_SUCCESS || !*buffer)
+				{
+					std::cerr << "Failed to create the query grid buffers: " << err << std::endl;
+					*buffer = nullptr;
+					return false;
+				}
+			}
+			queryCellCapacity = cells;
+		}
+		if (particles > queryParticleCapacity)
+		{
+			queryParticleCapacity = 0;
+			std::vector<std::pair<cl_mem *, size_t>> buffers = {
+				{&queryParticleCellsCL, sizeof(cl_uint)}, {&queryParticlePosCL, 4 * sizeof(float)},
+				{&querySortedIndexCL, sizeof(cl_uint)}, {&querySortedPosCL, 4 * sizeof(float)},
+			};
+			for (auto &buffer : buffers)
+			{
+				if (*buffer.first)
+					clReleaseMemObject(*buffer.first);
+				*buffer.first = clCreateBuffer(context, CL_MEM_READ_WRITE, particles * buffer.second, nullptr, &err);
+				if (err != CL_SUCCESS || !*buffer.first)
+				{
+					std::cerr << "Failed to create the query particle buffers: " << err << std::endl;
+					*buffer.first = nullptr;
+					return false;
+				}
+			}
+			queryParticleCapacity = particles;
+		}
+		return true;
+	}
+
+	/*
+		Bins the active particles into a uniform grid over the last statistics bounding box
+		with a counting sort: count per cell, scan, scatter. Positions are copied next to the
+		sorted indices so the queries never touch the shared chunks.
+		The grid is reused until the simulation ticks again
+	*/
+	bool particle_system::buildQueryGrid() {
+		unsigned long tick = simTickTotal;
+		if (queryGridValid && queryGridTick == tick && queryGrid.count == nb_particles)
+			return true;
+		sim_stats s = latestStats();
+		if (!s.valid)
+		{
+			std::cerr << "Failed to build the query grid: no particle statistics yet" << std::endl;
+			return false;
+		}
+
+		// Cubic cells, particles outside the box (the statistics are a tick old) fall in the border cells
+		float extent = std::max({s.bbox_max.x - s.bbox_min.x, s.bbox_max.y - s.bbox_min.y, s.bbox_max.z - s.bbox_min.z});
+		unsigned int res = static_cast<unsigned int>(std::cbrt(static_cast<double>(nb_particles) / QUERY_CELL_OCCUPANCY));
+		res = std::clamp(res, 8u, static_cast<unsigned int>(QUERY_MAX_RESOLUTION));
+		queryGrid.grid_min = s.bbox_min;
+		queryGrid.cell_size = std::max(extent, 1e-3f) * 1.001f / res;
+		queryGrid.resolution = res;
+		queryGrid.count = static_cast<unsigned int>(nb_particles);
+		queryGridValid = false;
+
+		cl_uint cells = res * res * res;
+		size_t particles = nb_particles;
+		if (!reserveQueryBuffers(cells, particles))
+			return false;
+
+		const cl_uint zero = 0;
+		err = clEnqueueFillBuffer(queue, queryCellCountsCL, &zero, sizeof(zero), 0, cells * sizeof(cl_uint), 0, nullptr, nullptr);
+		err |= clSetKernelArg(count_cells, 2, sizeof(query_grid), &queryGrid);
+		err |= clSetKernelArg(count_cells, 3, sizeof(cl_mem), &queryCellCountsCL);
+		err |= clSetKernelArg(count_cells, 4, sizeof(cl_mem), &queryParticleCellsCL);
+		err |= clSetKernelArg(count_cells, 5, sizeof(cl_mem), &queryParticlePosCL);
+		for (particle_chunk &chunk : chunks)
+		{
+			size_t count = chunkActiveCount(chunk);
+			if (err != CL_SUCCESS || count == 0)
+				break;
+
+			// The chunk stays locked until its positions are copied
+			std::lock_guard<std::mutex> lock(*chunk.lock);
+			cl_uint offset = static_cast<cl_uint>(chunk.offset);
+			err = acquireChunk(queue, chunk, 1, &chunk.bufferCL);
+			if (err == CL_SUCCESS)
+				err = clSetKernelArg(count_cells, 0, sizeof(cl_mem), &chunk.bufferCL);
+			if (err == CL_SUCCESS)
+				err = clSetKernelArg(count_cells, 1, sizeof(cl_uint), &offset);
+			if (err == CL_SUCCESS)
+				err = clEnqueueNDRangeKernel(queue, count_cells, 1, NULL, &count, NULL, 0, NULL, NULL);
+			cl_int releaseErr = clEnqueueReleaseGLObjects(queue, 1, &chunk.bufferCL, 0, nullptr, nullptr);
+			clFinish(queue);
+			if (err == CL_SUCCESS)
+				err = releaseErr;
+		}
+
+		size_t scanSize = QUERY_SCAN_GROUP_SIZE;
+		if (err == CL_SUCCESS)
+		{
+			err = clSetKernelArg(scan_cells, 0, sizeof(cl_mem), &queryCellCountsCL);
+			err |= clSetKernelArg(scan_cells, 1, sizeof(cl_mem), &queryCellStartsCL);
+			err |= clSetKernelArg(scan_cells, 2, sizeof(cl_mem), &queryCellCursorCL);
+			err |= clSetKernelArg(scan_cells, 3, sizeof(cl_uint), &cells);
+			err |= clSetKernelArg(scatter_particles, 0, sizeof(cl_mem), &queryParticleCellsCL);
+			err |= clSetKernelArg(scatter_particles, 1, sizeof(cl_mem), &queryParticlePosCL);
+			err |= clSetKernelArg(scatter_particles, 2, sizeof(cl_mem), &queryCellCursorCL);
+			err |= clSetKernelArg(scatter_particles, 3, sizeof(cl_mem), &querySortedIndexCL);
+			err |= clSetKernelArg(scatter_particles, 4, sizeof(cl_mem), &querySortedPosCL);
+		}
+		if (err == CL_SUCCESS)
+			err = clEnqueueNDRangeKernel(queue, scan_cells, 1, NULL, &scanSize, &scanSize, 0, NULL, NULL);
+		if (err == CL_SUCCESS)
+			err = clEnqueueNDRangeKernel(queue, scatter_particles, 1, NULL, &particles, NULL, 0, NULL, NULL);
+		clFinish(queue);
+		if (err != CL_SUCCESS)
+		{
+			std::cerr << "Failed to build the query grid: " << err << std::endl;
+			return false;
+		}
+		queryGridTick = tick;
+		queryGridValid = true;
+		return true;
+	}
+
+	/*
+		Runs a radius or box query over the cells covering [low, high] and reads back the
+		compact index list. The caller has set the shape arguments (7 and up)
+	*/
+	bool particle_system::runCellQuery(cl_kernel kernel, const glm::vec3 &low, const glm::vec3 &high, std::vector<cl_uint> &indices) {
+		indices.clear();
+		if (!buildQueryGrid())
+			return false;
+
+		// Clamped into the grid, the border cells hold everything beyond it
+		const glm::vec3 gridMin(queryGrid.grid_min.x, queryGrid.grid_min.y, queryGrid.grid_min.z);
+		const int last = static_cast<int>(queryGrid.resolution) - 1;
+		cl_int cellMin[4] = {0, 0, 0, 0};
+		size_t cellRange[3];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float lowCell = std::clamp((low[axis] - gridMin[axis]) / queryGrid.cell_size, 0.0f, static_cast<float>(last));
+			float highCell = std::clamp((high[axis] - gridMin[axis]) / queryGrid.cell_size, 0.0f, static_cast<float>(last));
+			cellMin[axis] = static_cast<cl_int>(lowCell);
+			cellRange[axis] = static_cast<size_t>(static_cast<cl_int>(highCell) - cellMin[axis] + 1);
+		}
+
+		const cl_uint zero = 0;
+		const cl_uint maxResults = QUERY_MAX_RESULTS;
+		err = clEnqueueFillBuffer(queue, queryResultsCL, &zero, sizeof(zero), 0, sizeof(zero), 0, nullptr, nullptr);
+		err |= clSetKernelArg(kernel, 0, sizeof(cl_mem), &queryCellStartsCL);
+		err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &querySortedIndexCL);
+		err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &querySortedPosCL);
+		err |= clSetKernelArg(kernel, 3, sizeof(query_grid), &queryGrid);
+		err |= clSetKernelArg(kernel, 4, sizeof(cellMin), cellMin);
+		err |= clSetKernelArg(kernel, 5, sizeof(cl_mem), &queryResultsCL);
+		err |= clSetKernelArg(kernel, 6, sizeof(cl_uint), &maxResults);
+		if (err == CL_SUCCESS)
+			err = clEnqueueNDRangeKernel(queue, kernel, 3, NULL, cellRange, NULL, 0, NULL, NULL);
+
+		// Interactive queries, the blocking reads are what the caller waits for
+		cl_uint found = 0;
+		if (err == CL_SUCCESS)
+			err = clEnqueueReadBuffer(queue, queryResultsCL, CL_TRUE, 0, sizeof(found), &found, 0, nullptr, nullptr);
+		if (err == CL_SUCCESS && found > 0)
+		{
+			if (found > maxResults)
+				std::cerr << "Query truncated to " << maxResults << " of " << found << " particles" << std::endl;
+			indices.resize(std::min(found, maxResults));
+			err = clEnqueueReadBuffer(queue, queryResultsCL, CL_TRUE, sizeof(cl_uint), indices.size() * sizeof(cl_uint),
+				indices.data(), 0, nullptr, nullptr);
+		}
+		if (err != CL_SUCCESS)
+		{
+			std::cerr << "Failed to run the spatial query: " << err << std::endl;
+			indices.clear();
+			return false;
+		}
+		return true;
+	}
+
+	/*
+		Indices of the particles within radius of center
+	*/
+	bool particle_system::queryRadius(const glm::vec3 &center, float radius, std::vector<cl_uint> &indices) {
+		const float sphere[4] = {center.x, center.y, center.z, radius};
+		if (clSetKernelArg(query_radius, 7, sizeof(sphere), sphere) != CL_SUCCESS)
+		{
+			std::cerr << "Failed to set args for the radius query" << std::endl;
+			return false;
+		}
+		return runCellQuery(query_radius, center - glm::vec3(radius), center + glm::vec3(radius), indices);
+	}
+
+	/*
+		Indices of the particles inside the axis aligned box [low, high]
+	*/
+	bool particle_system::queryBox(const glm::vec3 &low, const glm::vec3 &high, std::vector<cl_uint> &indices) {
+		const float boxMin[4] = {low.x, low.y, low.z, 0.0f};
+		const float boxMax[4] = {high.x, high.y, high.z, 0.0f};
+		if (clSetKernelArg(query_box, 7, sizeof(boxMin), boxMin) != CL_SUCCESS
+			|| clSetKernelArg(query_box, 8, sizeof(boxMax), boxMax) != CL_SUCCESS)
+		{
+			std::cerr << "Failed to set args for the box query" << std::endl;
+			return false;
+		}
+		return runCellQuery(query_box, low, high, indices);
+	}
+
+	/*
+		Closest particle along the ray within a cone of the given slope (radius per unit of depth),
+		false when nothing is hit
+	*/
+	bool particle_system::queryRayNearest(const glm::vec3 &origin, const glm::vec3 &direction, float slope, cl_uint &index, glm::vec3 &pos) {
+		if (!buildQueryGrid())
+			return false;
+
+		// All bits set: above any depth and any slot
+		cl_uint best[2] = {0xFFFFFFFFu, 0xFFFFFFFFu};
+		const float rayOrigin[4] = {origin.x, origin.y, origin.z, 0.0f};
+		const float rayDirection[4] = {direction.x, direction.y, direction.z, slope};
+		size_t cells = static_cast<size_t>(queryGrid.resolution) * queryGrid.resolution * queryGrid.resolution;
+
+		err = clEnqueueWriteBuffer(queue, queryResultsCL, CL_FALSE, 0, sizeof(best), best, 0, nullptr, nullptr);
+		err |= clSetKernelArg(query_ray, 0, sizeof(cl_mem), &queryCellStartsCL);
+		err |= clSetKernelArg(query_ray, 1, sizeof(cl_mem), &querySortedPosCL);
+		err |= clSetKernelArg(query_ray, 2, sizeof(query_grid), &queryGrid);
+		err |= clSetKernelArg(query_ray, 3, sizeof(rayOrigin), rayOrigin);
+		err |= clSetKernelArg(query_ray, 4, sizeof(rayDirection), rayDirection);
+		err |= clSetKernelArg(query_ray, 6, sizeof(cl_mem), &queryResultsCL);
+		for (cl_uint pass = 0; pass < 2 && err == CL_SUCCESS; ++pass)
+		{
+			err = clSetKernelArg(query_ray, 5, sizeof(cl_uint), &pass);
+			if (err == CL_SUCCESS)
+				err = clEnqueueNDRangeKernel(queue, query_ray, 1, NULL, &cells, NULL, 0, NULL, NULL);
+		}
+		if (err == CL_SUCCESS)
+			err = clEnqueueReadBuffer(queue, queryResultsCL, CL_TRUE, 0, sizeof(best), best, 0, nullptr, nullptr);
+		if (err != CL_SUCCESS)
+		{
+			std::cerr << "Failed to run the ray query: " << err << std::endl;
+			return false;
+		}
+		if (best[1] == 0xFFFFFFFFu)
+			return false;
+
+		// The winning slot gives the particle index and its position at build time
+		float hit[4];
+		err = clEnqueueReadBuffer(queue, querySortedIndexCL, CL_TRUE, best[1] * sizeof(cl_uint), sizeof(cl_uint), &index, 0, nullptr, nullptr);
+		err |= clEnqueueReadBuffer(queue, querySortedPosCL, CL_TRUE, best[1] * sizeof(hit), sizeof(hit), hit, 0, nullptr, nullptr);
+		if (err != CL_SUCCESS)
+		{
+			std::cerr << "Failed to read back the ray query hit: " << err << std::endl;
+			return false;
+		}
+		pos = glm::vec3(hit[0], hit[1], hit[2]);
+		return true;
+	}
+
+	/*
+		Casts the cursor ray (the screen center when the mouse is captured)
+		with a cone of QUERY_PICK_PIXELS pixels
+	*/
+	bool particle_system::pickParticle(cl_uint &index, glm::vec3 &pos)
+	{
+		float cursorX = mouseCaptureToggle ? windowWidth / 2.0f : camera.mousePos.x;
+		float cursorY = mouseCaptureToggle ? windowHeight / 2.0f : camera.mousePos.y;
+		float xNDC = (2.0f * cursorX) / windowWidth - 1.0f;
+		float yNDC = 1.0f - (2.0f * cursorY) / windowHeight;
+
+		glm::mat4 inverse = glm::inverse(projectionMatrix * lastViewMatrix);
+		glm::vec4 nearPoint = inverse * glm::vec4(xNDC, yNDC, -1.0f, 1.0f);
+		glm::vec4 farPoint = inverse * glm::vec4(xNDC, yNDC, 1.0f, 1.0f);
+		glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+		glm::vec3 direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+
+		float slope = std::tan(glm::radians(45.0f) * 0.5f) * 2.0f / std::max(windowHeight, 1) * QUERY_PICK_PIXELS;
+		return queryRayNearest(origin, direction, slope, index, pos);
+	}
+
+	/*
+		Prints how long after launch the first window frame and the
+		first frame with particles reached the screen
+	*/
+	void particle_system::reportFirstFrame(bool withParticles)
+	{
+		if (firstFrameShown && (firstParticlesShown || !withParticles))
+			return;
+		float elapsed = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - launchTime).count();
+		if (!firstFrameShown)
+		{
+			firstFrameShown = true;
+			std::cout << "First frame after " << elapsed << " ms" << std::endl;
+		}
+		if (withParticles && !firstParticlesShown)
+		{
+			firstParticlesShown = true;
+			std::cout << "First particle frame after " << elapsed << " ms" << std::endl;
+		}
+	}
+
+	void particle_system::update()
+	{
+		// Check for delta and apply to move and rotation speeds
+		findMoveRotationSpeed();
+
+		// Update player position and orientation
+		updateMovement();
+
+		// Mass control
+		// Increase tangent vector rotation in x, y z respectively
+		if (keyStates[GLFW_KEY_U])
+			update_mass_tangent(0.1f, 0.0f, 0.0f);
+		if (keyStates[GLFW_KEY_I])
+			update_mass_tangent(0.0f, 0.1f, 0.0f);
+		if (keyStates[GLFW_KEY_O])
+			update_mass_tangent(0.0f, 0.0f, 0.1f);
+		// Decrease tangent vector rotation in x, y z respectively
+		if (keyStates[GLFW_KEY_J])
+			update_mass_tangent(-0.1f, 0.0f, 0.0f);
+		if (keyStates[GLFW_KEY_K])
+			update_mass_tangent(0.0f, -0.1f, 0.0f);
+		if (keyStates[GLFW_KEY_L])
+			update_mass_tangent(0.0f, 0.0f, -0.1f);
+		if (keyStates[GLFW_KEY_KP_ADD]) m.intensity += 0.1f;
+		if (keyStates[GLFW_KEY_KP_SUBTRACT]) m.intensity -= 0.1f;
+
+		// Optional slow random drift of the mass tangent
+		tickRandomMassRotation();
+
+		display();
+	}
+
+	/*
+		Randomly selects rotation of particles around mass while toggle is active
+		Will also determine the next point in time that it will change
+	*/
+	void particle_system::tickRandomMassRotation()
+	{
+		if (!randomMassRotation)
+			return;
+
+		randomRotationTimer += delta;
+		if (randomRotationTimer < nextRandomRotationDelay)
+			return;
+
+		// Pick next delay to keep motion slow and slightly unpredictable
+		std::uniform_real_distribution<float> delayDist(0.5f, 3.0f);
+		nextRandomRotationDelay = delayDist(rng);
+		randomRotationTimer = 0.0f;
+
+		std::uniform_int_distribution<int> axisDist(0, 2);
+		std::uniform_int_distribution<int> signDist(0, 1);
+
+		float step = signDist(rng) == 0 ? -0.5f : 0.5f;
+		float dx = 0.0f, dy = 0.0f, dz = 0.0f;
+		switch (axisDist(rng))
+		{
+			case 0: dx = step; break;
+			case 1: dy = step; break;
+			default: dz = step; break;
+		}
+		update_mass_tangent(dx, dy, dz);
+	}
+
+	int particle_system::initGLFW()
+	{
+		GLFWmonitor *monitor = glfwGetPrimaryMonitor();
+		if (monitor)
+		{
+			const GLFWvidmode *mode = glfwGetVideoMode(monitor);
+			if (mode)
+			{
+				windowWidth = mode->width;
+				windowHeight = mode->height;
+				windowedWidth = windowWidth;
+				windowedHeight = windowHeight;
+			}
+		}
+		_window = glfwCreateWindow(windowWidth, windowHeight, "particle_system | FPS: 0", NULL, NULL);
+		if (!_window)
+		{
+			std::cerr << "Failed to create GLFW window" << std::endl;
+			glfwTerminate();
+			return 0;
 		}
 		glfwSetWindowUserPointer(_window, this);
 		glfwSetFramebufferSizeCallback(_window, reshape);
 		glfwSetKeyCallback(_window, keyPress);
 		glfwSetCursorPosCallback(_window, mouseCallback);
+		glfwSetMouseButtonCallback(_window, mouseButtonCallback);
 		glfwMakeContextCurrent(_window);
 
 		// Prefer raw mouse motion if supported for smoother, acceleration-free deltas
@@ -406,7 +1551,6 @@ namespace psys
 	{
 		(void)scancode;
 		(void)mods;
-		const size_t reduced_particle_count = 100000;
 
 		if (action == GLFW_PRESS)
 			keyStates[key] = true;
@@ -427,6 +1571,16 @@ namespace psys
 			reset_shape = particleShape::SPHERE;
 			resetSim = true;
 		}
+		else if (action == GLFW_PRESS && key == GLFW_KEY_KP_2)
+		{
+			if (cloud.data)
+			{
+				reset_shape = particleShape::CLOUD;
+				resetSim = true;
+			}
+			else
+				std::cout << "No point cloud loaded, start with --load file" << std::endl;
+		}
 		else if (action == GLFW_PRESS && key == GLFW_KEY_B)
 		{
 			randomMassRotation = !randomMassRotation;
@@ -444,23 +1598,21 @@ namespace psys
 			massDisplay = !massDisplay;
 		else if (action == GLFW_PRESS && key == GLFW_KEY_R)
 		{
+			trailingMode = !trailingMode;
 			if (trailingMode)
 			{
-				trailingMode = false;
-				if (!spaghettiMode)
-					setParticleCount(default_nb_particles);
-			}
-			else
-			{
-				trailingMode = true;
 				spaghettiMode = false;
-				setParticleCount(std::min(default_nb_particles, reduced_particle_count));
+				motionBlurMode = false;
+				splatMode = false;
 			}
+			setParticleCount(desiredParticleCount());
 		}
 		else if (action == GLFW_PRESS && key == GLFW_KEY_H)
 			std::cout << COMMANDS_LIST << std::endl;
 		else if (action == GLFW_PRESS && key == GLFW_KEY_C)
 			mouseCaptureToggle = !mouseCaptureToggle;
+		else if (action == GLFW_PRESS && key == GLFW_KEY_HOME)
+			frameParticles();
 		else if (action == GLFW_PRESS && key == GLFW_KEY_E)
 		{
 			emitterEnabled = !emitterEnabled;
@@ -471,21 +1623,94 @@ namespace psys
 			glfwSetWindowShouldClose(_window, GL_TRUE);
 		else if (action == GLFW_PRESS && key == GLFW_KEY_G)
 		{
+			spaghettiMode = !spaghettiMode;
 			if (spaghettiMode)
 			{
-				spaghettiMode = false;
-				if (!trailingMode)
-					setParticleCount(default_nb_particles);
+				trailingMode = false;
+				motionBlurMode = false;
+				splatMode = false;
 			}
-			else
+			setParticleCount(desiredParticleCount());
+		}
+		else if (action == GLFW_PRESS && key == GLFW_KEY_X)
+		{
+			// No history to keep, only the count of the mode it replaces may change
+			motionBlurMode = !motionBlurMode;
+			if (motionBlurMode)
+				splatMode = false;
+			if (motionBlurMode && (trailingMode || spaghettiMode))
 			{
-				spaghettiMode = true;
 				trailingMode = false;
-				setParticleCount(std::min(default_nb_particles, reduced_particle_count));
+				spaghettiMode = false;
+				setParticleCount(desiredParticleCount());
 			}
 		}
 		else if (action == GLFW_PRESS && key == GLFW_KEY_F11)
 			toggleFullscreen();
+		else if (action == GLFW_PRESS && key == GLFW_KEY_F2)
+		{
+			// Single pixel points only, the line based modes have no splat equivalent
+			splatMode = !splatMode;
+			if (splatMode)
+				motionBlurMode = false;
+			if (splatMode && (trailingMode || spaghettiMode))
+			{
+				trailingMode = false;
+				spaghettiMode = false;
+				setParticleCount(desiredParticleCount());
+			}
+			std::cout << (splatMode ? "OpenCL point splatting" : "GL point") << " renderer" << std::endl;
+		}
+		else if (action == GLFW_PRESS && key == GLFW_KEY_F3)
+		{
+			if (hud.ready())
+				hudMode = !hudMode;
+			else
+				std::cout << "HUD unavailable, no font could be loaded (see --font)" << std::endl;
+		}
+		else if (action == GLFW_PRESS && (key == GLFW_KEY_PAGE_UP || key == GLFW_KEY_PAGE_DOWN))
+		{
+			// Requested count, the buffer grows on the fly when it is exceeded
+			if (key == GLFW_KEY_PAGE_UP)
+				default_nb_particles += default_nb_particles / 2;
+			else
+				default_nb_particles = std::max<size_t>(1, default_nb_particles * 2 / 3);
+			setParticleCount(desiredParticleCount());
+		}
+		else if (action == GLFW_PRESS && key == GLFW_KEY_N)
+		{
+			fieldMode = !fieldMode;
+			std::cout << "Force field " << (fieldMode ? "enabled" : "disabled")
+				<< " (" << fieldResolution << "^3, " << (fieldPath.empty() ? "curl noise" : fieldPath) << ")" << std::endl;
+		}
+		else if (action == GLFW_PRESS && key == GLFW_KEY_Z)
+		{
+			collisionMode = !collisionMode;
+			std::cout << "Collisions " << (collisionMode ? "enabled" : "disabled") << " (" << colliders.size()
+				<< " colliders, " << colliderTriangles.size() / 9 << " mesh triangles)" << std::endl;
+		}
+		else if (action == GLFW_PRESS && key == GLFW_KEY_V)
+		{
+			lodMode = !lodMode;
+			std::cout << "Density volume LOD " << (lodMode ? "enabled" : "disabled")
+				<< " (" << lod.resolution << "^3 grid, threshold " << lod.distance << ")" << std::endl;
+		}
+		else if (action == GLFW_PRESS && (key == GLFW_KEY_LEFT_BRACKET || key == GLFW_KEY_RIGHT_BRACKET))
+		{
+			float scale = key == GLFW_KEY_LEFT_BRACKET ? 0.8f : 1.25f;
+			lodBaseDistance = std::clamp(lodBaseDistance * scale, 5.0f, LOD_GRID_EXTENT);
+			lod.distance = lodBaseDistance * currentQuality().lod_scale;
+			std::cout << "LOD distance threshold set to: " << lod.distance << std::endl;
+		}
+		else if (action == GLFW_PRESS && key == GLFW_KEY_Q)
+		{
+			governorMode = !governorMode;
+			std::cout << "Quality governor " << (governorMode ? "enabled" : "disabled")
+				<< " (" << governorBudgetMs << " ms budget)" << std::endl;
+			// Back to full quality when the governor lets go
+			if (!governorMode)
+				applyQualityLevel(quality_levels.size() - 1);
+		}
 	}
 
 	void particle_system::keyPress(GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -608,31 +1833,154 @@ namespace psys
 		if (engine) engine->mouseAction(x, y);
 	}
 
-
 	/*
-		Initialises simulation data
+		Left click picks the particle under the cursor, right click moves the mass onto it,
+		middle click selects the particles around it (a box with Shift, a sphere otherwise)
 	*/
-	void particle_system::initSimData()
+	void particle_system::mouseButtonAction(int button, int action, int mods)
 	{
-		context = nullptr;
-		queue = nullptr;
-		update_program = nullptr;
-		init_cube_program = nullptr;
-		calculate_position = nullptr;
-		init_particles_cube = nullptr;
-		particleBufferCL = nullptr;
-		
-		// No mass or intensity at first
-		m.intensity = 0.0f;
-		m.radius = 5.0f;
-		m.pos.x = 5.0f;
-		m.pos.y = -20.0f;
-		m.pos.z = -10.0f;
-
-		// Default rotation angle for particles around the mass
-		m.rotationTangent.x = 0.0f;
-		m.rotationTangent.y = 1.0f;
-		m.rotationTangent.z = 0.0f;
+		if (action != GLFW_PRESS || !simReady)
+			return;
+
+		auto queryStart = std::chrono::steady_clock::now();
+		cl_uint index = 0;
+		glm::vec3 pos(0.0f);
+		if (!pickParticle(index, pos))
+		{
+			std::cout << "No particle under the cursor" << std::endl;
+			return;
+		}
+
+		if (button == GLFW_MOUSE_BUTTON_LEFT)
+		{
+			float pickMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - queryStart).count();
+			std::cout << "Picked particle " << index << " at (" << pos.x << ", " << pos.y << ", " << pos.z
+				<< ") in " << pickMs << " ms" << std::endl;
+		}
+		else if (button == GLFW_MOUSE_BUTTON_RIGHT)
+		{
+			massFollow = false;
+			m.pos = {pos.x, pos.y, pos.z};
+			std::cout << "Mass placed on particle " << index << std::endl;
+		}
+		else if (button == GLFW_MOUSE_BUTTON_MIDDLE)
+		{
+			const glm::vec3 half(QUERY_SELECT_RADIUS);
+			bool box = mods & GLFW_MOD_SHIFT;
+			bool ok = box ? queryBox(pos - half, pos + half, selection) : queryRadius(pos, QUERY_SELECT_RADIUS, selection);
+			if (!ok)
+				return;
+			float queryMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - queryStart).count();
+			std::cout << "Selected " << selection.size() << " particles in a " << (box ? "box" : "sphere") << " of "
+				<< QUERY_SELECT_RADIUS << " around particle " << index << " in " << queryMs << " ms" << std::endl;
+		}
+	}
+
+	void particle_system::mouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
+	{
+		particle_system *engine = static_cast<particle_system*>(glfwGetWindowUserPointer(window));
+
+		if (engine) engine->mouseButtonAction(button, action, mods);
+	}
+
+
+	/*
+		Initialises simulation data
+	*/
+	void particle_system::initSimData()
+	{
+		queue = nullptr;
+		simQueue = nullptr;
+		update_program = nullptr;
+		init_cube_program = nullptr;
+		for (cl_kernel &kernel : update_species)
+			kernel = nullptr;
+		init_particles_cube = nullptr;
+		init_sphere_program = nullptr;
+		init_particles_sphere = nullptr;
+		init_cloud_program = nullptr;
+		init_particles_cloud = nullptr;
+		lod_program = nullptr;
+		splat_density = nullptr;
+		resolve_density = nullptr;
+		densityAccumCL = nullptr;
+		densityVolumeCL = nullptr;
+		densityCoarseCL = nullptr;
+		field_program = nullptr;
+		generate_field = nullptr;
+		fieldStagingCL = nullptr;
+		fieldImagesCL[0] = nullptr;
+		fieldImagesCL[1] = nullptr;
+		sdf_program = nullptr;
+		bake_distance = nullptr;
+		bake_normals = nullptr;
+		stats_program = nullptr;
+		reduce_stats = nullptr;
+		combine_stats = nullptr;
+		statsPartialsCL = nullptr;
+		statsResultCL = nullptr;
+		statsPartialCapacity = 0;
+		statsEvent = nullptr;
+		stats.valid = false;
+		query_program = nullptr;
+		count_cells = nullptr;
+		scan_cells = nullptr;
+		scatter_particles = nullptr;
+		query_radius = nullptr;
+		query_box = nullptr;
+		query_ray = nullptr;
+		queryCellCountsCL = nullptr;
+		queryCellStartsCL = nullptr;
+		queryCellCursorCL = nullptr;
+		queryParticleCellsCL = nullptr;
+		queryParticlePosCL = nullptr;
+		querySortedIndexCL = nullptr;
+		querySortedPosCL = nullptr;
+		queryResultsCL = nullptr;
+		queryCellCapacity = 0;
+		queryParticleCapacity = 0;
+		queryGridValid = false;
+		splat_program = nullptr;
+		bin_points = nullptr;
+		scan_tiles = nullptr;
+		scatter_points = nullptr;
+		raster_tiles = nullptr;
+		splatTileCountsCL = nullptr;
+		splatTileStartsCL = nullptr;
+		splatTileCursorCL = nullptr;
+		splatPointTilesCL = nullptr;
+		splatPointFragmentsCL = nullptr;
+		splatTileFragmentsCL = nullptr;
+		splatFrameCL = nullptr;
+		splatTileCapacity = 0;
+		splatPointCapacity = 0;
+		migrate_program = nullptr;
+		find_emigrants = nullptr;
+		fill_holes = nullptr;
+		sample_particles = nullptr;
+		emigrantCountCL = nullptr;
+		emigrantIndexCL = nullptr;
+		emigrantsCL = nullptr;
+		migrateMovesCL = nullptr;
+		viewSamplesCL = nullptr;
+		quantize_program = nullptr;
+		quantize_particles = nullptr;
+		streamQuantizedCL = nullptr;
+		streamCapacity = 0;
+		migrateCapacity = 0;
+		simReady = false;
+		
+		// No mass or intensity at first
+		m.intensity = 0.0f;
+		m.radius = 5.0f;
+		m.pos.x = 5.0f;
+		m.pos.y = -20.0f;
+		m.pos.z = -10.0f;
+
+		// Default rotation angle for particles around the mass
+		m.rotationTangent.x = 0.0f;
+		m.rotationTangent.y = 1.0f;
+		m.rotationTangent.z = 0.0f;
 
 		// Emitter defaults
 		e.pos = {-15.0f, 0.0f, -10.0f};
@@ -645,7 +1993,7 @@ namespace psys
 		e.enabled = 0u;
 		emitterEnabled = false;
 		emitterDisplay = false;
-		updateEmitterRange();
+		updateSpeciesRanges();
 
 		// Window data
 		if (_window)
@@ -678,6 +2026,34 @@ namespace psys
 		spaghettiMode = false;
 		massDisplay = true;
 		trailingMode = false;
+		motionBlurMode = false;
+
+		// Density volume LOD, resolution comes from the launch options
+		lodMode = false;
+		lodBaseDistance = LOD_DISTANCE;
+		lod.distance = lodBaseDistance * currentQuality().lod_scale;
+		lod.density_scale = LOD_DENSITY_SCALE;
+		lod.cell_size = LOD_GRID_EXTENT / lod.resolution;
+
+		// Curl-noise force field, resolution is replaced by the file one with --field
+		fieldMode = false;
+		fieldResolution = FIELD_RESOLUTION;
+		fieldSeed = 1;
+		fieldTime = 0.0f;
+		field.origin = {0.0f, 0.0f, 0.0f};
+		field.inv_extent = 1.0f / FIELD_EXTENT;
+		field.blend = 0.0f;
+		field.strength = FIELD_STRENGTH;
+		field.enabled = 0;
+
+		// SDF collisions, the grid is baked once the kernels are built
+		collisionMode = false;
+		collision.grid_min = {SDF_GRID_MIN, SDF_GRID_MIN, SDF_GRID_MIN};
+		collision.size = SDF_GRID_SIZE;
+		collision.restitution = SDF_RESTITUTION;
+		collision.friction = SDF_FRICTION;
+		collision.margin = SDF_MARGIN;
+		collision.enabled = 0;
 
 		// Keys states and runtime booleans()
 		bzero(keyStates, sizeof(keyStates));
@@ -712,17 +2088,58 @@ namespace psys
 		windowHeight = height;
 	}
 
+	/*
+		Centers the density grid on the camera,
+		snapped to whole cells so the splatted volume doesn't shimmer when moving
+	*/
+	void particle_system::update_lod_grid(const glm::mat4 &viewMatrix)
+	{
+		glm::vec3 eye = glm::vec3(glm::inverse(viewMatrix)[3]);
+		float half = LOD_GRID_EXTENT / 2.0f;
+
+		lod.cell_size = LOD_GRID_EXTENT / lod.resolution;
+		lod.eye = {eye.x, eye.y, eye.z};
+		lod.grid_min = {
+			std::floor((eye.x - half) / lod.cell_size) * lod.cell_size,
+			std::floor((eye.y - half) / lod.cell_size) * lod.cell_size,
+			std::floor((eye.z - half) / lod.cell_size) * lod.cell_size
+		};
+	}
+
+	/*
+		Active count for the current mode and quality level: trail and spaghetti
+		modes are capped, the governor scales what is left
+	*/
+	size_t particle_system::desiredParticleCount() const
+	{
+		size_t count = default_nb_particles;
+		if (trailingMode || spaghettiMode)
+			count = std::min<size_t>(count, REDUCED_PARTICLE_COUNT);
+		return std::max<size_t>(1, static_cast<size_t>(count * currentQuality().particle_scale));
+	}
+
 	void particle_system::setParticleCount(size_t newCount)
 	{
-		size_t capped = std::min(newCount, default_nb_particles);
-		if (capped == nb_particles)
-			return;
-		nb_particles = capped;
-		updateEmitterRange();
-		std::cout << "Active particle count set to: " << nb_particles << std::endl;
+		// The chunks and the active range are only changed while the simulation is paused
+		stopSimThread();
+		if (newCount > particleBufferSize && !growParticleBuffer(newCount))
+			default_nb_particles = particleBufferSize;
+		size_t capped = std::min(newCount, particleBufferSize);
+		if (capped != nb_particles)
+		{
+			nb_particles = capped;
+			updateSpeciesRanges();
+			std::cout << "Active particle count set to: " << nb_particles << std::endl;
+		}
+		if (simReady)
+			startSimThread();
 	}
 
-	void particle_system::updateEmitterRange()
+	/*
+		Splits the active particles into the species ranges: heavy, tracers, passive, then the emitter slice.
+		The passive range sits next to the emitter one, it takes it over while the emitter is off
+	*/
+	void particle_system::updateSpeciesRanges()
 	{
 		const size_t minEmitter = 1;
 		const size_t target = nb_particles / 20; // 5% of the buffer
@@ -730,6 +2147,9 @@ namespace psys
 		if (emitter_count > nb_particles)
 			emitter_count = nb_particles;
 		emitter_start = nb_particles - emitter_count;
+
+		tracer_start = std::min(static_cast<size_t>(nb_particles * heavyShare), emitter_start);
+		passive_start = std::min(tracer_start + static_cast<size_t>(nb_particles * tracerShare), emitter_start);
 	}
 
 	/*
@@ -792,235 +2212,2661 @@ namespace psys
 			std::cout << "Resetting the simulation back to a cube of size: " << cubeSize << std::endl;
 		else if (reset_shape == particleShape::SPHERE)
 			std::cout << "Resetting the simulation back to a sphere of radius: " << sphereRadius << std::endl;
-		freeCLdata(false);
+		else if (reset_shape == particleShape::CLOUD)
+			std::cout << "Resetting the simulation back to the point cloud of " << cloud.count << " points" << std::endl;
+		freeCLdata(false, "", true);
 		initSimData();
 		initCLdata();
 		resetSim = false;
 	}
 
 	/*
-		Computes runtime particle positions depending on mass point and intensity
+		Same argument on every species kernel, they all take the update_particles.cl signature
+	*/
+	cl_int particle_system::setUpdateArg(cl_uint index, size_t size, const void *value) {
+		cl_int err = CL_SUCCESS;
+		for (cl_kernel kernel : update_species)
+			err |= clSetKernelArg(kernel, index, size, value);
+		return err;
+	}
+
+	/*
+		Computes one fixed tick of particle positions from the parameters sent by the input side.
+		Chunks are stepped one at a time under their own lock, so the renderer only ever
+		waits for the chunk being written
+	*/
+	bool particle_system::enqueueUpdateParticles(const sim_params &params) {
+		cl_int err;
+
+		err = setUpdateArg(1, sizeof(mass), &params.m);
+		if (err != CL_SUCCESS) {
+			std::cerr << "Failed to set args 1 for OpenCL: " << err << std::endl;
+			return false;
+		}
+
+		err = setUpdateArg(2, sizeof(emitter), &params.e);
+		if (err != CL_SUCCESS) {
+			std::cerr << "Failed to set args 2 (emitter) for OpenCL: " << err << std::endl;
+			return false;
+		}
+
+		err = setUpdateArg(3, sizeof(float), &simDelta);
+		if (err != CL_SUCCESS) {
+			std::cerr << "Failed to set args 3 (deltaTime) for OpenCL: " << err << std::endl;
+			return false;
+		}
+
+		if (!advanceVectorField(params.field))
+			return false;
+
+		collision.enabled = params.collisions ? 1u : 0u;
+		err = setUpdateArg(7, sizeof(cl_mem), &sdfImageCL);
+		err |= setUpdateArg(8, sizeof(collision_params), &collision);
+		if (err != CL_SUCCESS) {
+			std::cerr << "Failed to set args 7-8 (collisions) for OpenCL: " << err << std::endl;
+			return false;
+		}
+
+		// Species boundaries in the whole system, the emitter slice is passive while the emitter is off
+		const size_t speciesStart[SPECIES_COUNT + 1] = {0, params.tracer_start, params.passive_start,
+			params.e.enabled ? params.emitter_start : nb_particles, nb_particles};
+
+		// One history slice per TRAIL_INTERVAL for the whole system, a slow tick rate writes one per tick at most
+		trailTimer += simDelta;
+		trail_params trail = {trailClock % TRAIL_SAMPLES, 0, trailClock, 0u};
+		if (trailTimer >= TRAIL_INTERVAL)
+		{
+			trail.write = 1u;
+			trailTimer = std::min(trailTimer - TRAIL_INTERVAL, TRAIL_INTERVAL);
+		}
+
+		// A new reduction only once the previous result has been read back
+		collectStats();
+		bool reduce = statsEvent == nullptr;
+		if (reduce)
+		{
+			size_t groups = 0;
+			for (const particle_chunk &chunk : chunks)
+				groups += (chunkActiveCount(chunk) + STATS_GROUP_SIZE - 1) / STATS_GROUP_SIZE;
+			reduce = reserveStatsPartials(groups);
+		}
+		cl_uint statsGroups = 0;
+
+		// Per chunk, one dispatch per species range it holds, offset within the chunk
+		for (particle_chunk &chunk : chunks)
+		{
+			size_t count = chunkActiveCount(chunk);
+			if (count == 0)
+				break;
+
+			std::lock_guard<std::mutex> lock(*chunk.lock);
+			err = setUpdateArg(0, sizeof(cl_mem), &chunk.bufferCL);
+			if (err != CL_SUCCESS) {
+				std::cerr << "Failed to set args 0 for OpenCL: " << err << std::endl;
+				return false;
+			}
+
+			// Particles that skipped ticks (inactive chunk, or past the count) have holes in their history
+			if (count > chunk.trailActive || chunk.trailClock != trail.clock)
+				chunk.trailValidFrom = trail.clock;
+			chunk.trailActive = count;
+			trail.stride = static_cast<cl_uint>(chunk.capacity);
+			err = setUpdateArg(9, sizeof(cl_mem), &chunk.trailCL);
+			err |= setUpdateArg(10, sizeof(trail_params), &trail);
+			if (err != CL_SUCCESS) {
+				std::cerr << "Failed to set args 9-10 (trails) for OpenCL: " << err << std::endl;
+				return false;
+			}
+
+			cl_mem shared[2] = {chunk.bufferCL, chunk.trailCL};
+			err = acquireChunk(simQueue, chunk, 2, shared);
+			if (err != CL_SUCCESS) {
+				std::cerr << "Failed to acquire GL objects for OpenCL: " << err << std::endl;
+				return false;
+			}
+			for (int species = 0; species < SPECIES_COUNT && err == CL_SUCCESS; ++species)
+			{
+				size_t low = std::clamp(speciesStart[species], chunk.offset, chunk.offset + count) - chunk.offset;
+				size_t high = std::clamp(speciesStart[species + 1], chunk.offset, chunk.offset + count) - chunk.offset;
+				size_t size = high - low;
+				if (size > 0)
+					err = clEnqueueNDRangeKernel(simQueue, update_species[species], 1, &low, &size, NULL, 0, NULL, NULL);
+			}
+			if (err != CL_SUCCESS)
+				std::cerr << "Failed to enqueue kernel for OpenCL: " << err << std::endl;
+			// Reduced while the chunk is still acquired, a failed reduction only skips the statistics
+			else if (reduce && enqueueReduceStats(chunk, count, params, statsGroups))
+				statsGroups += static_cast<cl_uint>((count + STATS_GROUP_SIZE - 1) / STATS_GROUP_SIZE);
+			else
+				reduce = false;
+			cl_int releaseErr = clEnqueueReleaseGLObjects(simQueue, 2, shared, 0, nullptr, nullptr);
+			if (releaseErr != CL_SUCCESS)
+				std::cerr << "Failed to dequeue kernel for OpenCL: " << releaseErr << std::endl;
+			clFinish(simQueue);
+			if (err != CL_SUCCESS || releaseErr != CL_SUCCESS)
+				return false;
+
+			// pos_prev now holds the previous tick, the renderer interpolates from here
+			chunk.tick = std::chrono::steady_clock::now();
+			chunk.trailClock = trail.clock + trail.write;
+		}
+		trailClock += trail.write;
+		if (reduce && statsGroups > 0)
+			enqueueCombineStats(statsGroups);
+		return true;
+	}
+
+	/*
+		Grows the per work-group partial records buffer, only ever called from the simulation thread
+	*/
+	bool particle_system::reserveStatsPartials(size_t groups) {
+		if (groups <= statsPartialCapacity)
+			return true;
+		if (statsPartialsCL)
+			clReleaseMemObject(statsPartialsCL);
+		statsPartialCapacity = 0;
+
+		cl_int err;
+		statsPartialsCL = clCreateBuffer(context, CL_MEM_READ_WRITE, groups * sizeof(stats_record), nullptr, &err);
+		if (err != CL_SUCCESS || !statsPartialsCL) {
+			std::cerr << "Failed to create the statistics partials buffer: " << err << std::endl;
+			statsPartialsCL = nullptr;
+			return false;
+		}
+		statsPartialCapacity = groups;
+		return true;
+	}
+
+	/*
+		First reduction pass over one chunk, one partial record per work-group from groupOffset on
+	*/
+	bool particle_system::enqueueReduceStats(particle_chunk &chunk, size_t count, const sim_params &params, cl_uint groupOffset) {
+		cl_int err;
+		cl_uint activeCount = static_cast<cl_uint>(count);
+		// Without the emitter no particle of the chunk counts as live
+		cl_uint emitterStart = activeCount;
+		if (params.e.enabled)
+			emitterStart = static_cast<cl_uint>(std::clamp(params.emitter_start, chunk.offset, chunk.offset + count) - chunk.offset);
+
+		err = clSetKernelArg(reduce_stats, 0, sizeof(cl_mem), &chunk.bufferCL);
+		err |= clSetKernelArg(reduce_stats, 1, sizeof(cl_uint), &activeCount);
+		err |= clSetKernelArg(reduce_stats, 2, sizeof(mass), &params.m);
+		err |= clSetKernelArg(reduce_stats, 3, sizeof(cl_uint), &emitterStart);
+		err |= clSetKernelArg(reduce_stats, 4, sizeof(cl_mem), &statsPartialsCL);
+		err |= clSetKernelArg(reduce_stats, 5, sizeof(cl_uint), &groupOffset);
+		if (err != CL_SUCCESS) {
+			std::cerr << "Failed to set args for the statistics reduction: " << err << std::endl;
+			return false;
+		}
+
+		size_t local = STATS_GROUP_SIZE;
+		size_t global = (count + local - 1) / local * local;
+		err = clEnqueueNDRangeKernel(simQueue, reduce_stats, 1, NULL, &global, &local, 0, NULL, NULL);
+		if (err != CL_SUCCESS) {
+			std::cerr << "Failed to enqueue the statistics reduction: " << err << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	/*
+		Folds the partial records into one and starts a non-blocking read of it,
+		collectStats() picks it up on a later tick once statsEvent has completed
+	*/
+	bool particle_system::enqueueCombineStats(cl_uint groupCount) {
+		cl_int err;
+		err = clSetKernelArg(combine_stats, 0, sizeof(cl_mem), &statsPartialsCL);
+		err |= clSetKernelArg(combine_stats, 1, sizeof(cl_uint), &groupCount);
+		err |= clSetKernelArg(combine_stats, 2, sizeof(cl_mem), &statsResultCL);
+		if (err != CL_SUCCESS) {
+			std::cerr << "Failed to set args for the statistics combine: " << err << std::endl;
+			return false;
+		}
+
+		size_t size = STATS_GROUP_SIZE;
+		err = clEnqueueNDRangeKernel(simQueue, combine_stats, 1, NULL, &size, &size, 0, NULL, NULL);
+		if (err != CL_SUCCESS) {
+			std::cerr << "Failed to enqueue the statistics combine: " << err << std::endl;
+			return false;
+		}
+		err = clEnqueueReadBuffer(simQueue, statsResultCL, CL_FALSE, 0, sizeof(stats_record), &statsReadback, 0, nullptr, &statsEvent);
+		if (err != CL_SUCCESS) {
+			std::cerr << "Failed to read back the statistics: " << err << std::endl;
+			statsEvent = nullptr;
+			return false;
+		}
+		clFlush(simQueue);
+		return true;
+	}
+
+	/*
+		Publishes the statistics read back by a previous tick, without waiting if they are not there yet
+	*/
+	void particle_system::collectStats() {
+		if (!statsEvent)
+			return;
+		cl_int status = CL_QUEUED;
+		clGetEventInfo(statsEvent, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, nullptr);
+		if (status > CL_COMPLETE)
+			return;
+		clReleaseEvent(statsEvent);
+		statsEvent = nullptr;
+		if (status < 0) {
+			std::cerr << "Failed to read back the statistics: " << status << std::endl;
+			return;
+		}
+
+		const stats_record &r = statsReadback;
+		float inv = r.count ? 1.0f / r.count : 0.0f;
+		sim_stats result;
+		result.bbox_min = {r.min[0], r.min[1], r.min[2]};
+		result.bbox_max = {r.max[0], r.max[1], r.max[2]};
+		result.centroid = {r.sum[0] * inv, r.sum[1] * inv, r.sum[2] * inv};
+		// Unit mass particles
+		result.kinetic_energy = r.sum[3];
+		result.max_speed = r.max_speed;
+		result.inside_mass = r.inside;
+		result.live_emitter = r.live;
+		result.count = r.count;
+		result.valid = r.count > 0;
+
+		std::lock_guard<std::mutex> lock(statsMutex);
+		stats = result;
+	}
+
+	/*
+		Latest published statistics, safe to call from the render thread
+	*/
+	sim_stats particle_system::latestStats() const {
+		std::lock_guard<std::mutex> lock(statsMutex);
+		return stats;
+	}
+
+	/*
+		Simulation thread: drains the latest parameters and steps the particles at a fixed rate.
+		A step slower than a tick pushes the schedule back instead of trying to catch up
+	*/
+	void particle_system::simLoop() {
+		const auto tick = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(simDelta));
+		auto next = std::chrono::steady_clock::now();
+		sim_params params = simParams;
+
+		std::unique_lock<std::mutex> lock(simMutex);
+		while (simRunning)
+		{
+			lock.unlock();
+			while (simChannel.pop(params))
+				;
+			auto stepStart = std::chrono::steady_clock::now();
+			if (!enqueueUpdateParticles(params))
+			{
+				// The next steps would fail the same way, the main loop exits instead of drawing stale particles
+				std::cerr << "Error: simulation step failed, stopping" << std::endl;
+				simFailed = true;
+				lock.lock();
+				simRunning = false;
+				return;
+			}
+			simStepMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - stepStart).count();
+			simTicks++;
+			simTickTotal++;
+			lock.lock();
+
+			next += tick;
+			auto now = std::chrono::steady_clock::now();
+			if (next < now)
+				next = now;
+			simWake.wait_until(lock, next, [this] { return !simRunning; });
+		}
+	}
+
+	/*
+		Rank 0 in place of simLoop: each tick sends the latest parameters to every worker, then gathers
+		their decimated particles for the render thread. The workers run in lockstep with it, so the
+		slowest one sets the pace. Once a second the run prints its throughput and how much of a tick
+		the average worker spends updating particles, compare runs of different --ranks at the same count
+	*/
+	void particle_system::viewerLoop() {
+		const auto tick = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(simDelta));
+		auto next = std::chrono::steady_clock::now();
+		sim_params params = simParams;
+		const unsigned int workers = cluster->ranks() - 1;
+		std::vector<particle> gathered;
+		std::vector<unsigned char> payload;
+
+		auto reportStart = next;
+		unsigned int reportTicks = 0;
+		double tickMsSum = 0.0;
+		double stepMsSum = 0.0;
+		double exchangeMsSum = 0.0;
+		uint64_t migratedSum = 0;
+
+		std::unique_lock<std::mutex> lock(simMutex);
+		while (simRunning)
+		{
+			lock.unlock();
+			while (simChannel.pop(params))
+				;
+			auto stepStart = std::chrono::steady_clock::now();
+			bool stepped = true;
+			for (unsigned int rank = 1; rank <= workers && stepped; ++rank)
+				stepped = cluster->send(rank, CLUSTER_STEP, &params, sizeof(params));
+
+			gathered.clear();
+			uint64_t total = 0;
+			uint64_t largest = 0;
+			for (unsigned int rank = 1; rank <= workers && stepped; ++rank)
+			{
+				cluster_summary summary;
+				stepped = cluster->receive(rank, CLUSTER_VIEW, payload) && payload.size() >= sizeof(summary);
+				if (!stepped)
+					break;
+				memcpy(&summary, payload.data(), sizeof(summary));
+				if (payload.size() != sizeof(summary) + summary.sampleCount * sizeof(particle))
+				{
+					std::cerr << "Failed to read the view sent by rank " << rank << ": " << payload.size() << " bytes" << std::endl;
+					stepped = false;
+					break;
+				}
+				size_t first = gathered.size();
+				gathered.resize(first + summary.sampleCount);
+				memcpy(gathered.data() + first, payload.data() + sizeof(summary), summary.sampleCount * sizeof(particle));
+				total += summary.count;
+				largest = std::max(largest, summary.count);
+				stepMsSum += summary.stepMs;
+				exchangeMsSum += summary.exchangeMs;
+				migratedSum += summary.migrated;
+			}
+			if (!stepped)
+			{
+				// The display keeps the last view, the input has no one left to drive
+				std::cerr << "Lost a worker, the distributed simulation stops" << std::endl;
+				return;
+			}
+			{
+				std::lock_guard<std::mutex> viewLock(viewMutex);
+				viewFrame.swap(gathered);
+				viewPending = true;
+			}
+			auto stepEnd = std::chrono::steady_clock::now();
+			simStepMs = std::chrono::duration<float, std::milli>(stepEnd - stepStart).count();
+			simTicks++;
+			simTickTotal++;
+
+			reportTicks++;
+			tickMsSum += simStepMs;
+			std::chrono::duration<double> reportTime = stepEnd - reportStart;
+			if (reportTime.count() >= 1.0)
+			{
+				const double ticksPerSecond = reportTicks / reportTime.count();
+				const double tickMs = tickMsSum / reportTicks;
+				const double stepMs = stepMsSum / (static_cast<double>(reportTicks) * workers);
+				std::cout << std::fixed << std::setprecision(1) << "Cluster: " << workers << " workers, " << total
+					<< " particles (balance " << (largest ? 100.0 * total / workers / largest : 100.0) << "%), "
+					<< ticksPerSecond << " ticks/s, " << std::scientific << std::setprecision(2)
+					<< total * ticksPerSecond << " particle updates/s" << std::fixed << std::setprecision(1)
+					<< ", tick " << tickMs << " ms: update " << stepMs << " ms (efficiency " << 100.0 * stepMs / tickMs
+					<< "%), migration " << exchangeMsSum / (static_cast<double>(reportTicks) * workers) << " ms, "
+					<< migratedSum / reportTicks << " migrated/tick" << std::defaultfloat << std::setprecision(6) << std::endl;
+				reportStart = stepEnd;
+				reportTicks = 0;
+				tickMsSum = 0.0;
+				stepMsSum = 0.0;
+				exchangeMsSum = 0.0;
+				migratedSum = 0;
+			}
+			lock.lock();
+
+			next += tick;
+			auto now = std::chrono::steady_clock::now();
+			if (next < now)
+				next = now;
+			simWake.wait_until(lock, next, [this] { return !simRunning; });
+		}
+	}
+
+	/*
+		--connect viewer in place of simLoop: rebuilds the particles of every frame the server sends, with
+		pos_prev from the frame before so the points still interpolate, and acknowledges it with the latest
+		input. Once a second the viewer prints what the link delivers
+	*/
+	void particle_system::streamLoop() {
+		sim_params params = simParams;
+		stream_frame_header header = {0, 0, 0, 0, 0, 0, 0};
+		std::vector<unsigned char> payload;
+		std::vector<uint16_t> previous;
+		std::vector<particle> decoded;
+		const float scale = STREAM_EXTENT / 65535.0f;
+
+		auto reportStart = std::chrono::steady_clock::now();
+		unsigned int reportFrames = 0;
+		uint64_t reportBytes = 0;
+		uint64_t reportParticles = 0;
+
+		std::unique_lock<std::mutex> lock(simMutex);
+		while (simRunning)
+		{
+			lock.unlock();
+			bool ready = false;
+			if (!streamClient->receive(header, payload, STREAM_WAIT_MS, maxParticles, ready))
+			{
+				std::cerr << "Lost the server, the view stops" << std::endl;
+				return;
+			}
+			if (ready)
+			{
+				const bool keyframe = header.keyframe != 0;
+				if (!keyframe && streamValues.size() != static_cast<size_t>(header.count) * 4)
+				{
+					std::cerr << "Failed to decode frame " << header.sequence << " (tick " << header.tick << "): delta without its keyframe" << std::endl;
+					return;
+				}
+				previous = streamValues;
+				streamValues.resize(static_cast<size_t>(header.count) * 4);
+				if (!decodeFrame(payload.data(), payload.size(), header.count, streamValues.data(), keyframe))
+				{
+					std::cerr << "Failed to decode frame " << header.sequence << " (tick " << header.tick << "): malformed payload" << std::endl;
+					return;
+				}
+
+				decoded.assign(header.count, particle{});
+				for (size_t i = 0; i < header.count; ++i)
+				{
+					const uint16_t *q = &streamValues[i * 4];
+					const uint16_t *o = keyframe ? q : &previous[i * 4];
+					particle &p = decoded[i];
+					p.pos = {q[0] * scale - STREAM_EXTENT * 0.5f, q[1] * scale - STREAM_EXTENT * 0.5f, q[2] * scale - STREAM_EXTENT * 0.5f};
+					p.pos_prev = {o[0] * scale - STREAM_EXTENT * 0.5f, o[1] * scale - STREAM_EXTENT * 0.5f, o[2] * scale - STREAM_EXTENT * 0.5f};
+					p.color = {(q[3] >> 11) / 31.0f, ((q[3] >> 5) & 63) / 63.0f, (q[3] & 31) / 31.0f};
+					p.life = 1.0f;
+					p.max_life = 1.0f;
+				}
+				{
+					std::lock_guard<std::mutex> viewLock(viewMutex);
+					viewFrame.swap(decoded);
+					viewPending = true;
+				}
+				simTicks++;
+				simTickTotal++;
+
+				while (simChannel.pop(params))
+					;
+				if (!streamClient->acknowledge(header.sequence, &params, sizeof(params)))
+				{
+					std::cerr << "Lost the server, the view stops" << std::endl;
+					return;
+				}
+				reportFrames++;
+				reportBytes += sizeof(header) + payload.size();
+				reportParticles += header.count;
+			}
+
+			auto now = std::chrono::steady_clock::now();
+			std::chrono::duration<double> reportTime = now - reportStart;
+			if (reportTime.count() >= 1.0)
+			{
+				std::cout << std::fixed << std::setprecision(1) << "Stream: " << reportFrames / reportTime.count()
+					<< " frames/s, " << (reportFrames ? reportParticles / reportFrames : 0) << " of " << header.total
+					<< " particles per frame, " << reportBytes / reportTime.count() / 1e6 << " MB/s ("
+					<< (reportParticles ? static_cast<double>(reportBytes) / reportParticles : 0.0) << " bytes/particle)"
+					<< std::defaultfloat << std::setprecision(6) << std::endl;
+				reportStart = now;
+				reportFrames = 0;
+				reportBytes = 0;
+				reportParticles = 0;
+			}
+			lock.lock();
+		}
+	}
+
+	/*
+		Starts the simulation thread once the particles are initialised
+	*/
+	void particle_system::startSimThread() {
+		// Workers are stepped by rank 0 from runWorker()
+		if (simThread.joinable() || (cluster && cluster->rank() > 0))
+			return;
+		simParams = currentSimParams();
+		simRunning = true;
+		simThread = std::thread(cluster ? &particle_system::viewerLoop
+			: streamClient ? &particle_system::streamLoop : &particle_system::simLoop, this);
+	}
+
+	/*
+		Stops the simulation thread after its current step, used before touching
+		the chunks or the OpenCL objects from the render thread
+	*/
+	void particle_system::stopSimThread() {
+		if (!simThread.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(simMutex);
+			simRunning = false;
+		}
+		simWake.notify_all();
+		simThread.join();
+	}
+
+	/*
+		Snapshot of everything the simulation reads from the input side
+	*/
+	sim_params particle_system::currentSimParams() const {
+		sim_params params;
+		params.m = m;
+		params.e = e;
+		params.tracer_start = tracer_start;
+		params.passive_start = passive_start;
+		params.emitter_start = emitter_start;
+		params.field = fieldMode;
+		params.collisions = collisionMode;
+		return params;
+	}
+
+	/*
+		Scrolls the force field and blends towards the next frame,
+		a fresh frame is generated on the device each time the blend wraps
+	*/
+	bool particle_system::advanceVectorField(bool enabled) {
+		field.enabled = enabled ? 1u : 0u;
+		if (enabled)
+		{
+			fieldTime += simDelta;
+			float drift = std::fmod(FIELD_SCROLL_SPEED * fieldTime, FIELD_EXTENT);
+			field.origin = {drift, drift * 0.5f, drift * 0.25f};
+
+			// A loaded field has a single frame and only scrolls
+			if (fieldStagingCL)
+			{
+				field.blend += simDelta / FIELD_FRAME_PERIOD;
+				if (field.blend >= 1.0f)
+				{
+					// The frame blended to becomes current, the old one is regenerated as the next target
+					std::swap(fieldImagesCL[0], fieldImagesCL[1]);
+					field.blend = std::fmod(field.blend, 1.0f);
+					fieldSeed++;
+					if (!generateFieldFrame(fieldImagesCL[1], fieldSeed + 1))
+						return false;
+				}
+			}
+		}
+
+		cl_int err = setUpdateArg(4, sizeof(cl_mem), &fieldImagesCL[0]);
+		err |= setUpdateArg(5, sizeof(cl_mem), &fieldImagesCL[1]);
+		err |= setUpdateArg(6, sizeof(field_params), &field);
+		if (err != CL_SUCCESS) {
+			std::cerr << "Failed to set args 4-6 (force field) for OpenCL: " << err << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	/*
+		Runs the curl-noise kernel into the staging buffer and copies it into the field image,
+		the in-order simulation queue keeps consecutive frames from racing on the staging buffer
+	*/
+	bool particle_system::generateFieldFrame(cl_mem image, unsigned int seed) {
+		const size_t texels = static_cast<size_t>(fieldResolution) * fieldResolution * fieldResolution;
+		const cl_uint resolution = fieldResolution;
+		const cl_uint frameSeed = seed;
+
+		cl_int err = clSetKernelArg(generate_field, 0, sizeof(cl_mem), &fieldStagingCL);
+		err |= clSetKernelArg(generate_field, 1, sizeof(cl_uint), &resolution);
+		err |= clSetKernelArg(generate_field, 2, sizeof(cl_uint), &frameSeed);
+		if (err != CL_SUCCESS) {
+			std::cerr << "Failed to set args for the force field kernel: " << err << std::endl;
+			return false;
+		}
+		err = clEnqueueNDRangeKernel(simQueue, generate_field, 1, nullptr, &texels, nullptr, 0, nullptr, nullptr);
+		if (err != CL_SUCCESS) {
+			std::cerr << "Failed to enqueue the force field kernel: " << err << std::endl;
+			return false;
+		}
+
+		const size_t origin[3] = {0, 0, 0};
+		const size_t region[3] = {fieldResolution, fieldResolution, fieldResolution};
+		err = clEnqueueCopyBufferToImage(simQueue, fieldStagingCL, image, 0, origin, region, 0, nullptr, nullptr);
+		if (err != CL_SUCCESS) {
+			std::cerr << "Failed to copy the force field to its image: " << err << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	/*
+		Grows the particle storage with geometric growth so it holds at least minCount particles:
+		the last chunk is reallocated up to the chunk limit, then new chunks are appended.
+		The new tail goes through the current init kernel
+	*/
+	bool particle_system::growParticleBuffer(size_t minCount) {
+		auto growStart = std::chrono::steady_clock::now();
+		const size_t oldCapacity = particleBufferSize;
+		const size_t newCapacity = std::min(std::max(minCount, oldCapacity * 2), maxParticles);
+
+		if (minCount > maxParticles) {
+			std::cerr << "Can't grow to " << minCount << " particles, the device holds at most "
+				<< maxParticles << std::endl;
+			return false;
+		}
+
+		// Fill up the last chunk first
+		size_t remaining = newCapacity - oldCapacity;
+		if (!chunks.empty() && chunks.back().capacity < chunkCapacity) {
+			particle_chunk &last = chunks.back();
+			size_t target = std::min(chunkCapacity, last.capacity + remaining);
+			size_t previous = last.capacity;
+			if (!resizeParticleChunk(last, target))
+				return false;
+			remaining -= target - previous;
+		}
+		while (remaining > 0) {
+			size_t capacity = std::min(remaining, chunkCapacity);
+			if (!createParticleChunk(particleBufferSize, capacity))
+				break;
+			if (!registerParticleChunk(chunks.back())) {
+				dropLastChunk();
+				break;
+			}
+			remaining -= capacity;
+		}
+		// What did grow before a failure is kept and initialised, the caller clamps to it
+		if (particleBufferSize < newCapacity) {
+			std::cerr << "Failed to grow the particle buffer to " << newCapacity << " particles, "
+				<< particleBufferSize << " allocated" << std::endl;
+			if (particleBufferSize > oldCapacity)
+				enqueueInitParticles(oldCapacity, particleBufferSize - oldCapacity);
+			return false;
+		}
+		auto copyEnd = std::chrono::steady_clock::now();
+
+		if (!enqueueInitParticles(oldCapacity, newCapacity - oldCapacity))
+			return false;
+
+		auto growEnd = std::chrono::steady_clock::now();
+		std::chrono::duration<double, std::milli> copyTime = copyEnd - growStart;
+		std::chrono::duration<double, std::milli> totalTime = growEnd - growStart;
+		std::cout << "Particle buffer grown from " << oldCapacity << " to " << newCapacity
+			<< " particles in " << chunks.size() << " chunks, stalled " << totalTime.count()
+			<< " ms (copy " << copyTime.count() << " ms)" << std::endl;
+		return true;
+	}
+
+	/*
+		Allocates a new chunk at the end of the particle storage
+	*/
+	bool particle_system::createParticleChunk(size_t offset, size_t capacity) {
+		particle_chunk chunk = {0, 0, 0, nullptr, nullptr, offset, capacity, std::make_unique<std::mutex>(),
+			std::chrono::steady_clock::now(), trailClock, trailClock, 0, nullptr};
+
+		glGenVertexArrays(1, &chunk.vao);
+		glGenBuffers(1, &chunk.bufferGL);
+		glBindBuffer(GL_ARRAY_BUFFER, chunk.bufferGL);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(particle) * capacity, nullptr, GL_DYNAMIC_DRAW);
+		glGenBuffers(1, &chunk.trailGL);
+		glBindBuffer(GL_ARRAY_BUFFER, chunk.trailGL);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(float3) * TRAIL_SAMPLES * capacity, nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		GLenum glErr = glGetError();
+		if (glErr != GL_NO_ERROR) {
+			std::cerr << "OpenGL error while allocating a chunk of " << capacity << " particles: " << glErr << std::endl;
+			glDeleteBuffers(1, &chunk.bufferGL);
+			glDeleteBuffers(1, &chunk.trailGL);
+			glDeleteVertexArrays(1, &chunk.vao);
+			return false;
+		}
+		bindParticleAttributes(chunk);
+		chunks.push_back(std::move(chunk));
+		particleBufferSize = offset + capacity;
+		return true;
+	}
+
+	/*
+		Reallocates a chunk with a bigger capacity,
+		its particles are copied on the device and the interop object is registered again
+	*/
+	bool particle_system::resizeParticleChunk(particle_chunk &chunk, size_t capacity) {
+		GLuint newBufferGL;
+		GLuint newTrailGL;
+		glGenBuffers(1, &newBufferGL);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, newBufferGL);
+		glBufferData(GL_COPY_WRITE_BUFFER, sizeof(particle) * capacity, nullptr, GL_DYNAMIC_DRAW);
+		glGenBuffers(1, &newTrailGL);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, newTrailGL);
+		glBufferData(GL_COPY_WRITE_BUFFER, sizeof(float3) * TRAIL_SAMPLES * capacity, nullptr, GL_DYNAMIC_DRAW);
+		GLenum glErr = glGetError();
+		if (glErr != GL_NO_ERROR) {
+			std::cerr << "OpenGL error while growing a chunk to " << capacity << " particles: " << glErr << std::endl;
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			glDeleteBuffers(1, &newBufferGL);
+			glDeleteBuffers(1, &newTrailGL);
+			return false;
+		}
+
+		// Device side copy of the whole previous chunk, inactive particles keep their state too.
+		// The history slices move to their new stride one by one
+		glBindBuffer(GL_COPY_READ_BUFFER, chunk.trailGL);
+		for (size_t slice = 0; slice < TRAIL_SAMPLES; ++slice)
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, sizeof(float3) * slice * chunk.capacity,
+				sizeof(float3) * slice * capacity, sizeof(float3) * chunk.capacity);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, newBufferGL);
+		glBindBuffer(GL_COPY_READ_BUFFER, chunk.bufferGL);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(particle) * chunk.capacity);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glFinish();
+
+		// The new buffers are registered before the old ones go, a failure leaves the chunk as it was
+		cl_mem newBufferCL = nullptr;
+		cl_mem newTrailCL = nullptr;
+		if (!registerChunkBuffers(newBufferGL, newTrailGL, newBufferCL, newTrailCL)) {
+			glDeleteBuffers(1, &newBufferGL);
+			glDeleteBuffers(1, &newTrailGL);
+			return false;
+		}
+		for (cl_mem *buffer : {&chunk.bufferCL, &chunk.trailCL})
+		{
+			if (*buffer)
+				clReleaseMemObject(*buffer);
+			*buffer = nullptr;
+		}
+		glDeleteBuffers(1, &chunk.bufferGL);
+		glDeleteBuffers(1, &chunk.trailGL);
+		chunk.bufferGL = newBufferGL;
+		chunk.trailGL = newTrailGL;
+		chunk.bufferCL = newBufferCL;
+		chunk.trailCL = newTrailCL;
+		chunk.capacity = capacity;
+		particleBufferSize = chunk.offset + capacity;
+		bindParticleAttributes(chunk);
+		return true;
+	}
+
+	/*
+		Creates the OpenCL views of a chunk, false with nothing left behind when either fails
+	*/
+	bool particle_system::registerParticleChunk(particle_chunk &chunk) {
+		return registerChunkBuffers(chunk.bufferGL, chunk.trailGL, chunk.bufferCL, chunk.trailCL);
+	}
+
+	bool particle_system::registerChunkBuffers(GLuint bufferGL, GLuint trailGL, cl_mem &bufferCL, cl_mem &trailCL) {
+		bufferCL = clCreateFromGLBuffer(context, CL_MEM_READ_WRITE, bufferGL, &err);
+		if (err == CL_SUCCESS && bufferCL)
+			trailCL = clCreateFromGLBuffer(context, CL_MEM_WRITE_ONLY, trailGL, &err);
+		if (err == CL_SUCCESS && bufferCL && trailCL)
+			return true;
+		std::cerr << "Failed to register a chunk with OpenCL: " << err << std::endl;
+		for (cl_mem *buffer : {&bufferCL, &trailCL})
+		{
+			if (*buffer)
+				clReleaseMemObject(*buffer);
+			*buffer = nullptr;
+		}
+		return false;
+	}
+
+	/*
+		Releases the last chunk and gives its range back, for a chunk that could not be registered
+	*/
+	void particle_system::dropLastChunk() {
+		particle_chunk &chunk = chunks.back();
+		for (cl_mem buffer : {chunk.bufferCL, chunk.trailCL})
+		{
+			if (buffer)
+				clReleaseMemObject(buffer);
+		}
+		if (chunk.glDone)
+			glDeleteSync(chunk.glDone);
+		glDeleteBuffers(1, &chunk.bufferGL);
+		glDeleteBuffers(1, &chunk.trailGL);
+		glDeleteVertexArrays(1, &chunk.vao);
+		particleBufferSize = chunk.offset;
+		chunks.pop_back();
+	}
+
+	/*
+		Number of active particles stored in the chunk
+	*/
+	size_t particle_system::chunkActiveCount(const particle_chunk &chunk) const {
+		if (nb_particles <= chunk.offset)
+			return 0;
+		return std::min(chunk.capacity, nb_particles - chunk.offset);
+	}
+
+	/*
+		OpenCL views of every chunk, acquired and released together
+	*/
+	std::vector<cl_mem> particle_system::sharedChunkBuffers() const {
+		std::vector<cl_mem> shared;
+		shared.reserve(chunks.size());
+		for (const particle_chunk &chunk : chunks)
+			shared.push_back(chunk.bufferCL);
+		return shared;
+	}
+
+	/*
+		Runs the init kernel of the selected reset shape on [offset, offset + count)
+	*/
+	bool particle_system::enqueueInitParticles(size_t offset, size_t count) {
+		if (reset_shape == particleShape::SPHERE)
+			return enqueueInitSphereParticles(offset, count);
+		if (reset_shape == particleShape::CLOUD)
+			return enqueueInitCloudParticles(offset, count);
+		return enqueueInitCubeParticles(offset, count);
+	}
+
+	/*
+		Computes the first particle positions inside a cube
+		depending on cube size and number of particles
+	*/
+	bool particle_system::enqueueInitCubeParticles(size_t offset, size_t count) {
+		err = clSetKernelArg(init_particles_cube, 1, sizeof(unsigned int), &cubeSize);
+		if (err != CL_SUCCESS)
+			return freeCLdata(true, KERNEL_ARGS_SET_ERR);
+		return enqueueInitKernel(init_particles_cube, offset, count);
+	}
+
+	/*
+		Computes the first particle positions inside a sphere
+		depending on sphere radius and number of particles
+	*/
+	bool particle_system::enqueueInitSphereParticles(size_t offset, size_t count) {
+		err = clSetKernelArg(init_particles_sphere, 1, sizeof(float), &sphereRadius);
+		if (err != CL_SUCCESS)
+			return freeCLdata(true, KERNEL_ARGS_SET_ERR);
+		return enqueueInitKernel(init_particles_sphere, offset, count);
+	}
+
+	/*
+		Fills the particles [offset, offset + count) from the mapped point cloud.
+		The records go from the mapping to the device in batches of at most LOAD_STAGING_BYTES
+		without being parsed on the host, the kernel picks and converts the points of each batch
+	*/
+	bool particle_system::enqueueInitCloudParticles(size_t offset, size_t count) {
+		auto loadStart = std::chrono::steady_clock::now();
+		const cl_uint totalCount = static_cast<cl_uint>(offset + count);
+		const cl_uint birth = trailClock;
+		const cl_ulong pointCount = cloud.count;
+		const size_t stride = cloud.layout.stride;
+		auto pointOf = [&](size_t id) { return static_cast<size_t>(static_cast<cl_ulong>(id) * pointCount / totalCount); };
+
+		// Largest particle batch whose point span fits the staging buffer
+		const size_t stagingPoints = std::max<size_t>(std::min<size_t>(LOAD_STAGING_BYTES / stride, cloud.count), 2);
+		const size_t batch = static_cast<size_t>((stagingPoints - 2) * static_cast<cl_ulong>(totalCount) / pointCount + 1);
+		cl_mem staging = clCreateBuffer(context, CL_MEM_READ_ONLY, stagingPoints * stride, nullptr, &err);
+		if (err != CL_SUCCESS || !staging)
+			return freeCLdata(true, CLOUD_LOAD_ERR);
+
+		std::vector<cl_mem> shared = sharedChunkBuffers();
+		err = clEnqueueAcquireGLObjects(queue, shared.size(), shared.data(), 0, nullptr, nullptr);
+		if (err != CL_SUCCESS)
+		{
+			clReleaseMemObject(staging);
+			return freeCLdata(true, ENQUEUE_BUFFER_CL_GL_ERR);
+		}
+
+		size_t uploaded = 0;
+		for (particle_chunk &chunk : chunks)
+		{
+			size_t first = std::max(offset, chunk.offset);
+			size_t last = std::min(offset + count, chunk.offset + chunk.capacity);
+			for (size_t begin = first; begin < last && err == CL_SUCCESS; begin += batch)
+			{
+				size_t end = std::min(last, begin + batch);
+				cl_ulong firstPoint = pointOf(begin);
+				size_t bytes = (pointOf(end - 1) - firstPoint + 1) * stride;
+
+				// In order queue: the next write waits for this batch's kernel, the mapping outlives both
+				err = clEnqueueWriteBuffer(queue, staging, CL_FALSE, 0, bytes, cloud.data + firstPoint * stride, 0, nullptr, nullptr);
+				uploaded += bytes;
+
+				cl_uint chunkOffset = static_cast<cl_uint>(chunk.offset);
+				err |= clSetKernelArg(init_particles_cloud, 0, sizeof(cl_mem), &chunk.bufferCL);
+				err |= clSetKernelArg(init_particles_cloud, 1, sizeof(cl_mem), &staging);
+				err |= clSetKernelArg(init_particles_cloud, 2, sizeof(cl_uint), &chunkOffset);
+				err |= clSetKernelArg(init_particles_cloud, 3, sizeof(cl_uint), &totalCount);
+				err |= clSetKernelArg(init_particles_cloud, 4, sizeof(cloud_layout), &cloud.layout);
+				err |= clSetKernelArg(init_particles_cloud, 5, sizeof(cl_ulong), &pointCount);
+				err |= clSetKernelArg(init_particles_cloud, 6, sizeof(cl_ulong), &firstPoint);
+				err |= clSetKernelArg(init_particles_cloud, 7, sizeof(cl_uint), &birth);
+				if (err != CL_SUCCESS)
+					break;
+
+				size_t localOffset = begin - chunk.offset;
+				size_t localCount = end - begin;
+				err = clEnqueueNDRangeKernel(queue, init_particles_cloud, 1, &localOffset, &localCount, NULL, 0, NULL, NULL);
+			}
+		}
+		clFinish(queue);
+		clReleaseMemObject(staging);
+		if (err != CL_SUCCESS)
+		{
+			std::cout << "Error code: " << err << std::endl;
+			return freeCLdata(true, CLOUD_LOAD_ERR);
+		}
+		err = clEnqueueReleaseGLObjects(queue, shared.size(), shared.data(), 0, nullptr, nullptr);
+		if (err != CL_SUCCESS)
+			return freeCLdata(true, RELEASE_BUFFER_CL_GL_ERR);
+		clFinish(queue);
+
+		float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - loadStart).count();
+		std::cout << "Point cloud: " << count << " particles from " << cloud.count << " points, "
+			<< uploaded / (1024 * 1024) << " MB uploaded in " << static_cast<int>(seconds * 1000.0f) << " ms ("
+			<< static_cast<int>(uploaded / (1024.0f * 1024.0f) / std::max(seconds, 0.001f)) << " MB/s)" << std::endl;
+		return true;
+	}
+
+	/*
+		Runs an init kernel on the particles [offset, offset + count),
+		dispatched on every chunk overlapping the range
+	*/
+	bool particle_system::enqueueInitKernel(cl_kernel kernel, size_t offset, size_t count) {
+		//Acquiring buffers
+		std::vector<cl_mem> shared = sharedChunkBuffers();
+		err = clEnqueueAcquireGLObjects(queue, shared.size(), shared.data(), 0, nullptr, nullptr);
+		if (err != CL_SUCCESS)
+			return freeCLdata(true, ENQUEUE_BUFFER_CL_GL_ERR);
+
+		// The cube layout and the seeds depend on the index in the whole system, a worker holds a part of it
+		const cl_uint totalCount = static_cast<cl_uint>(clusterTotal ? clusterTotal : offset + count);
+		const cl_uint birth = trailClock;
+		for (particle_chunk &chunk : chunks)
+		{
+			size_t first = std::max(offset, chunk.offset);
+			size_t last = std::min(offset + count, chunk.offset + chunk.capacity);
+			if (first >= last)
+				continue;
+
+			// Set kernel arguments
+			cl_uint chunkOffset = static_cast<cl_uint>(clusterFirst + chunk.offset);
+			err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &chunk.bufferCL);
+			err |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &chunkOffset);
+			err |= clSetKernelArg(kernel, 3, sizeof(cl_uint), &totalCount);
+			err |= clSetKernelArg(kernel, 4, sizeof(cl_uint), &birth);
+			if (err != CL_SUCCESS)
+				return freeCLdata(true, KERNEL_ARGS_SET_ERR);
+
+			// Execute the init kernel on the chunk local range
+			size_t localOffset = first - chunk.offset;
+			size_t localCount = last - first;
+			err = clEnqueueNDRangeKernel(queue, kernel, 1, &localOffset, &localCount, NULL, 0, NULL, NULL);
+			if (err != CL_SUCCESS)
+			{
+				std::cout << "Error code: " << err << std::endl;
+				return freeCLdata(true, ENQUEUE_NDRANGE_KERNEL_ERR);
+			}
+		}
+		clFinish(queue);
+		err = clEnqueueReleaseGLObjects(queue, shared.size(), shared.data(), 0, nullptr, nullptr);
+		if (err != CL_SUCCESS)
+			return freeCLdata(true, RELEASE_BUFFER_CL_GL_ERR);
+		clFinish(queue);
+		return true;
+	}
+
+	/*
+		Splats the far particles into the density grid with atomics
+		then resolves it into the shared volume buffers
+	*/
+	bool particle_system::enqueueSplatDensity() {
+		const cl_uchar zero = 0;
+		const size_t coarseRes = lod.resolution / LOD_COARSE_FACTOR;
+		const size_t coarseCells = coarseRes * coarseRes * coarseRes;
+		size_t cells = static_cast<size_t>(lod.resolution) * lod.resolution * lod.resolution;
+
+		err = clSetKernelArg(splat_density, 1, sizeof(cl_mem), &densityAccumCL);
+		err |= clSetKernelArg(splat_density, 2, sizeof(lod_params), &lod);
+		err |= clSetKernelArg(resolve_density, 0, sizeof(cl_mem), &densityAccumCL);
+		err |= clSetKernelArg(resolve_density, 1, sizeof(cl_mem), &densityVolumeCL);
+		err |= clSetKernelArg(resolve_density, 2, sizeof(cl_mem), &densityCoarseCL);
+		err |= clSetKernelArg(resolve_density, 3, sizeof(lod_params), &lod);
+		if (err != CL_SUCCESS) {
+			std::cerr << "Failed to set args for density kernels: " << err << std::endl;
+			return false;
+		}
+
+		std::vector<cl_mem> shared = {densityVolumeCL, densityCoarseCL};
+		err = clEnqueueAcquireGLObjects(queue, shared.size(), shared.data(), 0, nullptr, nullptr);
+		if (err != CL_SUCCESS) {
+			std::cerr << "Failed to acquire density GL objects for OpenCL: " << err << std::endl;
+			return false;
+		}
+
+		err = clEnqueueFillBuffer(queue, densityCoarseCL, &zero, sizeof(zero), 0, coarseCells, 0, nullptr, nullptr);
+		for (particle_chunk &chunk : chunks)
+		{
+			size_t count = chunkActiveCount(chunk);
+			if (err != CL_SUCCESS || count == 0)
+				break;
+
+			// The chunk stays locked until the splat has read it
+			std::lock_guard<std::mutex> lock(*chunk.lock);
+			err = acquireChunk(queue, chunk, 1, &chunk.bufferCL);
+			if (err == CL_SUCCESS)
+				err = clSetKernelArg(splat_density, 0, sizeof(cl_mem), &chunk.bufferCL);
+			if (err == CL_SUCCESS)
+				err = clEnqueueNDRangeKernel(queue, splat_density, 1, NULL, &count, NULL, 0, NULL, NULL);
+			cl_int releaseErr = clEnqueueReleaseGLObjects(queue, 1, &chunk.bufferCL, 0, nullptr, nullptr);
+			clFinish(queue);
+			if (err == CL_SUCCESS)
+				err = releaseErr;
+		}
+		if (err == CL_SUCCESS)
+			err = clEnqueueNDRangeKernel(queue, resolve_density, 1, NULL, &cells, NULL, 0, NULL, NULL);
+		if (err != CL_SUCCESS)
+			std::cerr << "Failed to enqueue density kernels: " << err << std::endl;
+
+		cl_int releaseErr = clEnqueueReleaseGLObjects(queue, shared.size(), shared.data(), 0, nullptr, nullptr);
+		if (releaseErr != CL_SUCCESS)
+			std::cerr << "Failed to release density GL objects: " << releaseErr << std::endl;
+		clFinish(queue);
+		return err == CL_SUCCESS && releaseErr == CL_SUCCESS;
+	}
+
+	/*
+		Grows the splat buffers, the tile ones and the per particle ones separately
+	*/
+	bool particle_system::reserveSplatBuffers(size_t tiles, size_t points) {
+		cl_int err = CL_SUCCESS;
+		if (tiles > splatTileCapacity)
+		{
+			splatTileCapacity = 0;
+			for (cl_mem *buffer : {&splatTileCountsCL, &splatTileStartsCL, &splatTileCursorCL})
+			{
+				if (*buffer)
+					clReleaseMemObject(*buffer);
+				// One more start than tiles, the end of the last tile
+				*buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, (tiles + 1) * sizeof(cl_uint), nullptr, &err);
+				if (err != CL_SUCCESS || !*buffer)
+				{
+					std::cerr << SPLAT_CREATE_ERR << ": " << err << std::endl;
+					*buffer = nullptr;
+					return false;
+				}
+			}
+			splatTileCapacity = tiles;
+		}
+		if (points > splatPointCapacity)
+		{
+			splatPointCapacity = 0;
+			std::vector<std::pair<cl_mem *, size_t>> buffers = {
+				{&splatPointTilesCL, sizeof(cl_uint)}, {&splatPointFragmentsCL, 2 * sizeof(cl_uint)},
+				{&splatTileFragmentsCL, 2 * sizeof(cl_uint)},
+			};
+			for (auto &buffer : buffers)
+			{
+				if (*buffer.first)
+					clReleaseMemObject(*buffer.first);
+				*buffer.first = clCreateBuffer(context, CL_MEM_READ_WRITE, points * buffer.second, nullptr, &err);
+				if (err != CL_SUCCESS || !*buffer.first)
+				{
+					std::cerr << SPLAT_CREATE_ERR << ": " << err << std::endl;
+					*buffer.first = nullptr;
+					return false;
+				}
+			}
+			splatPointCapacity = points;
+		}
+		return true;
+	}
+
+	/*
+		(Re)creates the RGBA8 frame texture at the framebuffer size and the OpenCL image over it,
+		the old image is released before GL respecifies the texture
+	*/
+	bool particle_system::resizeSplatFrame(int width, int height) {
+		if (splatFrameCL)
+			clReleaseMemObject(splatFrameCL);
+		splatFrameCL = nullptr;
+		splatWidth = 0;
+		splatHeight = 0;
+
+		if (!splatFrameTex)
+			glGenTextures(1, &splatFrameTex);
+		glBindTexture(GL_TEXTURE_2D, splatFrameTex);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		// The storage must exist on the GL side before OpenCL wraps it
+		glFinish();
+
+		cl_int err = CL_SUCCESS;
+		splatFrameCL = clCreateFromGLTexture(context, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0, splatFrameTex, &err);
+		if (err != CL_SUCCESS || !splatFrameCL)
+		{
+			std::cerr << "Failed to share the splat frame texture with OpenCL: " << err << std::endl;
+			splatFrameCL = nullptr;
+			return false;
+		}
+		splatWidth = width;
+		splatHeight = height;
+		return true;
+	}
+
+	/*
+		Splats every active particle as one pixel into the frame texture, a counting sort by screen tile
+		like the query grid: bin per chunk, scan the tile counts, scatter the fragments in tile order,
+		then one work-group per tile depth tests them in local memory and writes its pixels
+	*/
+	bool particle_system::enqueueSplatPoints(const glm::mat4 &viewProj) {
+		// Minimized, the last frame stays in the texture
+		if (windowWidth <= 0 || windowHeight <= 0)
+			return splatFrameCL != nullptr;
+		if ((!splatFrameCL || splatWidth != windowWidth || splatHeight != windowHeight)
+			&& !resizeSplatFrame(windowWidth, windowHeight))
+			return false;
+
+		splat_params s;
+		std::memcpy(s.view_proj, glm::value_ptr(viewProj), sizeof(s.view_proj));
+		s.width = static_cast<cl_uint>(splatWidth);
+		s.height = static_cast<cl_uint>(splatHeight);
+		s.tiles_x = (s.width + SPLAT_TILE_SIZE - 1) / SPLAT_TILE_SIZE;
+		s.alpha = 1.0f;
+		cl_uint tiles = s.tiles_x * ((s.height + SPLAT_TILE_SIZE - 1) / SPLAT_TILE_SIZE);
+		size_t points = nb_particles;
+		if (!reserveSplatBuffers(tiles, points))
+			return false;
+
+		const cl_uint zero = 0;
+		err = clEnqueueFillBuffer(queue, splatTileCountsCL, &zero, sizeof(zero), 0, tiles * sizeof(cl_uint), 0, nullptr, nullptr);
+		err |= clSetKernelArg(bin_points, 3, sizeof(cl_mem), &splatTileCountsCL);
+		err |= clSetKernelArg(bin_points, 4, sizeof(cl_mem), &splatPointTilesCL);
+		err |= clSetKernelArg(bin_points, 5, sizeof(cl_mem), &splatPointFragmentsCL);
+		for (particle_chunk &chunk : chunks)
+		{
+			size_t count = chunkActiveCount(chunk);
+			if (err != CL_SUCCESS || count == 0)
+				break;
+
+			// The chunk stays locked until it is binned, each one at its own interpolation
+			std::lock_guard<std::mutex> lock(*chunk.lock);
+			float sinceTick = std::chrono::duration<float>(std::chrono::steady_clock::now() - chunk.tick).count();
+			s.alpha = std::clamp(sinceTick / simDelta, 0.0f, 1.0f);
+			cl_uint offset = static_cast<cl_uint>(chunk.offset);
+			err = acquireChunk(queue, chunk, 1, &chunk.bufferCL);
+			if (err == CL_SUCCESS)
+				err = clSetKernelArg(bin_points, 0, sizeof(cl_mem), &chunk.bufferCL);
+			if (err == CL_SUCCESS)
+				err = clSetKernelArg(bin_points, 1, sizeof(cl_uint), &offset);
+			if (err == CL_SUCCESS)
+				err = clSetKernelArg(bin_points, 2, sizeof(splat_params), &s);
+			if (err == CL_SUCCESS)
+				err = clEnqueueNDRangeKernel(queue, bin_points, 1, NULL, &count, NULL, 0, NULL, NULL);
+			cl_int releaseErr = clEnqueueReleaseGLObjects(queue, 1, &chunk.bufferCL, 0, nullptr, nullptr);
+			clFinish(queue);
+			if (err == CL_SUCCESS)
+				err = releaseErr;
+		}
+
+		size_t scanSize = SPLAT_SCAN_GROUP_SIZE;
+		size_t tileSize = SPLAT_TILE_SIZE * SPLAT_TILE_SIZE;
+		size_t rasterSize = tiles * tileSize;
+		if (err == CL_SUCCESS)
+		{
+			err = clSetKernelArg(scan_tiles, 0, sizeof(cl_mem), &splatTileCountsCL);
+			err |= clSetKernelArg(scan_tiles, 1, sizeof(cl_mem), &splatTileStartsCL);
+			err |= clSetKernelArg(scan_tiles, 2, sizeof(cl_mem), &splatTileCursorCL);
+			err |= clSetKernelArg(scan_tiles, 3, sizeof(cl_uint), &tiles);
+			err |= clSetKernelArg(scatter_points, 0, sizeof(cl_mem), &splatPointTilesCL);
+			err |= clSetKernelArg(scatter_points, 1, sizeof(cl_mem), &splatPointFragmentsCL);
+			err |= clSetKernelArg(scatter_points, 2, sizeof(cl_mem), &splatTileCursorCL);
+			err |= clSetKernelArg(scatter_points, 3, sizeof(cl_mem), &splatTileFragmentsCL);
+			err |= clSetKernelArg(raster_tiles, 0, sizeof(cl_mem), &splatTileStartsCL);
+			err |= clSetKernelArg(raster_tiles, 1, sizeof(cl_mem), &splatTileFragmentsCL);
+			err |= clSetKernelArg(raster_tiles, 2, sizeof(splat_params), &s);
+			err |= clSetKernelArg(raster_tiles, 3, sizeof(cl_mem), &splatFrameCL);
+		}
+		if (err == CL_SUCCESS)
+			err = clEnqueueNDRangeKernel(queue, scan_tiles, 1, NULL, &scanSize, &scanSize, 0, NULL, NULL);
+		if (err == CL_SUCCESS)
+			err = clEnqueueNDRangeKernel(queue, scatter_points, 1, NULL, &points, NULL, 0, NULL, NULL);
+		if (err != CL_SUCCESS)
+		{
+			std::cerr << "Failed to bin the splatted points: " << err << std::endl;
+			clFinish(queue);
+			return false;
+		}
+
+		// Only the raster step touches the texture
+		err = clEnqueueAcquireGLObjects(queue, 1, &splatFrameCL, 0, nullptr, nullptr);
+		if (err == CL_SUCCESS)
+			err = clEnqueueNDRangeKernel(queue, raster_tiles, 1, NULL, &rasterSize, &tileSize, 0, NULL, NULL);
+		cl_int releaseErr = clEnqueueReleaseGLObjects(queue, 1, &splatFrameCL, 0, nullptr, nullptr);
+		clFinish(queue);
+		if (err != CL_SUCCESS || releaseErr != CL_SUCCESS)
+		{
+			std::cerr << "Failed to rasterize the splatted points: " << (err != CL_SUCCESS ? err : releaseErr) << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	/*
+		Worker whose slab holds x, the outer slabs reach to infinity and NaN falls in the first one
+	*/
+	unsigned int particle_system::slabOwner(float x) const {
+		const unsigned int workers = cluster->ranks() - 1;
+		const float slab = std::floor((x + cubeSize / 2.0f) / (static_cast<float>(cubeSize) / workers));
+		if (!(slab > 0.0f))
+			return 1;
+		return 1 + static_cast<unsigned int>(std::min(slab, static_cast<float>(workers - 1)));
+	}
+
+	/*
+		Lists the particles outside [slabLow, slabHigh) with a copy of their state. The count keeps going
+		past a full list, which then grows to it and the listing runs again, so no emigrant waits a tick
+	*/
+	bool particle_system::listEmigrants(std::vector<cl_uint> &indices, std::vector<particle> &emigrants) {
+		std::vector<cl_mem> shared = sharedChunkBuffers();
+		cl_uint found = 0;
+		do {
+			if (!reserveMigrateBuffers(found))
+				return false;
+			const cl_uint capacity = static_cast<cl_uint>(migrateCapacity);
+			cl_int err = clEnqueueAcquireGLObjects(simQueue, shared.size(), shared.data(), 0, nullptr, nullptr);
+			if (err != CL_SUCCESS) {
+				std::cerr << "Failed to acquire the chunks for the migration: " << err << std::endl;
+				return false;
+			}
+			// From here on every error goes through the release below
+			cl_uint zero = 0;
+			err = clEnqueueWriteBuffer(simQueue, emigrantCountCL, CL_FALSE, 0, sizeof(cl_uint), &zero, 0, nullptr, nullptr);
+			for (particle_chunk &chunk : chunks)
+			{
+				size_t count = chunkActiveCount(chunk);
+				if (count == 0 || err != CL_SUCCESS)
+					break;
+				cl_uint chunkOffset = static_cast<cl_uint>(chunk.offset);
+				err = clSetKernelArg(find_emigrants, 0, sizeof(cl_mem), &chunk.bufferCL);
+				err |= clSetKernelArg(find_emigrants, 1, sizeof(cl_uint), &chunkOffset);
+				err |= clSetKernelArg(find_emigrants, 2, sizeof(float), &slabLow);
+				err |= clSetKernelArg(find_emigrants, 3, sizeof(float), &slabHigh);
+				err |= clSetKernelArg(find_emigrants, 4, sizeof(cl_mem), &emigrantCountCL);
+				err |= clSetKernelArg(find_emigrants, 5, sizeof(cl_mem), &emigrantIndexCL);
+				err |= clSetKernelArg(find_emigrants, 6, sizeof(cl_mem), &emigrantsCL);
+				err |= clSetKernelArg(find_emigrants, 7, sizeof(cl_uint), &capacity);
+				if (err == CL_SUCCESS)
+					err = clEnqueueNDRangeKernel(simQueue, find_emigrants, 1, nullptr, &count, nullptr, 0, nullptr, nullptr);
+			}
+			if (err == CL_SUCCESS)
+				err = clEnqueueReadBuffer(simQueue, emigrantCountCL, CL_TRUE, 0, sizeof(cl_uint), &found, 0, nullptr, nullptr);
+			const size_t listed = std::min(found, capacity);
+			indices.resize(listed);
+			emigrants.resize(listed);
+			if (err == CL_SUCCESS && listed > 0 && found <= capacity)
+			{
+				err = clEnqueueReadBuffer(simQueue, emigrantIndexCL, CL_FALSE, 0, listed * sizeof(cl_uint), indices.data(), 0, nullptr, nullptr);
+				err |= clEnqueueReadBuffer(simQueue, emigrantsCL, CL_TRUE, 0, listed * sizeof(particle), emigrants.data(), 0, nullptr, nullptr);
+			}
+			cl_int releaseErr = clEnqueueReleaseGLObjects(simQueue, shared.size(), shared.data(), 0, nullptr, nullptr);
+			clFinish(simQueue);
+			if (err != CL_SUCCESS || releaseErr != CL_SUCCESS) {
+				std::cerr << "Failed to list the particles leaving the slab: " << (err != CL_SUCCESS ? err : releaseErr) << std::endl;
+				return false;
+			}
+			if (found > capacity)
+				std::cout << "Worker " << cluster->rank() << ": " << found << " particles leaving the slab, past the list of "
+					<< capacity << ", growing it" << std::endl;
+		} while (found > migrateCapacity);
+		return true;
+	}
+
+	/*
+		Sends the particles that left the slab to the worker owning their new position. They are listed
+		on the device, the holes they leave below the new end are filled from the tail so the active range
+		stays contiguous, and the particles received from the other workers are appended after it.
+		Every chunk but the last is full, so a particle index finds its chunk by division
+	*/
+	bool particle_system::migrateParticles(uint64_t &migrated) {
+		cl_int err;
+		migrated = 0;
+		const unsigned int self = cluster->rank();
+
+		// Step 1: list the particles outside [slabLow, slabHigh) with a copy of their state
+		std::vector<cl_uint> indices;
+		std::vector<particle> emigrants;
+		if (!listEmigrants(indices, emigrants))
+			return false;
+		const size_t listed = indices.size();
+
+		// Step 2: one message to every other worker, empty or not. A particle right on a boundary
+		// the host places in this slab after all stays where it is
+		std::vector<std::vector<unsigned char>> outgoing(cluster->ranks());
+		std::vector<cl_uint> leaving;
+		for (size_t i = 0; i < listed; ++i)
+		{
+			unsigned int owner = slabOwner(emigrants[i].pos.x);
+			if (owner == self)
+				continue;
+			const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&emigrants[i]);
+			outgoing[owner].insert(outgoing[owner].end(), bytes, bytes + sizeof(particle));
+			leaving.push_back(indices[i]);
+		}
+		std::vector<unsigned int> peers;
+		for (unsigned int rank = 1; rank < cluster->ranks(); ++rank)
+		{
+			if (rank != self)
+				peers.push_back(rank);
+		}
+		std::vector<std::vector<unsigned char>> incoming;
+		if (!cluster->exchange(peers, CLUSTER_MIGRATE, outgoing, incoming))
+			return false;
+
+		std::vector<particle> arrivals;
+		for (unsigned int rank : peers)
+		{
+			size_t first = arrivals.size();
+			arrivals.resize(first + incoming[rank].size() / sizeof(particle));
+			memcpy(arrivals.data() + first, incoming[rank].data(), (arrivals.size() - first) * sizeof(particle));
+		}
+		const size_t count = nb_particles;
+		const size_t kept = count - leaving.size();
+		const size_t newCount = kept + arrivals.size();
+		if (newCount > particleBufferSize && !growParticleBuffer(newCount))
+			return false;
+		if (leaving.empty() && arrivals.empty())
+			return true;
+
+		// Step 3: the holes below kept, in order, take the particles staying in the tail [kept, count)
+		std::sort(leaving.begin(), leaving.end());
+		const size_t holes = std::lower_bound(leaving.begin(), leaving.end(), kept) - leaving.begin();
+		std::vector<cl_uint> moves;
+		moves.reserve(holes * 2);
+		size_t tailEmigrant = holes;
+		size_t source = kept;
+		for (size_t hole = 0; hole < holes; ++hole, ++source)
+		{
+			while (tailEmigrant < leaving.size() && leaving[tailEmigrant] == source)
+			{
+				tailEmigrant++;
+				source++;
+			}
+			moves.push_back(leaving[hole]);
+			moves.push_back(static_cast<cl_uint>(source - kept));
+		}
+
+		std::vector<cl_mem> shared = sharedChunkBuffers();
+		err = clEnqueueAcquireGLObjects(simQueue, shared.size(), shared.data(), 0, nullptr, nullptr);
+		if (err != CL_SUCCESS) {
+			std::cerr << "Failed to acquire the chunks for the migration: " << err << std::endl;
+			return false;
+		}
+		if (holes > 0)
+		{
+			// The tail is staged in the emigrant buffer, already read back, before the arrivals overwrite it
+			for (particle_chunk &chunk : chunks)
+			{
+				size_t first = std::max(kept, chunk.offset);
+				size_t last = std::min(count, chunk.offset + chunk.capacity);
+				if (first >= last || err != CL_SUCCESS)
+					continue;
+				err = clEnqueueCopyBuffer(simQueue, chunk.bufferCL, emigrantsCL, (first - chunk.offset) * sizeof(particle),
+					(first - kept) * sizeof(particle), (last - first) * sizeof(particle), 0, nullptr, nullptr);
+			}
+			if (err == CL_SUCCESS)
+				err = clEnqueueWriteBuffer(simQueue, migrateMovesCL, CL_FALSE, 0, moves.size() * sizeof(cl_uint), moves.data(), 0, nullptr, nullptr);
+			for (size_t hole = 0; hole < holes && err == CL_SUCCESS;)
+			{
+				particle_chunk &chunk = chunks[leaving[hole] / chunkCapacity];
+				size_t end = hole;
+				while (end < holes && leaving[end] < chunk.offset + chunk.capacity)
+					end++;
+				cl_uint chunkOffset = static_cast<cl_uint>(chunk.offset);
+				cl_uint firstMove = static_cast<cl_uint>(hole);
+				err = clSetKernelArg(fill_holes, 0, sizeof(cl_mem), &chunk.bufferCL);
+				err |= clSetKernelArg(fill_holes, 1, sizeof(cl_uint), &chunkOffset);
+				err |= clSetKernelArg(fill_holes, 2, sizeof(cl_mem), &migrateMovesCL);
+				err |= clSetKernelArg(fill_holes, 3, sizeof(cl_uint), &firstMove);
+				err |= clSetKernelArg(fill_holes, 4, sizeof(cl_mem), &emigrantsCL);
+				size_t moveCount = end - hole;
+				if (err == CL_SUCCESS)
+					err = clEnqueueNDRangeKernel(simQueue, fill_holes, 1, nullptr, &moveCount, nullptr, 0, nullptr, nullptr);
+				hole = end;
+			}
+		}
+
+		// Step 4: the arrivals go after the kept particles
+		for (particle_chunk &chunk : chunks)
+		{
+			size_t first = std::max(kept, chunk.offset);
+			size_t last = std::min(newCount, chunk.offset + chunk.capacity);
+			if (first >= last || err != CL_SUCCESS)
+				continue;
+			err = clEnqueueWriteBuffer(simQueue, chunk.bufferCL, CL_FALSE, (first - chunk.offset) * sizeof(particle),
+				(last - first) * sizeof(particle), arrivals.data() + (first - kept), 0, nullptr, nullptr);
+		}
+		cl_int releaseErr = clEnqueueReleaseGLObjects(simQueue, shared.size(), shared.data(), 0, nullptr, nullptr);
+		clFinish(simQueue);
+		if (err != CL_SUCCESS || releaseErr != CL_SUCCESS) {
+			std::cerr << "Failed to move the migrated particles: " << (err != CL_SUCCESS ? err : releaseErr) << std::endl;
+			return false;
+		}
+
+		nb_particles = newCount;
+		default_nb_particles = newCount;
+		updateSpeciesRanges();
+		migrated = leaving.size();
+		return true;
+	}
+
+	/*
+		Every nb_particles / sampleCount-th particle of the worker, at most its share of
+		CLUSTER_VIEW_PARTICLES, goes to rank 0 behind the summary of the tick
+	*/
+	bool particle_system::sendViewSample(cluster_summary &summary) {
+		const size_t share = CLUSTER_VIEW_PARTICLES / (cluster->ranks() - 1);
+		const size_t sampleCount = std::min(nb_particles, share);
+		summary.sampleCount = sampleCount;
+		std::vector<unsigned char> payload(sizeof(summary) + sampleCount * sizeof(particle));
+		memcpy(payload.data(), &summary, sizeof(summary));
+
+		if (sampleCount > 0)
+		{
+			cl_int err;
+			std::vector<cl_mem> shared = sharedChunkBuffers();
+			err = clEnqueueAcquireGLObjects(simQueue, shared.size(), shared.data(), 0, nullptr, nullptr);
+			if (err != CL_SUCCESS) {
+				std::cerr << "Failed to acquire the chunks for the view sample: " << err << std::endl;
+				return false;
+			}
+			const cl_uint count = static_cast<cl_uint>(nb_particles);
+			const cl_uint samples = static_cast<cl_uint>(sampleCount);
+			for (particle_chunk &chunk : chunks)
+			{
+				size_t active = chunkActiveCount(chunk);
+				if (active == 0 || err != CL_SUCCESS)
+					break;
+				// Samples whose source index lands in [offset, offset + active)
+				size_t first = (chunk.offset * sampleCount + nb_particles - 1) / nb_particles;
+				size_t end = std::min(sampleCount, ((chunk.offset + active) * sampleCount + nb_particles - 1) / nb_particles);
+				if (first >= end)
+					continue;
+				cl_uint chunkOffset = static_cast<cl_uint>(chunk.offset);
+				cl_uint firstSample = static_cast<cl_uint>(first);
+				err = clSetKernelArg(sample_particles, 0, sizeof(cl_mem), &chunk.bufferCL);
+				err |= clSetKernelArg(sample_particles, 1, sizeof(cl_uint), &chunkOffset);
+				err |= clSetKernelArg(sample_particles, 2, sizeof(cl_uint), &count);
+				err |= clSetKernelArg(sample_particles, 3, sizeof(cl_uint), &samples);
+				err |= clSetKernelArg(sample_particles, 4, sizeof(cl_uint), &firstSample);
+				err |= clSetKernelArg(sample_particles, 5, sizeof(cl_mem), &viewSamplesCL);
+				size_t range = end - first;
+				if (err == CL_SUCCESS)
+					err = clEnqueueNDRangeKernel(simQueue, sample_particles, 1, nullptr, &range, nullptr, 0, nullptr, nullptr);
+			}
+			if (err == CL_SUCCESS)
+				err = clEnqueueReadBuffer(simQueue, viewSamplesCL, CL_TRUE, 0, sampleCount * sizeof(particle),
+					payload.data() + sizeof(summary), 0, nullptr, nullptr);
+			cl_int releaseErr = clEnqueueReleaseGLObjects(simQueue, shared.size(), shared.data(), 0, nullptr, nullptr);
+			clFinish(simQueue);
+			if (err != CL_SUCCESS || releaseErr != CL_SUCCESS) {
+				std::cerr << "Failed to sample the particles for rank 0: " << (err != CL_SUCCESS ? err : releaseErr) << std::endl;
+				return false;
+			}
+		}
+		return cluster->send(0, CLUSTER_VIEW, payload.data(), payload.size());
+	}
+
+	bool particle_system::reserveStreamBuffer(size_t particles) {
+		if (particles <= streamCapacity)
+			return true;
+		cl_int err = CL_SUCCESS;
+		streamCapacity = 0;
+		if (streamQuantizedCL)
+			clReleaseMemObject(streamQuantizedCL);
+		streamQuantizedCL = clCreateBuffer(context, CL_MEM_WRITE_ONLY, particles * 4 * sizeof(cl_ushort), nullptr, &err);
+		if (err != CL_SUCCESS || !streamQuantizedCL)
+		{
+			std::cerr << STREAM_CREATE_ERR << ": " << err << std::endl;
+			streamQuantizedCL = nullptr;
+			return false;
+		}
+		streamCapacity = particles;
+		return true;
+	}
+
+	/*
+		Every particle as 4 ushorts into streamQuantized, one chunk at a time under its lock
+		so the simulation thread never waits for more than one chunk
+	*/
+	bool particle_system::quantizeParticles() {
+		const size_t count = nb_particles;
+		if (!reserveStreamBuffer(count))
+			return false;
+		const float extent = STREAM_EXTENT;
+		cl_int err = clSetKernelArg(quantize_particles, 2, sizeof(float), &extent);
+		err |= clSetKernelArg(quantize_particles, 3, sizeof(cl_mem), &streamQuantizedCL);
+		for (particle_chunk &chunk : chunks)
+		{
+			size_t active = chunkActiveCount(chunk);
+			if (err != CL_SUCCESS || active == 0)
+				break;
+			std::lock_guard<std::mutex> lock(*chunk.lock);
+			cl_uint offset = static_cast<cl_uint>(chunk.offset);
+			err = acquireChunk(queue, chunk, 1, &chunk.bufferCL);
+			if (err == CL_SUCCESS)
+				err = clSetKernelArg(quantize_particles, 0, sizeof(cl_mem), &chunk.bufferCL);
+			if (err == CL_SUCCESS)
+				err = clSetKernelArg(quantize_particles, 1, sizeof(cl_uint), &offset);
+			if (err == CL_SUCCESS)
+				err = clEnqueueNDRangeKernel(queue, quantize_particles, 1, nullptr, &active, nullptr, 0, nullptr, nullptr);
+			cl_int releaseErr = clEnqueueReleaseGLObjects(queue, 1, &chunk.bufferCL, 0, nullptr, nullptr);
+			clFinish(queue);
+			if (err == CL_SUCCESS)
+				err = releaseErr;
+		}
+		streamQuantized.resize(count * 4);
+		if (err == CL_SUCCESS && count > 0)
+			err = clEnqueueReadBuffer(queue, streamQuantizedCL, CL_TRUE, 0, count * 4 * sizeof(cl_ushort),
+				streamQuantized.data(), 0, nullptr, nullptr);
+		if (err != CL_SUCCESS)
+		{
+			std::cerr << "Failed to quantize the particles for the viewers: " << err << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	/*
+		Initialises vertex array and vertex buffer objects
+		Initialises the vertex and fragment shaders
+	*/
+	void particle_system::initShaders()
+	{
+
+		// Vertex and Fragment shader setup
+		shaderProgram = createShaderProgram("shaders/particle.vert", "shaders/particle.frag", "shaders/particle.gs");
+
+		// Vertex and Fragment shader setup for spaghetti mode
+		spaghettiShaderProgram = createShaderProgram("shaders/spaghetti.vert", "shaders/spaghetti.frag", "");
+
+		// Ray marcher for the density volume LOD
+		volumeShaderProgram = createShaderProgram("shaders/volume.vert", "shaders/volume.frag", "");
+
+		// Instanced mass and emitter spheres
+		gizmoShaderProgram = createShaderProgram("shaders/gizmo.vert", "shaders/gizmo.frag", "");
+
+		// Batched text and graphs of the performance overlay
+		hudShaderProgram = createShaderProgram("shaders/hud.vert", "shaders/hud.frag", "");
+
+		// Presents the OpenCL splatted frame, same fullscreen triangle as the ray marcher
+		splatShaderProgram = createShaderProgram("shaders/volume.vert", "shaders/splat.frag", "");
+	}
+
+	/*
+		Returns true once every shader program has finished linking,
+		without blocking when the driver compiles in the background
+	*/
+	bool particle_system::pollShaders()
+	{
+		bool ready = true;
+		for (GLuint program : {shaderProgram, spaghettiShaderProgram, volumeShaderProgram, gizmoShaderProgram, hudShaderProgram,
+			splatShaderProgram})
+			ready = shaderProgramReady(program) && ready;
+		return ready;
+	}
+
+	/*
+		Marks the end of the GL commands using a chunk, on the render thread with the chunk locked.
+		A glFlush() only submits them, so without cl_khr_gl_event the GPU is drained here instead
+	*/
+	void particle_system::fenceChunk(particle_chunk &chunk)
+	{
+		if (!createEventFromGLsync)
+		{
+			glFinish();
+			return;
+		}
+		if (chunk.glDone)
+			glDeleteSync(chunk.glDone);
+		chunk.glDone = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+	}
+
+	/*
+		Acquires shared objects of a locked chunk once GL is done with them. The fence is only replaced
+		under the same lock and every caller finishes its queue before unlocking, so it outlives the wait
+	*/
+	cl_int particle_system::acquireChunk(cl_command_queue target, particle_chunk &chunk, cl_uint count, const cl_mem *objects)
+	{
+		cl_event glDone = nullptr;
+		if (chunk.glDone && createEventFromGLsync)
+		{
+			cl_int syncErr;
+			glDone = createEventFromGLsync(context, reinterpret_cast<cl_GLsync>(chunk.glDone), &syncErr);
+			if (syncErr != CL_SUCCESS)
+				return syncErr;
+		}
+		cl_int acquireErr = clEnqueueAcquireGLObjects(target, count, objects, glDone ? 1 : 0, glDone ? &glDone : nullptr, nullptr);
+		if (glDone)
+			clReleaseEvent(glDone);
+		return acquireErr;
+	}
+
+	/*
+		Points the vertex attributes of the chunk VAO at its buffer,
+		called again whenever the chunk is reallocated
+	*/
+	void particle_system::bindParticleAttributes(particle_chunk &chunk)
+	{
+		// OpenGL VAO/VBO setup
+		glBindVertexArray(chunk.vao);
+		glBindBuffer(GL_ARRAY_BUFFER, chunk.bufferGL);
+
+		// Position
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(particle), (void*)offsetof(particle, pos));
+
+		// Colors
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(particle), (void*)offsetof(particle, color));
+
+		// Old position
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(particle), (void*)offsetof(particle, pos_prev));
+
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+	}
+
+	/*
+		Initialises and allocates the CL/GL shared buffer
+		on the VRAM and checks for errors
+	*/
+	bool particle_system::initSharedBufferData() {
+		std::cout << "Initialising OpenGL/OpenCL shared buffer" << std::endl;
+		std::cout << glGetString(GL_VERSION) << std::endl;
+		if (nb_particles > maxParticles) {
+			std::cerr << "Error: " << nb_particles << " particles don't fit in memory, at most "
+				<< maxParticles << " can be allocated" << std::endl;
+			return false;
+		}
+
+		// Generate the OpenGL buffers, each one stays under the device allocation limit
+		particleBufferSize = 0;
+		while (particleBufferSize < nb_particles)
+		{
+			if (!createParticleChunk(particleBufferSize, std::min(nb_particles - particleBufferSize, chunkCapacity)))
+			{
+				// Every pass sizes its work from nb_particles, it never goes past what was allocated.
+				// Without a single chunk finishCLdata() refuses to start
+				std::cerr << "Error: only " << particleBufferSize << " of " << nb_particles
+					<< " particles could be allocated, running with those" << std::endl;
+				nb_particles = particleBufferSize;
+				default_nb_particles = std::min(default_nb_particles, particleBufferSize);
+				updateSpeciesRanges();
+				return false;
+			}
+		}
+		std::cout << nb_particles << " particles split in " << chunks.size() << " chunk(s)" << std::endl;
+
+		// Ensure OpenGL commands are finished before proceeding
+		glFinish();
+		return true;
+	}
+
+	/*
+		Reads the device memory limits: the largest single allocation sizes the chunks,
+		the global memory (and the host memory backing the GL buffers) bounds the particle count
+	*/
+	void particle_system::queryDeviceLimits() {
+		// Minimum allocation size guaranteed by the OpenCL specification
+		cl_ulong maxAlloc = 128ull << 20;
+		cl_ulong globalMem = 0;
+
+		if (selected_device) {
+			clGetDeviceInfo(selected_device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAlloc), &maxAlloc, nullptr);
+			clGetDeviceInfo(selected_device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(globalMem), &globalMem, nullptr);
+		}
+		deviceGlobalMem = globalMem;
+		chunkCapacity = std::min<size_t>(maxAlloc / sizeof(particle), CHUNK_MAX_PARTICLES);
+
+		std::cout << "Device memory: " << (globalMem >> 20) << " MB, max allocation: " << (maxAlloc >> 20)
+			<< " MB, chunks of " << chunkCapacity << " particles" << std::endl;
+	}
+
+	/*
+		Bytes taken on the device by each particle and by every fixed size resource,
+		the particle storage gets what is left of the usable memory
+	*/
+	memory_plan particle_system::memoryFootprint() const {
+		memory_plan plan;
+		const size_t lodCells = static_cast<size_t>(lod.resolution) * lod.resolution * lod.resolution;
+		const size_t coarseCells = lodCells / (LOD_COARSE_FACTOR * LOD_COARSE_FACTOR * LOD_COARSE_FACTOR);
+		// Accumulation buffer, shared half4 buffer and its texture, coarse buffer and texture
+		plan.fixed.push_back({"density volume", lodCells * (4 * sizeof(cl_uint) + 2 * 4 * sizeof(GLhalf)) + coarseCells * 2});
+
+		// Generated: staging buffer and two frames, loaded: one RGBA image of the file triples
+		size_t fieldBytes = static_cast<size_t>(fieldResolution) * fieldResolution * fieldResolution * 4 * sizeof(float) * 3;
+		struct stat fieldInfo;
+		if (!fieldPath.empty() && stat(fieldPath.c_str(), &fieldInfo) == 0)
+			fieldBytes = static_cast<size_t>(fieldInfo.st_size) / 3 * 4;
+		plan.fixed.push_back({"force field", fieldBytes});
+
+		const size_t sdfCells = static_cast<size_t>(SDF_RESOLUTION) * SDF_RESOLUTION * SDF_RESOLUTION;
+		plan.fixed.push_back({"collision SDF", sdfCells * 4 * sizeof(cl_half)});
+
+		// Counts, starts and cursors at the largest grid, and the result list
+		const size_t queryCells = static_cast<size_t>(QUERY_MAX_RESOLUTION) * QUERY_MAX_RESOLUTION * QUERY_MAX_RESOLUTION;
+		plan.fixed.push_back({"query grid", (queryCells + 1) * 3 * sizeof(cl_uint) + (QUERY_MAX_RESULTS + 1) * sizeof(cl_uint)});
+
+		// Double buffered color and depth at the largest size the window can take
+		int fbWidth = windowWidth;
+		int fbHeight = windowHeight;
+		if (GLFWmonitor *monitor = glfwGetPrimaryMonitor())
+		{
+			if (const GLFWvidmode *mode = glfwGetVideoMode(monitor))
+			{
+				fbWidth = std::max(fbWidth, mode->width);
+				fbHeight = std::max(fbHeight, mode->height);
+			}
+		}
+		plan.fixed.push_back({"framebuffers", static_cast<size_t>(fbWidth) * fbHeight * 4 * 3});
+
+		// Shared RGBA8 frame and the counts, starts and cursors of its tiles
+		const size_t splatTiles = static_cast<size_t>((fbWidth + SPLAT_TILE_SIZE - 1) / SPLAT_TILE_SIZE)
+			* ((fbHeight + SPLAT_TILE_SIZE - 1) / SPLAT_TILE_SIZE);
+		plan.fixed.push_back({"splat frame", static_cast<size_t>(fbWidth) * fbHeight * 4 + (splatTiles + 1) * 3 * sizeof(cl_uint)});
+
+		// Emigrant list with the moves that compact the range behind them, and the view sample
+		if (cluster && cluster->rank() > 0)
+			plan.fixed.push_back({"migration", static_cast<size_t>(CLUSTER_MIGRATE_MAX) * (sizeof(particle) + 3 * sizeof(cl_uint))
+				+ CLUSTER_VIEW_PARTICLES / (cluster->ranks() - 1) * sizeof(particle)});
+
+		// State, trail history, grid copy of the position, cell and sort slot, statistics partial,
+		// splat tile and fragment before and after the scatter
+		plan.perParticle = sizeof(particle) + TRAIL_SAMPLES * sizeof(float3) + 2 * (4 * sizeof(float) + sizeof(cl_uint))
+			+ (sizeof(stats_record) + STATS_GROUP_SIZE - 1) / STATS_GROUP_SIZE + 5 * sizeof(cl_uint);
+		// The server's quantized copy of every particle
+		if (streamServer)
+			plan.perParticle += 4 * sizeof(cl_ushort);
+		return plan;
+	}
+
+	/*
+		Sizes the particle storage before anything is allocated: the usable memory is the smallest of
+		the OpenCL global memory, the free video memory reported by GL (NVX or ATI extension) and the host memory,
+		minus MEMORY_RESERVE_FRACTION for the driver. A request that does not fit is scaled down,
+		maxParticles stays at 0 when not even the fixed resources fit and startCLdata() refuses to start
+	*/
+	void particle_system::planMemoryBudget() {
+		memory_plan plan = memoryFootprint();
+		size_t usable = deviceGlobalMem ? static_cast<size_t>(deviceGlobalMem) : std::numeric_limits<size_t>::max();
+		const char *source = deviceGlobalMem ? "OpenCL global memory" : "no device limit";
+
+		GLint freeKb[4] = {0, 0, 0, 0};
+		if (GLEW_NVX_gpu_memory_info)
+			glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, freeKb);
+		else if (GLEW_ATI_meminfo)
+			glGetIntegerv(GL_VBO_FREE_MEMORY_ATI, freeKb);
+		// Free memory already excludes what the desktop uses, compared before the reserve is taken out
+		if (freeKb[0] > 0 && static_cast<size_t>(freeKb[0]) * 1024 < usable)
+		{
+			usable = static_cast<size_t>(freeKb[0]) * 1024;
+			source = "free video memory";
+		}
+		long pages = sysconf(_SC_PHYS_PAGES);
+		long pageSize = sysconf(_SC_PAGE_SIZE);
+		if (pages > 0 && pageSize > 0 && static_cast<size_t>(pages) * pageSize < usable)
+		{
+			usable = static_cast<size_t>(pages) * pageSize;
+			source = "host memory";
+		}
+		usable -= static_cast<size_t>(usable * MEMORY_RESERVE_FRACTION);
+
+		size_t fixed = 0;
+		for (const memory_item &item : plan.fixed)
+			fixed += item.bytes;
+		maxParticles = usable > fixed ? (usable - fixed) / plan.perParticle : 0;
+
+		std::cout << "Memory budget: " << (usable >> 20) << " MB usable (" << source << ", "
+			<< static_cast<int>(MEMORY_RESERVE_FRACTION * 100) << "% kept for the driver)" << std::endl;
+		for (const memory_item &item : plan.fixed)
+			std::cout << "  " << std::left << std::setw(16) << item.name << std::right << std::setw(8) << (item.bytes >> 20) << " MB" << std::endl;
+		std::cout << "  " << std::left << std::setw(16) << "particles" << std::right << std::setw(8)
+			<< ((std::min(nb_particles, maxParticles) * plan.perParticle) >> 20) << " MB ("
+			<< plan.perParticle << " B each, up to " << maxParticles << ")" << std::endl;
+
+		if (maxParticles == 0)
+		{
+			std::cerr << "Error: the fixed resources alone need " << (fixed >> 20) << " MB" << std::endl;
+			return;
+		}
+		if (nb_particles > maxParticles)
+		{
+			std::cerr << "Warning: " << nb_particles << " particles don't fit, starting with " << maxParticles << std::endl;
+			nb_particles = maxParticles;
+			default_nb_particles = maxParticles;
+			particleBufferSize = maxParticles;
+		}
+	}
+
+	/*
+		Allocates the GL side of the density volume LOD:
+		the buffers the resolve kernel writes and the 3D textures sampled by the ray marcher
+	*/
+	bool particle_system::initDensityVolumeData() {
+		const GLsizei res = static_cast<GLsizei>(lod.resolution);
+		const GLsizei coarseRes = res / LOD_COARSE_FACTOR;
+		const size_t cells = static_cast<size_t>(res) * res * res;
+		const size_t coarseCells = static_cast<size_t>(coarseRes) * coarseRes * coarseRes;
+
+		// Resolved half4 texels and coarse occupancy bytes, written by OpenCL
+		glGenBuffers(1, &densityVolumeGL);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, densityVolumeGL);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, cells * 4 * sizeof(GLhalf), nullptr, GL_DYNAMIC_COPY);
+		glGenBuffers(1, &densityCoarseGL);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, densityCoarseGL);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, coarseCells, nullptr, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		// Trilinear filtered volume, nearest fetched occupancy
+		glGenTextures(1, &densityVolumeTex);
+		glBindTexture(GL_TEXTURE_3D, densityVolumeTex);
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, res, res, res, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+		glGenTextures(1, &densityCoarseTex);
+		glBindTexture(GL_TEXTURE_3D, densityCoarseTex);
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, coarseRes, coarseRes, coarseRes, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_3D, 0);
+
+		// The fullscreen triangle is generated in the vertex shader
+		glGenVertexArrays(1, &volumeVao);
+
+		GLenum glErr = glGetError();
+		if (glErr != GL_NO_ERROR) {
+			std::cerr << "OpenGL error during density volume initialization: " << glErr << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	/*
+		Builds the unit sphere mesh shared by every gizmo once,
+		the instance buffer holds a position, radius and color per gizmo
+	*/
+	bool particle_system::initGizmoData() {
+		const unsigned int seg = GIZMO_SPHERE_SEGMENTS;
+		std::vector<float> vertices;
+		std::vector<GLuint> indices;
+
+		vertices.reserve((seg + 1) * (seg + 1) * 3);
+		for (unsigned int stack = 0; stack <= seg; stack++)
+		{
+			float phi = M_PI * stack / seg;
+			for (unsigned int slice = 0; slice <= seg; slice++)
+			{
+				float theta = 2.0f * M_PI * slice / seg;
+				vertices.push_back(std::sin(phi) * std::cos(theta));
+				vertices.push_back(std::cos(phi));
+				vertices.push_back(std::sin(phi) * std::sin(theta));
+			}
+		}
+		indices.reserve(seg * seg * 6);
+		for (unsigned int stack = 0; stack < seg; stack++)
+		{
+			for (unsigned int slice = 0; slice < seg; slice++)
+			{
+				GLuint a = stack * (seg + 1) + slice;
+				GLuint b = a + seg + 1;
+				indices.insert(indices.end(), {a, b, a + 1, a + 1, b, b + 1});
+			}
+		}
+		gizmoIndexCount = static_cast<GLsizei>(indices.size());
+
+		glGenVertexArrays(1, &gizmoVao);
+		glBindVertexArray(gizmoVao);
+
+		glGenBuffers(1, &gizmoMeshVBO);
+		glBindBuffer(GL_ARRAY_BUFFER, gizmoMeshVBO);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+		glEnableVertexAttribArray(0);
+
+		glGenBuffers(1, &gizmoMeshIBO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gizmoMeshIBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+
+		glGenBuffers(1, &gizmoInstanceVBO);
+		glBindBuffer(GL_ARRAY_BUFFER, gizmoInstanceVBO);
+		glBufferData(GL_ARRAY_BUFFER, GIZMO_MAX_INSTANCES * sizeof(gizmo_instance), nullptr, GL_DYNAMIC_DRAW);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(gizmo_instance), (void*)offsetof(gizmo_instance, pos));
+		glEnableVertexAttribArray(1);
+		glVertexAttribDivisor(1, 1);
+		glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(gizmo_instance), (void*)offsetof(gizmo_instance, color));
+		glEnableVertexAttribArray(2);
+		glVertexAttribDivisor(2, 1);
+
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		GLenum glErr = glGetError();
+		if (glErr != GL_NO_ERROR) {
+			std::cerr << "OpenGL error during gizmo initialization: " << glErr << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	/*
+		Creates the 3D images the update kernel samples the force field from,
+		either two generated curl-noise frames or the one loaded with --field
+	*/
+	bool particle_system::initVectorFieldCL() {
+		cl_bool imageSupport = CL_FALSE;
+		clGetDeviceInfo(selected_device, CL_DEVICE_IMAGE_SUPPORT, sizeof(imageSupport), &imageSupport, nullptr);
+		if (!imageSupport)
+			return freeCLdata(true, FIELD_CREATE_ERR);
+
+		if (!fieldPath.empty())
+			return loadVectorField();
+
+		const size_t texels = static_cast<size_t>(fieldResolution) * fieldResolution * fieldResolution;
+		fieldStagingCL = clCreateBuffer(context, CL_MEM_READ_WRITE, texels * 4 * sizeof(cl_float), nullptr, &err);
+		if (err != CL_SUCCESS || !fieldStagingCL)
+			return freeCLdata(true, FIELD_CREATE_ERR);
+
+		cl_image_format format = {CL_RGBA, CL_FLOAT};
+		cl_image_desc desc;
+		memset(&desc, 0, sizeof(desc));
+		desc.image_type = CL_MEM_OBJECT_IMAGE3D;
+		desc.image_width = fieldResolution;
+		desc.image_height = fieldResolution;
+		desc.image_depth = fieldResolution;
+		for (cl_mem &image : fieldImagesCL)
+		{
+			image = clCreateImage(context, CL_MEM_READ_ONLY, &format, &desc, nullptr, &err);
+			if (err != CL_SUCCESS || !image)
+				return freeCLdata(true, FIELD_CREATE_ERR);
+		}
+
+		// Current frame and the one it blends towards
+		if (!generateFieldFrame(fieldImagesCL[0], fieldSeed) || !generateFieldFrame(fieldImagesCL[1], fieldSeed + 1))
+			return freeCLdata(true, FIELD_CREATE_ERR);
+		clFinish(simQueue);
+		return true;
+	}
+
+	/*
+		Loads a static force field made of n^3 float32 x, y, z triples (x fastest),
+		padded to RGBA since RGB float images are optional in OpenCL
+	*/
+	bool particle_system::loadVectorField() {
+		std::ifstream file(fieldPath, std::ios::binary | std::ios::ate);
+		if (!file.is_open())
+			return freeCLdata(true, std::string(FIELD_LOAD_ERR) + ": " + fieldPath);
+
+		const size_t bytes = static_cast<size_t>(file.tellg());
+		const size_t texels = bytes / (3 * sizeof(float));
+		const size_t res = static_cast<size_t>(std::lround(std::cbrt(static_cast<double>(texels))));
+		if (res < 2 || res * res * res * 3 * sizeof(float) != bytes)
+			return freeCLdata(true, std::string(FIELD_LOAD_ERR) + ": expected n^3 float32 x, y, z triples in " + fieldPath);
+
+		std::vector<float> xyz(texels * 3);
+		file.seekg(0);
+		if (!file.read(reinterpret_cast<char*>(xyz.data()), bytes))
+			return freeCLdata(true, std::string(FIELD_LOAD_ERR) + ": " + fieldPath);
+		std::vector<float> rgba(texels * 4, 0.0f);
+		for (size_t i = 0; i < texels; i++)
+			std::copy(&xyz[i * 3], &xyz[i * 3] + 3, &rgba[i * 4]);
+
+		fieldResolution = static_cast<unsigned int>(res);
+		cl_image_format format = {CL_RGBA, CL_FLOAT};
+		cl_image_desc desc;
+		memset(&desc, 0, sizeof(desc));
+		desc.image_type = CL_MEM_OBJECT_IMAGE3D;
+		desc.image_width = res;
+		desc.image_height = res;
+		desc.image_depth = res;
+		fieldImagesCL[0] = clCreateImage(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, &format, &desc, rgba.data(), &err);
+		if (err != CL_SUCCESS || !fieldImagesCL[0])
+			return freeCLdata(true, FIELD_CREATE_ERR);
+
+		// Both kernel slots point at the same image, the blend stays at 0
+		fieldImagesCL[1] = fieldImagesCL[0];
+		clRetainMemObject(fieldImagesCL[1]);
+		if (!resetSim)
+			std::cout << "Force field loaded from " << fieldPath << " (" << res << "^3)" << std::endl;
+		return true;
+	}
+
+	/*
+		Loads the collision scene and bakes it into the SDF image the first time,
+		resets keep both along with the context
+	*/
+	bool particle_system::initCollisionCL() {
+		if (!collidersLoaded && !loadColliders())
+			return freeCLdata(true, std::string(COLLIDER_LOAD_ERR) + ": " + colliderPath);
+		collidersLoaded = true;
+		return sdfImageCL || bakeCollisionField();
+	}
+
+	/*
+		Reads the --colliders scene, one primitive per line, '#' starts a comment.
+		Without a file a floor, a sphere and a box are placed around the mass
+	*/
+	bool particle_system::loadColliders() {
+		colliders.clear();
+		colliderTriangles.clear();
+		if (colliderPath.empty())
+		{
+			colliders.push_back({{0.0f, 1.0f, 0.0f}, {-35.0f, 0.0f, 0.0f}, COLLIDER_PLANE});
+			colliders.push_back({{-15.0f, -25.0f, 5.0f}, {7.0f, 0.0f, 0.0f}, COLLIDER_SPHERE});
+			colliders.push_back({{18.0f, -28.0f, -6.0f}, {6.0f, 6.0f, 6.0f}, COLLIDER_BOX});
+			return true;
+		}
+
+		std::ifstream file(colliderPath);
+		if (!file.is_open())
+			return false;
+		std::string line;
+		while (std::getline(file, line))
+		{
+			std::istringstream in(line.substr(0, line.find('#')));
+			std::string kind;
+			if (!(in >> kind))
+				continue;
+			collider c = {{0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}, COLLIDER_PLANE};
+			if (kind == "plane" && in >> c.center.x >> c.center.y >> c.center.z >> c.extent.x)
+			{
+				float len = std::sqrt(c.center.x * c.center.x + c.center.y * c.center.y + c.center.z * c.center.z);
+				if (len <= 0.0f)
+					return false;
+				c.center = {c.center.x / len, c.center.y / len, c.center.z / len};
+			}
+			else if (kind == "sphere" && in >> c.center.x >> c.center.y >> c.center.z >> c.extent.x)
+				c.type = COLLIDER_SPHERE;
+			else if (kind == "box" && in >> c.center.x >> c.center.y >> c.center.z >> c.extent.x >> c.extent.y >> c.extent.z)
+				c.type = COLLIDER_BOX;
+			else if (kind == "mesh")
+			{
+				std::string path;
+				if (!(in >> path) || !loadColliderMesh(path))
+					return false;
+				continue;
+			}
+			else
+			{
+				std::cerr << "Invalid collider line: " << line << std::endl;
+				return false;
+			}
+			colliders.push_back(c);
+		}
+		return true;
+	}
+
+	/*
+		Appends the faces of a Wavefront OBJ mesh as triangles (fan triangulated),
+		only 'v' and 'f' records are used
 	*/
-	cl_event particle_system::enqueueUpdateParticles() {
-		cl_int err;
-		cl_event kernel_event;
-
-		err = clSetKernelArg(calculate_position, 0, sizeof(cl_mem), &particleBufferCL);
-		if (err != CL_SUCCESS) {
-			std::cerr << "Failed to set args 0 for OpenCL: " << err << std::endl;
-			return 0;
+	bool particle_system::loadColliderMesh(const std::string &path) {
+		std::ifstream file(path);
+		if (!file.is_open())
+		{
+			std::cerr << "Couldn't open collider mesh: " << path << std::endl;
+			return false;
 		}
-
-		err = clSetKernelArg(calculate_position, 1, sizeof(mass), &m);
-		if (err != CL_SUCCESS) {
-			std::cerr << "Failed to set args 1 for OpenCL: " << err << std::endl;
-			return 0;
+		std::vector<float3> vertices;
+		std::string line;
+		while (std::getline(file, line))
+		{
+			std::istringstream in(line);
+			std::string kind;
+			in >> kind;
+			if (kind == "v")
+			{
+				float3 v;
+				if (in >> v.x >> v.y >> v.z)
+					vertices.push_back(v);
+			}
+			else if (kind == "f")
+			{
+				// "i", "i/t" or "i/t/n", negative indices count from the end
+				std::vector<float3> face;
+				std::string token;
+				while (in >> token)
+				{
+					long index = std::strtol(token.c_str(), nullptr, 10);
+					if (index < 0)
+						index += static_cast<long>(vertices.size()) + 1;
+					if (index < 1 || index > static_cast<long>(vertices.size()))
+					{
+						std::cerr << "Invalid face in collider mesh: " << path << std::endl;
+						return false;
+					}
+					face.push_back(vertices[index - 1]);
+				}
+				for (size_t i = 2; i < face.size(); i++)
+				{
+					for (const float3 &v : {face[0], face[i - 1], face[i]})
+						colliderTriangles.insert(colliderTriangles.end(), {v.x, v.y, v.z});
+				}
+			}
 		}
+		return true;
+	}
 
-		err = clSetKernelArg(calculate_position, 2, sizeof(emitter), &e);
-		if (err != CL_SUCCESS) {
-			std::cerr << "Failed to set args 2 (emitter) for OpenCL: " << err << std::endl;
-			return 0;
+	/*
+		Maps a --load file: binary little endian PLY (float x, y, z vertex properties)
+		or raw float32 records, x y z per point in a .xyz file and x y z r g b in a .xyzrgb one.
+		Only the header is read here, the points are left to the upload
+	*/
+	bool particle_system::mapPointCloud(const std::string &path) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			std::cerr << "Couldn't open point cloud: " << path << std::endl;
+			return false;
 		}
-
-		err = clSetKernelArg(calculate_position, 3, sizeof(float), &delta);
-		if (err != CL_SUCCESS) {
-			std::cerr << "Failed to set args 3 (deltaTime) for OpenCL: " << err << std::endl;
-			return 0;
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size <= 0)
+		{
+			std::cerr << "Empty point cloud: " << path << std::endl;
+			close(fd);
+			return false;
 		}
-
-		cl_uint emitterStart = static_cast<cl_uint>(emitter_start);
-		err = clSetKernelArg(calculate_position, 4, sizeof(cl_uint), &emitterStart);
-		if (err != CL_SUCCESS) {
-			std::cerr << "Failed to set args 4 (emitter start) for OpenCL: " << err << std::endl;
-			return 0;
+		cloud.mappingSize = static_cast<size_t>(info.st_size);
+		cloud.mapping = mmap(nullptr, cloud.mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (cloud.mapping == MAP_FAILED)
+		{
+			std::cerr << "Couldn't map point cloud: " << path << std::endl;
+			cloud.mapping = nullptr;
+			return false;
 		}
+		// Read front to back once per upload
+		madvise(cloud.mapping, cloud.mappingSize, MADV_SEQUENTIAL);
 
-		err = clEnqueueAcquireGLObjects(queue, 1, &particleBufferCL, 0, nullptr, nullptr);
-		if (err != CL_SUCCESS) {
-			std::cerr << "Failed to acquire GL objects for OpenCL: " << err << std::endl;
-			return 0;
+		const char *begin = static_cast<const char *>(cloud.mapping);
+		bool valid;
+		if (cloud.mappingSize >= 4 && std::memcmp(begin, "ply\n", 4) == 0)
+			valid = parsePlyHeader(begin, cloud.mappingSize);
+		else
+		{
+			bool withColors = path.size() >= 7 && path.compare(path.size() - 7, 7, ".xyzrgb") == 0;
+			cloud.layout = {static_cast<cl_uint>((withColors ? 6 : 3) * sizeof(float)), 0, 4, 8};
+			cloud.data = static_cast<const unsigned char *>(cloud.mapping);
+			cloud.count = cloud.mappingSize / cloud.layout.stride;
+			valid = cloud.count > 0;
 		}
-		clFinish(queue);
-
-		err = clEnqueueNDRangeKernel(queue, calculate_position, 1, NULL, &nb_particles, NULL, 0, NULL, &kernel_event);
-		if (err != CL_SUCCESS) {
-			std::cerr << "Failed to enqueue kernel for OpenCL: " << err << std::endl;
-			return 0;
+		if (!valid)
+		{
+			std::cerr << "Invalid point cloud: " << path << std::endl;
+			unmapPointCloud();
+			return false;
 		}
+		std::cout << "Mapped point cloud " << path << ": " << cloud.count << " points" << std::endl;
+		return true;
+	}
 
-		err = clEnqueueReleaseGLObjects(queue, 1, &particleBufferCL, 0, nullptr, nullptr);
-		if (err != CL_SUCCESS) {
-			std::cerr << "Failed to dequeue kernel for OpenCL: " << err << std::endl;
-			return 0;
+	/*
+		Reads the vertex layout from the PLY header, the vertex element has to come first
+		and have no list property. Properties other than x, y and z are skipped over
+	*/
+	bool particle_system::parsePlyHeader(const char *begin, size_t size) {
+		static const std::map<std::string, cl_uint> typeSizes = {
+			{"char", 1}, {"uchar", 1}, {"int8", 1}, {"uint8", 1},
+			{"short", 2}, {"ushort", 2}, {"int16", 2}, {"uint16", 2},
+			{"int", 4}, {"uint", 4}, {"float", 4}, {"int32", 4}, {"uint32", 4}, {"float32", 4},
+			{"double", 8}, {"float64", 8},
+		};
+		const std::string terminator = "end_header\n";
+		std::string header(begin, std::min<size_t>(size, LOAD_PLY_HEADER_MAX));
+		size_t headerEnd = header.find(terminator);
+		if (headerEnd == std::string::npos)
+			return false;
+		header.resize(headerEnd);
+
+		std::istringstream lines(header);
+		std::string line;
+		bool binary = false;
+		bool inVertex = false;
+		int elements = 0;
+		int found = 0;
+		size_t vertexCount = 0;
+		cloud.layout = {0, 0, 0, 0};
+		while (std::getline(lines, line))
+		{
+			std::istringstream in(line);
+			std::string keyword;
+			in >> keyword;
+			if (keyword == "format")
+			{
+				std::string format;
+				in >> format;
+				binary = format == "binary_little_endian";
+			}
+			else if (keyword == "element")
+			{
+				std::string name;
+				in >> name;
+				// Only the first element matters, the vertices have to be at the start of the data
+				inVertex = elements++ == 0 && name == "vertex" && in >> vertexCount;
+			}
+			else if (keyword == "property" && inVertex)
+			{
+				std::string type;
+				std::string name;
+				in >> type >> name;
+				auto typeSize = typeSizes.find(type);
+				if (type == "list" || typeSize == typeSizes.end())
+					return false;
+				bool isFloat = type == "float" || type == "float32";
+				if (name == "x" || name == "y" || name == "z")
+				{
+					if (!isFloat)
+						return false;
+					(name == "x" ? cloud.layout.x : name == "y" ? cloud.layout.y : cloud.layout.z) = cloud.layout.stride;
+					++found;
+				}
+				cloud.layout.stride += typeSize->second;
+			}
 		}
-		clFinish(queue);
+		if (!binary || found != 3 || vertexCount == 0)
+			return false;
+
+		cloud.data = reinterpret_cast<const unsigned char *>(begin) + headerEnd + terminator.size();
+		cloud.count = vertexCount;
+		size_t available = size - (headerEnd + terminator.size());
+		return available / cloud.layout.stride >= vertexCount;
+	}
 
-		return kernel_event;
+	void particle_system::unmapPointCloud() {
+		if (cloud.mapping)
+			munmap(cloud.mapping, cloud.mappingSize);
+		cloud = {nullptr, 0, nullptr, 0, {0, 0, 0, 0}};
 	}
 
 	/*
-		Computes the first particle positions inside a cube
-		depending on cube size and number of particles
+		Bakes every collider into a half4 image (outward normal, signed distance),
+		the collision cost in the update kernel no longer depends on the scene
 	*/
-	bool particle_system::enqueueInitCubeParticles() {
-		//Acquiring buffer
-		err = clEnqueueAcquireGLObjects(queue, 1, &particleBufferCL, 0, nullptr, nullptr);
-		if (err != CL_SUCCESS)
-			return freeCLdata(true, ENQUEUE_BUFFER_CL_GL_ERR);
-
-		// Set kernel arguments
-		err = clSetKernelArg(init_particles_cube, 0, sizeof(cl_mem), &particleBufferCL);
-		if (err != CL_SUCCESS)
-			return freeCLdata(true, KERNEL_ARGS_SET_ERR);
-		err = clSetKernelArg(init_particles_cube, 1, sizeof(unsigned int), &cubeSize);
-		if (err != CL_SUCCESS)
-			return freeCLdata(true, KERNEL_ARGS_SET_ERR);
+	bool particle_system::bakeCollisionField() {
+		const cl_uint res = SDF_RESOLUTION;
+		const size_t cells = static_cast<size_t>(res) * res * res;
+		const cl_uint colliderCount = static_cast<cl_uint>(colliders.size());
+		const cl_uint triangleCount = static_cast<cl_uint>(colliderTriangles.size() / 9);
+
+		// Zero sized buffers are invalid, keep one dummy element
+		std::vector<collider> colliderData = colliders;
+		std::vector<float> triangleData = colliderTriangles;
+		colliderData.resize(std::max<size_t>(colliderData.size(), 1));
+		triangleData.resize(std::max<size_t>(triangleData.size(), 9));
+
+		cl_mem distCL = clCreateBuffer(context, CL_MEM_READ_WRITE, cells * sizeof(cl_float), nullptr, &err);
+		cl_mem packedCL = clCreateBuffer(context, CL_MEM_READ_WRITE, cells * 4 * sizeof(cl_half), nullptr, &err);
+		cl_mem collidersCL = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			colliderData.size() * sizeof(collider), colliderData.data(), &err);
+		cl_mem trianglesCL = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			triangleData.size() * sizeof(float), triangleData.data(), &err);
+
+		cl_image_format format = {CL_RGBA, CL_HALF_FLOAT};
+		cl_image_desc desc;
+		memset(&desc, 0, sizeof(desc));
+		desc.image_type = CL_MEM_OBJECT_IMAGE3D;
+		desc.image_width = res;
+		desc.image_height = res;
+		desc.image_depth = res;
+		sdfImageCL = clCreateImage(context, CL_MEM_READ_ONLY, &format, &desc, nullptr, &err);
+
+		bool ok = distCL && packedCL && collidersCL && trianglesCL && sdfImageCL;
+		if (ok)
+		{
+			err = clSetKernelArg(bake_distance, 0, sizeof(cl_mem), &distCL);
+			err |= clSetKernelArg(bake_distance, 1, sizeof(cl_uint), &res);
+			err |= clSetKernelArg(bake_distance, 2, sizeof(collision_params), &collision);
+			err |= clSetKernelArg(bake_distance, 3, sizeof(cl_mem), &collidersCL);
+			err |= clSetKernelArg(bake_distance, 4, sizeof(cl_uint), &colliderCount);
+			err |= clSetKernelArg(bake_distance, 5, sizeof(cl_mem), &trianglesCL);
+			err |= clSetKernelArg(bake_distance, 6, sizeof(cl_uint), &triangleCount);
+			err |= clSetKernelArg(bake_normals, 0, sizeof(cl_mem), &distCL);
+			err |= clSetKernelArg(bake_normals, 1, sizeof(cl_mem), &packedCL);
+			err |= clSetKernelArg(bake_normals, 2, sizeof(cl_uint), &res);
+			err |= clEnqueueNDRangeKernel(queue, bake_distance, 1, nullptr, &cells, nullptr, 0, nullptr, nullptr);
+			err |= clEnqueueNDRangeKernel(queue, bake_normals, 1, nullptr, &cells, nullptr, 0, nullptr, nullptr);
+
+			const size_t origin[3] = {0, 0, 0};
+			const size_t region[3] = {res, res, res};
+			err |= clEnqueueCopyBufferToImage(queue, packedCL, sdfImageCL, 0, origin, region, 0, nullptr, nullptr);
+			err |= clFinish(queue);
+			ok = err == CL_SUCCESS;
+		}
 
-		// Execute the init kernel
-		size_t globalWorkSize = nb_particles;
-		err = clEnqueueNDRangeKernel(queue, init_particles_cube, 1, NULL, &globalWorkSize, NULL, 0, NULL, NULL);
-		if (err != CL_SUCCESS)
+		// Only the image is kept
+		for (cl_mem buffer : {distCL, packedCL, collidersCL, trianglesCL})
 		{
-			std::cout << "Error code: " << err << std::endl;
-			return freeCLdata(true, ENQUEUE_NDRANGE_KERNEL_ERR);
+			if (buffer)
+				clReleaseMemObject(buffer);
 		}
-		clFinish(queue);
-		err = clEnqueueReleaseGLObjects(queue, 1, &particleBufferCL, 0, nullptr, nullptr);
-		if (err != CL_SUCCESS)
-			return freeCLdata(true, RELEASE_BUFFER_CL_GL_ERR);
-		clFinish(queue);
+		if (!ok)
+			return freeCLdata(true, SDF_CREATE_ERR);
+		std::cout << "Collision field baked: " << colliders.size() << " colliders, "
+			<< triangleCount << " mesh triangles into " << res << "^3 cells" << std::endl;
 		return true;
 	}
 
 	/*
-		Computes the first particle positions inside a sphere
-		depending on sphere radius and number of particles
+		Creates the CL side of the density volume LOD,
+		the accumulation grid only lives on the device
 	*/
-	bool particle_system::enqueueInitSphereParticles() {
-		//Acquiring buffer
-		err = clEnqueueAcquireGLObjects(queue, 1, &particleBufferCL, 0, nullptr, nullptr);
-		if (err != CL_SUCCESS)
-			return freeCLdata(true, ENQUEUE_BUFFER_CL_GL_ERR);
-
-		// Set kernel arguments
-		err = clSetKernelArg(init_particles_sphere, 0, sizeof(cl_mem), &particleBufferCL);
-		if (err != CL_SUCCESS)
-			return freeCLdata(true, KERNEL_ARGS_SET_ERR);
-		err = clSetKernelArg(init_particles_sphere, 1, sizeof(float), &sphereRadius);
-		if (err != CL_SUCCESS)
-			return freeCLdata(true, KERNEL_ARGS_SET_ERR);
-
-		// Execute the init kernel
-		size_t globalWorkSize = nb_particles;
-		err = clEnqueueNDRangeKernel(queue, init_particles_sphere, 1, NULL, &globalWorkSize, NULL, 0, NULL, NULL);
-		if (err != CL_SUCCESS)
-		{
-			std::cout << "Error code: " << err << std::endl;
-			return freeCLdata(true, ENQUEUE_NDRANGE_KERNEL_ERR);
-		}
-		clFinish(queue);
-		err = clEnqueueReleaseGLObjects(queue, 1, &particleBufferCL, 0, nullptr, nullptr);
+	bool particle_system::initDensityVolumeCL() {
+		const size_t cells = static_cast<size_t>(lod.resolution) * lod.resolution * lod.resolution;
+		const cl_uint zero = 0;
+
+		densityAccumCL = clCreateBuffer(context, CL_MEM_READ_WRITE, cells * 4 * sizeof(cl_uint), nullptr, &err);
+		if (err != CL_SUCCESS || !densityAccumCL)
+			return freeCLdata(true, DENSITY_BUFFER_CREATE_ERR);
+		err = clEnqueueFillBuffer(queue, densityAccumCL, &zero, sizeof(zero), 0, cells * 4 * sizeof(cl_uint), 0, nullptr, nullptr);
 		if (err != CL_SUCCESS)
-			return freeCLdata(true, RELEASE_BUFFER_CL_GL_ERR);
+			return freeCLdata(true, DENSITY_BUFFER_CREATE_ERR);
+
+		densityVolumeCL = clCreateFromGLBuffer(context, CL_MEM_WRITE_ONLY, densityVolumeGL, &err);
+		if (err != CL_SUCCESS || !densityVolumeCL)
+			return freeCLdata(true, DENSITY_BUFFER_CREATE_ERR);
+		densityCoarseCL = clCreateFromGLBuffer(context, CL_MEM_WRITE_ONLY, densityCoarseGL, &err);
+		if (err != CL_SUCCESS || !densityCoarseCL)
+			return freeCLdata(true, DENSITY_BUFFER_CREATE_ERR);
 		clFinish(queue);
 		return true;
 	}
 
 	/*
-		Initialises vertex array and vertex buffer objects
-		Initialises the vertex and fragment shaders
+		Creates the single record the statistics are combined into,
+		the partial records grow with the particle count on the simulation thread
 	*/
-	void particle_system::initShaders()
-	{
-		// OpenGL VAO/VBO setup
-		glBindVertexArray(vao);
-		glBindBuffer(GL_ARRAY_BUFFER, particleBufferGL);
-
-		// Position
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(particle), (void*)offsetof(particle, pos));
-
-		// Colors
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(particle), (void*)offsetof(particle, color));
-
-		// Old position
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(particle), (void*)offsetof(particle, pos_prev));
-
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glBindVertexArray(0);
-
-		// Vertex and Fragment shader setup
-		shaderProgram = createShaderProgram("shaders/particle.vert", "shaders/particle.frag", "shaders/particle.gs");
-
-		// Vertex and Fragment shader setup for spaghetti mode
-		spaghettiShaderProgram = createShaderProgram("shaders/spaghetti.vert", "shaders/spaghetti.frag", "");
+	bool particle_system::initStatsCL() {
+		statsResultCL = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(stats_record), nullptr, &err);
+		if (err != CL_SUCCESS || !statsResultCL)
+			return freeCLdata(true, STATS_CREATE_ERR);
+
+		size_t groups = 0;
+		for (const particle_chunk &chunk : chunks)
+			groups += (chunk.capacity + STATS_GROUP_SIZE - 1) / STATS_GROUP_SIZE;
+		if (!reserveStatsPartials(groups))
+			return freeCLdata(true, STATS_CREATE_ERR);
+		return true;
 	}
 
 	/*
-		Initialises and allocates the CL/GL shared buffer
-		on the VRAM and checks for errors
+		Creates the query result list, the grid buffers are sized on the first query
 	*/
-	bool particle_system::initSharedBufferData() {
-		std::cout << "Initialising OpenGL/OpenCL shared buffer" << std::endl;
-		// Generate OpenGL buffer
-		std::cout << glGetString(GL_VERSION) << std::endl;
-		glGenBuffers(1, &particleBufferGL);
-		glBindBuffer(GL_ARRAY_BUFFER, particleBufferGL);
-
-		// Allocate space for particles in the OpenGL buffer
-		glBufferData(GL_ARRAY_BUFFER, (sizeof(particle) * nb_particles), nullptr, GL_DYNAMIC_DRAW);
+	bool particle_system::initQueryCL() {
+		queryResultsCL = clCreateBuffer(context, CL_MEM_READ_WRITE, (QUERY_MAX_RESULTS + 1) * sizeof(cl_uint), nullptr, &err);
+		if (err != CL_SUCCESS || !queryResultsCL)
+			return freeCLdata(true, QUERY_CREATE_ERR);
+		queryGridValid = false;
+		return true;
+	}
 
-		// Check for OpenGL errors
-		GLenum glErr = glGetError();
-		if (glErr != GL_NO_ERROR) {
-			std::cerr << "OpenGL error during buffer initialization: " << glErr << std::endl;
-			return false;
+	/*
+		Worker side buffers of a distributed run: the emigrant list and its copies,
+		the hole filling moves and this worker's share of the view sent to rank 0
+	*/
+	bool particle_system::initClusterCL() {
+		const size_t share = CLUSTER_VIEW_PARTICLES / (cluster->ranks() - 1);
+		const std::vector<std::pair<cl_mem *, size_t>> buffers = {
+			{&emigrantCountCL, sizeof(cl_uint)},
+			{&viewSamplesCL, share * sizeof(particle)},
+		};
+		for (const auto &buffer : buffers)
+		{
+			*buffer.first = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer.second, nullptr, &err);
+			if (err != CL_SUCCESS || !*buffer.first)
+				return freeCLdata(true, CLUSTER_CREATE_ERR);
 		}
+		if (!reserveMigrateBuffers(CLUSTER_MIGRATE_MAX))
+			return freeCLdata(true, CLUSTER_CREATE_ERR);
+		return true;
+	}
 
-		// Unbind the buffer to avoid accidental modification later
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-		// Ensure OpenGL commands are finished before proceeding
-		glFinish();
+	/*
+		Emigrant list, its particle copies and the hole filling moves for at least particles emigrants
+	*/
+	bool particle_system::reserveMigrateBuffers(size_t particles) {
+		if (particles <= migrateCapacity)
+			return true;
+		migrateCapacity = 0;
+		const std::vector<std::pair<cl_mem *, size_t>> buffers = {
+			{&emigrantIndexCL, particles * sizeof(cl_uint)},
+			{&emigrantsCL, particles * sizeof(particle)},
+			{&migrateMovesCL, particles * 2 * sizeof(cl_uint)},
+		};
+		for (const auto &buffer : buffers)
+		{
+			if (*buffer.first)
+				clReleaseMemObject(*buffer.first);
+			*buffer.first = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer.second, nullptr, &err);
+			if (err != CL_SUCCESS || !*buffer.first)
+			{
+				std::cerr << CLUSTER_CREATE_ERR << ": " << err << std::endl;
+				*buffer.first = nullptr;
+				return false;
+			}
+		}
+		migrateCapacity = particles;
 		return true;
 	}
 
 	/*
-		Releases all CL/GL data from the particle_system
+		Releases all CL/GL data from the particle_system. keepBaked (a reset) keeps the context
+		and the collision field baked in it, the scene does not change between runs
 	*/
-	bool particle_system::freeCLdata(bool err, const std::string &err_msg) {
+	bool particle_system::freeCLdata(bool err, const std::string &err_msg, bool keepBaked) {
 		if (err)
 			std::cerr << "Error: " << err_msg << std::endl;
+		stopSimThread();
 		// Avoid double frees by checking and setting to nullptr
 		if (queue)
 			clFlush(queue);
-		if (particleBufferCL) {
+		for (particle_chunk &chunk : chunks) {
 			// TODO: dynamically release queue if acquired
-			//clEnqueueReleaseGLObjects(queue, 1, &particleBufferCL, 0, nullptr, nullptr);
-			clReleaseMemObject(particleBufferCL);
+			//clEnqueueReleaseGLObjects(queue, 1, &chunk.bufferCL, 0, nullptr, nullptr);
+			if (chunk.bufferCL)
+				clReleaseMemObject(chunk.bufferCL);
+			if (chunk.trailCL)
+				clReleaseMemObject(chunk.trailCL);
+			chunk.bufferCL = nullptr;
+			chunk.trailCL = nullptr;
+			if (chunk.glDone)
+				glDeleteSync(chunk.glDone);
+			chunk.glDone = nullptr;
+		}
+		if (densityAccumCL)
+			clReleaseMemObject(densityAccumCL);
+		if (densityVolumeCL)
+			clReleaseMemObject(densityVolumeCL);
+		if (densityCoarseCL)
+			clReleaseMemObject(densityCoarseCL);
+		if (splat_density)
+			clReleaseKernel(splat_density);
+		if (resolve_density)
+			clReleaseKernel(resolve_density);
+		if (lod_program)
+			clReleaseProgram(lod_program);
+		for (cl_mem &image : fieldImagesCL) {
+			if (image)
+				clReleaseMemObject(image);
+			image = nullptr;
+		}
+		if (fieldStagingCL)
+			clReleaseMemObject(fieldStagingCL);
+		if (generate_field)
+			clReleaseKernel(generate_field);
+		if (field_program)
+			clReleaseProgram(field_program);
+		if (sdfImageCL && !keepBaked)
+			clReleaseMemObject(sdfImageCL);
+		if (bake_distance)
+			clReleaseKernel(bake_distance);
+		if (bake_normals)
+			clReleaseKernel(bake_normals);
+		if (sdf_program)
+			clReleaseProgram(sdf_program);
+		if (statsEvent)
+			clReleaseEvent(statsEvent);
+		if (statsPartialsCL)
+			clReleaseMemObject(statsPartialsCL);
+		if (statsResultCL)
+			clReleaseMemObject(statsResultCL);
+		if (reduce_stats)
+			clReleaseKernel(reduce_stats);
+		if (combine_stats)
+			clReleaseKernel(combine_stats);
+		if (stats_program)
+			clReleaseProgram(stats_program);
+		for (cl_mem buffer : {queryCellCountsCL, queryCellStartsCL, queryCellCursorCL, queryParticleCellsCL,
+			queryParticlePosCL, querySortedIndexCL, querySortedPosCL, queryResultsCL}) {
+			if (buffer)
+				clReleaseMemObject(buffer);
+		}
+		for (cl_kernel kernel : {count_cells, scan_cells, scatter_particles, query_radius, query_box, query_ray}) {
+			if (kernel)
+				clReleaseKernel(kernel);
+		}
+		if (query_program)
+			clReleaseProgram(query_program);
+		for (cl_mem buffer : {splatTileCountsCL, splatTileStartsCL, splatTileCursorCL, splatPointTilesCL,
+			splatPointFragmentsCL, splatTileFragmentsCL, splatFrameCL}) {
+			if (buffer)
+				clReleaseMemObject(buffer);
+		}
+		for (cl_kernel kernel : {bin_points, scan_tiles, scatter_points, raster_tiles}) {
+			if (kernel)
+				clReleaseKernel(kernel);
+		}
+		if (splat_program)
+			clReleaseProgram(splat_program);
+		for (cl_mem buffer : {emigrantCountCL, emigrantIndexCL, emigrantsCL, migrateMovesCL, viewSamplesCL}) {
+			if (buffer)
+				clReleaseMemObject(buffer);
+		}
+		for (cl_kernel kernel : {find_emigrants, fill_holes, sample_particles}) {
+			if (kernel)
+				clReleaseKernel(kernel);
+		}
+		if (migrate_program)
+			clReleaseProgram(migrate_program);
+		if (streamQuantizedCL)
+			clReleaseMemObject(streamQuantizedCL);
+		if (quantize_particles)
+			clReleaseKernel(quantize_particles);
+		if (quantize_program)
+			clReleaseProgram(quantize_program);
+		for (cl_kernel kernel : update_species)
+		{
+			if (kernel)
+				clReleaseKernel(kernel);
 		}
-		if (calculate_position)
-			clReleaseKernel(calculate_position);
 		if (init_particles_cube)
 			clReleaseKernel(init_particles_cube);
 		if (init_cube_program)
 			clReleaseProgram(init_cube_program);
+		if (init_particles_sphere)
+			clReleaseKernel(init_particles_sphere);
+		if (init_sphere_program)
+			clReleaseProgram(init_sphere_program);
+		if (init_particles_cloud)
+			clReleaseKernel(init_particles_cloud);
+		if (init_cloud_program)
+			clReleaseProgram(init_cloud_program);
 		if (update_program)
 			clReleaseProgram(update_program);
 		if (queue)
 			clReleaseCommandQueue(queue);
-		if (context)
+		if (simQueue)
+			clReleaseCommandQueue(simQueue);
+		if (context && !keepBaked)
+		{
 			clReleaseContext(context);
-		context = nullptr;
+			context = nullptr;
+			createEventFromGLsync = nullptr;
+			sdfImageCL = nullptr;
+		}
 		queue = nullptr;
+		simQueue = nullptr;
 		update_program = nullptr;
 		init_cube_program = nullptr;
-		calculate_position = nullptr;
+		for (cl_kernel &kernel : update_species)
+			kernel = nullptr;
 		init_particles_cube = nullptr;
-		particleBufferCL = nullptr;
+		init_sphere_program = nullptr;
+		init_particles_sphere = nullptr;
+		init_cloud_program = nullptr;
+		init_particles_cloud = nullptr;
+		lod_program = nullptr;
+		splat_density = nullptr;
+		resolve_density = nullptr;
+		densityAccumCL = nullptr;
+		densityVolumeCL = nullptr;
+		densityCoarseCL = nullptr;
+		field_program = nullptr;
+		generate_field = nullptr;
+		fieldStagingCL = nullptr;
+		sdf_program = nullptr;
+		bake_distance = nullptr;
+		bake_normals = nullptr;
+		stats_program = nullptr;
+		reduce_stats = nullptr;
+		combine_stats = nullptr;
+		statsPartialsCL = nullptr;
+		statsResultCL = nullptr;
+		statsPartialCapacity = 0;
+		statsEvent = nullptr;
+		query_program = nullptr;
+		count_cells = nullptr;
+		scan_cells = nullptr;
+		scatter_particles = nullptr;
+		query_radius = nullptr;
+		query_box = nullptr;
+		query_ray = nullptr;
+		queryCellCountsCL = nullptr;
+		queryCellStartsCL = nullptr;
+		queryCellCursorCL = nullptr;
+		queryParticleCellsCL = nullptr;
+		queryParticlePosCL = nullptr;
+		querySortedIndexCL = nullptr;
+		querySortedPosCL = nullptr;
+		queryResultsCL = nullptr;
+		queryCellCapacity = 0;
+		queryParticleCapacity = 0;
+		queryGridValid = false;
+		splat_program = nullptr;
+		bin_points = nullptr;
+		scan_tiles = nullptr;
+		scatter_points = nullptr;
+		raster_tiles = nullptr;
+		splatTileCountsCL = nullptr;
+		splatTileStartsCL = nullptr;
+		splatTileCursorCL = nullptr;
+		splatPointTilesCL = nullptr;
+		splatPointFragmentsCL = nullptr;
+		splatTileFragmentsCL = nullptr;
+		splatFrameCL = nullptr;
+		splatTileCapacity = 0;
+		splatPointCapacity = 0;
+		migrate_program = nullptr;
+		find_emigrants = nullptr;
+		fill_holes = nullptr;
+		sample_particles = nullptr;
+		emigrantCountCL = nullptr;
+		emigrantIndexCL = nullptr;
+		emigrantsCL = nullptr;
+		migrateMovesCL = nullptr;
+		viewSamplesCL = nullptr;
+		quantize_program = nullptr;
+		quantize_particles = nullptr;
+		streamQuantizedCL = nullptr;
+		streamCapacity = 0;
+		migrateCapacity = 0;
+		simReady = false;
 		return !err;
 	}
 
@@ -1101,19 +4947,18 @@ namespace psys
 				}
 			}
 		}
-		return true;
+		return false;
 	}
 
 	/*
 		Parses .cl files in kernel_srcs/ for program loading
 	*/
-	const char *particle_system::get_CL_program(const std::string& path) {
-		// Static string to hold the program content (so we can return a reference)
-		static std::string content;
+	bool particle_system::get_CL_program(const std::string& path, std::string &content) {
+		// Returned by value so several programs can be read and built at the same time
 		content.clear();
 		std::ifstream file(path, std::ios::in);
 		if (!file.is_open()) {
-			return nullptr;
+			return false;
 		}
 
 		// Ensure the file is read in a valid encoding (UTF-8)
@@ -1123,17 +4968,18 @@ namespace psys
 		std::stringstream buffer;
 		buffer << file.rdbuf();
 		content = buffer.str();
-		return content.c_str();
+		return true;
 	}
 
 	/*
 		Initialises cl_context
 	*/
 	bool particle_system::initContext() {
-		// Context properties for CL/GL buffer sharing
+		// Context properties for CL/GL buffer sharing, with the EGL context when headless
 		const cl_context_properties properties[] = {
-			CL_GL_CONTEXT_KHR, (cl_context_properties)glXGetCurrentContext(),
-			CL_GLX_DISPLAY_KHR, (cl_context_properties)glXGetCurrentDisplay(),
+			CL_GL_CONTEXT_KHR, offscreen ? (cl_context_properties)eglGetCurrentContext() : (cl_context_properties)glXGetCurrentContext(),
+			offscreen ? CL_EGL_DISPLAY_KHR : CL_GLX_DISPLAY_KHR,
+			offscreen ? (cl_context_properties)eglGetCurrentDisplay() : (cl_context_properties)glXGetCurrentDisplay(),
 			CL_CONTEXT_PLATFORM, (cl_context_properties)selected_platform,  // the OpenCL platform you are using
 			0
 		};
@@ -1151,6 +4997,13 @@ namespace psys
 			std::cerr << "Error: Failed to get OpenCL device: " << err << std::endl;
 			return freeCLdata(true, "");
 		}
+
+		// GL fences become acquire wait events when the device can import them
+		char extensions[4096] = {};
+		clGetDeviceInfo(selected_device, CL_DEVICE_EXTENSIONS, sizeof(extensions) - 1, extensions, nullptr);
+		if (std::string(extensions).find("cl_khr_gl_event") != std::string::npos)
+			createEventFromGLsync = reinterpret_cast<gl_sync_event_fn>(
+				clGetExtensionFunctionAddressForPlatform(selected_platform, "clCreateEventFromGLsyncKHR"));
 		return true;
 	}
 
@@ -1163,77 +5016,111 @@ namespace psys
 		queue = clCreateCommandQueueWithProperties(context, selected_device, queue_properties, &err);
 		if (err != CL_SUCCESS || !queue)
 			return freeCLdata(true, QUEUE_CREATE_ERR);
+
+		// Own queue for the simulation thread, the render thread keeps the first one
+		simQueue = clCreateCommandQueueWithProperties(context, selected_device, queue_properties, &err);
+		if (err != CL_SUCCESS || !simQueue)
+			return freeCLdata(true, QUEUE_CREATE_ERR);
 		return true;
 	}
 
 	/*
-		Initialises and builds openCL programs (init and runtime) with the cl code in kernel_srcs/
+		Initialises openCL programs with the cl code in kernel_srcs/ and starts building them all at once,
+		clBuildProgram returns right away and programBuilt() is called as each one finishes
 	*/
 	bool particle_system::initPrograms() {
-		// Init update program
-		// OpenCL kernel source for updating particles
-		const char *updateParticlesSrc = get_CL_program("kernel_srcs/update_particles.cl");
-		if (!updateParticlesSrc)
-			return freeCLdata(true, FETCH_CL_FILE_ERR);
-
-		// Create program for updating particles
-		update_program = clCreateProgramWithSource(context, 1, &updateParticlesSrc, nullptr, &err);
-		if (err != CL_SUCCESS || !update_program)
-			return freeCLdata(true, std::string(PROGRAM_CREATE_ERR) + " update_program");
-
-		err = clBuildProgram(update_program, 1, &selected_device, nullptr, nullptr, nullptr);
-		if (err != CL_SUCCESS)
+		buildStart = std::chrono::steady_clock::now();
+		for (const cl_program_source &src : programSources())
 		{
-			size_t len = 0;
-			char buffer[2048];
-			bzero(buffer, sizeof(buffer));
-			clGetProgramBuildInfo(update_program, selected_device, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
-			std::cerr << buffer << std::endl;
-			return freeCLdata(true, std::string(PROGRAM_BUILD_ERR) + " update_program");
+			std::string source;
+			if (!get_CL_program(src.path, source))
+				return freeCLdata(true, std::string(FETCH_CL_FILE_ERR) + ": " + src.path);
+
+			const char *sourcePtr = source.c_str();
+			*src.program = clCreateProgramWithSource(context, 1, &sourcePtr, nullptr, &err);
+			if (err != CL_SUCCESS || !*src.program)
+				return freeCLdata(true, std::string(PROGRAM_CREATE_ERR) + src.name);
+
+			// Build failures are read from the build status once every program is done
+			clBuildProgram(*src.program, 1, &selected_device, profileOptions[buildProfile], programBuilt, this);
 		}
+		return true;
+	}
 
-		// OpenCL kernel source for initializing particles in a cube
-		const char *initParticlesCubeSrc = get_CL_program("kernel_srcs/init_particles_cube.cl");
-		if (!initParticlesCubeSrc)
-			return freeCLdata(true, FETCH_CL_FILE_ERR);
+	/*
+		Every program built at startup with its source file
+	*/
+	std::vector<particle_system::cl_program_source> particle_system::programSources() {
+		return {
+			{&update_program, "kernel_srcs/update_particles.cl", "update_program"},
+			{&init_cube_program, "kernel_srcs/init_particles_cube.cl", "init_cube_program"},
+			{&init_sphere_program, "kernel_srcs/init_particles_sphere.cl", "init_sphere_program"},
+			{&init_cloud_program, "kernel_srcs/init_particles_cloud.cl", "init_cloud_program"},
+			{&lod_program, "kernel_srcs/splat_density.cl", "lod_program"},
+			{&field_program, "kernel_srcs/vector_field.cl", "field_program"},
+			{&sdf_program, "kernel_srcs/bake_sdf.cl", "sdf_program"},
+			{&stats_program, "kernel_srcs/reduce_stats.cl", "stats_program"},
+			{&query_program, "kernel_srcs/spatial_query.cl", "query_program"},
+			{&splat_program, "kernel_srcs/splat_points.cl", "splat_program"},
+			{&migrate_program, "kernel_srcs/migrate_particles.cl", "migrate_program"},
+			{&quantize_program, "kernel_srcs/quantize_particles.cl", "quantize_program"},
+		};
+	}
 
-		//Init cube_init program
-		// Create program for initializing particles
-		init_cube_program = clCreateProgramWithSource(context, 1, &initParticlesCubeSrc, nullptr, &err);
-		if (err != CL_SUCCESS || !init_cube_program)
-			return freeCLdata(true, std::string(PROGRAM_CREATE_ERR) + " init_particles_cube");
+	/*
+		Build notification, called from an OpenCL thread: only wakes up waitForPrograms()
+	*/
+	void CL_CALLBACK particle_system::programBuilt(cl_program program, void *userData) {
+		(void)program;
+		particle_system *engine = static_cast<particle_system*>(userData);
+		std::lock_guard<std::mutex> lock(engine->buildMutex);
+		engine->buildDone.notify_all();
+	}
 
-		// Build the init program
-		err = clBuildProgram(init_cube_program, 1, &selected_device, nullptr, nullptr, nullptr);
-		if (err != CL_SUCCESS) {
-			size_t len;
-			char buffer[2048];
-			bzero(buffer, sizeof(buffer));
-			clGetProgramBuildInfo(init_cube_program, selected_device, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
-			std::cerr << buffer << std::endl;
-			return freeCLdata(true, std::string(PROGRAM_BUILD_ERR) + " init_cube_program");
+	/*
+		True once no program is still building
+	*/
+	bool particle_system::programsReady() {
+		for (const cl_program_source &src : programSources())
+		{
+			cl_build_status status = CL_BUILD_NONE;
+			clGetProgramBuildInfo(*src.program, selected_device, CL_PROGRAM_BUILD_STATUS, sizeof(status), &status, nullptr);
+			if (status == CL_BUILD_IN_PROGRESS)
+				return false;
 		}
+		return true;
+	}
 
-		// OpenCL kernel source for initializing particles in a sphere
-		const char *initParticlesSphereSrc = get_CL_program("kernel_srcs/init_particles_sphere.cl");
-		if (!initParticlesSphereSrc)
-			return freeCLdata(true, FETCH_CL_FILE_ERR);
-
-		//Init cube_init program
-		// Create program for initializing particles
-		init_sphere_program = clCreateProgramWithSource(context, 1, &initParticlesSphereSrc, nullptr, &err);
-		if (err != CL_SUCCESS || !init_sphere_program)
-			return freeCLdata(true, std::string(PROGRAM_CREATE_ERR) + " init_particles_sphere");
+	/*
+		Blocks until every program is built, used when the simulation is reset
+	*/
+	void particle_system::waitForPrograms() {
+		std::unique_lock<std::mutex> lock(buildMutex);
+		// The timeout covers notifications sent before we started waiting
+		while (!programsReady())
+			buildDone.wait_for(lock, std::chrono::milliseconds(10));
+	}
 
-		// Build the init program
-		err = clBuildProgram(init_sphere_program, 1, &selected_device, nullptr, nullptr, nullptr);
-		if (err != CL_SUCCESS) {
-			size_t len;
+	/*
+		Checks the outcome of every build and prints the logs of the failed ones
+	*/
+	bool particle_system::checkPrograms() {
+		for (const cl_program_source &src : programSources())
+		{
+			cl_build_status status = CL_BUILD_ERROR;
+			clGetProgramBuildInfo(*src.program, selected_device, CL_PROGRAM_BUILD_STATUS, sizeof(status), &status, nullptr);
+			if (status == CL_BUILD_SUCCESS)
+				continue;
+			size_t len = 0;
 			char buffer[2048];
 			bzero(buffer, sizeof(buffer));
-			clGetProgramBuildInfo(init_sphere_program, selected_device, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+			clGetProgramBuildInfo(*src.program, selected_device, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
 			std::cerr << buffer << std::endl;
-			return freeCLdata(true, std::string(PROGRAM_BUILD_ERR) + " init_sphere_program");
+			return freeCLdata(true, std::string(PROGRAM_BUILD_ERR) + src.name);
+		}
+		if (!resetSim) {
+			std::chrono::duration<double, std::milli> buildTime = std::chrono::steady_clock::now() - buildStart;
+			std::cout << "OpenCL programs built in parallel in " << buildTime.count() << " ms" << std::endl;
 		}
 		return true;
 	}
@@ -1252,44 +5139,150 @@ namespace psys
 		if (err != CL_SUCCESS || !init_particles_sphere)
 			return freeCLdata(true, std::string(KERNEL_CREATE_ERR) + " init_sphere_program");
 
-		// Create update particles kernel
-		calculate_position = clCreateKernel(update_program, "updateParticles", &err);
-		if (err != CL_SUCCESS || !calculate_position)
-			return freeCLdata(true, std::string(KERNEL_CREATE_ERR) + " update_program");
+		// Create init point cloud particles kernel
+		init_particles_cloud = clCreateKernel(init_cloud_program, "init_particles_cloud", &err);
+		if (err != CL_SUCCESS || !init_particles_cloud)
+			return freeCLdata(true, std::string(KERNEL_CREATE_ERR) + " init_cloud_program");
+
+		// Create the update kernels, one per species
+		for (int species = 0; species < SPECIES_COUNT; ++species)
+		{
+			update_species[species] = clCreateKernel(update_program, speciesKernels[species], &err);
+			if (err != CL_SUCCESS || !update_species[species])
+				return freeCLdata(true, std::string(KERNEL_CREATE_ERR) + " update_program");
+		}
+
+		// Create density volume LOD kernels
+		splat_density = clCreateKernel(lod_program, "splatDensity", &err);
+		if (err != CL_SUCCESS || !splat_density)
+			return freeCLdata(true, std::string(KERNEL_CREATE_ERR) + " lod_program");
+		resolve_density = clCreateKernel(lod_program, "resolveDensity", &err);
+		if (err != CL_SUCCESS || !resolve_density)
+			return freeCLdata(true, std::string(KERNEL_CREATE_ERR) + " lod_program");
+
+		// Create curl-noise field kernel
+		generate_field = clCreateKernel(field_program, "generateCurlField", &err);
+		if (err != CL_SUCCESS || !generate_field)
+			return freeCLdata(true, std::string(KERNEL_CREATE_ERR) + " field_program");
+
+		// Create SDF baking kernels
+		bake_distance = clCreateKernel(sdf_program, "bakeDistance", &err);
+		if (err != CL_SUCCESS || !bake_distance)
+			return freeCLdata(true, std::string(KERNEL_CREATE_ERR) + " sdf_program");
+		bake_normals = clCreateKernel(sdf_program, "bakeNormals", &err);
+		if (err != CL_SUCCESS || !bake_normals)
+			return freeCLdata(true, std::string(KERNEL_CREATE_ERR) + " sdf_program");
+
+		// Create statistics reduction kernels
+		reduce_stats = clCreateKernel(stats_program, "reduceStats", &err);
+		if (err != CL_SUCCESS || !reduce_stats)
+			return freeCLdata(true, std::string(KERNEL_CREATE_ERR) + " stats_program");
+		combine_stats = clCreateKernel(stats_program, "combineStats", &err);
+		if (err != CL_SUCCESS || !combine_stats)
+			return freeCLdata(true, std::string(KERNEL_CREATE_ERR) + " stats_program");
+
+		// Create spatial query kernels
+		std::vector<std::pair<cl_kernel *, const char *>> queryKernels = {
+			{&count_cells, "countCells"}, {&scan_cells, "scanCells"}, {&scatter_particles, "scatterParticles"},
+			{&query_radius, "queryRadius"}, {&query_box, "queryBox"}, {&query_ray, "queryRay"},
+		};
+		for (auto &kernel : queryKernels)
+		{
+			*kernel.first = clCreateKernel(query_program, kernel.second, &err);
+			if (err != CL_SUCCESS || !*kernel.first)
+				return freeCLdata(true, std::string(KERNEL_CREATE_ERR) + " query_program");
+		}
+
+		// Create point splatting kernels
+		std::vector<std::pair<cl_kernel *, const char *>> splatKernels = {
+			{&bin_points, "binPoints"}, {&scan_tiles, "scanTiles"},
+			{&scatter_points, "scatterPoints"}, {&raster_tiles, "rasterTiles"},
+		};
+		for (auto &kernel : splatKernels)
+		{
+			*kernel.first = clCreateKernel(splat_program, kernel.second, &err);
+			if (err != CL_SUCCESS || !*kernel.first)
+				return freeCLdata(true, std::string(KERNEL_CREATE_ERR) + " splat_program");
+		}
+
+		// Create particle migration kernels
+		std::vector<std::pair<cl_kernel *, const char *>> migrateKernels = {
+			{&find_emigrants, "findEmigrants"}, {&fill_holes, "fillHoles"}, {&sample_particles, "sampleParticles"},
+		};
+		for (auto &kernel : migrateKernels)
+		{
+			*kernel.first = clCreateKernel(migrate_program, kernel.second, &err);
+			if (err != CL_SUCCESS || !*kernel.first)
+				return freeCLdata(true, std::string(KERNEL_CREATE_ERR) + " migrate_program");
+		}
+
+		// Create stream quantization kernel
+		quantize_particles = clCreateKernel(quantize_program, "quantizeParticles", &err);
+		if (err != CL_SUCCESS || !quantize_particles)
+			return freeCLdata(true, std::string(KERNEL_CREATE_ERR) + " quantize_program");
 		return true;
 	}
 
 	/*
 		Calls all initialisation methods and enqueues the initCube
-		kernel
+		kernel, blocking until the programs are built
 	*/
 	bool particle_system::initCLdata() {
-		// Select device (GPU)
-		if (!selectDevice())
-			return freeCLdata(true, DEVICE_GET_ERR);
-
-		if (!initContext()
-			|| !initQueue()
-			|| !initPrograms()
-			|| !initKernels())
+		if (!startCLdata())
 			return false;
+		waitForPrograms();
+		return finishCLdata();
+	}
+
+	/*
+		First half of the OpenCL initialisation: device, context, queue,
+		then the program builds are started without waiting for them
+	*/
+	bool particle_system::startCLdata() {
+		// Select device (GPU), done early by the constructor to size the chunks
+		if (!selected_device && !selectDevice())
+			return freeCLdata(true, DEVICE_GET_ERR);
 
 		if (nb_particles == 0)
 			return freeCLdata(true, NO_PARTICLES_ERR);
+		if (maxParticles == 0)
+			return freeCLdata(true, NOT_ENOUGH_MEMORY_ERR);
+
+		return (context || initContext())
+			&& initQueue()
+			&& initPrograms();
+	}
+
+	/*
+		Second half of the OpenCL initialisation once the programs are built:
+		kernels, shared buffers and the first particle positions
+	*/
+	bool particle_system::finishCLdata() {
+		if (!checkPrograms() || !initKernels())
+			return false;
+
+		if (chunks.empty())
+			return freeCLdata(true, NOT_ENOUGH_MEMORY_ERR);
 
-		// Create a buffer that OpenCL can use
-		particleBufferCL = clCreateFromGLBuffer(context, CL_MEM_READ_WRITE, particleBufferGL, &err);
-		if (err != CL_SUCCESS || !particleBufferCL)
-			return freeCLdata(true, BUFFER_CREATE_ERR);
+		// Create the buffers that OpenCL can use
+		for (particle_chunk &chunk : chunks)
+		{
+			if (!registerParticleChunk(chunk))
+				return freeCLdata(true, BUFFER_CREATE_ERR);
+		}
 
-		// Call init_cube kernel to init the particles in a cube
-		if (reset_shape == particleShape::CUBE && !enqueueInitCubeParticles())
+		if (!initDensityVolumeCL() || !initVectorFieldCL() || !initCollisionCL() || !initStatsCL() || !initQueryCL())
 			return false;
-		// Call init_sphere kernel to init the particles in a sphere
-		else if (reset_shape == particleShape::SPHERE && !enqueueInitSphereParticles())
+		if (cluster && cluster->rank() > 0 && !initClusterCL())
+			return false;
+
+		// Call init_cube or init_sphere kernel to init the particles in the selected shape
+		if (!enqueueInitParticles(0, nb_particles))
 			return false;
 		if (!resetSim)
 			std::cout << "OpenCL particles data initialized directly on GPU" << std::endl;
+		simReady = true;
+		startSimThread();
 		return true;
 	}
 };
@@ -0,0 +1,582 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   psys_api.cpp                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: tmoragli <tmoragli@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 21:02:47 by tmoragli          #+#    #+#             */
+/*   Updated: 2026/10/19 21:02:47 by tmoragli         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "psys.h"
+#include "sim_types.hpp"
+#include "define.hpp"
+#include "error_msg.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <new>
+#include <algorithm>
+#include <cstring>
+
+using namespace psys;
+
+static_assert(sizeof(psys_particle) == sizeof(particle), "psys_particle must match the kernels' particle");
+
+struct psys_system {
+	cl_context context;
+	cl_command_queue queue;
+	cl_program update_program;
+	cl_program init_cube_program;
+	cl_program init_sphere_program;
+	cl_program stats_program;
+	cl_kernel update_ensemble;
+	cl_kernel init_particles_cube;
+	cl_kernel init_particles_sphere;
+	cl_kernel reduce_members;
+	cl_mem particlesCL;
+	cl_mem paramsCL;		// member_params per member, replaced rather than written when they change
+	cl_mem statsCL;			// stats_record per member
+	cl_mem trailsCL;		// history argument of the update kernel, never written (trail_params.write is 0)
+	cl_mem dummyImageCL;	// field and SDF images, both off
+	size_t count;
+	size_t members;
+	size_t memberSize;
+	std::vector<member_params> params;
+	bool paramsDirty;
+	uint64_t steps;
+	psys_particle *mapped;
+};
+
+/*
+	First GPU of any platform, any device otherwise: the buffers are plain OpenCL ones,
+	a CPU runtime runs the library as well
+*/
+static cl_device_id pickDevice()
+{
+	cl_uint platformCount = 0;
+	if (clGetPlatformIDs(0, nullptr, &platformCount) != CL_SUCCESS || platformCount == 0)
+		return nullptr;
+	std::vector<cl_platform_id> platforms(platformCount);
+	if (clGetPlatformIDs(platformCount, platforms.data(), nullptr) != CL_SUCCESS)
+		return nullptr;
+
+	const cl_device_type types[] = {CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_ALL};
+	for (cl_device_type type : types)
+	{
+		for (cl_platform_id platform : platforms)
+		{
+			cl_device_id device = nullptr;
+			if (clGetDeviceIDs(platform, type, 1, &device, nullptr) == CL_SUCCESS && device)
+				return device;
+		}
+	}
+	return nullptr;
+}
+
+static psys_status buildKernel(psys_system *sys, cl_device_id device, const std::string &dir, const char *file,
+	const char *name, cl_program &program, cl_kernel &kernel)
+{
+	const std::string path = dir + "/" + file;
+	std::ifstream source(path);
+	if (!source.is_open())
+	{
+		std::cerr << FETCH_CL_FILE_ERR << ": " << path << std::endl;
+		return PSYS_ERROR_PROGRAM;
+	}
+	std::stringstream buffer;
+	buffer << source.rdbuf();
+	std::string content = buffer.str();
+	const char *contentPtr = content.c_str();
+
+	cl_int err;
+	program = clCreateProgramWithSource(sys->context, 1, &contentPtr, nullptr, &err);
+	if (err != CL_SUCCESS || !program)
+	{
+		std::cerr << PROGRAM_CREATE_ERR << file << std::endl;
+		return PSYS_ERROR_PROGRAM;
+	}
+	if (clBuildProgram(program, 1, &device, nullptr, nullptr, nullptr) != CL_SUCCESS)
+	{
+		size_t logSize = 0;
+		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, nullptr, &logSize);
+		std::string log(logSize, '\0');
+		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, logSize, &log[0], nullptr);
+		std::cerr << PROGRAM_BUILD_ERR << file << std::endl << log << std::endl;
+		return PSYS_ERROR_PROGRAM;
+	}
+	kernel = clCreateKernel(program, name, &err);
+	if (err != CL_SUCCESS || !kernel)
+	{
+		std::cerr << KERNEL_CREATE_ERR << name << std::endl;
+		return PSYS_ERROR_PROGRAM;
+	}
+	return PSYS_OK;
+}
+
+/*
+	Device, buffers and kernels, then the arguments that never change: the field and the collisions
+	are off and no trail slice is written. The mass and emitter start as in the application
+*/
+static psys_status initSystem(psys_system *sys, size_t members, size_t memberSize, const std::string &kernelDir)
+{
+	const size_t count = members * memberSize;
+	cl_int err;
+	cl_device_id device = pickDevice();
+	if (!device)
+	{
+		std::cerr << DEVICE_GET_ERR << std::endl;
+		return PSYS_ERROR_DEVICE;
+	}
+	sys->context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &err);
+	if (err != CL_SUCCESS || !sys->context)
+	{
+		std::cerr << CONTEXT_CREATE_ERR << std::endl;
+		return PSYS_ERROR_DEVICE;
+	}
+	cl_queue_properties queueProperties[] = {0};
+	sys->queue = clCreateCommandQueueWithProperties(sys->context, device, queueProperties, &err);
+	if (err != CL_SUCCESS || !sys->queue)
+	{
+		std::cerr << QUEUE_CREATE_ERR << std::endl;
+		return PSYS_ERROR_DEVICE;
+	}
+
+	psys_status status = buildKernel(sys, device, kernelDir, "update_particles.cl", "updateEnsemble",
+		sys->update_program, sys->update_ensemble);
+	if (status == PSYS_OK)
+		status = buildKernel(sys, device, kernelDir, "init_particles_cube.cl", "init_particles_cube",
+			sys->init_cube_program, sys->init_particles_cube);
+	if (status == PSYS_OK)
+		status = buildKernel(sys, device, kernelDir, "init_particles_sphere.cl", "init_particles_sphere",
+			sys->init_sphere_program, sys->init_particles_sphere);
+	if (status == PSYS_OK)
+		status = buildKernel(sys, device, kernelDir, "reduce_stats.cl", "reduceMembers",
+			sys->stats_program, sys->reduce_members);
+	if (status != PSYS_OK)
+		return status;
+
+	// One buffer, no chunks: a batch system is sized for the device, not split under the GL limits
+	cl_ulong maxAlloc = 0;
+	clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAlloc), &maxAlloc, nullptr);
+	if (count * sizeof(particle) > maxAlloc)
+	{
+		std::cerr << NOT_ENOUGH_MEMORY_ERR << ": " << count << " particles, at most "
+			<< maxAlloc / sizeof(particle) << " in one allocation" << std::endl;
+		return PSYS_ERROR_MEMORY;
+	}
+	sys->count = count;
+	sys->members = members;
+	sys->memberSize = memberSize;
+	sys->params.resize(members);
+	sys->particlesCL = clCreateBuffer(sys->context, CL_MEM_READ_WRITE, count * sizeof(particle), nullptr, &err);
+	if (err == CL_SUCCESS)
+		sys->statsCL = clCreateBuffer(sys->context, CL_MEM_WRITE_ONLY, members * sizeof(stats_record), nullptr, &err);
+	if (err == CL_SUCCESS)
+		sys->trailsCL = clCreateBuffer(sys->context, CL_MEM_READ_WRITE, sizeof(float3), nullptr, &err);
+	cl_image_format format = {CL_RGBA, CL_FLOAT};
+	cl_image_desc desc;
+	memset(&desc, 0, sizeof(desc));
+	desc.image_type = CL_MEM_OBJECT_IMAGE3D;
+	desc.image_width = 1;
+	desc.image_height = 1;
+	desc.image_depth = 1;
+	if (err == CL_SUCCESS)
+		sys->dummyImageCL = clCreateImage(sys->context, CL_MEM_READ_ONLY, &format, &desc, nullptr, &err);
+	if (err != CL_SUCCESS || !sys->particlesCL || !sys->statsCL || !sys->trailsCL || !sys->dummyImageCL)
+	{
+		std::cerr << "Failed to create the particle buffer: " << err << std::endl;
+		return PSYS_ERROR_MEMORY;
+	}
+
+	field_params f = {{0.0f, 0.0f, 0.0f}, 1.0f, 0.0f, 0.0f, 0u};
+	collision_params c = {{0.0f, 0.0f, 0.0f}, 1.0f, 0.0f, 0.0f, 0.0f, 0u};
+	trail_params t = {0u, 0u, 0u, 0u};
+	const float deltaTime = 1.0f / SIM_TICK_RATE;
+	const cl_uint memberCount = static_cast<cl_uint>(memberSize);
+	err = clSetKernelArg(sys->update_ensemble, 0, sizeof(cl_mem), &sys->particlesCL);
+	err |= clSetKernelArg(sys->update_ensemble, 2, sizeof(cl_uint), &memberCount);
+	err |= clSetKernelArg(sys->update_ensemble, 3, sizeof(float), &deltaTime);
+	err |= clSetKernelArg(sys->update_ensemble, 4, sizeof(cl_mem), &sys->dummyImageCL);
+	err |= clSetKernelArg(sys->update_ensemble, 5, sizeof(cl_mem), &sys->dummyImageCL);
+	err |= clSetKernelArg(sys->update_ensemble, 6, sizeof(field_params), &f);
+	err |= clSetKernelArg(sys->update_ensemble, 7, sizeof(cl_mem), &sys->dummyImageCL);
+	err |= clSetKernelArg(sys->update_ensemble, 8, sizeof(collision_params), &c);
+	err |= clSetKernelArg(sys->update_ensemble, 9, sizeof(cl_mem), &sys->trailsCL);
+	err |= clSetKernelArg(sys->update_ensemble, 10, sizeof(trail_params), &t);
+	err |= clSetKernelArg(sys->reduce_members, 0, sizeof(cl_mem), &sys->particlesCL);
+	err |= clSetKernelArg(sys->reduce_members, 1, sizeof(cl_uint), &memberCount);
+	err |= clSetKernelArg(sys->reduce_members, 4, sizeof(cl_mem), &sys->statsCL);
+	if (err != CL_SUCCESS)
+	{
+		std::cerr << KERNEL_ARGS_SET_ERR << std::endl;
+		return PSYS_ERROR_RUNTIME;
+	}
+
+	const psys_mass m = {{5.0f, -20.0f, -10.0f}, {0.0f, 1.0f, 0.0f}, 0.0f, 5.0f};
+	const psys_emitter e = {{-15.0f, 0.0f, -10.0f}, 1.5f, 35.0f, 8.0f, 6.0f, 1.5f, 4.0f, 0};
+	status = psys_set_mass(sys, &m);
+	if (status == PSYS_OK)
+		status = psys_set_emitter(sys, &e);
+	if (status == PSYS_OK)
+		status = psys_reset(sys, PSYS_SHAPE_CUBE);
+	return status;
+}
+
+/*
+	Hands the parameter blocks changed since the last launch to the device. A new buffer is made
+	from the host copy instead of writing the old one, so no wait on the steps still reading it:
+	they hold it until they complete
+*/
+static psys_status uploadParams(psys_system *sys)
+{
+	if (!sys->paramsDirty)
+		return PSYS_OK;
+	cl_int err;
+	cl_mem params = clCreateBuffer(sys->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+		sys->members * sizeof(member_params), sys->params.data(), &err);
+	if (err != CL_SUCCESS || !params)
+	{
+		std::cerr << "Failed to upload the member parameters: " << err << std::endl;
+		return PSYS_ERROR_MEMORY;
+	}
+	err = clSetKernelArg(sys->update_ensemble, 1, sizeof(cl_mem), &params);
+	err |= clSetKernelArg(sys->reduce_members, 2, sizeof(cl_mem), &params);
+	if (err != CL_SUCCESS)
+	{
+		clReleaseMemObject(params);
+		std::cerr << KERNEL_ARGS_SET_ERR << std::endl;
+		return PSYS_ERROR_RUNTIME;
+	}
+	if (sys->paramsCL)
+		clReleaseMemObject(sys->paramsCL);
+	sys->paramsCL = params;
+	sys->paramsDirty = false;
+	return PSYS_OK;
+}
+
+static psys::mass toMass(const psys_mass *mass)
+{
+	return {{mass->pos[0], mass->pos[1], mass->pos[2]},
+		{mass->rotation_tangent[0], mass->rotation_tangent[1], mass->rotation_tangent[2]}, mass->intensity, mass->radius};
+}
+
+static psys::emitter toEmitter(const psys_emitter *emitter)
+{
+	return {{emitter->pos[0], emitter->pos[1], emitter->pos[2]}, emitter->spawn_radius, emitter->push_intensity,
+		emitter->push_radius, emitter->spawn_speed, emitter->life_min, emitter->life_max, emitter->count > 0 ? 1u : 0u};
+}
+
+extern "C" {
+
+psys_status psys_create(uint64_t count, const char *kernel_dir, psys_system **out)
+{
+	return psys_create_ensemble(1, count, kernel_dir, out);
+}
+
+psys_status psys_create_ensemble(uint64_t members, uint64_t member_count, const char *kernel_dir, psys_system **out)
+{
+	// Work-item ids are 32 bit signed in the kernels
+	if (!out || members == 0 || member_count == 0 || member_count > INT32_MAX / members)
+		return PSYS_ERROR_ARGUMENT;
+	*out = nullptr;
+	psys_system *sys = new (std::nothrow) psys_system();
+	if (!sys)
+		return PSYS_ERROR_MEMORY;
+	psys_status status = initSystem(sys, static_cast<size_t>(members), static_cast<size_t>(member_count),
+		kernel_dir ? kernel_dir : "kernel_srcs");
+	if (status != PSYS_OK)
+	{
+		psys_destroy(sys);
+		return status;
+	}
+	*out = sys;
+	return PSYS_OK;
+}
+
+void psys_destroy(psys_system *sys)
+{
+	if (!sys)
+		return;
+	if (sys->mapped)
+		psys_unmap(sys);
+	if (sys->queue)
+		clFinish(sys->queue);
+	for (cl_mem buffer : {sys->particlesCL, sys->paramsCL, sys->statsCL, sys->trailsCL, sys->dummyImageCL})
+	{
+		if (buffer)
+			clReleaseMemObject(buffer);
+	}
+	for (cl_kernel kernel : {sys->update_ensemble, sys->init_particles_cube, sys->init_particles_sphere, sys->reduce_members})
+	{
+		if (kernel)
+			clReleaseKernel(kernel);
+	}
+	for (cl_program program : {sys->update_program, sys->init_cube_program, sys->init_sphere_program, sys->stats_program})
+	{
+		if (program)
+			clReleaseProgram(program);
+	}
+	if (sys->queue)
+		clReleaseCommandQueue(sys->queue);
+	if (sys->context)
+		clReleaseContext(sys->context);
+	delete sys;
+}
+
+psys_status psys_reset(psys_system *sys, psys_shape shape)
+{
+	if (!sys || sys->mapped || (shape != PSYS_SHAPE_CUBE && shape != PSYS_SHAPE_SPHERE))
+		return PSYS_ERROR_ARGUMENT;
+	cl_kernel kernel = shape == PSYS_SHAPE_CUBE ? sys->init_particles_cube : sys->init_particles_sphere;
+	const cl_uint chunkOffset = 0;
+	const cl_uint totalCount = static_cast<cl_uint>(sys->memberSize);
+	const cl_uint birth = 0;
+	cl_int err = shape == PSYS_SHAPE_CUBE ? clSetKernelArg(kernel, 1, sizeof(cl_uint), &cubeSize)
+		: clSetKernelArg(kernel, 1, sizeof(float), &sphereRadius);
+	err |= clSetKernelArg(kernel, 0, sizeof(cl_mem), &sys->particlesCL);
+	err |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &chunkOffset);
+	err |= clSetKernelArg(kernel, 3, sizeof(cl_uint), &totalCount);
+	err |= clSetKernelArg(kernel, 4, sizeof(cl_uint), &birth);
+	if (err == CL_SUCCESS)
+		err = clEnqueueNDRangeKernel(sys->queue, kernel, 1, nullptr, &sys->memberSize, nullptr, 0, nullptr, nullptr);
+	// The first member is laid out, the others are copies of it, doubling each copy
+	const size_t memberBytes = sys->memberSize * sizeof(particle);
+	for (size_t done = 1; err == CL_SUCCESS && done < sys->members; done *= 2)
+	{
+		size_t copied = std::min(done, sys->members - done);
+		err = clEnqueueCopyBuffer(sys->queue, sys->particlesCL, sys->particlesCL, 0, done * memberBytes,
+			copied * memberBytes, 0, nullptr, nullptr);
+	}
+	if (err == CL_SUCCESS)
+		err = clFinish(sys->queue);
+	if (err != CL_SUCCESS)
+	{
+		std::cerr << "Failed to reset the particles: " << err << std::endl;
+		return PSYS_ERROR_RUNTIME;
+	}
+	sys->steps = 0;
+	return PSYS_OK;
+}
+
+psys_status psys_set_mass(psys_system *sys, const psys_mass *mass)
+{
+	if (!sys || !mass)
+		return PSYS_ERROR_ARGUMENT;
+	// Uploaded by the next step, the steps already queued keep the old ones
+	const psys::mass m = toMass(mass);
+	for (member_params &params : sys->params)
+		params.m = m;
+	sys->paramsDirty = true;
+	return PSYS_OK;
+}
+
+psys_status psys_set_emitter(psys_system *sys, const psys_emitter *emitter)
+{
+	if (!sys || !emitter || emitter->count > sys->memberSize)
+		return PSYS_ERROR_ARGUMENT;
+	const psys::emitter e = toEmitter(emitter);
+	for (member_params &params : sys->params)
+	{
+		params.e = e;
+		params.emitter_start = static_cast<cl_uint>(sys->memberSize - emitter->count);
+	}
+	sys->paramsDirty = true;
+	return PSYS_OK;
+}
+
+psys_status psys_set_member(psys_system *sys, uint64_t member, const psys_mass *mass, const psys_emitter *emitter)
+{
+	if (!sys || member >= sys->members || (emitter && emitter->count > sys->memberSize))
+		return PSYS_ERROR_ARGUMENT;
+	member_params &params = sys->params[member];
+	if (mass)
+		params.m = toMass(mass);
+	if (emitter)
+	{
+		params.e = toEmitter(emitter);
+		params.emitter_start = static_cast<cl_uint>(sys->memberSize - emitter->count);
+	}
+	sys->paramsDirty = true;
+	return PSYS_OK;
+}
+
+psys_status psys_set_time_step(psys_system *sys, float seconds)
+{
+	if (!sys || !(seconds > 0.0f))
+		return PSYS_ERROR_ARGUMENT;
+	if (clSetKernelArg(sys->update_ensemble, 3, sizeof(float), &seconds) != CL_SUCCESS)
+	{
+		std::cerr << KERNEL_ARGS_SET_ERR << std::endl;
+		return PSYS_ERROR_RUNTIME;
+	}
+	return PSYS_OK;
+}
+
+psys_status psys_step(psys_system *sys, uint64_t steps)
+{
+	if (!sys || sys->mapped)
+		return PSYS_ERROR_ARGUMENT;
+	psys_status status = uploadParams(sys);
+	if (status != PSYS_OK)
+		return status;
+	// Every member in the one launch
+	for (uint64_t step = 0; step < steps; ++step)
+	{
+		cl_int err = clEnqueueNDRangeKernel(sys->queue, sys->update_ensemble, 1, nullptr, &sys->count, nullptr,
+			0, nullptr, nullptr);
+		if (err != CL_SUCCESS)
+		{
+			std::cerr << ENQUEUE_NDRANGE_KERNEL_ERR << ": " << err << std::endl;
+			return PSYS_ERROR_RUNTIME;
+		}
+		sys->steps++;
+	}
+	// Submitted now, waited for by whichever call needs the particles
+	clFlush(sys->queue);
+	return PSYS_OK;
+}
+
+psys_status psys_finish(psys_system *sys)
+{
+	if (!sys)
+		return PSYS_ERROR_ARGUMENT;
+	cl_int err = clFinish(sys->queue);
+	if (err != CL_SUCCESS)
+	{
+		std::cerr << "Failed to finish the queued steps: " << err << std::endl;
+		return PSYS_ERROR_RUNTIME;
+	}
+	return PSYS_OK;
+}
+
+uint64_t psys_count(const psys_system *sys)
+{
+	return sys ? sys->count : 0;
+}
+
+uint64_t psys_members(const psys_system *sys)
+{
+	return sys ? sys->members : 0;
+}
+
+uint64_t psys_steps(const psys_system *sys)
+{
+	return sys ? sys->steps : 0;
+}
+
+psys_status psys_read(psys_system *sys, uint64_t first, uint64_t count, psys_particle *out)
+{
+	if (!sys || !out || sys->mapped || first > sys->count || count > sys->count - first)
+		return PSYS_ERROR_ARGUMENT;
+	if (count == 0)
+		return PSYS_OK;
+	cl_int err = clEnqueueReadBuffer(sys->queue, sys->particlesCL, CL_TRUE, first * sizeof(particle),
+		count * sizeof(particle), out, 0, nullptr, nullptr);
+	if (err != CL_SUCCESS)
+	{
+		std::cerr << "Failed to read back the particles: " << err << std::endl;
+		return PSYS_ERROR_RUNTIME;
+	}
+	return PSYS_OK;
+}
+
+psys_status psys_write(psys_system *sys, uint64_t first, uint64_t count, const psys_particle *in)
+{
+	if (!sys || !in || sys->mapped || first > sys->count || count > sys->count - first)
+		return PSYS_ERROR_ARGUMENT;
+	if (count == 0)
+		return PSYS_OK;
+	cl_int err = clEnqueueWriteBuffer(sys->queue, sys->particlesCL, CL_TRUE, first * sizeof(particle),
+		count * sizeof(particle), in, 0, nullptr, nullptr);
+	if (err != CL_SUCCESS)
+	{
+		std::cerr << "Failed to upload the particles: " << err << std::endl;
+		return PSYS_ERROR_RUNTIME;
+	}
+	return PSYS_OK;
+}
+
+psys_status psys_map(psys_system *sys, psys_particle **particles)
+{
+	if (!sys || !particles || sys->mapped)
+		return PSYS_ERROR_ARGUMENT;
+	cl_int err;
+	void *mapping = clEnqueueMapBuffer(sys->queue, sys->particlesCL, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0,
+		sys->count * sizeof(particle), 0, nullptr, nullptr, &err);
+	if (err != CL_SUCCESS || !mapping)
+	{
+		std::cerr << "Failed to map the particles: " << err << std::endl;
+		return PSYS_ERROR_RUNTIME;
+	}
+	sys->mapped = static_cast<psys_particle *>(mapping);
+	*particles = sys->mapped;
+	return PSYS_OK;
+}
+
+psys_status psys_unmap(psys_system *sys)
+{
+	if (!sys || !sys->mapped)
+		return PSYS_ERROR_ARGUMENT;
+	cl_int err = clEnqueueUnmapMemObject(sys->queue, sys->particlesCL, sys->mapped, 0, nullptr, nullptr);
+	sys->mapped = nullptr;
+	if (err != CL_SUCCESS)
+	{
+		std::cerr << "Failed to unmap the particles: " << err << std::endl;
+		return PSYS_ERROR_RUNTIME;
+	}
+	return PSYS_OK;
+}
+
+psys_status psys_member_stats(psys_system *sys, uint64_t first, uint64_t count, psys_stats *out)
+{
+	if (!sys || !out || sys->mapped || first > sys->members || count > sys->members - first)
+		return PSYS_ERROR_ARGUMENT;
+	if (count == 0)
+		return PSYS_OK;
+	psys_status status = uploadParams(sys);
+	if (status != PSYS_OK)
+		return status;
+
+	// One work-group per member, the records land at the start of statsCL
+	std::vector<stats_record> records(count);
+	const cl_uint firstMember = static_cast<cl_uint>(first);
+	const size_t local = STATS_GROUP_SIZE;
+	const size_t global = count * STATS_GROUP_SIZE;
+	cl_int err = clSetKernelArg(sys->reduce_members, 3, sizeof(cl_uint), &firstMember);
+	if (err == CL_SUCCESS)
+		err = clEnqueueNDRangeKernel(sys->queue, sys->reduce_members, 1, nullptr, &global, &local, 0, nullptr, nullptr);
+	if (err == CL_SUCCESS)
+		err = clEnqueueReadBuffer(sys->queue, sys->statsCL, CL_TRUE, 0, count * sizeof(stats_record), records.data(),
+			0, nullptr, nullptr);
+	if (err != CL_SUCCESS)
+	{
+		std::cerr << "Failed to reduce the member statistics: " << err << std::endl;
+		return PSYS_ERROR_RUNTIME;
+	}
+
+	for (uint64_t i = 0; i < count; ++i)
+	{
+		const stats_record &r = records[i];
+		float inv = r.count ? 1.0f / r.count : 0.0f;
+		psys_stats &s = out[i];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			s.bbox_min[axis] = r.min[axis];
+			s.bbox_max[axis] = r.max[axis];
+			s.centroid[axis] = r.sum[axis] * inv;
+		}
+		s.kinetic_energy = r.sum[3];
+		s.max_speed = r.max_speed;
+		s.inside_mass = r.inside;
+		s.live_emitter = r.live;
+		s.count = r.count;
+	}
+	return PSYS_OK;
+}
+
+}
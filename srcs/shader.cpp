@@ -1,5 +1,20 @@
 #include "particle_system.hpp"
 
+// Set once the driver accepted KHR_parallel_shader_compile
+static bool parallelCompile = false;
+
+/*
+	Lets the driver compile and link shaders on its own threads so
+	startup does not stall on them
+*/
+void enableParallelShaderCompile()
+{
+	if (!GLEW_KHR_parallel_shader_compile)
+		return;
+	glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	parallelCompile = true;
+}
+
 GLuint compileShader(const char* filePath, GLenum shaderType)
 {
 	std::ifstream shaderFile(filePath);
@@ -16,14 +31,6 @@ GLuint compileShader(const char* filePath, GLenum shaderType)
 	GLuint shader = glCreateShader(shaderType);
 	glShaderSource(shader, 1, &shaderSource, NULL);
 	glCompileShader(shader);
-
-	GLint success;
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-	if (!success) {
-		char infoLog[512];
-		glGetShaderInfoLog(shader, 512, NULL, infoLog);
-		std::cerr << "Error: Shader compilation failed\n" << infoLog << std::endl;
-	}
 	return shader;
 }
 
@@ -47,17 +54,46 @@ GLuint createShaderProgram(const char* vertexShaderPath, const char* fragmentSha
 	}
 	glLinkProgram(shaderProgram);
 
+	// Status is checked later by shaderProgramReady so the link can run in the background
+	return shaderProgram;
+}
+
+/*
+	Returns false while the program is still compiling, otherwise reports
+	compile and link errors once and releases the attached shaders
+*/
+bool shaderProgramReady(GLuint program)
+{
 	GLint success;
-	glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+	if (parallelCompile)
+	{
+		glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &success);
+		if (!success)
+			return false;
+	}
+
+	GLuint shaders[3];
+	GLsizei count = 0;
+	glGetAttachedShaders(program, 3, &count, shaders);
+	if (count == 0)
+		return true;
+	for (GLsizei i = 0; i < count; i++)
+	{
+		glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &success);
+		if (!success) {
+			char infoLog[512];
+			glGetShaderInfoLog(shaders[i], 512, NULL, infoLog);
+			std::cerr << "Error: Shader compilation failed\n" << infoLog << std::endl;
+		}
+		glDetachShader(program, shaders[i]);
+		glDeleteShader(shaders[i]);
+	}
+
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
 	if (!success) {
 		char infoLog[512];
-		glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
+		glGetProgramInfoLog(program, 512, NULL, infoLog);
 		std::cerr << "Error: Shader program linking failed\n" << infoLog << std::endl;
 	}
-
-	glDeleteShader(vertexShader);
-	glDeleteShader(fragmentShader);
-	if (std::string(geometryShaderPath) != "")
-		glDeleteShader(geometryShader);
-	return shaderProgram;
+	return true;
 }
@@ -0,0 +1,457 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   stream.cpp                                         :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: tmoragli <tmoragli@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 20:05:31 by tmoragli          #+#    #+#             */
+/*   Updated: 2026/10/19 20:05:31 by tmoragli         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "stream.hpp"
+#include "cluster.hpp"
+#include "define.hpp"
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+namespace psys
+{
+	/*
+		PackBits: a control byte below 128 is followed by control + 1 literal bytes,
+		from 128 on it repeats the next byte control - 125 times (runs of 3 to 130)
+	*/
+	static void packBits(const unsigned char *data, size_t size, std::vector<unsigned char> &out)
+	{
+		size_t i = 0;
+		while (i < size)
+		{
+			size_t run = 1;
+			while (i + run < size && run < 130 && data[i + run] == data[i])
+				run++;
+			if (run >= 3)
+			{
+				out.push_back(static_cast<unsigned char>(run + 125));
+				out.push_back(data[i]);
+				i += run;
+				continue;
+			}
+			// Literals up to the next run worth encoding
+			size_t start = i;
+			while (i < size && i - start < 128 && !(i + 2 < size && data[i] == data[i + 1] && data[i] == data[i + 2]))
+				i++;
+			out.push_back(static_cast<unsigned char>(i - start - 1));
+			out.insert(out.end(), data + start, data + i);
+		}
+	}
+
+	static bool unpackBits(const unsigned char *data, size_t size, unsigned char *out, size_t expected)
+	{
+		size_t i = 0;
+		size_t written = 0;
+		while (i < size)
+		{
+			unsigned char control = data[i++];
+			if (control < 128)
+			{
+				size_t n = control + 1u;
+				if (i + n > size || written + n > expected)
+					return false;
+				memcpy(out + written, data + i, n);
+				i += n;
+				written += n;
+			}
+			else
+			{
+				size_t n = control - 125u;
+				if (i >= size || written + n > expected)
+					return false;
+				memset(out + written, data[i++], n);
+				written += n;
+			}
+		}
+		return written == expected;
+	}
+
+	void encodeFrame(const uint16_t *values, const uint16_t *previous, size_t count, std::vector<unsigned char> &out)
+	{
+		std::vector<unsigned char> low(count);
+		std::vector<unsigned char> high(count);
+		for (size_t c = 0; c < 4; ++c)
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				// Wrapping difference, zigzagged so small moves either way keep a zero high byte
+				uint16_t d = static_cast<uint16_t>(values[i * 4 + c] - (previous ? previous[i * 4 + c] : 0));
+				uint16_t z = static_cast<uint16_t>((d << 1) ^ (d & 0x8000 ? 0xffff : 0));
+				low[i] = static_cast<unsigned char>(z);
+				high[i] = static_cast<unsigned char>(z >> 8);
+			}
+			for (const std::vector<unsigned char> *plane : {&low, &high})
+			{
+				size_t at = out.size();
+				out.resize(at + sizeof(uint32_t));
+				packBits(plane->data(), count, out);
+				uint32_t size = static_cast<uint32_t>(out.size() - at - sizeof(uint32_t));
+				memcpy(out.data() + at, &size, sizeof(size));
+			}
+		}
+	}
+
+	/*
+		8 planes behind their size, a plane of all literals costs one control byte per 128 of them
+	*/
+	size_t encodedFrameBound(size_t count)
+	{
+		return 8 * (sizeof(uint32_t) + count + (count + 127) / 128);
+	}
+
+	bool decodeFrame(const unsigned char *data, size_t bytes, size_t count, uint16_t *values, bool keyframe)
+	{
+		std::vector<unsigned char> planes[2] = {std::vector<unsigned char>(count), std::vector<unsigned char>(count)};
+		size_t pos = 0;
+		for (size_t c = 0; c < 4; ++c)
+		{
+			for (std::vector<unsigned char> &plane : planes)
+			{
+				uint32_t size = 0;
+				if (pos + sizeof(size) > bytes)
+					return false;
+				memcpy(&size, data + pos, sizeof(size));
+				pos += sizeof(size);
+				if (pos + size > bytes || !unpackBits(data + pos, size, plane.data(), count))
+					return false;
+				pos += size;
+			}
+			for (size_t i = 0; i < count; ++i)
+			{
+				uint16_t z = static_cast<uint16_t>(planes[0][i] | (planes[1][i] << 8));
+				uint16_t d = static_cast<uint16_t>((z >> 1) ^ (z & 1 ? 0xffff : 0));
+				values[i * 4 + c] = static_cast<uint16_t>((keyframe ? 0 : values[i * 4 + c]) + d);
+			}
+		}
+		return pos == bytes;
+	}
+
+	StreamServer::StreamServer()
+		: listener(-1)
+	{
+	}
+
+	StreamServer::~StreamServer()
+	{
+		for (stream_viewer &client : clients)
+			close(client.fd);
+		if (listener >= 0)
+			close(listener);
+	}
+
+	bool StreamServer::listen(unsigned int port)
+	{
+		listener = socket(AF_INET, SOCK_STREAM, 0);
+		int yes = 1;
+		sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_ANY);
+		address.sin_port = htons(static_cast<uint16_t>(port));
+		if (listener < 0 || setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) != 0
+			|| bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0
+			|| ::listen(listener, 8) != 0 || fcntl(listener, F_SETFL, O_NONBLOCK) != 0)
+		{
+			std::cerr << "Failed to listen on port " << port << ": " << strerror(errno) << std::endl;
+			if (listener >= 0)
+				close(listener);
+			listener = -1;
+			return false;
+		}
+		std::cout << "Serving the simulation on port " << port << std::endl;
+		return true;
+	}
+
+	size_t StreamServer::viewers() const
+	{
+		return clients.size();
+	}
+
+	void StreamServer::drop(size_t index, const char *reason)
+	{
+		std::cout << "Viewer " << clients[index].name << " left: " << reason << std::endl;
+		close(clients[index].fd);
+		clients.erase(clients.begin() + index);
+	}
+
+	bool StreamServer::service(std::vector<unsigned char> &params, size_t paramBytes)
+	{
+		sockaddr_in address;
+		socklen_t length = sizeof(address);
+		int fd;
+		while ((fd = accept(listener, reinterpret_cast<sockaddr *>(&address), &length)) >= 0)
+		{
+			int yes = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+			fcntl(fd, F_SETFL, O_NONBLOCK);
+			char host[INET_ADDRSTRLEN] = "?";
+			inet_ntop(AF_INET, &address.sin_addr, host, sizeof(host));
+			stream_viewer client = {fd, std::string(host) + ":" + std::to_string(ntohs(address.sin_port)), {}, 0, {},
+				0, 0, STREAM_START_PARTICLES, 0, 0, {}, 0, 0, 0, 0, 0};
+			std::cout << "Viewer " << client.name << " connected" << std::endl;
+			clients.push_back(std::move(client));
+			length = sizeof(address);
+		}
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+		{
+			std::cerr << "Failed to accept viewers: " << strerror(errno) << std::endl;
+			return false;
+		}
+
+		unsigned char buffer[4096];
+		for (size_t i = clients.size(); i-- > 0;)
+		{
+			stream_viewer &client = clients[i];
+			ssize_t n;
+			while ((n = recv(client.fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+				client.in.insert(client.in.end(), buffer, buffer + n);
+			if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+			{
+				drop(i, n == 0 ? "connection closed" : strerror(errno));
+				continue;
+			}
+			// Only the newest parameters matter, every acknowledgement still moves the window
+			size_t used = 0;
+			stream_ack ack;
+			const char *malformed = nullptr;
+			while (!malformed && client.in.size() - used >= sizeof(ack))
+			{
+				memcpy(&ack, client.in.data() + used, sizeof(ack));
+				if (ack.bytes != paramBytes)
+					malformed = "malformed acknowledgement";
+				else if (ack.sequence - client.ackedFrames > client.sentFrames - client.ackedFrames)
+					malformed = "acknowledged a frame never sent";
+				else if (client.in.size() - used - sizeof(ack) < ack.bytes)
+					break;
+				else
+				{
+					client.ackedFrames = ack.sequence;
+					params.assign(client.in.begin() + used + sizeof(ack), client.in.begin() + used + sizeof(ack) + ack.bytes);
+					used += sizeof(ack) + ack.bytes;
+				}
+			}
+			if (malformed)
+			{
+				drop(i, malformed);
+				continue;
+			}
+			client.in.erase(client.in.begin(), client.in.begin() + used);
+		}
+		return true;
+	}
+
+	bool StreamServer::wantsFrame() const
+	{
+		for (const stream_viewer &client : clients)
+		{
+			if (client.sent == client.out.size() && client.sentFrames - client.ackedFrames < STREAM_MAX_IN_FLIGHT)
+				return true;
+		}
+		return false;
+	}
+
+	/*
+		Each viewer gets every stride-th particle, the smallest stride within its budget. A change of
+		stride or count breaks the index match with its last frame and sends absolute values instead
+	*/
+	void StreamServer::publish(const uint16_t *quantized, size_t total, uint32_t tick)
+	{
+		std::vector<uint16_t> subset;
+		for (stream_viewer &client : clients)
+		{
+			client.offered++;
+			if (client.sent < client.out.size() || client.sentFrames - client.ackedFrames >= STREAM_MAX_IN_FLIGHT)
+			{
+				client.skipped++;
+				continue;
+			}
+			const size_t budget = std::max<size_t>(client.budget, 1);
+			const uint32_t stride = static_cast<uint32_t>(std::max<size_t>((total + budget - 1) / budget, 1));
+			const size_t count = (total + stride - 1) / stride;
+			subset.resize(count * 4);
+			for (size_t i = 0; i < count; ++i)
+				memcpy(&subset[i * 4], quantized + i * stride * 4, 4 * sizeof(uint16_t));
+
+			const bool keyframe = stride != client.stride || total != client.total || client.previous.empty();
+			stream_frame_header header = {client.sentFrames + 1, tick, keyframe ? 1u : 0u, static_cast<uint32_t>(count),
+				static_cast<uint32_t>(total), stride, 0};
+			client.out.resize(sizeof(header));
+			encodeFrame(subset.data(), keyframe ? nullptr : client.previous.data(), count, client.out);
+			header.bytes = static_cast<uint32_t>(client.out.size() - sizeof(header));
+			memcpy(client.out.data(), &header, sizeof(header));
+			client.sent = 0;
+			client.sentFrames++;
+			client.stride = stride;
+			client.total = static_cast<uint32_t>(total);
+			client.previous.swap(subset);
+			client.windowBytes += client.out.size();
+			client.windowParticles += count;
+		}
+	}
+
+	void StreamServer::flush()
+	{
+		for (size_t i = clients.size(); i-- > 0;)
+		{
+			stream_viewer &client = clients[i];
+			bool failed = false;
+			while (client.sent < client.out.size())
+			{
+				ssize_t n = ::send(client.fd, client.out.data() + client.sent, client.out.size() - client.sent,
+					MSG_DONTWAIT | MSG_NOSIGNAL);
+				if (n > 0)
+					client.sent += static_cast<size_t>(n);
+				else if (n < 0 && errno == EINTR)
+					continue;
+				else
+				{
+					failed = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+					break;
+				}
+			}
+			if (failed)
+				drop(i, strerror(errno));
+		}
+	}
+
+	/*
+		More than STREAM_SKIP_TOLERANCE of the frames skipped shrinks the budget at once,
+		STREAM_CALM_WINDOWS seconds in a row without a skip grow it back
+	*/
+	void StreamServer::report(double seconds)
+	{
+		for (stream_viewer &client : clients)
+		{
+			const unsigned int sentFrames = client.offered - client.skipped;
+			std::cout << std::fixed << std::setprecision(1) << "Viewer " << client.name << ": " << sentFrames / seconds
+				<< " frames/s, " << (sentFrames ? client.windowParticles / sentFrames : 0) << " particles/frame, "
+				<< client.windowBytes / seconds / 1e6 << " MB/s ("
+				<< (client.windowParticles ? static_cast<double>(client.windowBytes) / client.windowParticles : 0.0)
+				<< " bytes/particle), " << (client.offered ? 100.0 * client.skipped / client.offered : 0.0)
+				<< "% skipped" << std::defaultfloat << std::setprecision(6) << std::endl;
+
+			if (client.offered > 0 && client.skipped > client.offered * STREAM_SKIP_TOLERANCE)
+			{
+				client.budget = std::max<size_t>(static_cast<size_t>(client.budget * STREAM_BACKOFF), STREAM_MIN_PARTICLES);
+				client.calmWindows = 0;
+			}
+			else if (client.skipped == 0 && ++client.calmWindows >= STREAM_CALM_WINDOWS)
+			{
+				// No growth past the whole system, the next drop would take seconds to show
+				client.budget = std::min<size_t>(static_cast<size_t>(client.budget * STREAM_GROWTH),
+					std::max<size_t>(client.total, STREAM_MIN_PARTICLES));
+				client.calmWindows = 0;
+			}
+			client.offered = 0;
+			client.skipped = 0;
+			client.windowBytes = 0;
+			client.windowParticles = 0;
+		}
+	}
+
+	StreamClient::StreamClient()
+		: fd(-1)
+	{
+	}
+
+	StreamClient::~StreamClient()
+	{
+		if (fd >= 0)
+			close(fd);
+	}
+
+	bool StreamClient::connect(const std::string &host, unsigned int port)
+	{
+		addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo *found = nullptr;
+		int status = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found);
+		if (status != 0)
+		{
+			std::cerr << "Failed to resolve " << host << ": " << gai_strerror(status) << std::endl;
+			return false;
+		}
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0 || ::connect(fd, found->ai_addr, found->ai_addrlen) != 0)
+		{
+			std::cerr << "Failed to connect to " << host << ":" << port << ": " << strerror(errno) << std::endl;
+			freeaddrinfo(found);
+			if (fd >= 0)
+				close(fd);
+			fd = -1;
+			return false;
+		}
+		freeaddrinfo(found);
+		int yes = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+		std::cout << "Viewing the simulation served at " << host << ":" << port << std::endl;
+		return true;
+	}
+
+	bool StreamClient::receive(stream_frame_header &header, std::vector<unsigned char> &payload, int timeoutMs, size_t maxCount,
+		bool &ready)
+	{
+		ready = false;
+		pollfd waiting = {fd, POLLIN, 0};
+		int polled = poll(&waiting, 1, timeoutMs);
+		if (polled < 0 && errno != EINTR)
+		{
+			std::cerr << "Failed to wait for a frame: " << strerror(errno) << std::endl;
+			return false;
+		}
+		if (polled <= 0)
+			return true;
+		if (!readAll(fd, &header, sizeof(header)))
+		{
+			std::cerr << "Failed to receive a frame: " << (errno ? strerror(errno) : "the server closed the connection") << std::endl;
+			return false;
+		}
+		// The size comes from the network, nothing is allocated for a frame this viewer could not hold
+		if (header.count > maxCount || header.bytes > encodedFrameBound(header.count))
+		{
+			std::cerr << "Failed to receive a frame: header of " << header.count << " particles in " << header.bytes
+				<< " bytes, at most " << maxCount << " particles expected" << std::endl;
+			return false;
+		}
+		payload.resize(header.bytes);
+		if (header.bytes > 0 && !readAll(fd, payload.data(), payload.size()))
+		{
+			std::cerr << "Failed to receive a frame: " << strerror(errno ? errno : ECONNRESET) << std::endl;
+			return false;
+		}
+		ready = true;
+		return true;
+	}
+
+	bool StreamClient::acknowledge(uint32_t sequence, const void *params, size_t bytes)
+	{
+		stream_ack ack = {sequence, static_cast<uint32_t>(bytes)};
+		if (!writeAll(fd, &ack, sizeof(ack)) || (bytes > 0 && !writeAll(fd, params, bytes)))
+		{
+			std::cerr << "Failed to acknowledge frame " << sequence << ": " << strerror(errno) << std::endl;
+			return false;
+		}
+		return true;
+	}
+};
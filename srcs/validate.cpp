@@ -0,0 +1,594 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   validate.cpp                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: tmoragli <tmoragli@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 15:21:40 by tmoragli          #+#    #+#             */
+/*   Updated: 2026/10/19 15:21:40 by tmoragli         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "validate.hpp"
+#include <iomanip>
+
+namespace psys
+{
+	// Same constants as update_particles.cl
+	static const float decayRate = 0.30075f;
+	static const float eps = 0.0001f;
+	static const float heavyMass = 4.0f;
+	static const float heavyDrag = 0.25f;
+	static const float tracerFieldGain = 3.0f;
+
+	static unsigned int lcg(unsigned int &state)
+	{
+		state = (state * 1664525u) + 1013904223u;
+		return state;
+	}
+
+	static float rand01(unsigned int &state)
+	{
+		return static_cast<float>(lcg(state) & 0x00FFFFFFu) / 16777216.0f;
+	}
+
+	/*
+		Statement by statement copy of the kernel, in float and in the same order
+		so the only differences left are the device rounding of sqrt, exp, pow, cos and sin
+	*/
+	void referenceUpdate(particle &p, unsigned int id, particle_species species, const mass &m, const emitter &e, float deltaTime,
+		const field_params &f, const float3 &fieldForce, float3 *trails, const trail_params &t)
+	{
+		p.pos_prev = p.pos;
+
+		if (species == SPECIES_EMITTER)
+		{
+			p.life -= deltaTime;
+			if (p.life <= 0.0f)
+			{
+				unsigned int seed = p.seed ^ (id * 747796405u + 2891336453u);
+				float u = rand01(seed);
+				float v = rand01(seed);
+				float theta = 6.2831853f * u;
+				float z = 1.0f - 2.0f * v;
+				float xy = std::sqrt(std::fmax(0.0f, 1.0f - z * z));
+				float3 dir = {xy * std::cos(theta), xy * std::sin(theta), z};
+				float spawnScale = std::pow(rand01(seed), 0.3333333f) * e.spawn_radius;
+				p.pos.x = e.pos.x + dir.x * spawnScale;
+				p.pos.y = e.pos.y + dir.y * spawnScale;
+				p.pos.z = e.pos.z + dir.z * spawnScale;
+				p.pos_prev = p.pos;
+
+				p.velocity.x = dir.x * e.spawn_speed;
+				p.velocity.y = dir.y * e.spawn_speed;
+				p.velocity.z = dir.z * e.spawn_speed;
+
+				p.max_life = e.life_min + (e.life_max - e.life_min) * rand01(seed);
+				p.life = p.max_life;
+
+				p.trail_birth = t.clock;
+
+				p.seed = seed;
+			}
+		}
+
+		float3 direction = {m.pos.x - p.pos.x, m.pos.y - p.pos.y, m.pos.z - p.pos.z};
+		float distance = std::sqrt(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+		float invDist = 1.0f / std::fmax(distance, eps);
+		float3 directionNorm = {direction.x * invDist, direction.y * invDist, direction.z * invDist};
+
+		if (distance > m.radius)
+		{
+			float gravitationalForce = m.intensity / (distance * distance) * 20.0f;
+			p.velocity.x += directionNorm.x * gravitationalForce * deltaTime;
+			p.velocity.y += directionNorm.y * gravitationalForce * deltaTime;
+			p.velocity.z += directionNorm.z * gravitationalForce * deltaTime;
+		}
+		else
+		{
+			float3 tangentialVelocity;
+			tangentialVelocity.x = directionNorm.y * m.rotationTangent.z - directionNorm.z * m.rotationTangent.y;
+			tangentialVelocity.y = directionNorm.z * m.rotationTangent.x - directionNorm.x * m.rotationTangent.z;
+			tangentialVelocity.z = directionNorm.x * m.rotationTangent.y - directionNorm.y * m.rotationTangent.x;
+
+			float tangentialForce = m.intensity / std::fmax(distance, eps);
+			tangentialVelocity.x *= tangentialForce * deltaTime;
+			tangentialVelocity.y *= tangentialForce * deltaTime;
+			tangentialVelocity.z *= tangentialForce * deltaTime;
+
+			p.velocity.x += tangentialVelocity.x * 2.0f;
+			p.velocity.y += tangentialVelocity.y * 2.0f;
+			p.velocity.z += tangentialVelocity.z * 2.0f;
+		}
+
+		if (e.enabled != 0u && species != SPECIES_TRACER)
+		{
+			float3 eDir = {p.pos.x - e.pos.x, p.pos.y - e.pos.y, p.pos.z - e.pos.z};
+			float eDist = std::sqrt(eDir.x * eDir.x + eDir.y * eDir.y + eDir.z * eDir.z);
+			if (eDist > eps && eDist < e.push_radius)
+			{
+				float invEDist = 1.0f / eDist;
+				float repulse = e.push_intensity / (eDist * eDist + 1.0f);
+				if (species == SPECIES_HEAVY)
+					repulse *= 1.0f / heavyMass;
+				p.velocity.x += (eDir.x * invEDist) * repulse * deltaTime;
+				p.velocity.y += (eDir.y * invEDist) * repulse * deltaTime;
+				p.velocity.z += (eDir.z * invEDist) * repulse * deltaTime;
+			}
+		}
+
+		if (f.enabled != 0u)
+		{
+			float gain = 1.0f;
+			if (species == SPECIES_HEAVY)
+				gain = 1.0f / heavyMass;
+			else if (species == SPECIES_TRACER)
+				gain = tracerFieldGain;
+			float3 force = {fieldForce.x * gain, fieldForce.y * gain, fieldForce.z * gain};
+			p.velocity.x += force.x * f.strength * deltaTime;
+			p.velocity.y += force.y * f.strength * deltaTime;
+			p.velocity.z += force.z * f.strength * deltaTime;
+		}
+
+		const float drag = species == SPECIES_HEAVY ? decayRate * heavyDrag : decayRate;
+		const float damping = std::exp(-drag * deltaTime);
+		p.velocity.x *= damping;
+		p.velocity.y *= damping;
+		p.velocity.z *= damping;
+
+		p.pos.x += p.velocity.x * deltaTime;
+		p.pos.y += p.velocity.y * deltaTime;
+		p.pos.z += p.velocity.z * deltaTime;
+
+		float normalizedDist = (distance / m.radius) / 2.0f;
+		float totalVelocity = p.velocity.x + p.velocity.y + p.velocity.z;
+		float normalizedVelocity = totalVelocity / 2.0f;
+
+		p.color.x = std::clamp(normalizedVelocity - normalizedDist, 0.0f, 1.0f);
+		p.color.y = std::clamp((normalizedDist + normalizedVelocity) * 0.3f, 0.0f, 1.0f);
+		p.color.z = std::clamp(0.5f * normalizedDist, 0.0f, 1.0f);
+
+		if (species == SPECIES_EMITTER)
+		{
+			float lifeRatio = (p.max_life > 0.0f) ? (p.life / p.max_life) : 0.0f;
+			lifeRatio = std::clamp(lifeRatio, 0.0f, 1.0f);
+			p.color.x = 1.0f;
+			p.color.y = lifeRatio;
+			p.color.z = lifeRatio;
+		}
+		else if (species == SPECIES_HEAVY)
+		{
+			float shade = std::clamp(0.35f + std::fabs(normalizedVelocity) * 0.5f, 0.0f, 1.0f);
+			p.color.x = shade * 0.8f;
+			p.color.y = shade * 0.8f;
+			p.color.z = shade;
+		}
+		else if (species == SPECIES_TRACER)
+		{
+			p.color.x = 0.2f;
+			p.color.y = std::clamp(0.4f + std::fabs(normalizedVelocity), 0.0f, 1.0f);
+			p.color.z = 0.5f;
+		}
+
+		if (t.write != 0u)
+			trails[static_cast<size_t>(t.slot) * t.stride + id] = p.pos;
+	}
+
+	/*
+		Trail slice of the next tick, same clock as enqueueUpdateParticles()
+	*/
+	static trail_params nextTrailParams(float &timer, cl_uint &clock, float deltaTime, cl_uint stride)
+	{
+		trail_params t = {clock % TRAIL_SAMPLES, stride, clock, 0u};
+		timer += deltaTime;
+		if (timer >= TRAIL_INTERVAL)
+		{
+			t.write = 1u;
+			timer = std::min(timer - TRAIL_INTERVAL, TRAIL_INTERVAL);
+		}
+		clock += t.write;
+		return t;
+	}
+
+	/*
+		Seeded start: a jittered cloud around the mass with random velocities and emitter lifetimes,
+		so both force branches and respawns happen within a few steps
+	*/
+	static std::vector<particle> validationScenario(size_t count, unsigned int emitterStart)
+	{
+		std::mt19937 gen(VALIDATE_SEED);
+		std::uniform_real_distribution<float> position(-20.0f, 20.0f);
+		std::uniform_real_distribution<float> velocity(-2.0f, 2.0f);
+		std::uniform_real_distribution<float> life(0.0f, 1.0f);
+
+		std::vector<particle> particles(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			particle &p = particles[i];
+			p.pos = {position(gen), position(gen), position(gen)};
+			p.velocity = {velocity(gen), velocity(gen), velocity(gen)};
+			p.color = {1.0f, 1.0f, 1.0f};
+			p.pos_prev = p.pos;
+			p.trail_birth = 0;
+			p.life = i >= emitterStart ? life(gen) : 0.0f;
+			p.max_life = i >= emitterStart ? 1.0f : 0.0f;
+			p.seed = static_cast<unsigned int>(i) * 747796405u + 2891336453u;
+		}
+		return particles;
+	}
+
+	static void accumulate(field_error &error, float device, float reference)
+	{
+		double diff = std::fabs(static_cast<double>(device) - reference) / std::max(1.0, std::fabs(static_cast<double>(reference)));
+		// A NaN on one side only must fail, not vanish in the comparisons
+		if (std::isnan(diff))
+			diff = std::numeric_limits<double>::infinity();
+		error.max = std::max(error.max, diff);
+		error.sum2 += diff * diff;
+		++error.samples;
+	}
+
+	static void accumulate(field_error &error, const float3 &device, const float3 &reference)
+	{
+		accumulate(error, device.x, reference.x);
+		accumulate(error, device.y, reference.y);
+		accumulate(error, device.z, reference.z);
+	}
+
+	// Every handle of one profile's run, released on any exit
+	struct validation_cl {
+		cl_context context = nullptr;
+		cl_command_queue queue = nullptr;
+		cl_program program = nullptr;
+		std::array<cl_kernel, SPECIES_COUNT> kernels = {};
+		cl_mem particles = nullptr;
+		cl_mem trails = nullptr;
+		cl_mem fieldImage = nullptr;
+		cl_mem dummyImage = nullptr;
+
+		~validation_cl()
+		{
+			if (dummyImage)
+				clReleaseMemObject(dummyImage);
+			if (fieldImage)
+				clReleaseMemObject(fieldImage);
+			if (trails)
+				clReleaseMemObject(trails);
+			if (particles)
+				clReleaseMemObject(particles);
+			for (cl_kernel kernel : kernels)
+			{
+				if (kernel)
+					clReleaseKernel(kernel);
+			}
+			if (program)
+				clReleaseProgram(program);
+			if (queue)
+				clReleaseCommandQueue(queue);
+			if (context)
+				clReleaseContext(context);
+		}
+	};
+
+	// The seeded run every profile is compared with, stepped once on the host
+	struct validation_scenario {
+		mass m;
+		emitter e;
+		field_params f;
+		float3 fieldForce;							// the whole field is this one vector
+		std::array<cl_uint, SPECIES_COUNT + 1> starts;	// species s owns [starts[s], starts[s + 1])
+		float deltaTime;
+		unsigned int steps;
+		size_t count;
+		std::vector<particle> start;
+		std::vector<particle> reference;
+		std::vector<float3> referenceTrails;
+	};
+
+	// Errors of one profile against the reference and the time its steps took on the device
+	struct profile_result {
+		std::array<field_error, 4> errors;
+		double seconds;
+		bool ran;
+		bool passed;
+	};
+
+	/*
+		First GPU of any platform, any device otherwise: no GL sharing is needed here,
+		so a CPU runtime is enough to check the kernel without a display
+	*/
+	static cl_device_id validationDevice()
+	{
+		cl_uint platformCount = 0;
+		if (clGetPlatformIDs(0, nullptr, &platformCount) != CL_SUCCESS || platformCount == 0)
+			return nullptr;
+		std::vector<cl_platform_id> platforms(platformCount);
+		if (clGetPlatformIDs(platformCount, platforms.data(), nullptr) != CL_SUCCESS)
+			return nullptr;
+
+		const cl_device_type types[] = {CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_ALL};
+		for (cl_device_type type : types)
+		{
+			for (cl_platform_id platform : platforms)
+			{
+				cl_device_id device = nullptr;
+				if (clGetDeviceIDs(platform, type, 1, &device, nullptr) == CL_SUCCESS && device)
+					return device;
+			}
+		}
+		return nullptr;
+	}
+
+	static bool buildValidationKernel(validation_cl &cl, cl_device_id device, build_profile profile)
+	{
+		std::ifstream file("kernel_srcs/update_particles.cl");
+		if (!file.is_open())
+		{
+			std::cerr << FETCH_CL_FILE_ERR << ": kernel_srcs/update_particles.cl" << std::endl;
+			return false;
+		}
+		std::stringstream buffer;
+		buffer << file.rdbuf();
+		std::string source = buffer.str();
+		const char *sourcePtr = source.c_str();
+
+		cl_int err;
+		cl.program = clCreateProgramWithSource(cl.context, 1, &sourcePtr, nullptr, &err);
+		if (err != CL_SUCCESS || !cl.program)
+		{
+			std::cerr << PROGRAM_CREATE_ERR << "update_particles" << std::endl;
+			return false;
+		}
+		if (clBuildProgram(cl.program, 1, &device, profileOptions[profile], nullptr, nullptr) != CL_SUCCESS)
+		{
+			size_t logSize = 0;
+			clGetProgramBuildInfo(cl.program, device, CL_PROGRAM_BUILD_LOG, 0, nullptr, &logSize);
+			std::string log(logSize, '\0');
+			clGetProgramBuildInfo(cl.program, device, CL_PROGRAM_BUILD_LOG, logSize, &log[0], nullptr);
+			std::cerr << PROGRAM_BUILD_ERR << "update_particles (" << profileNames[profile] << ")" << std::endl << log << std::endl;
+			return false;
+		}
+		// Every species kernel, dispatched over its range as the application does
+		for (int species = 0; species < SPECIES_COUNT; ++species)
+		{
+			cl.kernels[species] = clCreateKernel(cl.program, speciesKernels[species], &err);
+			if (err != CL_SUCCESS || !cl.kernels[species])
+			{
+				std::cerr << KERNEL_CREATE_ERR << speciesKernels[species] << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/*
+		Host side of the scenario: both sides run free from the same start,
+		so the errors include how they grow over the steps
+	*/
+	static validation_scenario referenceRun(unsigned int steps, size_t count)
+	{
+		validation_scenario s;
+		// Same parameters as a running simulation with the mass pulling and the emitter on, plus a
+		// uniform field so the heavy and tracer gains show: an eighth of heavy, an eighth of tracers
+		s.m = {{5.0f, -2.0f, -1.0f}, {0.0f, 1.0f, 0.0f}, VALIDATE_MASS_INTENSITY, 5.0f};
+		s.e = {{-10.0f, 0.0f, -5.0f}, 1.5f, 35.0f, 8.0f, 6.0f, 1.5f, 4.0f, 1u};
+		s.f = {{0.0f, 0.0f, 0.0f}, 1.0f / 64.0f, 0.0f, 2.0f, 1u};
+		s.fieldForce = {0.6f, -0.3f, 0.45f};
+		s.starts = {0, static_cast<cl_uint>(count / 8), static_cast<cl_uint>(count / 4),
+			static_cast<cl_uint>(count - count / 4), static_cast<cl_uint>(count)};
+		s.deltaTime = 1.0f / SIM_TICK_RATE;
+		s.steps = steps;
+		s.count = count;
+		s.start = validationScenario(count, s.starts[SPECIES_EMITTER]);
+		s.reference = s.start;
+		// The history starts zeroed on both sides
+		s.referenceTrails.assign(count * TRAIL_SAMPLES, float3{0.0f, 0.0f, 0.0f});
+
+		float trailTimer = 0.0f;
+		cl_uint trailClock = 0;
+		for (unsigned int step = 0; step < steps; ++step)
+		{
+			trail_params t = nextTrailParams(trailTimer, trailClock, s.deltaTime, static_cast<cl_uint>(count));
+			for (int species = 0; species < SPECIES_COUNT; ++species)
+			{
+				for (cl_uint i = s.starts[species]; i < s.starts[species + 1]; ++i)
+					referenceUpdate(s.reference[i], i, static_cast<particle_species>(species), s.m, s.e, s.deltaTime,
+						s.f, s.fieldForce, s.referenceTrails.data(), t);
+			}
+		}
+		return s;
+	}
+
+	/*
+		The scenario on the device with update_particles.cl built for profile, timed from the first
+		step queued to the last one done, then compared with the reference
+	*/
+	static bool runProfile(cl_device_id device, build_profile profile, validation_scenario &s, profile_result &result)
+	{
+		validation_cl cl;
+		cl_int err;
+		const size_t count = s.count;
+
+		cl.context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &err);
+		if (err != CL_SUCCESS || !cl.context)
+		{
+			std::cerr << CONTEXT_CREATE_ERR << std::endl;
+			return false;
+		}
+		cl_queue_properties queueProperties[] = {0};
+		cl.queue = clCreateCommandQueueWithProperties(cl.context, device, queueProperties, &err);
+		if (err != CL_SUCCESS || !cl.queue)
+		{
+			std::cerr << QUEUE_CREATE_ERR << std::endl;
+			return false;
+		}
+		if (!buildValidationKernel(cl, device, profile))
+			return false;
+
+		std::vector<float3> trails(s.referenceTrails.size(), float3{0.0f, 0.0f, 0.0f});
+		cl.particles = clCreateBuffer(cl.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+			count * sizeof(particle), s.start.data(), &err);
+		if (err == CL_SUCCESS)
+			cl.trails = clCreateBuffer(cl.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+				trails.size() * sizeof(float3), trails.data(), &err);
+		if (err != CL_SUCCESS || !cl.particles || !cl.trails)
+		{
+			std::cerr << BUFFER_CREATE_ERR << std::endl;
+			return false;
+		}
+
+		// A single texel repeated everywhere is the uniform field, collisions are off and
+		// their image argument only needs to be a valid object
+		cl_image_format format = {CL_RGBA, CL_FLOAT};
+		cl_image_desc desc;
+		memset(&desc, 0, sizeof(desc));
+		desc.image_type = CL_MEM_OBJECT_IMAGE3D;
+		desc.image_width = 1;
+		desc.image_height = 1;
+		desc.image_depth = 1;
+		float texel[4] = {s.fieldForce.x, s.fieldForce.y, s.fieldForce.z, 0.0f};
+		cl.fieldImage = clCreateImage(cl.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, &format, &desc, texel, &err);
+		if (err == CL_SUCCESS)
+			cl.dummyImage = clCreateImage(cl.context, CL_MEM_READ_ONLY, &format, &desc, nullptr, &err);
+		if (err != CL_SUCCESS || !cl.fieldImage || !cl.dummyImage)
+		{
+			std::cerr << FIELD_CREATE_ERR << std::endl;
+			return false;
+		}
+		collision_params c = {{0.0f, 0.0f, 0.0f}, 1.0f, 0.0f, 0.0f, 0.0f, 0u};
+
+		err = CL_SUCCESS;
+		for (cl_kernel kernel : cl.kernels)
+		{
+			err |= clSetKernelArg(kernel, 0, sizeof(cl_mem), &cl.particles);
+			err |= clSetKernelArg(kernel, 1, sizeof(mass), &s.m);
+			err |= clSetKernelArg(kernel, 2, sizeof(emitter), &s.e);
+			err |= clSetKernelArg(kernel, 3, sizeof(float), &s.deltaTime);
+			err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &cl.fieldImage);
+			err |= clSetKernelArg(kernel, 5, sizeof(cl_mem), &cl.fieldImage);
+			err |= clSetKernelArg(kernel, 6, sizeof(field_params), &s.f);
+			err |= clSetKernelArg(kernel, 7, sizeof(cl_mem), &cl.dummyImage);
+			err |= clSetKernelArg(kernel, 8, sizeof(collision_params), &c);
+			err |= clSetKernelArg(kernel, 9, sizeof(cl_mem), &cl.trails);
+		}
+		if (err != CL_SUCCESS)
+		{
+			std::cerr << KERNEL_ARGS_SET_ERR << std::endl;
+			return false;
+		}
+
+		// The uploads are done before the clock starts
+		clFinish(cl.queue);
+		auto start = std::chrono::steady_clock::now();
+		float trailTimer = 0.0f;
+		cl_uint trailClock = 0;
+		for (unsigned int step = 0; step < s.steps; ++step)
+		{
+			trail_params t = nextTrailParams(trailTimer, trailClock, s.deltaTime, static_cast<cl_uint>(count));
+			// Arguments are captured at enqueue time, the next step can change them right away
+			err = CL_SUCCESS;
+			for (int species = 0; species < SPECIES_COUNT && err == CL_SUCCESS; ++species)
+			{
+				const size_t offset = s.starts[species];
+				const size_t range = s.starts[species + 1] - s.starts[species];
+				err = clSetKernelArg(cl.kernels[species], 10, sizeof(trail_params), &t);
+				if (err == CL_SUCCESS && range > 0)
+					err = clEnqueueNDRangeKernel(cl.queue, cl.kernels[species], 1, &offset, &range, nullptr, 0, nullptr, nullptr);
+			}
+			if (err != CL_SUCCESS)
+			{
+				std::cerr << ENQUEUE_NDRANGE_KERNEL_ERR << ": " << err << std::endl;
+				return false;
+			}
+		}
+		err = clFinish(cl.queue);
+		result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::vector<particle> deviceParticles(count);
+		err |= clEnqueueReadBuffer(cl.queue, cl.particles, CL_TRUE, 0, count * sizeof(particle), deviceParticles.data(), 0, nullptr, nullptr);
+		err |= clEnqueueReadBuffer(cl.queue, cl.trails, CL_TRUE, 0, trails.size() * sizeof(float3), trails.data(), 0, nullptr, nullptr);
+		if (err != CL_SUCCESS)
+		{
+			std::cerr << "Failed to read back the validation particles: " << err << std::endl;
+			return false;
+		}
+
+		result.errors = {{
+			{"position", 0.0, 0.0, 0},
+			{"velocity", 0.0, 0.0, 0},
+			{"color", 0.0, 0.0, 0},
+			{"trail", 0.0, 0.0, 0},
+		}};
+		for (size_t i = 0; i < count; ++i)
+		{
+			const particle &d = deviceParticles[i];
+			const particle &r = s.reference[i];
+			accumulate(result.errors[0], d.pos, r.pos);
+			accumulate(result.errors[1], d.velocity, r.velocity);
+			accumulate(result.errors[2], d.color, r.color);
+		}
+		for (size_t i = 0; i < trails.size(); ++i)
+			accumulate(result.errors[3], trails[i], s.referenceTrails[i]);
+		result.passed = true;
+		for (const field_error &error : result.errors)
+			result.passed = result.passed && error.max <= VALIDATE_TOLERANCE;
+		result.ran = true;
+		return true;
+	}
+
+	bool runValidation(unsigned int steps, size_t count, build_profile selected)
+	{
+		cl_device_id device = validationDevice();
+		if (!device)
+		{
+			std::cerr << DEVICE_GET_ERR << std::endl;
+			return false;
+		}
+		char deviceName[128] = {};
+		clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(deviceName), deviceName, nullptr);
+		std::cout << "Validating update_particles.cl on " << deviceName << ": "
+			<< count << " particles, " << steps << " steps, every build profile" << std::endl;
+
+		validation_scenario scenario = referenceRun(steps, count);
+		std::array<profile_result, PROFILE_COUNT> results = {};
+		for (int profile = 0; profile < PROFILE_COUNT; ++profile)
+		{
+			profile_result &result = results[profile];
+			std::cout << profileNames[profile] << " (" << (*profileOptions[profile] ? profileOptions[profile] : "no options")
+				<< ")" << std::endl;
+			if (!runProfile(device, static_cast<build_profile>(profile), scenario, result))
+			{
+				std::cout << "  did not run" << std::endl;
+				continue;
+			}
+			std::cout << std::scientific << std::setprecision(3);
+			for (const field_error &error : result.errors)
+			{
+				double rms = std::sqrt(error.sum2 / std::max<size_t>(error.samples, 1));
+				std::cout << "  " << std::left << std::setw(10) << error.name << std::right
+					<< " max " << error.max << "  rms " << rms << (error.max <= VALIDATE_TOLERANCE ? "" : "  FAILED") << std::endl;
+			}
+			std::cout << std::defaultfloat;
+			// Host timing, the first steps also carry the kernel's first launch
+			std::cout << "  " << steps << " steps in " << result.seconds * 1000.0 << " ms, "
+				<< static_cast<double>(count) * steps / std::max(result.seconds, 1e-9) / 1e6
+				<< " M particle steps/s" << std::endl;
+		}
+
+		// Measured, not assumed: relaxed math is not faster on every device
+		int fastest = -1;
+		for (int profile = 0; profile < PROFILE_COUNT; ++profile)
+		{
+			if (results[profile].passed && (fastest < 0 || results[profile].seconds < results[fastest].seconds))
+				fastest = profile;
+		}
+		if (fastest >= 0)
+			std::cout << "Fastest profile within the tolerance: " << profileNames[fastest] << std::endl;
+
+		bool passed = results[selected].passed;
+		std::cout << (passed ? "Validation passed" : "Validation failed") << " for the " << profileNames[selected]
+			<< " profile (relative tolerance " << VALIDATE_TOLERANCE << ")" << std::endl;
+		return passed;
+	}
+};
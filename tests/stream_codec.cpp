@@ -0,0 +1,97 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   stream_codec.cpp                                   :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: tmoragli <tmoragli@student.42.fr>          +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2026/10/19 21:12:08 by tmoragli          #+#    #+#             */
+/*   Updated: 2026/10/19 21:12:08 by tmoragli         ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "stream.hpp"
+#include <iostream>
+#include <cstdint>
+#include <vector>
+
+using namespace psys;
+
+/*
+	Round trip of the frame codec the way a viewer sees it: a keyframe, a delta on top of it,
+	then a stride change that has to come as a keyframe again. Exits 1 on the first mismatch
+*/
+
+// Every stride-th particle of a seeded system at a given tick, 4 uint16 each like quantize_particles
+static std::vector<uint16_t> makeFrame(size_t total, size_t stride, unsigned int tick)
+{
+	std::vector<uint16_t> values;
+	for (size_t i = 0; i < total; i += stride)
+	{
+		uint32_t seed = static_cast<uint32_t>(i) * 2654435761u;
+		for (size_t c = 0; c < 3; ++c)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			// Small moves either way, with some wrapping around the ends of the range
+			int step = static_cast<int>(seed >> 28) - 8;
+			values.push_back(static_cast<uint16_t>((seed >> 8) + step * static_cast<int>(tick)));
+		}
+		values.push_back(static_cast<uint16_t>(tick & 1 ? 0xffff : i));
+	}
+	return values;
+}
+
+static bool roundTrip(const char *name, const std::vector<uint16_t> &frame, const std::vector<uint16_t> *previous,
+	std::vector<uint16_t> &viewer)
+{
+	const size_t count = frame.size() / 4;
+	std::vector<unsigned char> payload;
+	encodeFrame(frame.data(), previous ? previous->data() : nullptr, count, payload);
+	if (payload.size() > encodedFrameBound(count))
+	{
+		std::cerr << name << ": " << payload.size() << " bytes, past the bound of " << encodedFrameBound(count) << std::endl;
+		return false;
+	}
+	viewer.resize(frame.size());
+	if (!decodeFrame(payload.data(), payload.size(), count, viewer.data(), previous == nullptr))
+	{
+		std::cerr << name << ": failed to decode " << payload.size() << " bytes" << std::endl;
+		return false;
+	}
+	for (size_t i = 0; i < frame.size(); ++i)
+	{
+		if (viewer[i] != frame[i])
+		{
+			std::cerr << name << ": value " << i << " decoded as " << viewer[i] << " instead of " << frame[i] << std::endl;
+			return false;
+		}
+	}
+	std::cout << name << ": " << count << " particles, " << payload.size() << " bytes" << std::endl;
+	return true;
+}
+
+int main()
+{
+	const size_t total = 10007;
+	std::vector<uint16_t> viewer;
+
+	std::vector<uint16_t> key = makeFrame(total, 1, 0);
+	std::vector<uint16_t> delta = makeFrame(total, 1, 1);
+	std::vector<uint16_t> strided = makeFrame(total, 3, 2);
+	if (!roundTrip("keyframe", key, nullptr, viewer) || !roundTrip("delta", delta, &key, viewer)
+		|| !roundTrip("stride change", strided, nullptr, viewer))
+		return 1;
+
+	// A truncated payload is rejected instead of read past its end
+	std::vector<unsigned char> payload;
+	encodeFrame(delta.data(), key.data(), total, payload);
+	payload.pop_back();
+	viewer = key;
+	if (decodeFrame(payload.data(), payload.size(), total, viewer.data(), false))
+	{
+		std::cerr << "truncated delta: decoded" << std::endl;
+		return 1;
+	}
+	std::cout << "Stream codec: OK" << std::endl;
+	return 0;
+}